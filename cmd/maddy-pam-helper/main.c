@@ -1,6 +1,8 @@
 #define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <security/pam_appl.h>
 #include "pam.h"
 
@@ -34,6 +36,9 @@ int run(void) {
     }
 
     struct error_obj err = run_pam_auth(username, password);
+    secure_wipe(password, password_buf_len);
+    free(password);
+    free(username);
     if (err.status != 0) {
         if (err.status == 2) {
             fprintf(stderr, "%s: %s\n", err.func_name, err.error_msg);
@@ -44,8 +49,105 @@ int run(void) {
     return 0;
 }
 
+/*
+Persistent mode protocol. All integers are 32-bit big-endian.
+
+Request:  <username length> <username> <password length> <password>
+Reply:    <status> <func_name length> <func_name> <error_msg length> <error_msg>
+
+Status values are the same as exit codes of the one-shot mode. The helper
+exits with status 0 once stdin is closed.
+*/
+
+#define MAX_FIELD_LEN 65536
+
+static int read_u32(uint32_t *out) {
+    unsigned char buf[4];
+    if (fread(buf, 1, 4, stdin) != 4) {
+        return -1;
+    }
+    *out = ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) |
+           ((uint32_t)buf[2] << 8) | (uint32_t)buf[3];
+    return 0;
+}
+
+static int write_u32(uint32_t val) {
+    unsigned char buf[4] = {
+        (unsigned char)(val >> 24), (unsigned char)(val >> 16),
+        (unsigned char)(val >> 8), (unsigned char)val,
+    };
+    return fwrite(buf, 1, 4, stdout) == 4 ? 0 : -1;
+}
+
+// read_field returns a NUL-terminated malloc'ed copy of the next field and
+// stores its length into len.
+static char *read_field(uint32_t *len_out) {
+    uint32_t len;
+    if (read_u32(&len) < 0 || len > MAX_FIELD_LEN) {
+        return NULL;
+    }
+    char *buf = malloc(len + 1);
+    if (buf == NULL) {
+        return NULL;
+    }
+    if (len != 0 && fread(buf, 1, len, stdin) != len) {
+        free(buf);
+        return NULL;
+    }
+    buf[len] = 0;
+    *len_out = len;
+    return buf;
+}
+
+static int write_field(const char *str) {
+    if (str == NULL) {
+        str = "";
+    }
+    size_t len = strlen(str);
+    if (write_u32((uint32_t)len) < 0) {
+        return -1;
+    }
+    return fwrite(str, 1, len, stdout) == len ? 0 : -1;
+}
+
+int run_persistent(void) {
+    for (;;) {
+        uint32_t username_len, password_len;
+        char *username = read_field(&username_len);
+        if (username == NULL) {
+            if (feof(stdin)) {
+                return 0;
+            }
+            fprintf(stderr, "malformed request\n");
+            return 2;
+        }
+        char *password = read_field(&password_len);
+        if (password == NULL) {
+            free(username);
+            fprintf(stderr, "malformed request\n");
+            return 2;
+        }
+
+        struct error_obj err = run_pam_auth(username, password);
+        secure_wipe(password, password_len);
+        free(password);
+        free(username);
+
+        if (write_u32((uint32_t)err.status) < 0 ||
+                write_field(err.func_name) < 0 ||
+                write_field(err.error_msg) < 0 ||
+                fflush(stdout) != 0) {
+            perror("reply write");
+            return 2;
+        }
+    }
+}
+
 #ifndef CGO
-int main() {
+int main(int argc, char **argv) {
+    if (argc > 1 && strcmp(argv[1], "-persistent") == 0) {
+        return run_persistent();
+    }
     return run();
 }
 #endif
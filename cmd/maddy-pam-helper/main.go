@@ -22,6 +22,7 @@ package main
 #cgo LDFLAGS: -lpam
 #cgo CFLAGS: -DCGO -Wall -Wextra -Werror -Wno-unused-parameter -Wno-error=unused-parameter -Wpedantic -std=c99
 extern int run();
+extern int run_persistent();
 */
 import "C"
 import "os"
@@ -33,6 +34,9 @@ bigger than one built using only C compiler.
 */
 
 func main() {
+	if len(os.Args) > 1 && os.Args[1] == "-persistent" {
+		os.Exit(int(C.run_persistent()))
+	}
 	i := int(C.run())
 	os.Exit(i)
 }
@@ -1,28 +1,62 @@
 #define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <security/pam_appl.h>
 #include "pam.h"
 
-static int conv_func(int num_msg, const struct pam_message **msg, struct pam_response **resp, void *appdata_ptr) {
-    *resp = (struct pam_response*)appdata_ptr;
-    return PAM_SUCCESS;
+void secure_wipe(void *buf, size_t len) {
+    volatile unsigned char *p = buf;
+    while (len--) {
+        *p++ = 0;
+    }
 }
 
-struct error_obj run_pam_auth(const char *username, char *password) {
-    // PAM frees pam_response for us.
-    struct pam_response *reply = malloc(sizeof(struct pam_response));
+struct conv_data {
+    const char *password;
+};
+
+/*
+Allocates a fresh response for each call. PAM frees responses (and strings
+in them) returned by the conversation function, so nothing here is shared
+with the caller.
+*/
+static int conv_func(int num_msg, const struct pam_message **msg, struct pam_response **resp, void *appdata_ptr) {
+    const struct conv_data *data = appdata_ptr;
+
+    if (num_msg <= 0) {
+        return PAM_CONV_ERR;
+    }
+
+    struct pam_response *reply = calloc(num_msg, sizeof(struct pam_response));
     if (reply == NULL) {
-        struct error_obj ret_val;
-        ret_val.status = 2;
-        ret_val.func_name = "malloc";
-        ret_val.error_msg = "Out of memory";
-        return ret_val;
+        return PAM_BUF_ERR;
     }
-    reply->resp = password;
-    reply->resp_retcode = 0;
 
-    const struct pam_conv local_conv = { conv_func, reply };
+    for (int i = 0; i < num_msg; i++) {
+        if (msg[i]->msg_style != PAM_PROMPT_ECHO_OFF) {
+            continue;
+        }
+        reply[i].resp = strdup(data->password);
+        if (reply[i].resp == NULL) {
+            for (int j = 0; j < i; j++) {
+                if (reply[j].resp != NULL) {
+                    secure_wipe(reply[j].resp, strlen(reply[j].resp));
+                    free(reply[j].resp);
+                }
+            }
+            free(reply);
+            return PAM_BUF_ERR;
+        }
+    }
+
+    *resp = reply;
+    return PAM_SUCCESS;
+}
+
+struct error_obj run_pam_auth(const char *username, const char *password) {
+    struct conv_data data = { password };
+    const struct pam_conv local_conv = { conv_func, &data };
     pam_handle_t *local_auth = NULL;
     int status = pam_start("maddy", username, &local_conv, &local_auth);
     if (status != PAM_SUCCESS) {
@@ -43,6 +77,7 @@ struct error_obj run_pam_auth(const char *username, char *password) {
         }
         ret_val.func_name = "pam_authenticate";
         ret_val.error_msg = pam_strerror(local_auth, status);
+        pam_end(local_auth, status);
         return ret_val;
     }
 
@@ -1,9 +1,17 @@
 #pragma once
 
+#include <stddef.h>
+
 struct error_obj {
     int status;
     const char* func_name;
     const char* error_msg;
 };
 
-struct error_obj run_pam_auth(const char *username, char *password);
+/*
+The password is not retained after the call returns, it is up to the caller
+to wipe it.
+*/
+struct error_obj run_pam_auth(const char *username, const char *password);
+
+void secure_wipe(void *buf, size_t len);
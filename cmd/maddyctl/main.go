@@ -655,6 +655,19 @@ func main() {
 				},
 			},
 		},
+		{
+			Name:  "table",
+			Usage: "Static tables management",
+			Subcommands: []cli.Command{
+				{
+					Name:        "compile",
+					Usage:       "Convert table.file text file into the compiled format",
+					Description: "Compiled tables are memory-mapped by table.file and are quicker to\nload and reload for large tables.",
+					ArgsUsage:   "SOURCE DESTINATION",
+					Action:      tableCompile,
+				},
+			},
+		},
 		{
 			Name:   "hash",
 			Usage:  "Generate password hashes for use with pass_table",
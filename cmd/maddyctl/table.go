@@ -0,0 +1,45 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package main
+
+import (
+	"errors"
+	"fmt"
+
+	"github.com/foxcpp/maddy/internal/table"
+	"github.com/urfave/cli"
+)
+
+func tableCompile(ctx *cli.Context) error {
+	src := ctx.Args().Get(0)
+	if src == "" {
+		return errors.New("Error: SOURCE is required")
+	}
+	dst := ctx.Args().Get(1)
+	if dst == "" {
+		return errors.New("Error: DESTINATION is required")
+	}
+
+	count, err := table.CompileFile(src, dst)
+	if err != nil {
+		return err
+	}
+	fmt.Println("Wrote", count, "entries to", dst)
+	return nil
+}
@@ -20,16 +20,27 @@ package buffer
 
 import (
 	"io"
-	"io/ioutil"
 )
 
 // MemoryBuffer implements Buffer interface using byte slice.
+//
+// If the MemoryBuffer is created by BufferInMemory or BufferInMemoryLimit,
+// the slice is returned to the shared pool once Remove is called and all
+// Readers are closed. Slice must not be used after Remove in this case.
 type MemoryBuffer struct {
 	Slice []byte
+
+	pooled *pooledSlice
 }
 
 func (mb MemoryBuffer) Open() (io.ReadCloser, error) {
-	return NewBytesReader(mb.Slice), nil
+	if mb.pooled == nil {
+		return NewBytesReader(mb.Slice), nil
+	}
+	if !mb.pooled.acquire() {
+		return nil, ErrRemoved
+	}
+	return &pooledReader{BytesReader: NewBytesReader(mb.Slice), p: mb.pooled}, nil
 }
 
 func (mb MemoryBuffer) Len() int {
@@ -37,15 +48,18 @@ func (mb MemoryBuffer) Len() int {
 }
 
 func (mb MemoryBuffer) Remove() error {
+	if mb.pooled != nil {
+		mb.pooled.remove()
+	}
 	return nil
 }
 
 // BufferInMemory is a convenience function which creates MemoryBuffer with
 // contents of the passed io.Reader.
 func BufferInMemory(r io.Reader) (Buffer, error) {
-	blob, err := ioutil.ReadAll(r)
+	buf, _, err := BufferInMemoryLimit(r, 0, -1)
 	if err != nil {
 		return nil, err
 	}
-	return MemoryBuffer{Slice: blob}, nil
+	return buf, nil
 }
@@ -0,0 +1,194 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package buffer
+
+import (
+	"errors"
+	"io"
+	"sync"
+	"sync/atomic"
+)
+
+// Slices used by MemoryBuffer are taken from pools with sizes
+// 4 KiB, 16 KiB, ..., 4 MiB. Larger blobs are allocated directly.
+const (
+	minClassShift = 12
+	classCount    = 6
+
+	// Initial size if there is no size hint.
+	defaultSizeHint = 64 * 1024
+)
+
+var (
+	classPools [classCount]sync.Pool
+
+	ErrRemoved = errors.New("buffer: Open called after Remove")
+)
+
+func classSize(class int) int {
+	return 1 << (minClassShift + 2*class)
+}
+
+// sizeClass returns the smallest class that fits size bytes or -1 if size is
+// too big to be pooled.
+func sizeClass(size int) int {
+	for class := 0; class < classCount; class++ {
+		if size <= classSize(class) {
+			return class
+		}
+	}
+	return -1
+}
+
+// getSlice returns an empty slice with capacity of at least size bytes.
+func getSlice(size int) []byte {
+	class := sizeClass(size)
+	if class < 0 {
+		return make([]byte, 0, size)
+	}
+	if b, ok := classPools[class].Get().(*[]byte); ok {
+		return (*b)[:0]
+	}
+	return make([]byte, 0, classSize(class))
+}
+
+func putSlice(b []byte) {
+	class := sizeClass(cap(b))
+	// Slices not allocated by getSlice are left to GC.
+	if class < 0 || cap(b) != classSize(class) {
+		return
+	}
+	b = b[:0]
+	classPools[class].Put(&b)
+}
+
+// pooledSlice tracks users of a slice so it can be returned to the pool.
+//
+// The owner of the MemoryBuffer holds one reference that is dropped by
+// Remove, each Reader created by Open holds another one until it is closed.
+// Readers that are never closed keep the slice out of the pool, it is then
+// collected by GC as usual.
+type pooledSlice struct {
+	b       []byte
+	refs    int32
+	removed int32
+}
+
+func (p *pooledSlice) acquire() bool {
+	for {
+		refs := atomic.LoadInt32(&p.refs)
+		if refs == 0 {
+			return false
+		}
+		if atomic.CompareAndSwapInt32(&p.refs, refs, refs+1) {
+			return true
+		}
+	}
+}
+
+func (p *pooledSlice) release() {
+	if atomic.AddInt32(&p.refs, -1) == 0 {
+		putSlice(p.b)
+	}
+}
+
+func (p *pooledSlice) remove() {
+	if atomic.CompareAndSwapInt32(&p.removed, 0, 1) {
+		p.release()
+	}
+}
+
+type pooledReader struct {
+	BytesReader
+	p      *pooledSlice
+	closed int32
+}
+
+func (r *pooledReader) Close() error {
+	if atomic.CompareAndSwapInt32(&r.closed, 0, 1) {
+		r.p.release()
+	}
+	return nil
+}
+
+// readPooled reads r until io.EOF or until limit bytes are read. Negative
+// limit means no limit. The returned slice should be passed to putSlice
+// when no longer used.
+func readPooled(r io.Reader, sizeHint, limit int) ([]byte, error) {
+	if sizeHint <= 0 {
+		sizeHint = defaultSizeHint
+	}
+	// The hint usually comes from the client and is not trusted beyond the
+	// largest pooled size, the slice is grown below as the data arrives.
+	if max := classSize(classCount - 1); sizeHint > max {
+		sizeHint = max
+	}
+	if limit >= 0 && sizeHint > limit {
+		sizeHint = limit
+	}
+
+	b := getSlice(sizeHint)
+	for {
+		if limit >= 0 && len(b) >= limit {
+			return b, nil
+		}
+		if len(b) == cap(b) {
+			newSize := 4 * cap(b)
+			if limit >= 0 && newSize > limit {
+				newSize = limit
+			}
+			newB := append(getSlice(newSize), b...)
+			putSlice(b)
+			b = newB
+		}
+
+		end := cap(b)
+		if limit >= 0 && end > limit {
+			end = limit
+		}
+		n, err := r.Read(b[len(b):end])
+		b = b[:len(b)+n]
+		if err == io.EOF {
+			return b, nil
+		}
+		if err != nil {
+			putSlice(b)
+			return nil, err
+		}
+	}
+}
+
+// BufferInMemoryLimit creates MemoryBuffer with contents of the passed
+// io.Reader using a slice from the shared pool. The slice is returned to the
+// pool after Remove is called and all Readers are closed.
+//
+// sizeHint is the expected size of the blob, if known, e.g. from the SIZE
+// argument of the SMTP MAIL command. At most limit bytes are read unless it
+// is negative. full is true if the limit is reached, in this case r may have
+// more data left.
+func BufferInMemoryLimit(r io.Reader, sizeHint, limit int) (buf MemoryBuffer, full bool, err error) {
+	b, err := readPooled(r, sizeHint, limit)
+	if err != nil {
+		return MemoryBuffer{}, false, err
+	}
+	return MemoryBuffer{
+		Slice:  b,
+		pooled: &pooledSlice{b: b, refs: 1},
+	}, limit >= 0 && len(b) == limit, nil
+}
@@ -0,0 +1,112 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package config
+
+import (
+	"context"
+	"errors"
+	"io/ioutil"
+	"net"
+	"os"
+	"path/filepath"
+	"strconv"
+	"strings"
+)
+
+// WorkerID is the index of the current process if maddy runs multiple
+// worker processes (see 'workers' global directive), -1 otherwise.
+//
+// Value of this variable must not change after initialization in
+// maddy.go.
+var WorkerID = -1
+
+// WorkerCount is the amount of worker processes if maddy runs multiple
+// of them, 0 otherwise.
+//
+// Value of this variable must not change after initialization in
+// maddy.go.
+var WorkerCount = 0
+
+// WorkerDir returns the directory to use for state that can not be shared
+// between worker processes, such as the messages queue.
+//
+// It is a subdirectory of dir named after the worker or dir itself if maddy
+// runs in a single process.
+func WorkerDir(dir string) string {
+	if WorkerID < 0 {
+		return dir
+	}
+	return filepath.Join(dir, "worker"+strconv.Itoa(WorkerID))
+}
+
+// OrphanedWorkerDirs returns directories created by WorkerDir(dir) for
+// processes that do not exist with the current 'workers' value. That is dir
+// itself if maddy runs multiple workers and workerN subdirectories for N
+// larger than the amount of workers (all of them if maddy runs in a single
+// process).
+//
+// Only the first worker (or the single process) gets a non-empty list so
+// state left there can be taken over by exactly one process.
+func OrphanedWorkerDirs(dir string) ([]string, error) {
+	if WorkerID > 0 {
+		return nil, nil
+	}
+
+	var dirs []string
+	if WorkerID == 0 {
+		dirs = append(dirs, dir)
+	}
+	entries, err := ioutil.ReadDir(dir)
+	if err != nil {
+		if os.IsNotExist(err) {
+			return dirs, nil
+		}
+		return nil, err
+	}
+	for _, entry := range entries {
+		name := entry.Name()
+		if !entry.IsDir() || !strings.HasPrefix(name, "worker") {
+			continue
+		}
+		id, err := strconv.Atoi(strings.TrimPrefix(name, "worker"))
+		if err != nil || id < WorkerCount {
+			continue
+		}
+		dirs = append(dirs, filepath.Join(dir, name))
+	}
+	return dirs, nil
+}
+
+// Listen creates the listener for the endpoint.
+//
+// In worker processes TCP sockets are created with SO_REUSEPORT so all
+// workers can bind the same address, the kernel distributes incoming
+// connections between them. Unix sockets cannot be shared this way, so
+// they are not supported in worker processes.
+func (e Endpoint) Listen() (net.Listener, error) {
+	if WorkerID < 0 {
+		return net.Listen(e.Network(), e.Address())
+	}
+	if e.Network() != "tcp" {
+		return nil, errors.New("unix sockets cannot be used with multiple worker processes")
+	}
+
+	lc := net.ListenConfig{Control: reusePortControl}
+	return lc.Listen(context.Background(), e.Network(), e.Address())
+}
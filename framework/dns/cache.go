@@ -0,0 +1,253 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package dns
+
+import (
+	"context"
+	"hash/fnv"
+	"net"
+	"strings"
+	"sync"
+	"time"
+)
+
+const cacheShards = 16
+
+// Cache is a Resolver that keeps answers of the underlying Resolver in
+// memory.
+//
+// If the upstream reports record TTLs (see DefaultResolver), positive
+// answers are kept for the record TTL clamped to [MinTTL, MaxTTL]. Otherwise
+// they are kept for TTL, which should be smaller than TTLs commonly used in
+// practice. "Not found" errors are kept for the negative caching TTL reported
+// by the upstream clamped the same way or for NegativeTTL if it is not
+// known, other errors are not cached. Concurrent lookups for the same name are coalesced into a
+// single upstream query.
+//
+// Returned slices are copies and can be modified by the caller.
+type Cache struct {
+	Upstream    Resolver
+	MinTTL      time.Duration
+	MaxTTL      time.Duration
+	TTL         time.Duration
+	NegativeTTL time.Duration
+
+	shardLimit int
+	shards     [cacheShards]cacheShard
+
+	now func() time.Time
+}
+
+type cacheEntry struct {
+	expires time.Time
+	value   interface{}
+	err     error
+}
+
+type inflightCall struct {
+	done      chan struct{}
+	value     interface{}
+	ttl       time.Duration
+	err       error
+	cancelled bool
+}
+
+type cacheShard struct {
+	lck      sync.Mutex
+	entries  map[string]cacheEntry
+	inflight map[string]*inflightCall
+}
+
+// NewCache creates the Cache that holds up to maxEntries answers.
+//
+// Both TTL and MaxTTL are set to ttl.
+func NewCache(upstream Resolver, ttl, negativeTTL time.Duration, maxEntries int) *Cache {
+	c := &Cache{
+		Upstream:    upstream,
+		MaxTTL:      ttl,
+		TTL:         ttl,
+		NegativeTTL: negativeTTL,
+		shardLimit:  maxEntries / cacheShards,
+		now:         time.Now,
+	}
+	if c.shardLimit == 0 {
+		c.shardLimit = 1
+	}
+	for i := range c.shards {
+		c.shards[i].entries = make(map[string]cacheEntry)
+		c.shards[i].inflight = make(map[string]*inflightCall)
+	}
+	return c
+}
+
+func (c *Cache) shard(key string) *cacheShard {
+	h := fnv.New32a()
+	h.Write([]byte(key))
+	return &c.shards[h.Sum32()%cacheShards]
+}
+
+func (c *Cache) lookup(ctx context.Context, kind, name string, fetch func() (interface{}, error)) (interface{}, error) {
+	key := kind + " " + strings.ToLower(name)
+	sh := c.shard(key)
+
+	for {
+		now := c.now()
+
+		sh.lck.Lock()
+		if ent, ok := sh.entries[key]; ok {
+			if now.Before(ent.expires) {
+				sh.lck.Unlock()
+				return ent.value, ent.err
+			}
+			delete(sh.entries, key)
+		}
+		call, ok := sh.inflight[key]
+		if !ok {
+			break
+		}
+		sh.lck.Unlock()
+
+		select {
+		case <-call.done:
+		case <-ctx.Done():
+			return nil, ctx.Err()
+		}
+		// The result is not usable if the lookup was cancelled by the
+		// context of another caller, do it again.
+		if !call.cancelled {
+			return call.value, call.err
+		}
+	}
+
+	call := &inflightCall{done: make(chan struct{})}
+	sh.inflight[key] = call
+	sh.lck.Unlock()
+
+	call.ttl = -1
+	if tl, ok := c.Upstream.(ttlLookuper); ok {
+		call.value, call.ttl, call.err = tl.lookupTTL(ctx, kind, name)
+	} else {
+		call.value, call.err = fetch()
+	}
+	call.cancelled = ctx.Err() != nil
+
+	now := c.now()
+	sh.lck.Lock()
+	delete(sh.inflight, key)
+	ttl := c.TTL
+	if call.err != nil {
+		ttl = 0
+		if IsNotFound(call.err) {
+			ttl = c.NegativeTTL
+		}
+	}
+	if call.ttl >= 0 && (call.err == nil || IsNotFound(call.err)) {
+		ttl = call.ttl
+		if ttl < c.MinTTL {
+			ttl = c.MinTTL
+		}
+		if ttl > c.MaxTTL {
+			ttl = c.MaxTTL
+		}
+	}
+	if ttl > 0 && !call.cancelled {
+		if len(sh.entries) >= c.shardLimit {
+			c.evict(sh, now)
+		}
+		sh.entries[key] = cacheEntry{expires: now.Add(ttl), value: call.value, err: call.err}
+	}
+	sh.lck.Unlock()
+	close(call.done)
+
+	return call.value, call.err
+}
+
+// evict makes space in the full shard by removing expired entries or, if
+// there are none, an arbitrary one.
+func (c *Cache) evict(sh *cacheShard, now time.Time) {
+	for key, ent := range sh.entries {
+		if !now.Before(ent.expires) {
+			delete(sh.entries, key)
+		}
+	}
+	for key := range sh.entries {
+		if len(sh.entries) < c.shardLimit {
+			break
+		}
+		delete(sh.entries, key)
+	}
+}
+
+func copyStrings(s []string) []string {
+	if s == nil {
+		return nil
+	}
+	return append(make([]string, 0, len(s)), s...)
+}
+
+func (c *Cache) LookupAddr(ctx context.Context, addr string) ([]string, error) {
+	names, err := c.lookup(ctx, "PTR", addr, func() (interface{}, error) {
+		return c.Upstream.LookupAddr(ctx, addr)
+	})
+	res, _ := names.([]string)
+	return copyStrings(res), err
+}
+
+func (c *Cache) LookupHost(ctx context.Context, host string) ([]string, error) {
+	addrs, err := c.lookup(ctx, "HOST", host, func() (interface{}, error) {
+		return c.Upstream.LookupHost(ctx, host)
+	})
+	res, _ := addrs.([]string)
+	return copyStrings(res), err
+}
+
+func (c *Cache) LookupMX(ctx context.Context, name string) ([]*net.MX, error) {
+	mxs, err := c.lookup(ctx, "MX", name, func() (interface{}, error) {
+		return c.Upstream.LookupMX(ctx, name)
+	})
+	res, _ := mxs.([]*net.MX)
+	if res == nil {
+		return nil, err
+	}
+	resCopy := make([]*net.MX, len(res))
+	for i, mx := range res {
+		mxCopy := *mx
+		resCopy[i] = &mxCopy
+	}
+	return resCopy, err
+}
+
+func (c *Cache) LookupTXT(ctx context.Context, name string) ([]string, error) {
+	txts, err := c.lookup(ctx, "TXT", name, func() (interface{}, error) {
+		return c.Upstream.LookupTXT(ctx, name)
+	})
+	res, _ := txts.([]string)
+	return copyStrings(res), err
+}
+
+func (c *Cache) LookupIPAddr(ctx context.Context, host string) ([]net.IPAddr, error) {
+	addrs, err := c.lookup(ctx, "IP", host, func() (interface{}, error) {
+		return c.Upstream.LookupIPAddr(ctx, host)
+	})
+	res, _ := addrs.([]net.IPAddr)
+	if res == nil {
+		return nil, err
+	}
+	return append(make([]net.IPAddr, 0, len(res)), res...), err
+}
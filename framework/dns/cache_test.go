@@ -0,0 +1,299 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package dns
+
+import (
+	"context"
+	"errors"
+	"net"
+	"strconv"
+	"sync"
+	"sync/atomic"
+	"testing"
+	"time"
+)
+
+// countingResolver answers TXT queries with the query name and counts
+// upstream lookups. If block is not nil, lookups wait for it to be closed.
+type countingResolver struct {
+	calls int32
+	block chan struct{}
+}
+
+func (r *countingResolver) LookupAddr(ctx context.Context, addr string) ([]string, error) {
+	return nil, errors.New("not implemented")
+}
+
+func (r *countingResolver) LookupHost(ctx context.Context, host string) ([]string, error) {
+	return nil, errors.New("not implemented")
+}
+
+func (r *countingResolver) LookupMX(ctx context.Context, name string) ([]*net.MX, error) {
+	atomic.AddInt32(&r.calls, 1)
+	return []*net.MX{{Host: "mx." + name, Pref: 10}}, nil
+}
+
+func (r *countingResolver) LookupTXT(ctx context.Context, name string) ([]string, error) {
+	atomic.AddInt32(&r.calls, 1)
+	if r.block != nil {
+		select {
+		case <-r.block:
+		case <-ctx.Done():
+			return nil, ctx.Err()
+		}
+	}
+	switch name {
+	case "nx.example.org":
+		return nil, &net.DNSError{Err: "no such host", Name: name, IsNotFound: true}
+	case "fail.example.org":
+		return nil, &net.DNSError{Err: "server misbehaving", Name: name}
+	}
+	return []string{name}, nil
+}
+
+func (r *countingResolver) LookupIPAddr(ctx context.Context, host string) ([]net.IPAddr, error) {
+	return nil, errors.New("not implemented")
+}
+
+func (r *countingResolver) Calls() int {
+	return int(atomic.LoadInt32(&r.calls))
+}
+
+func TestCache_TTL(t *testing.T) {
+	up := &countingResolver{}
+	c := NewCache(up, time.Minute, 10*time.Second, 100)
+	now := time.Unix(1000, 0)
+	c.now = func() time.Time { return now }
+
+	for i := 0; i < 3; i++ {
+		txts, err := c.LookupTXT(context.Background(), "example.org")
+		if err != nil || len(txts) != 1 || txts[0] != "example.org" {
+			t.Fatal("Wrong answer:", txts, err)
+		}
+		// Answer is a copy.
+		txts[0] = "modified"
+	}
+	if _, err := c.LookupTXT(context.Background(), "EXAMPLE.org"); err != nil {
+		t.Fatal(err)
+	}
+	if up.Calls() != 1 {
+		t.Fatal("Answer is not cached, upstream calls:", up.Calls())
+	}
+
+	now = now.Add(time.Minute)
+	if _, err := c.LookupTXT(context.Background(), "example.org"); err != nil {
+		t.Fatal(err)
+	}
+	if up.Calls() != 2 {
+		t.Fatal("Expired answer is used, upstream calls:", up.Calls())
+	}
+
+	// Same name, different record type.
+	mxs, err := c.LookupMX(context.Background(), "example.org")
+	if err != nil || len(mxs) != 1 || mxs[0].Host != "mx.example.org" {
+		t.Fatal("Wrong answer:", mxs, err)
+	}
+	if up.Calls() != 3 {
+		t.Fatal("Record types are not separated, upstream calls:", up.Calls())
+	}
+}
+
+// ttlCountingResolver reports TTL for TXT lookups of countingResolver.
+type ttlCountingResolver struct {
+	*countingResolver
+	ttl time.Duration
+}
+
+func (r ttlCountingResolver) lookupTTL(ctx context.Context, kind, name string) (interface{}, time.Duration, error) {
+	txts, err := r.LookupTXT(ctx, name)
+	return txts, r.ttl, err
+}
+
+func TestCache_RecordTTL(t *testing.T) {
+	for _, test := range []struct {
+		recordTTL time.Duration
+		cachedFor time.Duration
+	}{
+		{recordTTL: 20 * time.Second, cachedFor: 20 * time.Second},
+		{recordTTL: 0, cachedFor: 5 * time.Second},
+		{recordTTL: 20 * time.Minute, cachedFor: 20 * time.Minute},
+		{recordTTL: 24 * time.Hour, cachedFor: time.Hour},
+		{recordTTL: -1, cachedFor: time.Minute},
+	} {
+		up := ttlCountingResolver{countingResolver: &countingResolver{}, ttl: test.recordTTL}
+		c := NewCache(up, time.Minute, 10*time.Second, 100)
+		c.MinTTL = 5 * time.Second
+		c.MaxTTL = time.Hour
+		now := time.Unix(1000, 0)
+		c.now = func() time.Time { return now }
+
+		if _, err := c.LookupTXT(context.Background(), "example.org"); err != nil {
+			t.Fatal(err)
+		}
+		now = now.Add(test.cachedFor - time.Second)
+		if _, err := c.LookupTXT(context.Background(), "example.org"); err != nil {
+			t.Fatal(err)
+		}
+		if up.Calls() != 1 {
+			t.Errorf("TTL %v: answer expired too early", test.recordTTL)
+		}
+		now = now.Add(time.Second)
+		if _, err := c.LookupTXT(context.Background(), "example.org"); err != nil {
+			t.Fatal(err)
+		}
+		if up.Calls() != 2 {
+			t.Errorf("TTL %v: answer is kept for too long", test.recordTTL)
+		}
+	}
+}
+
+func TestCache_NegativeRecordTTL(t *testing.T) {
+	up := ttlCountingResolver{countingResolver: &countingResolver{}, ttl: 2 * time.Minute}
+	c := NewCache(up, time.Minute, 10*time.Second, 100)
+	c.MaxTTL = time.Hour
+	now := time.Unix(1000, 0)
+	c.now = func() time.Time { return now }
+
+	for _, step := range []time.Duration{0, 2*time.Minute - time.Second} {
+		now = now.Add(step)
+		if _, err := c.LookupTXT(context.Background(), "nx.example.org"); !IsNotFound(err) {
+			t.Fatal("Expected not found error, got", err)
+		}
+	}
+	if up.Calls() != 1 {
+		t.Fatal("Negative answer expired too early, upstream calls:", up.Calls())
+	}
+	now = now.Add(time.Second)
+	if _, err := c.LookupTXT(context.Background(), "nx.example.org"); !IsNotFound(err) {
+		t.Fatal("Expected not found error, got", err)
+	}
+	if up.Calls() != 2 {
+		t.Fatal("Negative answer is kept for too long, upstream calls:", up.Calls())
+	}
+
+	// TTL is ignored for other errors.
+	for i := 0; i < 2; i++ {
+		if _, err := c.LookupTXT(context.Background(), "fail.example.org"); err == nil {
+			t.Fatal("Expected an error")
+		}
+	}
+	if up.Calls() != 4 {
+		t.Fatal("Server failure is cached, upstream calls:", up.Calls())
+	}
+}
+
+func TestCache_Errors(t *testing.T) {
+	up := &countingResolver{}
+	c := NewCache(up, time.Minute, 10*time.Second, 100)
+	now := time.Unix(1000, 0)
+	c.now = func() time.Time { return now }
+
+	for i := 0; i < 2; i++ {
+		if _, err := c.LookupTXT(context.Background(), "nx.example.org"); !IsNotFound(err) {
+			t.Fatal("Expected not found error, got", err)
+		}
+	}
+	if up.Calls() != 1 {
+		t.Fatal("Negative answer is not cached, upstream calls:", up.Calls())
+	}
+	now = now.Add(10 * time.Second)
+	c.LookupTXT(context.Background(), "nx.example.org")
+	if up.Calls() != 2 {
+		t.Fatal("Negative answer is not expired, upstream calls:", up.Calls())
+	}
+
+	for i := 0; i < 2; i++ {
+		if _, err := c.LookupTXT(context.Background(), "fail.example.org"); err == nil {
+			t.Fatal("Expected error")
+		}
+	}
+	if up.Calls() != 4 {
+		t.Fatal("Temporary error is cached, upstream calls:", up.Calls())
+	}
+}
+
+func TestCache_Coalescing(t *testing.T) {
+	up := &countingResolver{block: make(chan struct{})}
+	c := NewCache(up, time.Minute, 10*time.Second, 100)
+
+	var wg sync.WaitGroup
+	wg.Add(10)
+	for i := 0; i < 10; i++ {
+		go func() {
+			defer wg.Done()
+			txts, err := c.LookupTXT(context.Background(), "example.org")
+			if err != nil || len(txts) != 1 {
+				t.Error("Wrong answer:", txts, err)
+			}
+		}()
+	}
+	// Let all goroutines reach the cache.
+	time.Sleep(50 * time.Millisecond)
+	close(up.block)
+	wg.Wait()
+
+	if up.Calls() != 1 {
+		t.Fatal("Lookups are not coalesced, upstream calls:", up.Calls())
+	}
+}
+
+func TestCache_CancelledLeader(t *testing.T) {
+	up := &countingResolver{block: make(chan struct{})}
+	c := NewCache(up, time.Minute, 10*time.Second, 100)
+
+	leaderCtx, cancel := context.WithCancel(context.Background())
+	leaderDone := make(chan error)
+	go func() {
+		_, err := c.LookupTXT(leaderCtx, "example.org")
+		leaderDone <- err
+	}()
+	time.Sleep(20 * time.Millisecond)
+
+	followerDone := make(chan error)
+	go func() {
+		_, err := c.LookupTXT(context.Background(), "example.org")
+		followerDone <- err
+	}()
+	time.Sleep(20 * time.Millisecond)
+
+	cancel()
+	if err := <-leaderDone; err == nil {
+		t.Fatal("Expected error for the cancelled lookup")
+	}
+	close(up.block)
+	if err := <-followerDone; err != nil {
+		t.Fatal("Cancellation is propagated to other callers:", err)
+	}
+}
+
+func TestCache_Eviction(t *testing.T) {
+	up := &countingResolver{}
+	c := NewCache(up, time.Minute, 10*time.Second, cacheShards*4)
+
+	for i := 0; i < 1000; i++ {
+		if _, err := c.LookupTXT(context.Background(), strconv.Itoa(i)+".example.org"); err != nil {
+			t.Fatal(err)
+		}
+	}
+	for i := range c.shards {
+		if l := len(c.shards[i].entries); l > 4 {
+			t.Fatalf("Shard %d is over the limit: %d", i, l)
+		}
+	}
+}
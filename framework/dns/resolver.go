@@ -20,14 +20,16 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 // lookups.
 //
 // Currently, there is only Resolver interface which is implemented
-// by dns.DefaultResolver(). In the future, DNSSEC-enabled stub resolver
-// implementation will be added here.
+// by dns.DefaultResolver() and Cache. In the future, DNSSEC-enabled stub
+// resolver implementation will be added here.
 package dns
 
 import (
 	"context"
 	"net"
 	"strings"
+	"sync"
+	"time"
 )
 
 // Resolver is an interface that describes DNS-related methods used by maddy.
@@ -52,10 +54,39 @@ func LookupAddr(ctx context.Context, r Resolver, ip net.IP) (string, error) {
 	return strings.TrimRight(names[0], "."), nil
 }
 
+// DirectQueries enables sending queries made through DefaultResolver
+// directly to servers from /etc/resolv.conf so answers are cached for the
+// record TTL. It should be set before the first DefaultResolver call.
+//
+// Names are then resolved using DNS even if /etc/hosts or other NSS sources
+// have them, the system resolver is used only for names that are not DNS
+// names and if servers do not answer.
+var DirectQueries bool
+
+var (
+	defaultCache     *Cache
+	defaultCacheOnce sync.Once
+)
+
+// DefaultResolver returns the process-wide Resolver. It is the system
+// resolver wrapped in Cache so answers are shared between modules.
+//
+// See DirectQueries for record TTLs support.
 func DefaultResolver() Resolver {
 	if overrideServ != "" && overrideServ != "system-default" {
 		override(overrideServ)
 	}
 
-	return net.DefaultResolver
+	defaultCacheOnce.Do(func() {
+		var upstream Resolver = net.DefaultResolver
+		if DirectQueries {
+			if ext, err := NewExtResolver(); err == nil {
+				upstream = ttlResolver{Resolver: net.DefaultResolver, ext: ext}
+			}
+		}
+		defaultCache = NewCache(upstream, 1*time.Minute, 30*time.Second, 20000)
+		defaultCache.MinTTL = 5 * time.Second
+		defaultCache.MaxTTL = 1 * time.Hour
+	})
+	return defaultCache
 }
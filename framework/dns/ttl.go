@@ -0,0 +1,271 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package dns
+
+import (
+	"context"
+	"errors"
+	"net"
+	"strings"
+	"time"
+
+	"github.com/miekg/dns"
+)
+
+// ttlLookuper is implemented by upstream resolvers that report TTL of the
+// answer. Cache uses it instead of Resolver methods if it is available.
+//
+// kind is one of Cache entry kinds: PTR, HOST, MX, TXT or IP. Returned ttl is
+// negative if it is not known.
+type ttlLookuper interface {
+	lookupTTL(ctx context.Context, kind, name string) (value interface{}, ttl time.Duration, err error)
+}
+
+var errTruncated = errors.New("dns: truncated response")
+
+// ttlResolver sends queries using ExtResolver to get record TTLs.
+//
+// NXDOMAIN and NODATA answers are final and reported as "not found"
+// net.DNSError along with the negative caching TTL (RFC 2308). Queries that
+// fail to get an answer (e.g. due to network errors or a truncated response)
+// are repeated using the embedded Resolver (usually the system one), TTL is
+// not known in this case. Names that are not DNS names (IP addresses,
+// single-label names) are always resolved using the embedded Resolver so
+// search domains and /etc/hosts work for them.
+type ttlResolver struct {
+	Resolver
+	ext *ExtResolver
+}
+
+func notFoundErr(name string) error {
+	return &net.DNSError{Err: "no such host", Name: name, IsNotFound: true}
+}
+
+// negativeTTL returns the negative caching TTL from the SOA record in the
+// authority section or -1 if there is none.
+func negativeTTL(resp *dns.Msg) time.Duration {
+	for _, rr := range resp.Ns {
+		soa, ok := rr.(*dns.SOA)
+		if !ok {
+			continue
+		}
+		ttl := soa.Hdr.Ttl
+		if soa.Minttl < ttl {
+			ttl = soa.Minttl
+		}
+		return time.Duration(ttl) * time.Second
+	}
+	return -1
+}
+
+// exchange is similar to ExtResolver.exchange, but NXDOMAIN is accepted as
+// the final answer instead of trying other servers.
+func (r ttlResolver) exchange(ctx context.Context, msg *dns.Msg) (*dns.Msg, error) {
+	var lastErr error
+	for _, srv := range r.ext.Cfg.Servers {
+		resp, _, err := r.ext.cl.ExchangeContext(ctx, msg, net.JoinHostPort(srv, r.ext.Cfg.Port))
+		if err != nil {
+			lastErr = err
+			continue
+		}
+		if resp.Rcode != dns.RcodeSuccess && resp.Rcode != dns.RcodeNameError {
+			lastErr = RCodeError{msg.Question[0].Name, resp.Rcode}
+			continue
+		}
+		return resp, nil
+	}
+	return nil, lastErr
+}
+
+// query returns records from the answer section along with the smallest
+// TTL among them. For NXDOMAIN and NODATA answers the negative caching TTL
+// is returned instead.
+func (r ttlResolver) query(ctx context.Context, name string, qtype uint16) ([]dns.RR, time.Duration, error) {
+	msg := new(dns.Msg)
+	msg.SetQuestion(dns.Fqdn(name), qtype)
+	msg.SetEdns0(4096, false)
+
+	resp, err := r.exchange(ctx, msg)
+	if err != nil {
+		return nil, 0, err
+	}
+	if resp.Truncated {
+		// Let the fallback resolver retry over TCP.
+		return nil, 0, errTruncated
+	}
+	if resp.Rcode == dns.RcodeNameError {
+		return nil, negativeTTL(resp), notFoundErr(name)
+	}
+
+	var (
+		rrs []dns.RR
+		ttl = time.Duration(-1)
+	)
+	for _, rr := range resp.Answer {
+		// CNAMEs are included, their TTL applies to the answer too.
+		rrTTL := time.Duration(rr.Header().Ttl) * time.Second
+		if ttl < 0 || rrTTL < ttl {
+			ttl = rrTTL
+		}
+		if rr.Header().Rrtype == qtype {
+			rrs = append(rrs, rr)
+		}
+	}
+	if len(rrs) == 0 {
+		return nil, negativeTTL(resp), notFoundErr(name)
+	}
+	return rrs, ttl, nil
+}
+
+// queryIP sends A and AAAA queries concurrently, like net.Resolver does.
+func (r ttlResolver) queryIP(ctx context.Context, host string) ([]net.IPAddr, time.Duration, error) {
+	type result struct {
+		rrs []dns.RR
+		ttl time.Duration
+		err error
+	}
+	aaaaCh := make(chan result, 1)
+	go func() {
+		rrs, ttl, err := r.query(ctx, host, dns.TypeAAAA)
+		aaaaCh <- result{rrs, ttl, err}
+	}()
+	a, aTTL, aErr := r.query(ctx, host, dns.TypeA)
+	aaaaRes := <-aaaaCh
+	aaaa, aaaaTTL := aaaaRes.rrs, aaaaRes.ttl
+
+	for _, err := range []error{aErr, aaaaRes.err} {
+		if err != nil && !IsNotFound(err) {
+			return nil, 0, err
+		}
+	}
+	if len(a)+len(aaaa) == 0 {
+		return nil, minTTL(aTTL, aaaaTTL), aErr
+	}
+
+	ttl := aTTL
+	if len(a) == 0 || (len(aaaa) != 0 && aaaaTTL < ttl) {
+		ttl = aaaaTTL
+	}
+	addrs := make([]net.IPAddr, 0, len(a)+len(aaaa))
+	for _, rr := range aaaa {
+		addrs = append(addrs, net.IPAddr{IP: rr.(*dns.AAAA).AAAA})
+	}
+	for _, rr := range a {
+		addrs = append(addrs, net.IPAddr{IP: rr.(*dns.A).A})
+	}
+	return addrs, ttl, nil
+}
+
+// minTTL returns the smallest of known (non-negative) TTLs or -1.
+func minTTL(a, b time.Duration) time.Duration {
+	if a < 0 || (b >= 0 && b < a) {
+		return b
+	}
+	return a
+}
+
+func (r ttlResolver) lookupExt(ctx context.Context, kind, name string) (interface{}, time.Duration, error) {
+	switch kind {
+	case "PTR":
+		revAddr, err := dns.ReverseAddr(name)
+		if err != nil {
+			return nil, 0, err
+		}
+		rrs, ttl, err := r.query(ctx, revAddr, dns.TypePTR)
+		if err != nil {
+			return nil, ttl, err
+		}
+		names := make([]string, 0, len(rrs))
+		for _, rr := range rrs {
+			names = append(names, rr.(*dns.PTR).Ptr)
+		}
+		return names, ttl, nil
+	case "HOST":
+		addrs, ttl, err := r.queryIP(ctx, name)
+		if err != nil {
+			return nil, ttl, err
+		}
+		hosts := make([]string, 0, len(addrs))
+		for _, addr := range addrs {
+			hosts = append(hosts, addr.String())
+		}
+		return hosts, ttl, nil
+	case "MX":
+		rrs, ttl, err := r.query(ctx, name, dns.TypeMX)
+		if err != nil {
+			return nil, ttl, err
+		}
+		mxs := make([]*net.MX, 0, len(rrs))
+		for _, rr := range rrs {
+			mxRR := rr.(*dns.MX)
+			mxs = append(mxs, &net.MX{Host: mxRR.Mx, Pref: mxRR.Preference})
+		}
+		return mxs, ttl, nil
+	case "TXT":
+		rrs, ttl, err := r.query(ctx, name, dns.TypeTXT)
+		if err != nil {
+			return nil, ttl, err
+		}
+		txts := make([]string, 0, len(rrs))
+		for _, rr := range rrs {
+			txts = append(txts, strings.Join(rr.(*dns.TXT).Txt, ""))
+		}
+		return txts, ttl, nil
+	case "IP":
+		return r.queryIP(ctx, name)
+	}
+	return nil, 0, errors.New("dns: unknown lookup kind: " + kind)
+}
+
+// isDNSName reports whether name should be resolved by sending queries
+// directly.
+func isDNSName(name string) bool {
+	if net.ParseIP(name) != nil {
+		return false
+	}
+	return strings.Contains(strings.TrimSuffix(name, "."), ".")
+}
+
+func (r ttlResolver) lookupTTL(ctx context.Context, kind, name string) (interface{}, time.Duration, error) {
+	if kind == "PTR" || isDNSName(name) {
+		value, ttl, err := r.lookupExt(ctx, kind, name)
+		var rcodeErr RCodeError
+		if err == nil || IsNotFound(err) || errors.As(err, &rcodeErr) {
+			return value, ttl, err
+		}
+	}
+
+	var (
+		value interface{}
+		err   error
+	)
+	switch kind {
+	case "PTR":
+		value, err = r.Resolver.LookupAddr(ctx, name)
+	case "HOST":
+		value, err = r.Resolver.LookupHost(ctx, name)
+	case "MX":
+		value, err = r.Resolver.LookupMX(ctx, name)
+	case "TXT":
+		value, err = r.Resolver.LookupTXT(ctx, name)
+	case "IP":
+		value, err = r.Resolver.LookupIPAddr(ctx, name)
+	}
+	return value, -1, err
+}
@@ -0,0 +1,77 @@
+package dns
+
+import (
+	"context"
+	"net"
+	"strconv"
+	"testing"
+	"time"
+
+	"github.com/miekg/dns"
+)
+
+// nxServer answers NXDOMAIN for nx.example.org. and NODATA for other names.
+type nxServer struct {
+	udpServ dns.Server
+}
+
+func (s *nxServer) ServeDNS(w dns.ResponseWriter, m *dns.Msg) {
+	reply := new(dns.Msg)
+	reply.SetReply(m)
+	if m.Question[0].Name == "nx.example.org." {
+		reply.Rcode = dns.RcodeNameError
+	}
+	reply.Ns = append(reply.Ns, &dns.SOA{
+		Hdr: dns.RR_Header{
+			Name:   "example.org.",
+			Rrtype: dns.TypeSOA,
+			Class:  dns.ClassINET,
+			Ttl:    3600,
+		},
+		Ns:     "ns.example.org.",
+		Mbox:   "hostmaster.example.org.",
+		Minttl: 120,
+	})
+	if err := w.WriteMsg(reply); err != nil {
+		panic(err)
+	}
+}
+
+func TestTTLResolver_NotFound(t *testing.T) {
+	s := nxServer{}
+	pconn, err := net.ListenPacket("udp4", "127.0.0.1:0")
+	if err != nil {
+		t.Fatal(err)
+	}
+	s.udpServ.PacketConn = pconn
+	s.udpServ.Handler = &s
+	go s.udpServ.ActivateAndServe() //nolint:errcheck
+	defer pconn.Close()
+
+	fallback := &countingResolver{}
+	r := ttlResolver{
+		Resolver: fallback,
+		ext: &ExtResolver{
+			cl: new(dns.Client),
+			Cfg: &dns.ClientConfig{
+				Servers: []string{"127.0.0.1"},
+				Port:    strconv.Itoa(pconn.LocalAddr().(*net.UDPAddr).Port),
+			},
+		},
+	}
+
+	for _, kind := range []string{"TXT", "IP"} {
+		for _, name := range []string{"nx.example.org", "nodata.example.org"} {
+			_, ttl, err := r.lookupTTL(context.Background(), kind, name)
+			if !IsNotFound(err) {
+				t.Errorf("%s %s: expected not found error, got %v", kind, name, err)
+			}
+			if ttl != 120*time.Second {
+				t.Errorf("%s %s: wrong negative TTL: %v", kind, name, ttl)
+			}
+		}
+	}
+	if fallback.Calls() != 0 {
+		t.Fatal("Negative answers are repeated using the fallback resolver")
+	}
+}
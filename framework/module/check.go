@@ -20,6 +20,7 @@ package module
 
 import (
 	"context"
+	"io"
 
 	"github.com/emersion/go-message/textproto"
 	"github.com/emersion/go-msgauth/authres"
@@ -83,6 +84,20 @@ type CheckState interface {
 	Close() error
 }
 
+// StreamingCheckState is an optional interface that can be implemented by
+// CheckState if it reads the message body only once and sequentially.
+//
+// The message pipeline may call CheckBodyStream instead of CheckBody and
+// feed the same body read to multiple checks. body contains bodyLen bytes
+// and returns an error if the underlying buffer can't be read. The check
+// may stop reading at any point, the rest of body is then discarded for
+// it. body must not be used after CheckBodyStream returns.
+//
+// Slow readers delay other checks that consume the same stream.
+type StreamingCheckState interface {
+	CheckBodyStream(ctx context.Context, header textproto.Header, body io.Reader, bodyLen int) CheckResult
+}
+
 type CheckResult struct {
 	// Reason is the error that is reported to the message source
 	// if check decided that the message should be rejected.
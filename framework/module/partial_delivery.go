@@ -56,3 +56,15 @@ type PartialDelivery interface {
 	// to ensure correct handling of partial failures.
 	BodyNonAtomic(ctx context.Context, c StatusCollector, header textproto.Header, body buffer.Buffer)
 }
+
+// RcptBatcher is an optional interface that may be implemented by
+// the object returned by DeliveryTarget.Start in addition to
+// PartialDelivery.
+//
+// Callers that are going to use BodyNonAtomic may call DeferRcpts before
+// the first AddRcpt. This permits the target to accept recipients without
+// checking them and report rejections later using the StatusCollector
+// passed to BodyNonAtomic. Callers that use Body must not call it.
+type RcptBatcher interface {
+	DeferRcpts()
+}
@@ -0,0 +1,300 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Package cache implements auth.cache module that remembers verdicts of
+// another authentication provider for a short period of time.
+//
+// Passwords are never stored. Entries contain HMAC-SHA256 of the password
+// computed using a random key generated on start-up.
+package cache
+
+import (
+	"container/list"
+	"crypto/hmac"
+	"crypto/rand"
+	"crypto/sha256"
+	"errors"
+	"fmt"
+	"sync"
+	"time"
+
+	"github.com/foxcpp/maddy/framework/config"
+	modconfig "github.com/foxcpp/maddy/framework/config/module"
+	"github.com/foxcpp/maddy/framework/log"
+	"github.com/foxcpp/maddy/framework/module"
+	"golang.org/x/text/secure/precis"
+)
+
+type verdict struct {
+	mac     [sha256.Size]byte
+	expires time.Time
+}
+
+type entry struct {
+	username string
+	pos      *verdict
+	neg      *verdict
+}
+
+type Auth struct {
+	modName    string
+	instName   string
+	inlineArgs []string
+
+	wrapped    module.PlainAuth
+	ttl        time.Duration
+	negTTL     time.Duration
+	maxEntries int
+
+	key []byte
+
+	// Used in tests.
+	now func() time.Time
+
+	entriesLck sync.Mutex
+	entries    map[string]*list.Element
+	lru        *list.List
+
+	Log log.Logger
+}
+
+func New(modName, instName string, _, inlineArgs []string) (module.Module, error) {
+	return &Auth{
+		modName:    modName,
+		instName:   instName,
+		inlineArgs: inlineArgs,
+		now:        time.Now,
+		entries:    map[string]*list.Element{},
+		lru:        list.New(),
+		Log:        log.Logger{Name: modName},
+	}, nil
+}
+
+func (a *Auth) Name() string {
+	return a.modName
+}
+
+func (a *Auth) InstanceName() string {
+	return a.instName
+}
+
+func (a *Auth) Init(cfg *config.Map) error {
+	if len(a.inlineArgs) != 0 {
+		if err := modconfig.ModuleFromNode("auth", a.inlineArgs, cfg.Block, cfg.Globals, &a.wrapped); err != nil {
+			return err
+		}
+	} else {
+		cfg.Custom("auth", false, true, nil, func(m *config.Map, node config.Node) (interface{}, error) {
+			var auth module.PlainAuth
+			err := modconfig.ModuleFromNode("auth", node.Args, node, m.Globals, &auth)
+			return auth, err
+		}, &a.wrapped)
+	}
+	cfg.Bool("debug", true, false, &a.Log.Debug)
+	cfg.Duration("ttl", false, false, 1*time.Minute, &a.ttl)
+	cfg.Duration("negative_ttl", false, false, 5*time.Second, &a.negTTL)
+	cfg.Int("max_entries", false, false, 10000, &a.maxEntries)
+	if _, err := cfg.Process(); err != nil {
+		return err
+	}
+	if a.maxEntries <= 0 {
+		return errors.New("auth.cache: max_entries should be positive")
+	}
+
+	a.key = make([]byte, sha256.Size)
+	if _, err := rand.Read(a.key); err != nil {
+		return fmt.Errorf("auth.cache: key generation: %w", err)
+	}
+
+	return nil
+}
+
+func (a *Auth) passwordMAC(username, password string) [sha256.Size]byte {
+	mac := hmac.New(sha256.New, a.key)
+	// Username is included to make sure identical passwords of different
+	// users produce different MACs.
+	mac.Write([]byte(username))
+	mac.Write([]byte{0})
+	mac.Write([]byte(password))
+
+	var res [sha256.Size]byte
+	copy(res[:], mac.Sum(nil))
+	return res
+}
+
+func (v *verdict) matches(mac [sha256.Size]byte, now time.Time) bool {
+	return v != nil && now.Before(v.expires) && hmac.Equal(v.mac[:], mac[:])
+}
+
+// lookup returns the cached verdict for the credentials, if any.
+func (a *Auth) lookup(username string, mac [sha256.Size]byte) (bool, error) {
+	a.entriesLck.Lock()
+	defer a.entriesLck.Unlock()
+
+	el := a.entries[username]
+	if el == nil {
+		return false, nil
+	}
+	ent := el.Value.(*entry)
+	now := a.now()
+	if ent.pos.matches(mac, now) {
+		a.lru.MoveToFront(el)
+		return true, nil
+	}
+	if ent.neg.matches(mac, now) {
+		a.lru.MoveToFront(el)
+		return true, module.ErrUnknownCredentials
+	}
+	return false, nil
+}
+
+func (a *Auth) store(username string, mac [sha256.Size]byte, positive bool) {
+	ttl := a.ttl
+	if !positive {
+		ttl = a.negTTL
+	}
+	if ttl <= 0 {
+		return
+	}
+
+	a.entriesLck.Lock()
+	defer a.entriesLck.Unlock()
+
+	now := a.now()
+	var ent *entry
+	if el := a.entries[username]; el != nil {
+		ent = el.Value.(*entry)
+		a.lru.MoveToFront(el)
+	} else {
+		for a.lru.Len() >= a.maxEntries {
+			oldest := a.lru.Back()
+			a.lru.Remove(oldest)
+			delete(a.entries, oldest.Value.(*entry).username)
+		}
+		ent = &entry{username: username}
+		a.entries[username] = a.lru.PushFront(ent)
+	}
+
+	v := &verdict{mac: mac, expires: now.Add(ttl)}
+	if positive {
+		ent.pos = v
+		// Successful authentication means the negative entry (if any) is for
+		// an old password.
+		ent.neg = nil
+	} else {
+		ent.neg = v
+	}
+}
+
+func (a *Auth) AuthPlain(username, password string) error {
+	mac := a.passwordMAC(username, password)
+	if ok, err := a.lookup(username, mac); ok {
+		a.Log.DebugMsg("cache hit", "username", username, "success", err == nil)
+		return err
+	}
+
+	err := a.wrapped.AuthPlain(username, password)
+	switch {
+	case err == nil:
+		a.store(username, mac, true)
+	case errors.Is(err, module.ErrUnknownCredentials):
+		// Other errors may be temporary, do not remember them.
+		a.store(username, mac, false)
+	}
+	return err
+}
+
+// Invalidate removes all cached verdicts for the specified user.
+//
+// Username is compared using the same rules as auth.pass_table uses.
+func (a *Auth) Invalidate(username string) {
+	key, err := precis.UsernameCaseMapped.CompareKey(username)
+	if err != nil {
+		key = username
+	}
+
+	a.entriesLck.Lock()
+	defer a.entriesLck.Unlock()
+
+	for k, el := range a.entries {
+		entKey, err := precis.UsernameCaseMapped.CompareKey(k)
+		if err != nil {
+			entKey = k
+		}
+		if k == username || entKey == key {
+			a.lru.Remove(el)
+			delete(a.entries, k)
+		}
+	}
+}
+
+func (a *Auth) Lookup(username string) (string, bool, error) {
+	tbl, ok := a.wrapped.(module.Table)
+	if !ok {
+		return "", false, fmt.Errorf("%s: underlying module does not support lookups", a.modName)
+	}
+	return tbl.Lookup(username)
+}
+
+func (a *Auth) userDB() (module.PlainUserDB, error) {
+	db, ok := a.wrapped.(module.PlainUserDB)
+	if !ok {
+		return nil, fmt.Errorf("%s: underlying module does not support credentials management", a.modName)
+	}
+	return db, nil
+}
+
+func (a *Auth) ListUsers() ([]string, error) {
+	db, err := a.userDB()
+	if err != nil {
+		return nil, err
+	}
+	return db.ListUsers()
+}
+
+func (a *Auth) CreateUser(username, password string) error {
+	db, err := a.userDB()
+	if err != nil {
+		return err
+	}
+	// Clear negative cache entries.
+	defer a.Invalidate(username)
+	return db.CreateUser(username, password)
+}
+
+func (a *Auth) SetUserPassword(username, password string) error {
+	db, err := a.userDB()
+	if err != nil {
+		return err
+	}
+	defer a.Invalidate(username)
+	return db.SetUserPassword(username, password)
+}
+
+func (a *Auth) DeleteUser(username string) error {
+	db, err := a.userDB()
+	if err != nil {
+		return err
+	}
+	defer a.Invalidate(username)
+	return db.DeleteUser(username)
+}
+
+func init() {
+	module.Register("auth.cache", New)
+}
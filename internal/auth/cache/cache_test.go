@@ -0,0 +1,197 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package cache
+
+import (
+	"container/list"
+	"errors"
+	"testing"
+	"time"
+
+	"github.com/foxcpp/maddy/framework/module"
+	"github.com/foxcpp/maddy/internal/auth/pam"
+	"github.com/foxcpp/maddy/internal/testutils"
+)
+
+type mockAuth struct {
+	db    map[string]string
+	err   error
+	calls int
+}
+
+func (m *mockAuth) AuthPlain(username, password string) error {
+	m.calls++
+	if m.err != nil {
+		return m.err
+	}
+	if pass, ok := m.db[username]; !ok || pass != password {
+		return module.ErrUnknownCredentials
+	}
+	return nil
+}
+
+func testAuth(t *testing.T, wrapped module.PlainAuth) (*Auth, *time.Time) {
+	now := time.Unix(1000, 0)
+	a := &Auth{
+		modName:    "auth.cache",
+		wrapped:    wrapped,
+		ttl:        time.Minute,
+		negTTL:     5 * time.Second,
+		maxEntries: 2,
+		key:        []byte("0123456789abcdef0123456789abcdef"),
+		now:        func() time.Time { return now },
+		entries:    map[string]*list.Element{},
+		lru:        list.New(),
+		Log:        testutils.Logger(t, "auth.cache"),
+	}
+	return a, &now
+}
+
+func TestCache_Positive(t *testing.T) {
+	m := &mockAuth{db: map[string]string{"user": "pass"}}
+	a, now := testAuth(t, m)
+
+	for i := 0; i < 3; i++ {
+		if err := a.AuthPlain("user", "pass"); err != nil {
+			t.Fatal("Unexpected error:", err)
+		}
+	}
+	if m.calls != 1 {
+		t.Fatal("Wrapped module called", m.calls, "times")
+	}
+
+	if err := a.AuthPlain("user", "wrong"); !errors.Is(err, module.ErrUnknownCredentials) {
+		t.Fatal("Wrong password accepted, err:", err)
+	}
+	if m.calls != 2 {
+		t.Fatal("Wrapped module called", m.calls, "times")
+	}
+
+	*now = now.Add(2 * time.Minute)
+	if err := a.AuthPlain("user", "pass"); err != nil {
+		t.Fatal("Unexpected error:", err)
+	}
+	if m.calls != 3 {
+		t.Fatal("Expired entry used")
+	}
+}
+
+func TestCache_Negative(t *testing.T) {
+	m := &mockAuth{db: map[string]string{"user": "pass"}}
+	a, now := testAuth(t, m)
+
+	for i := 0; i < 3; i++ {
+		if err := a.AuthPlain("user", "wrong"); !errors.Is(err, module.ErrUnknownCredentials) {
+			t.Fatal("Unexpected error:", err)
+		}
+	}
+	if m.calls != 1 {
+		t.Fatal("Wrapped module called", m.calls, "times")
+	}
+
+	// Negative entry should not affect the correct password.
+	if err := a.AuthPlain("user", "pass"); err != nil {
+		t.Fatal("Unexpected error:", err)
+	}
+
+	*now = now.Add(10 * time.Second)
+	if err := a.AuthPlain("user", "wrong"); !errors.Is(err, module.ErrUnknownCredentials) {
+		t.Fatal("Unexpected error:", err)
+	}
+	if m.calls != 3 {
+		t.Fatal("Expired entry used")
+	}
+}
+
+func TestCache_NegativePAM(t *testing.T) {
+	m := &mockAuth{err: pam.ErrInvalidCredentials}
+	a, _ := testAuth(t, m)
+
+	for i := 0; i < 2; i++ {
+		if err := a.AuthPlain("user", "wrong"); !errors.Is(err, module.ErrUnknownCredentials) {
+			t.Fatal("Unexpected error:", err)
+		}
+	}
+	if m.calls != 1 {
+		t.Fatal("Failed PAM login is not cached, wrapped module called", m.calls, "times")
+	}
+}
+
+func TestCache_TemporaryErrNotCached(t *testing.T) {
+	m := &mockAuth{err: errors.New("backend is down")}
+	a, _ := testAuth(t, m)
+
+	for i := 0; i < 2; i++ {
+		if err := a.AuthPlain("user", "pass"); err == nil {
+			t.Fatal("Expected an error")
+		}
+	}
+	if m.calls != 2 {
+		t.Fatal("Temporary error was cached")
+	}
+}
+
+func TestCache_Invalidate(t *testing.T) {
+	m := &mockAuth{db: map[string]string{"user": "pass"}}
+	a, _ := testAuth(t, m)
+
+	if err := a.AuthPlain("User", "pass"); err == nil {
+		t.Fatal("Expected an error")
+	}
+	if err := a.AuthPlain("user", "pass"); err != nil {
+		t.Fatal("Unexpected error:", err)
+	}
+
+	a.Invalidate("USER")
+	if len(a.entries) != 0 {
+		t.Fatal("Entries left after Invalidate:", len(a.entries))
+	}
+}
+
+func TestCache_MaxEntries(t *testing.T) {
+	m := &mockAuth{db: map[string]string{}}
+	a, _ := testAuth(t, m)
+
+	for _, user := range []string{"a", "b", "c", "d"} {
+		_ = a.AuthPlain(user, "pass")
+	}
+	if len(a.entries) > a.maxEntries {
+		t.Fatal("Too many entries:", len(a.entries))
+	}
+}
+
+func TestCache_LRU(t *testing.T) {
+	m := &mockAuth{db: map[string]string{"a": "pass", "b": "pass", "c": "pass"}}
+	a, _ := testAuth(t, m)
+
+	for _, user := range []string{"a", "b", "a", "c"} {
+		if err := a.AuthPlain(user, "pass"); err != nil {
+			t.Fatal("Unexpected error:", err)
+		}
+	}
+	// "b" is the least recently used one.
+	if _, ok := a.entries["b"]; ok {
+		t.Error("Least recently used entry is not evicted")
+	}
+	for _, user := range []string{"a", "c"} {
+		if _, ok := a.entries[user]; !ok {
+			t.Error("Recently used entry is evicted:", user)
+		}
+	}
+}
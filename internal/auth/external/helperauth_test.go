@@ -0,0 +1,168 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package external
+
+import (
+	"bufio"
+	"encoding/binary"
+	"errors"
+	"io"
+	"os"
+	"testing"
+	"time"
+
+	"github.com/foxcpp/maddy/framework/module"
+	"github.com/foxcpp/maddy/internal/testutils"
+)
+
+const helperEnv = "MADDY_TEST_AUTH_HELPER"
+
+func fakeVerdict(username, password string) uint32 {
+	switch {
+	case username == "crash":
+		os.Exit(3)
+	case username == "hang":
+		time.Sleep(time.Minute)
+	case username == "user" && password == "pass":
+		return 0
+	case username == "error":
+		return 2
+	}
+	return 1
+}
+
+// fakeHelper implements both protocols of maddy-pam-helper with a hardcoded
+// set of credentials.
+func fakeHelper() int {
+	if len(os.Args) < 2 || os.Args[1] != "-persistent" {
+		scnr := bufio.NewScanner(os.Stdin)
+		scnr.Scan()
+		username := scnr.Text()
+		scnr.Scan()
+		password := scnr.Text()
+		return int(fakeVerdict(username, password))
+	}
+
+	in := bufio.NewReader(os.Stdin)
+	readField := func() (string, error) {
+		var l uint32
+		if err := binary.Read(in, binary.BigEndian, &l); err != nil {
+			return "", err
+		}
+		buf := make([]byte, l)
+		_, err := io.ReadFull(in, buf)
+		return string(buf), err
+	}
+	for {
+		username, err := readField()
+		if err != nil {
+			return 0
+		}
+		password, err := readField()
+		if err != nil {
+			return 2
+		}
+
+		status := fakeVerdict(username, password)
+		reply := make([]byte, 4, 32)
+		binary.BigEndian.PutUint32(reply, status)
+		if status == 2 {
+			reply = appendField(reply, "fake_func")
+			reply = appendField(reply, "fake error")
+		} else {
+			reply = appendField(reply, "")
+			reply = appendField(reply, "")
+		}
+		if _, err := os.Stdout.Write(reply); err != nil {
+			return 2
+		}
+	}
+}
+
+func TestMain(m *testing.M) {
+	if os.Getenv(helperEnv) == "1" {
+		os.Exit(fakeHelper())
+	}
+
+	os.Setenv(helperEnv, "1")
+	os.Exit(m.Run())
+}
+
+func TestAuthUsingHelper(t *testing.T) {
+	if err := AuthUsingHelper(os.Args[0], "user", "pass"); err != nil {
+		t.Fatal("Unexpected error:", err)
+	}
+	if err := AuthUsingHelper(os.Args[0], "user", "wrong"); !errors.Is(err, module.ErrUnknownCredentials) {
+		t.Fatal("Expected ErrUnknownCredentials, got", err)
+	}
+}
+
+func TestHelperPool(t *testing.T) {
+	hp := NewHelperPool(os.Args[0], 2, 5*time.Second, testutils.Logger(t, "helperauth"))
+	defer hp.Close()
+
+	for i := 0; i < 3; i++ {
+		if err := hp.AuthPlain("user", "pass"); err != nil {
+			t.Fatal("Unexpected error:", err)
+		}
+		if err := hp.AuthPlain("user", "wrong"); !errors.Is(err, module.ErrUnknownCredentials) {
+			t.Fatal("Expected ErrUnknownCredentials, got", err)
+		}
+		if err := hp.AuthPlain("error", "pass"); err == nil || errors.Is(err, module.ErrUnknownCredentials) {
+			t.Fatal("Expected helper error, got", err)
+		}
+	}
+
+	// Process dies, pool should recover.
+	if err := hp.AuthPlain("crash", "pass"); err == nil {
+		t.Fatal("Expected an error")
+	}
+	if err := hp.AuthPlain("user", "pass"); err != nil {
+		t.Fatal("Unexpected error after helper crash:", err)
+	}
+}
+
+func TestHelperPool_Timeout(t *testing.T) {
+	hp := NewHelperPool(os.Args[0], 1, 100*time.Millisecond, testutils.Logger(t, "helperauth"))
+	defer hp.Close()
+
+	if err := hp.AuthPlain("user", "pass"); err != nil {
+		t.Fatal("Unexpected error:", err)
+	}
+	if err := hp.AuthPlain("hang", "pass"); !errors.Is(err, ErrHelperTimeout) {
+		t.Fatal("Expected ErrHelperTimeout, got", err)
+	}
+	// The only slot should be usable again.
+	if err := hp.AuthPlain("user", "pass"); err != nil {
+		t.Fatal("Unexpected error after helper timeout:", err)
+	}
+}
+
+func BenchmarkAuthUsingHelper(b *testing.B) {
+	testutils.BenchFunc(b, func() error {
+		return AuthUsingHelper(os.Args[0], "user", "pass")
+	}, true)
+}
+
+func BenchmarkHelperPool(b *testing.B) {
+	hp := NewHelperPool(os.Args[0], 4, 5*time.Second, testutils.Logger(b, "helperauth"))
+	defer hp.Close()
+
+	testutils.BenchAuth(b, hp, "user", "pass", true)
+}
@@ -0,0 +1,232 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package external
+
+import (
+	"bufio"
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"io"
+	"os/exec"
+	"sync/atomic"
+	"time"
+
+	"github.com/foxcpp/maddy/framework/log"
+	"github.com/foxcpp/maddy/framework/module"
+)
+
+// maxReplyField is the upper limit on the length of strings in the helper
+// reply. It matches MAX_FIELD_LEN in maddy-pam-helper.
+const maxReplyField = 65536
+
+type helperProc struct {
+	cmd    *exec.Cmd
+	stdin  io.WriteCloser
+	stdout *bufio.Reader
+}
+
+func (p *helperProc) kill() {
+	p.stdin.Close()
+	if p.cmd.Process != nil {
+		_ = p.cmd.Process.Kill()
+	}
+	_ = p.cmd.Wait()
+}
+
+// HelperPool maintains a set of long-lived helper processes that speak the
+// framed protocol implemented by 'maddy-pam-helper -persistent'.
+//
+// Processes are started lazily and are replaced if they die or return
+// a malformed reply.
+type HelperPool struct {
+	binaryPath string
+	timeout    time.Duration
+	log        log.Logger
+
+	// slots contains exactly 'size' values. nil value is a slot without
+	// running process.
+	slots chan *helperProc
+}
+
+// NewHelperPool creates the HelperPool with up to size processes.
+//
+// If a process does not reply within timeout, it is killed and the
+// authentication attempt fails.
+func NewHelperPool(binaryPath string, size int, timeout time.Duration, log log.Logger) *HelperPool {
+	hp := &HelperPool{
+		binaryPath: binaryPath,
+		timeout:    timeout,
+		log:        log,
+		slots:      make(chan *helperProc, size),
+	}
+	for i := 0; i < size; i++ {
+		hp.slots <- nil
+	}
+	return hp
+}
+
+func (hp *HelperPool) spawn() (*helperProc, error) {
+	cmd := exec.Command(hp.binaryPath, "-persistent")
+	stdin, err := cmd.StdinPipe()
+	if err != nil {
+		return nil, fmt.Errorf("helperauth: stdin init: %w", err)
+	}
+	stdout, err := cmd.StdoutPipe()
+	if err != nil {
+		return nil, fmt.Errorf("helperauth: stdout init: %w", err)
+	}
+	if err := cmd.Start(); err != nil {
+		return nil, fmt.Errorf("helperauth: process start: %w", err)
+	}
+	hp.log.Debugln("started helper process, PID", cmd.Process.Pid)
+	return &helperProc{
+		cmd:    cmd,
+		stdin:  stdin,
+		stdout: bufio.NewReader(stdout),
+	}, nil
+}
+
+func (hp *HelperPool) AuthPlain(accountName, password string) error {
+	p := <-hp.slots
+	fresh := false
+	if p == nil {
+		var err error
+		p, err = hp.spawn()
+		if err != nil {
+			hp.slots <- nil
+			return err
+		}
+		fresh = true
+	}
+
+	authErr, err := p.roundTripTimeout(accountName, password, hp.timeout)
+	if err != nil && !fresh && !errors.Is(err, ErrHelperTimeout) {
+		// Idle process might have died in the meantime, give it one more try
+		// with a new one.
+		hp.log.Error("helper process failed, restarting", err, "pid", p.cmd.Process.Pid)
+		p.kill()
+		p, err = hp.spawn()
+		if err != nil {
+			hp.slots <- nil
+			return err
+		}
+		authErr, err = p.roundTripTimeout(accountName, password, hp.timeout)
+	}
+	if err != nil {
+		p.kill()
+		hp.slots <- nil
+		return err
+	}
+
+	hp.slots <- p
+	return authErr
+}
+
+// ErrHelperTimeout is returned by HelperPool.AuthPlain if the helper process
+// does not reply in time.
+var ErrHelperTimeout = errors.New("helperauth: helper process timed out")
+
+// roundTripTimeout is roundTrip that kills the process if it does not
+// complete within timeout, the process is not usable afterwards.
+func (p *helperProc) roundTripTimeout(accountName, password string, timeout time.Duration) (error, error) {
+	var timedOut int32
+	t := time.AfterFunc(timeout, func() {
+		atomic.StoreInt32(&timedOut, 1)
+		// Pending pipe I/O fails once the process is gone.
+		_ = p.cmd.Process.Kill()
+	})
+	authErr, err := p.roundTrip(accountName, password)
+	if !t.Stop() && atomic.LoadInt32(&timedOut) == 1 {
+		return nil, ErrHelperTimeout
+	}
+	return authErr, err
+}
+
+// roundTrip sends a single authentication request to the process.
+//
+// The first returned value is the authentication verdict, the second one is
+// set if the process is not usable anymore.
+func (p *helperProc) roundTrip(accountName, password string) (error, error) {
+	req := make([]byte, 0, 8+len(accountName)+len(password))
+	req = appendField(req, accountName)
+	req = appendField(req, password)
+	if _, err := p.stdin.Write(req); err != nil {
+		return nil, fmt.Errorf("helperauth: stdin write: %w", err)
+	}
+
+	var status uint32
+	if err := binary.Read(p.stdout, binary.BigEndian, &status); err != nil {
+		return nil, fmt.Errorf("helperauth: stdout read: %w", err)
+	}
+	funcName, err := readField(p.stdout)
+	if err != nil {
+		return nil, err
+	}
+	errorMsg, err := readField(p.stdout)
+	if err != nil {
+		return nil, err
+	}
+
+	switch status {
+	case 0:
+		return nil, nil
+	case 1:
+		return module.ErrUnknownCredentials, nil
+	case 2:
+		return fmt.Errorf("helperauth: %s: %s", funcName, errorMsg), nil
+	default:
+		return nil, fmt.Errorf("helperauth: unexpected status: %d", status)
+	}
+}
+
+func appendField(b []byte, s string) []byte {
+	var l [4]byte
+	binary.BigEndian.PutUint32(l[:], uint32(len(s)))
+	b = append(b, l[:]...)
+	return append(b, s...)
+}
+
+func readField(r io.Reader) (string, error) {
+	var l uint32
+	if err := binary.Read(r, binary.BigEndian, &l); err != nil {
+		return "", fmt.Errorf("helperauth: stdout read: %w", err)
+	}
+	if l > maxReplyField {
+		return "", errors.New("helperauth: reply field is too long")
+	}
+	buf := make([]byte, l)
+	if _, err := io.ReadFull(r, buf); err != nil {
+		return "", fmt.Errorf("helperauth: stdout read: %w", err)
+	}
+	return string(buf), nil
+}
+
+// Close stops all helper processes.
+//
+// It blocks until in-flight requests complete.
+func (hp *HelperPool) Close() error {
+	for i := 0; i < cap(hp.slots); i++ {
+		p := <-hp.slots
+		if p != nil {
+			p.kill()
+		}
+	}
+	return nil
+}
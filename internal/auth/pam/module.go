@@ -23,6 +23,7 @@ import (
 	"fmt"
 	"os"
 	"path/filepath"
+	"time"
 
 	"github.com/foxcpp/maddy/framework/config"
 	"github.com/foxcpp/maddy/framework/log"
@@ -30,10 +31,25 @@ import (
 	"github.com/foxcpp/maddy/internal/auth/external"
 )
 
+// ErrInvalidCredentials is returned if libpam rejects the credentials. It
+// wraps module.ErrUnknownCredentials.
+var ErrInvalidCredentials = fmt.Errorf("pam: invalid credentials or unknown user: %w", module.ErrUnknownCredentials)
+
 type Auth struct {
 	instName   string
 	useHelper  bool
 	helperPath string
+	poolSize   int
+
+	helperPool    *external.HelperPool
+	helperTimeout time.Duration
+
+	workers      int
+	maxQueue     int
+	queueTimeout time.Duration
+	reuseHandles bool
+	maxUses      int
+	pool         *workerPool
 
 	Log log.Logger
 }
@@ -59,6 +75,13 @@ func (a *Auth) InstanceName() string {
 func (a *Auth) Init(cfg *config.Map) error {
 	cfg.Bool("debug", true, false, &a.Log.Debug)
 	cfg.Bool("use_helper", false, false, &a.useHelper)
+	cfg.Int("helper_pool_size", false, false, 0, &a.poolSize)
+	cfg.Duration("helper_timeout", false, false, 30*time.Second, &a.helperTimeout)
+	cfg.Int("workers", false, false, 16, &a.workers)
+	cfg.Int("max_queue", false, false, 64, &a.maxQueue)
+	cfg.Duration("queue_timeout", false, false, 5*time.Second, &a.queueTimeout)
+	cfg.Bool("reuse_handles", false, false, &a.reuseHandles)
+	cfg.Int("handle_max_uses", false, false, 100, &a.maxUses)
 	if _, err := cfg.Process(); err != nil {
 		return err
 	}
@@ -71,6 +94,23 @@ func (a *Auth) Init(cfg *config.Map) error {
 		if _, err := os.Stat(a.helperPath); err != nil {
 			return fmt.Errorf("pam: no helper binary (maddy-pam-helper) found in %s", config.LibexecDirectory)
 		}
+		if a.poolSize < 0 {
+			return errors.New("pam: helper_pool_size should not be negative")
+		}
+		if a.poolSize != 0 {
+			a.helperPool = external.NewHelperPool(a.helperPath, a.poolSize, a.helperTimeout, a.Log)
+		}
+	} else {
+		if a.workers <= 0 {
+			return errors.New("pam: workers should be positive")
+		}
+		if a.maxQueue < 0 {
+			return errors.New("pam: max_queue should not be negative")
+		}
+		if a.maxUses < 0 {
+			return errors.New("pam: handle_max_uses should not be negative")
+		}
+		a.pool = newWorkerPool(a.workers, a.maxQueue, a.queueTimeout, a.reuseHandles, a.maxUses)
 	}
 
 	return nil
@@ -78,13 +118,20 @@ func (a *Auth) Init(cfg *config.Map) error {
 
 func (a *Auth) AuthPlain(username, password string) error {
 	if a.useHelper {
-		if err := external.AuthUsingHelper(a.helperPath, username, password); err != nil {
-			return err
+		if a.helperPool != nil {
+			return a.helperPool.AuthPlain(username, password)
 		}
+		return external.AuthUsingHelper(a.helperPath, username, password)
 	}
-	err := runPAMAuth(username, password)
-	if err != nil {
-		return err
+	return a.pool.AuthPlain(username, password)
+}
+
+func (a *Auth) Close() error {
+	if a.helperPool != nil {
+		return a.helperPool.Close()
+	}
+	if a.pool != nil {
+		a.pool.Close()
 	}
 	return nil
 }
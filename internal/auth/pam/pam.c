@@ -21,41 +21,116 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <security/pam_appl.h>
 #include "pam.h"
 
-static int conv_func(int num_msg, const struct pam_message **msg, struct pam_response **resp, void *appdata_ptr) {
-    *resp = (struct pam_response*)appdata_ptr;
-    return PAM_SUCCESS;
+struct conv_data {
+    const char *password;
+};
+
+static void secure_wipe(void *buf, size_t len) {
+    volatile unsigned char *p = buf;
+    while (len--) {
+        *p++ = 0;
+    }
 }
 
-struct error_obj run_pam_auth(const char *username, char *password) {
-    // PAM frees pam_response for us.
-    struct pam_response *reply = malloc(sizeof(struct pam_response));
+/*
+Allocates a fresh response for each call. PAM frees responses (and strings
+in them) returned by the conversation function, so nothing here is shared
+with the caller.
+*/
+static int conv_func_buf(int num_msg, const struct pam_message **msg, struct pam_response **resp, void *appdata_ptr) {
+    const struct conv_data *data = appdata_ptr;
+
+    if (num_msg <= 0) {
+        return PAM_CONV_ERR;
+    }
+
+    struct pam_response *reply = calloc(num_msg, sizeof(struct pam_response));
     if (reply == NULL) {
-        struct error_obj ret_val;
-        ret_val.status = 2;
-        ret_val.func_name = "malloc";
-        ret_val.error_msg = "Out of memory";
-        return ret_val;
+        return PAM_BUF_ERR;
+    }
+
+    for (int i = 0; i < num_msg; i++) {
+        if (msg[i]->msg_style != PAM_PROMPT_ECHO_OFF && msg[i]->msg_style != PAM_PROMPT_ECHO_ON) {
+            continue;
+        }
+        reply[i].resp = strdup(data->password);
+        if (reply[i].resp == NULL) {
+            for (int j = 0; j < i; j++) {
+                if (reply[j].resp != NULL) {
+                    secure_wipe(reply[j].resp, strlen(reply[j].resp));
+                    free(reply[j].resp);
+                }
+            }
+            free(reply);
+            return PAM_BUF_ERR;
+        }
+    }
+
+    *resp = reply;
+    return PAM_SUCCESS;
+}
+
+// copy_creds places NUL-terminated copies of credentials into the arena.
+static int copy_creds(const char *username, size_t username_len,
+                      const char *password, size_t password_len,
+                      char *arena, size_t arena_len,
+                      char **username_c, char **password_c) {
+    if (username_len + password_len + 2 > arena_len) {
+        return -1;
+    }
+
+    *username_c = arena;
+    *password_c = arena + username_len + 1;
+    if (username_len != 0) {
+        memcpy(*username_c, username, username_len);
     }
-    reply->resp = password;
-    reply->resp_retcode = 0;
+    (*username_c)[username_len] = 0;
+    if (password_len != 0) {
+        memcpy(*password_c, password, password_len);
+    }
+    (*password_c)[password_len] = 0;
+    return 0;
+}
+
+static struct error_obj creds_too_long(void) {
+    struct error_obj ret_val;
+    ret_val.status = 1;
+    ret_val.func_name = "run_pam_auth_buf";
+    ret_val.error_msg = "Credentials are too long";
+    return ret_val;
+}
 
-    const struct pam_conv local_conv = { conv_func, reply };
+struct error_obj run_pam_auth_buf(const char *username, size_t username_len,
+                                  const char *password, size_t password_len,
+                                  char *arena, size_t arena_len) {
+    struct error_obj ret_val;
+    ret_val.status = 0;
+    ret_val.func_name = NULL;
+    ret_val.error_msg = NULL;
+
+    char *username_c, *password_c;
+    if (copy_creds(username, username_len, password, password_len,
+                   arena, arena_len, &username_c, &password_c) < 0) {
+        return creds_too_long();
+    }
+
+    struct conv_data data = { password_c };
+    const struct pam_conv local_conv = { conv_func_buf, &data };
     pam_handle_t *local_auth = NULL;
-    int status = pam_start("maddy", username, &local_conv, &local_auth);
+    int status = pam_start("maddy", username_c, &local_conv, &local_auth);
     if (status != PAM_SUCCESS) {
-        struct error_obj ret_val;
         ret_val.status = 2;
         ret_val.func_name = "pam_start";
         ret_val.error_msg = pam_strerror(local_auth, status);
-        return ret_val;
+        goto out;
     }
 
     status = pam_authenticate(local_auth, PAM_SILENT|PAM_DISALLOW_NULL_AUTHTOK);
     if (status != PAM_SUCCESS) {
-        struct error_obj ret_val;
         if (status == PAM_AUTH_ERR || status == PAM_USER_UNKNOWN) {
             ret_val.status = 1;
         } else {
@@ -63,22 +138,114 @@ struct error_obj run_pam_auth(const char *username, char *password) {
         }
         ret_val.func_name = "pam_authenticate";
         ret_val.error_msg = pam_strerror(local_auth, status);
-        return ret_val;
+        pam_end(local_auth, status);
+        goto out;
     }
 
     status = pam_end(local_auth, status);
     if (status != PAM_SUCCESS) {
-        struct error_obj ret_val;
         ret_val.status = 2;
         ret_val.func_name = "pam_end";
         ret_val.error_msg = pam_strerror(local_auth, status);
-        return ret_val;
     }
 
+out:
+    secure_wipe(arena, username_len + password_len + 2);
+    return ret_val;
+}
+
+struct pam_worker *pam_worker_new(unsigned int max_uses) {
+    struct pam_worker *w = calloc(1, sizeof(struct pam_worker));
+    if (w == NULL) {
+        return NULL;
+    }
+    w->max_uses = max_uses;
+    return w;
+}
+
+static void pam_worker_reset(struct pam_worker *w, int status) {
+    if (w->handle != NULL) {
+        pam_end(w->handle, status);
+    }
+    w->handle = NULL;
+    w->uses = 0;
+}
+
+void pam_worker_free(struct pam_worker *w) {
+    if (w == NULL) {
+        return;
+    }
+    pam_worker_reset(w, PAM_SUCCESS);
+    free(w);
+}
+
+struct error_obj run_pam_auth_worker(struct pam_worker *w,
+                                     const char *username, size_t username_len,
+                                     const char *password, size_t password_len,
+                                     char *arena, size_t arena_len) {
     struct error_obj ret_val;
     ret_val.status = 0;
     ret_val.func_name = NULL;
     ret_val.error_msg = NULL;
+
+    char *username_c, *password_c;
+    if (copy_creds(username, username_len, password, password_len,
+                   arena, arena_len, &username_c, &password_c) < 0) {
+        return creds_too_long();
+    }
+
+    // conv_data lives on stack, so conversation is set again for each call.
+    struct conv_data data = { password_c };
+    const struct pam_conv local_conv = { conv_func_buf, &data };
+    int status;
+
+    if (w->handle != NULL && w->max_uses != 0 && w->uses >= w->max_uses) {
+        pam_worker_reset(w, PAM_SUCCESS);
+    }
+
+    if (w->handle == NULL) {
+        status = pam_start("maddy", username_c, &local_conv, &w->handle);
+        if (status != PAM_SUCCESS) {
+            ret_val.status = 2;
+            ret_val.func_name = "pam_start";
+            ret_val.error_msg = pam_strerror(w->handle, status);
+            // Handle is not usable, but may need to be freed.
+            pam_worker_reset(w, status);
+            goto out;
+        }
+    } else {
+        status = pam_set_item(w->handle, PAM_USER, username_c);
+        if (status == PAM_SUCCESS) {
+            status = pam_set_item(w->handle, PAM_CONV, &local_conv);
+        }
+        if (status != PAM_SUCCESS) {
+            ret_val.status = 2;
+            ret_val.func_name = "pam_set_item";
+            ret_val.error_msg = pam_strerror(w->handle, status);
+            pam_worker_reset(w, status);
+            goto out;
+        }
+    }
+    w->uses++;
+
+    // PAM_AUTHTOK left from the previous call is cleared by pam_authenticate
+    // itself.
+    status = pam_authenticate(w->handle, PAM_SILENT|PAM_DISALLOW_NULL_AUTHTOK);
+    if (status != PAM_SUCCESS) {
+        if (status == PAM_AUTH_ERR || status == PAM_USER_UNKNOWN) {
+            ret_val.status = 1;
+        } else {
+            ret_val.status = 2;
+        }
+        ret_val.func_name = "pam_authenticate";
+        ret_val.error_msg = pam_strerror(w->handle, status);
+        // Do not let module state left after a failure affect next
+        // authentications.
+        pam_worker_reset(w, status);
+        goto out;
+    }
+
+out:
+    secure_wipe(arena, username_len + password_len + 2);
     return ret_val;
 }
-
@@ -36,14 +36,69 @@ import (
 
 const canCallDirectly = true
 
-var ErrInvalidCredentials = errors.New("pam: invalid credentials or unknown user")
-
-func runPAMAuth(username, password string) error {
-	usernameC := C.CString(username)
-	passwordC := C.CString(password)
-	defer C.free(unsafe.Pointer(usernameC))
-	defer C.free(unsafe.Pointer(passwordC))
-	errObj := C.run_pam_auth(usernameC, passwordC)
+// pamArenaSize is the size of the per-worker buffer used to pass credentials
+// to libpam. It limits the total length of username and password.
+const pamArenaSize = 4096
+
+// pamArena is the C state owned by a single worker.
+//
+// Credentials are copied into buf by run_pam_auth_buf and wiped after each
+// call. If worker is not nil, its PAM handle is reused between calls.
+type pamArena struct {
+	buf    *C.char
+	worker *C.struct_pam_worker
+}
+
+// newPAMArena allocates the worker state. If reuseHandle is set, PAM handle
+// is reused for up to maxUses authentications (0 = unlimited).
+func newPAMArena(reuseHandle bool, maxUses int) *pamArena {
+	a := &pamArena{
+		buf: (*C.char)(C.malloc(pamArenaSize)),
+	}
+	if reuseHandle {
+		a.worker = C.pam_worker_new(C.uint(maxUses))
+	}
+	return a
+}
+
+func (a *pamArena) free() {
+	C.free(unsafe.Pointer(a.buf))
+	a.buf = nil
+	if a.worker != nil {
+		C.pam_worker_free(a.worker)
+		a.worker = nil
+	}
+}
+
+// stringData returns the pointer to the string contents without copying it.
+//
+// It is safe to pass the result to C as long as C code does not retain it.
+func stringData(s string) *C.char {
+	if len(s) == 0 {
+		return nil
+	}
+	return *(**C.char)(unsafe.Pointer(&s))
+}
+
+func (a *pamArena) auth(username, password string) error {
+	if a.buf == nil {
+		return errors.New("pam: arena allocation failed")
+	}
+
+	var errObj C.struct_error_obj
+	if a.worker != nil {
+		errObj = C.run_pam_auth_worker(a.worker,
+			stringData(username), C.size_t(len(username)),
+			stringData(password), C.size_t(len(password)),
+			a.buf, pamArenaSize,
+		)
+	} else {
+		errObj = C.run_pam_auth_buf(
+			stringData(username), C.size_t(len(username)),
+			stringData(password), C.size_t(len(password)),
+			a.buf, pamArenaSize,
+		)
+	}
 	if errObj.status == 1 {
 		return ErrInvalidCredentials
 	}
@@ -18,10 +18,46 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #pragma once
 
+#include <stddef.h>
+
 struct error_obj {
     int status;
     const char* func_name;
     const char* error_msg;
 };
 
-struct error_obj run_pam_auth(const char *username, char *password);
+/*
+Runs PAM authentication using length-delimited buffers that are not retained
+after the call returns.
+
+NUL-terminated copies of username and password are placed into a
+caller-provided arena which is wiped before returning. Conversation
+responses are allocated separately since PAM takes ownership of them.
+*/
+struct error_obj run_pam_auth_buf(const char *username, size_t username_len,
+                                  const char *password, size_t password_len,
+                                  char *arena, size_t arena_len);
+
+/*
+Per-thread PAM handle that is reused for multiple authentications.
+
+After max_uses authentications (if not 0) or after any failure, the handle
+is closed and a new one is created on the next call.
+*/
+struct pam_worker {
+    struct pam_handle *handle;
+    unsigned int uses;
+    unsigned int max_uses;
+};
+
+struct pam_worker *pam_worker_new(unsigned int max_uses);
+void pam_worker_free(struct pam_worker *w);
+
+/*
+Same as run_pam_auth_buf but uses the handle from the pam_worker instead of
+creating a new one.
+*/
+struct error_obj run_pam_auth_worker(struct pam_worker *w,
+                                     const char *username, size_t username_len,
+                                     const char *password, size_t password_len,
+                                     char *arena, size_t arena_len);
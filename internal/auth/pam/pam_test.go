@@ -0,0 +1,70 @@
+//+build cgo,libpam
+
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package pam
+
+import (
+	"runtime"
+	"testing"
+	"time"
+)
+
+// Verdicts in these benchmarks depend on the PAM configuration of the
+// system and are not important, only the overhead of the call path is
+// measured.
+
+func BenchmarkArenaAuth(b *testing.B) {
+	runtime.LockOSThread()
+	defer runtime.UnlockOSThread()
+
+	arena := newPAMArena(false, 0)
+	defer arena.free()
+
+	b.ReportAllocs()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		_ = arena.auth("maddy-bench-user", "password")
+	}
+}
+
+func BenchmarkArenaAuth_ReuseHandle(b *testing.B) {
+	runtime.LockOSThread()
+	defer runtime.UnlockOSThread()
+
+	arena := newPAMArena(true, 0)
+	defer arena.free()
+
+	b.ReportAllocs()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		_ = arena.auth("maddy-bench-user", "password")
+	}
+}
+
+func BenchmarkAuthPlain(b *testing.B) {
+	wp := newWorkerPool(1, 0, 5*time.Second, false, 0)
+	defer wp.Close()
+
+	b.ReportAllocs()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		_ = wp.AuthPlain("maddy-bench-user", "password")
+	}
+}
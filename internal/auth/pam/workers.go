@@ -0,0 +1,122 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package pam
+
+import (
+	"errors"
+	"runtime"
+	"sync"
+	"time"
+
+	"github.com/foxcpp/maddy/internal/limits/limiters"
+)
+
+var (
+	ErrQueueFull    = errors.New("pam: too many pending authentication requests")
+	ErrQueueTimeout = errors.New("pam: timed out waiting for a free worker")
+)
+
+type authReq struct {
+	username string
+	password string
+	res      chan error
+}
+
+// workerPool runs libpam calls on a fixed set of goroutines locked to their
+// OS threads so slow PAM modules can't make the runtime spawn a thread for
+// every pending authentication.
+//
+// At most workers+maxQueue requests are accepted at once, the rest are
+// rejected immediately.
+type workerPool struct {
+	admit        limiters.Semaphore
+	reqs         chan authReq
+	queueTimeout time.Duration
+
+	reuseHandles  bool
+	handleMaxUses int
+
+	stop chan struct{}
+	wg   sync.WaitGroup
+}
+
+// newWorkerPool starts the worker goroutines. If reuseHandles is set, each
+// worker keeps its PAM handle for up to handleMaxUses authentications.
+func newWorkerPool(workers, maxQueue int, queueTimeout time.Duration, reuseHandles bool, handleMaxUses int) *workerPool {
+	wp := &workerPool{
+		admit:         limiters.NewSemaphore(workers + maxQueue),
+		reqs:          make(chan authReq),
+		queueTimeout:  queueTimeout,
+		reuseHandles:  reuseHandles,
+		handleMaxUses: handleMaxUses,
+		stop:          make(chan struct{}),
+	}
+	wp.wg.Add(workers)
+	for i := 0; i < workers; i++ {
+		go wp.worker()
+	}
+	return wp
+}
+
+func (wp *workerPool) worker() {
+	defer wp.wg.Done()
+
+	runtime.LockOSThread()
+	defer runtime.UnlockOSThread()
+
+	arena := newPAMArena(wp.reuseHandles, wp.handleMaxUses)
+	defer arena.free()
+
+	for {
+		select {
+		case req := <-wp.reqs:
+			req.res <- arena.auth(req.username, req.password)
+		case <-wp.stop:
+			return
+		}
+	}
+}
+
+func (wp *workerPool) AuthPlain(username, password string) error {
+	if !wp.admit.TryTake() {
+		return ErrQueueFull
+	}
+	defer wp.admit.Release()
+
+	req := authReq{
+		username: username,
+		password: password,
+		res:      make(chan error, 1),
+	}
+
+	t := time.NewTimer(wp.queueTimeout)
+	defer t.Stop()
+	select {
+	case wp.reqs <- req:
+	case <-t.C:
+		return ErrQueueTimeout
+	}
+
+	return <-req.res
+}
+
+func (wp *workerPool) Close() {
+	close(wp.stop)
+	wp.wg.Wait()
+}
@@ -0,0 +1,63 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package pass_table
+
+import (
+	"testing"
+
+	"github.com/foxcpp/maddy/framework/config"
+	"github.com/foxcpp/maddy/internal/testutils"
+)
+
+func benchAuth(b *testing.B) *Auth {
+	addSHA256()
+
+	mod, err := New("pass_table", "", nil, []string{"dummy"})
+	if err != nil {
+		b.Fatal(err)
+	}
+	err = mod.Init(config.NewMap(nil, config.Node{
+		Children: []config.Node{},
+	}))
+	if err != nil {
+		b.Fatal(err)
+	}
+	a := mod.(*Auth)
+	a.table = testutils.Table{
+		M: map[string]string{
+			"sha256": "sha256:U0FMVA==:8PDRAgaUqaLSk34WpYniXjaBgGM93Lc6iF4pw2slthw=",
+			"bcrypt": "bcrypt:$2y$10$4tEJtJ6dApmhETg8tJ4WHOeMtmYXQwmHDKIyfg09Bw1F/smhLjlaa",
+			"argon2": "argon2:1:8:1:U0FBQUFBTFQ=:KHUshl3DcpHR3AoVd28ZeBGmZ1Fj1gwJgNn98Ia8DAvGHqI0BvFOMJPxtaAfO8F+qomm2O3h0P0yV50QGwXI/Q==",
+		},
+	}
+	return a
+}
+
+func BenchmarkAuthPlain(b *testing.B) {
+	a := benchAuth(b)
+
+	for _, hash := range []string{"sha256", "bcrypt", "argon2"} {
+		b.Run(hash, func(b *testing.B) {
+			testutils.BenchAuth(b, a, hash, "password", true)
+		})
+	}
+	b.Run("unknown user", func(b *testing.B) {
+		testutils.BenchAuth(b, a, "nobody", "password", false)
+	})
+}
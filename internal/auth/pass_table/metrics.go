@@ -0,0 +1,49 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package pass_table
+
+import "github.com/prometheus/client_golang/prometheus"
+
+var (
+	hashQueueWait = prometheus.NewHistogramVec(
+		prometheus.HistogramOpts{
+			Namespace: "maddy",
+			Subsystem: "pass_table",
+			Name:      "hash_queue_wait_seconds",
+			Help:      "Time spent waiting for a free hasher worker and memory budget",
+			Buckets:   []float64{0.001, 0.005, 0.01, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10},
+		},
+		[]string{"hash"},
+	)
+	hashVerifyTime = prometheus.NewHistogramVec(
+		prometheus.HistogramOpts{
+			Namespace: "maddy",
+			Subsystem: "pass_table",
+			Name:      "hash_verify_seconds",
+			Help:      "Time spent verifying password hashes",
+			Buckets:   []float64{0.001, 0.005, 0.01, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5},
+		},
+		[]string{"hash"},
+	)
+)
+
+func init() {
+	prometheus.MustRegister(hashQueueWait)
+	prometheus.MustRegister(hashVerifyTime)
+}
@@ -0,0 +1,110 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package pass_table
+
+import (
+	"context"
+	"fmt"
+	"strconv"
+	"strings"
+	"time"
+
+	"github.com/foxcpp/maddy/internal/limits/limiters"
+	"golang.org/x/sync/semaphore"
+)
+
+const (
+	// DefaultArgon2Budget is the default amount of memory (in KiB) that can
+	// be used by concurrent argon2 evaluations.
+	DefaultArgon2Budget = 256 * 1024
+
+	DefaultHashTimeout = 10 * time.Second
+)
+
+// hashScheduler limits the amount of concurrent hash verifications to avoid
+// CPU and memory exhaustion on bursts of authentication attempts.
+//
+// Each verification takes a worker slot and, for memory-hard functions,
+// the amount of memory it needs from the shared budget. Requests waiting
+// longer than timeout are rejected.
+type hashScheduler struct {
+	workers limiters.Semaphore
+
+	memory       *semaphore.Weighted
+	memoryBudget int64
+
+	timeout time.Duration
+}
+
+func newHashScheduler(workers int, memoryBudget int64, timeout time.Duration) *hashScheduler {
+	return &hashScheduler{
+		workers:      limiters.NewSemaphore(workers),
+		memory:       semaphore.NewWeighted(memoryBudget),
+		memoryBudget: memoryBudget,
+		timeout:      timeout,
+	}
+}
+
+// hashMemory returns the amount of memory (in KiB) needed to verify the hash.
+func hashMemory(hashName, hashSalt string) int64 {
+	if hashName != HashArgon2 {
+		return 0
+	}
+	parts := strings.SplitN(hashSalt, ":", 3)
+	if len(parts) != 3 {
+		return 0
+	}
+	memory, err := strconv.ParseUint(parts[1], 10, 32)
+	if err != nil {
+		return 0
+	}
+	return int64(memory)
+}
+
+func (s *hashScheduler) verify(hashName string, verify FuncHashVerify, pass, hashSalt string) error {
+	ctx, cancel := context.WithTimeout(context.Background(), s.timeout)
+	defer cancel()
+
+	queueStart := time.Now()
+
+	mem := hashMemory(hashName, hashSalt)
+	if mem > s.memoryBudget {
+		// Let it run alone instead of blocking forever.
+		mem = s.memoryBudget
+	}
+	if mem != 0 {
+		if err := s.memory.Acquire(ctx, mem); err != nil {
+			return fmt.Errorf("pass_table: waiting for hasher memory: %w", err)
+		}
+		defer s.memory.Release(mem)
+	}
+
+	if err := s.workers.TakeContext(ctx); err != nil {
+		return fmt.Errorf("pass_table: waiting for hasher worker: %w", err)
+	}
+	defer s.workers.Release()
+
+	verifyStart := time.Now()
+	hashQueueWait.WithLabelValues(hashName).Observe(verifyStart.Sub(queueStart).Seconds())
+
+	err := verify(pass, hashSalt)
+
+	hashVerifyTime.WithLabelValues(hashName).Observe(time.Since(verifyStart).Seconds())
+	return err
+}
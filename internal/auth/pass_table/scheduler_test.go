@@ -0,0 +1,100 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package pass_table
+
+import (
+	"context"
+	"errors"
+	"sync"
+	"sync/atomic"
+	"testing"
+	"time"
+)
+
+func TestHashScheduler_MemoryBudget(t *testing.T) {
+	// 3 workers, but memory is enough only for two argon2 evaluations at
+	// once.
+	s := newHashScheduler(3, 2048, 5*time.Second)
+
+	var running, maxRunning int32
+	verify := func(_, _ string) error {
+		cur := atomic.AddInt32(&running, 1)
+		for {
+			max := atomic.LoadInt32(&maxRunning)
+			if cur <= max || atomic.CompareAndSwapInt32(&maxRunning, max, cur) {
+				break
+			}
+		}
+		time.Sleep(10 * time.Millisecond)
+		atomic.AddInt32(&running, -1)
+		return nil
+	}
+
+	var wg sync.WaitGroup
+	for i := 0; i < 6; i++ {
+		wg.Add(1)
+		go func() {
+			defer wg.Done()
+			if err := s.verify(HashArgon2, verify, "", "1:1024:1:salt:hash"); err != nil {
+				t.Error(err)
+			}
+		}()
+	}
+	wg.Wait()
+
+	if maxRunning != 2 {
+		t.Fatal("Expected 2 concurrent verifications, got", maxRunning)
+	}
+}
+
+func TestHashScheduler_OverBudget(t *testing.T) {
+	s := newHashScheduler(1, 1024, 5*time.Second)
+	err := s.verify(HashArgon2, func(_, _ string) error { return nil }, "", "1:4096:1:salt:hash")
+	if err != nil {
+		t.Fatal("Hash requiring more than the budget should still be verified, got", err)
+	}
+}
+
+func TestHashScheduler_Timeout(t *testing.T) {
+	s := newHashScheduler(1, 1024, 50*time.Millisecond)
+
+	release := make(chan struct{})
+	started := make(chan struct{})
+	go func() {
+		_ = s.verify(HashBcrypt, func(_, _ string) error {
+			close(started)
+			<-release
+			return nil
+		}, "", "")
+	}()
+	<-started
+	defer close(release)
+
+	called := false
+	err := s.verify(HashBcrypt, func(_, _ string) error {
+		called = true
+		return nil
+	}, "", "")
+	if !errors.Is(err, context.DeadlineExceeded) {
+		t.Fatal("Expected timeout, got", err)
+	}
+	if called {
+		t.Fatal("verify function called after timeout")
+	}
+}
@@ -19,8 +19,11 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 package pass_table
 
 import (
+	"errors"
 	"fmt"
+	"runtime"
 	"strings"
+	"time"
 
 	"github.com/foxcpp/maddy/framework/config"
 	modconfig "github.com/foxcpp/maddy/framework/config/module"
@@ -34,7 +37,8 @@ type Auth struct {
 	instName   string
 	inlineArgs []string
 
-	table module.Table
+	table  module.Table
+	hasher *hashScheduler
 }
 
 func New(modName, instName string, _, inlineArgs []string) (module.Module, error) {
@@ -47,12 +51,31 @@ func New(modName, instName string, _, inlineArgs []string) (module.Module, error
 
 func (a *Auth) Init(cfg *config.Map) error {
 	if len(a.inlineArgs) != 0 {
+		a.hasher = newHashScheduler(runtime.GOMAXPROCS(0), DefaultArgon2Budget, DefaultHashTimeout)
 		return modconfig.ModuleFromNode("table", a.inlineArgs, cfg.Block, cfg.Globals, &a.table)
 	}
 
+	var (
+		workers      int
+		memoryBudget int
+		timeout      time.Duration
+	)
 	cfg.Custom("table", false, true, nil, modconfig.TableDirective, &a.table)
-	_, err := cfg.Process()
-	return err
+	cfg.Int("hash_workers", false, false, runtime.GOMAXPROCS(0), &workers)
+	cfg.DataSize("argon2_memory_budget", false, false, DefaultArgon2Budget*1024, &memoryBudget)
+	cfg.Duration("hash_timeout", false, false, DefaultHashTimeout, &timeout)
+	if _, err := cfg.Process(); err != nil {
+		return err
+	}
+	if workers <= 0 {
+		return errors.New("pass_table: hash_workers should be positive")
+	}
+	if memoryBudget < 1024 {
+		return errors.New("pass_table: argon2_memory_budget should be at least 1K")
+	}
+
+	a.hasher = newHashScheduler(workers, int64(memoryBudget/1024), timeout)
+	return nil
 }
 
 func (a *Auth) Name() string {
@@ -94,7 +117,7 @@ func (a *Auth) AuthPlain(username, password string) error {
 	if hashVerify == nil {
 		return fmt.Errorf("%s: auth plain %s: unknown hash: %s", a.modName, key, parts[0])
 	}
-	return hashVerify(password, parts[1])
+	return a.hasher.verify(parts[0], hashVerify, password, parts[1])
 }
 
 func (a *Auth) ListUsers() ([]string, error) {
@@ -0,0 +1,202 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package auth
+
+import (
+	"errors"
+	"net"
+	"strconv"
+	"time"
+
+	"github.com/foxcpp/maddy/framework/config"
+	"github.com/foxcpp/maddy/framework/exterrors"
+	"github.com/foxcpp/maddy/internal/limits/limiters"
+	"golang.org/x/text/secure/precis"
+)
+
+// ErrRateLimited is returned when the authentication attempt is rejected by
+// RateLimit without consulting any providers.
+var ErrRateLimited = exterrors.WithTemporary(
+	errors.New("auth: too many authentication attempts, try again later"),
+	true,
+)
+
+// RateLimit restricts the rate of authentication attempts on per-username
+// and per-source-network basis.
+//
+// Attempts are counted regardless of their outcome, so limits should be set
+// with legitimate clients opening multiple connections in mind.
+type RateLimit struct {
+	user *limiters.BucketSet
+	ip   *limiters.BucketSet
+
+	ipv4Mask net.IPMask
+	ipv6Mask net.IPMask
+}
+
+// maxRateBuckets is the amount of usernames (or networks) that are tracked at
+// the same time. Bucket is kept for 2 periods after the last attempt, so with
+// the default 1 minute period this is 10000 distinct keys per minute, which
+// is well above what a single server sees from legitimate clients. Buckets
+// are refilled lazily and take a few hundred bytes each, so the table takes a few
+// MiB when full.
+//
+// If there is no space left, attempts are allowed (see Allow).
+const maxRateBuckets = 20000
+
+func rateSet(burst int, period time.Duration) *limiters.BucketSet {
+	if burst <= 0 {
+		return nil
+	}
+	return limiters.NewBucketSet(func() limiters.L {
+		return limiters.NewLazyRate(burst, period)
+	}, 2*period, maxRateBuckets)
+}
+
+// Allow reports whether the next authentication attempt for the username
+// from remoteAddr should be processed.
+//
+// It never blocks. Nil RateLimit allows everything.
+//
+// If there is no space to track the username or network, the attempt is
+// allowed and counted in the maddy_auth_ratelimit_untracked metric. Otherwise
+// an attacker could lock out all users by filling the table with random
+// usernames.
+func (rl *RateLimit) Allow(remoteAddr net.Addr, username string) bool {
+	if rl == nil {
+		return true
+	}
+
+	// Source network is checked first so a single client hammering random
+	// usernames does not deplete buckets of legitimate users.
+	if rl.ip != nil {
+		if key := rl.ipKey(remoteAddr); key != "" && !tryTake(rl.ip, "ip", key) {
+			return false
+		}
+	}
+	if rl.user != nil {
+		key, err := precis.UsernameCaseMapped.CompareKey(username)
+		if err != nil {
+			key = username
+		}
+		if !tryTake(rl.user, "username", key) {
+			return false
+		}
+	}
+	return true
+}
+
+func tryTake(set *limiters.BucketSet, kind, key string) bool {
+	ok, tracked := set.TryTakeTracked(key)
+	if !tracked {
+		rateUntracked.WithLabelValues(kind).Inc()
+		return true
+	}
+	return ok
+}
+
+func (rl *RateLimit) ipKey(remoteAddr net.Addr) string {
+	var ip net.IP
+	switch addr := remoteAddr.(type) {
+	case *net.TCPAddr:
+		ip = addr.IP
+	case *net.UDPAddr:
+		ip = addr.IP
+	}
+	if ip == nil {
+		return ""
+	}
+
+	if v4 := ip.To4(); v4 != nil {
+		return v4.Mask(rl.ipv4Mask).String()
+	}
+	return ip.Mask(rl.ipv6Mask).String()
+}
+
+func (rl *RateLimit) Close() {
+	if rl == nil {
+		return
+	}
+	if rl.ip != nil {
+		rl.ip.Close()
+	}
+	if rl.user != nil {
+		rl.user.Close()
+	}
+}
+
+func rateDirective(m *config.Map, node config.Node) (interface{}, error) {
+	period := 1 * time.Minute
+	switch len(node.Args) {
+	case 2:
+		var err error
+		period, err = time.ParseDuration(node.Args[1])
+		if err != nil {
+			return nil, config.NodeErr(node, "%v", err)
+		}
+		if period <= 0 {
+			return nil, config.NodeErr(node, "period should be positive")
+		}
+		fallthrough
+	case 1:
+		burst, err := strconv.Atoi(node.Args[0])
+		if err != nil {
+			return nil, config.NodeErr(node, "%v", err)
+		}
+		return rateSet(burst, period), nil
+	case 0:
+		return nil, config.NodeErr(node, "at least burst size is needed")
+	default:
+		return nil, config.NodeErr(node, "too many arguments")
+	}
+}
+
+// RateLimitDirective parses the 'auth_ratelimit' configuration block and
+// creates the corresponding RateLimit object.
+//
+// It is intended to be used with config.Map.Custom.
+func RateLimitDirective(m *config.Map, node config.Node) (interface{}, error) {
+	if len(node.Args) != 0 {
+		return nil, config.NodeErr(node, "unexpected arguments")
+	}
+
+	var (
+		rl                     RateLimit
+		ipv4Prefix, ipv6Prefix int
+	)
+	cfg := config.NewMap(m.Globals, node)
+	cfg.Custom("username", false, false, nil, rateDirective, &rl.user)
+	cfg.Custom("ip", false, false, nil, rateDirective, &rl.ip)
+	cfg.Int("ipv4_prefix", false, false, 32, &ipv4Prefix)
+	cfg.Int("ipv6_prefix", false, false, 64, &ipv6Prefix)
+	if _, err := cfg.Process(); err != nil {
+		return nil, err
+	}
+
+	if ipv4Prefix < 0 || ipv4Prefix > 32 {
+		return nil, config.NodeErr(node, "ipv4_prefix should be in range 0-32")
+	}
+	if ipv6Prefix < 0 || ipv6Prefix > 128 {
+		return nil, config.NodeErr(node, "ipv6_prefix should be in range 0-128")
+	}
+	rl.ipv4Mask = net.CIDRMask(ipv4Prefix, 32)
+	rl.ipv6Mask = net.CIDRMask(ipv6Prefix, 128)
+
+	return &rl, nil
+}
@@ -0,0 +1,125 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package auth
+
+import (
+	"errors"
+	"net"
+	"strconv"
+	"testing"
+	"time"
+
+	"github.com/foxcpp/maddy/framework/exterrors"
+	"github.com/foxcpp/maddy/framework/module"
+	"github.com/foxcpp/maddy/internal/limits/limiters"
+	"github.com/foxcpp/maddy/internal/testutils"
+)
+
+type countingAuth struct {
+	calls int
+}
+
+func (c *countingAuth) AuthPlain(username, _ string) error {
+	c.calls++
+	return errors.New("invalid creds")
+}
+
+func TestRateLimit(t *testing.T) {
+	rl := &RateLimit{
+		user:     rateSet(2, time.Hour),
+		ip:       rateSet(3, time.Hour),
+		ipv4Mask: net.CIDRMask(24, 32),
+		ipv6Mask: net.CIDRMask(64, 128),
+	}
+	defer rl.Close()
+
+	addr1 := &net.TCPAddr{IP: net.IPv4(192, 0, 2, 1)}
+	addr2 := &net.TCPAddr{IP: net.IPv4(192, 0, 2, 200)}
+	addr3 := &net.TCPAddr{IP: net.IPv4(198, 51, 100, 1)}
+
+	// Usernames are case-insensitive.
+	for i, user := range []string{"user1", "USER1"} {
+		if !rl.Allow(addr1, user) {
+			t.Fatal("attempt", i, "rejected")
+		}
+	}
+	if rl.Allow(addr3, "user1") {
+		t.Fatal("username limit is not applied")
+	}
+
+	// Same /24 network.
+	if !rl.Allow(addr2, "user2") {
+		t.Fatal("attempt rejected")
+	}
+	if rl.Allow(addr2, "user3") {
+		t.Fatal("network limit is not applied")
+	}
+	if !rl.Allow(addr3, "user3") {
+		t.Fatal("limit is applied to unrelated network")
+	}
+
+	var nilRL *RateLimit
+	if !nilRL.Allow(addr1, "user1") {
+		t.Fatal("nil RateLimit rejected attempt")
+	}
+}
+
+func TestRateLimit_NoSpace(t *testing.T) {
+	// One bucket per shard, so some of the usernames below are not tracked.
+	user := limiters.NewBucketSet(func() limiters.L {
+		return limiters.NewRate(1, time.Hour)
+	}, time.Hour, 1)
+	rl := &RateLimit{user: user}
+	defer rl.Close()
+
+	addr := &net.TCPAddr{IP: net.IPv4(192, 0, 2, 1)}
+	for i := 0; i < 100; i++ {
+		if !rl.Allow(addr, "user"+strconv.Itoa(i)) {
+			t.Fatal("attempt", i, "rejected")
+		}
+	}
+}
+
+func TestCreateSASL_RateLimit(t *testing.T) {
+	backend := &countingAuth{}
+	a := SASLAuth{
+		Log:   testutils.Logger(t, "saslauth"),
+		Plain: []module.PlainAuth{backend},
+		RateLimit: &RateLimit{
+			user:     rateSet(1, time.Hour),
+			ipv4Mask: net.CIDRMask(32, 32),
+			ipv6Mask: net.CIDRMask(64, 128),
+		},
+	}
+	defer a.RateLimit.Close()
+
+	for i := 0; i < 3; i++ {
+		srv := a.CreateSASL("PLAIN", &net.TCPAddr{}, func(string) error { return nil })
+		_, _, err := srv.Next([]byte("\x00user1\x00aa"))
+		if err == nil {
+			t.Fatal("Expected an error")
+		}
+		if i != 0 && !exterrors.IsTemporary(err) {
+			t.Fatal("Non-temporary error for rate-limited attempt:", err)
+		}
+	}
+	if backend.calls != 1 {
+		t.Fatal("Provider called for rate-limited attempts:", backend.calls)
+	}
+}
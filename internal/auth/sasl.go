@@ -22,6 +22,7 @@ import (
 	"errors"
 	"fmt"
 	"net"
+	"time"
 
 	"github.com/emersion/go-sasl"
 	"github.com/foxcpp/maddy/framework/config"
@@ -44,6 +45,9 @@ type SASLAuth struct {
 	OnlyFirstID bool
 
 	Plain []module.PlainAuth
+
+	// RateLimit, if set, is consulted before any provider is called.
+	RateLimit *RateLimit
 }
 
 func (s *SASLAuth) SASLMechanisms() []string {
@@ -63,7 +67,13 @@ func (s *SASLAuth) AuthPlain(username, password string) error {
 
 	var lastErr error
 	for _, p := range s.Plain {
+		start := time.Now()
 		err := p.AuthPlain(username, password)
+		result := "ok"
+		if err != nil {
+			result = "failed"
+		}
+		authDuration.WithLabelValues(providerName(p), result).Observe(time.Since(start).Seconds())
 		if err == nil {
 			return nil
 		}
@@ -76,6 +86,14 @@ func (s *SASLAuth) AuthPlain(username, password string) error {
 	return fmt.Errorf("no auth. provider accepted creds, last err: %w", lastErr)
 }
 
+// providerName returns the name used to identify the provider in metrics.
+func providerName(p module.PlainAuth) string {
+	if mod, ok := p.(module.Module); ok {
+		return mod.Name() + ":" + mod.InstanceName()
+	}
+	return fmt.Sprintf("%T", p)
+}
+
 // CreateSASL creates the sasl.Server instance for the corresponding mechanism.
 func (s *SASLAuth) CreateSASL(mech string, remoteAddr net.Addr, successCb func(identity string) error) sasl.Server {
 	switch mech {
@@ -85,6 +103,11 @@ func (s *SASLAuth) CreateSASL(mech string, remoteAddr net.Addr, successCb func(i
 				identity = username
 			}
 
+			if !s.RateLimit.Allow(remoteAddr, username) {
+				s.Log.Msg("authentication attempt rate-limited", "username", username, "src_ip", remoteAddr)
+				return ErrRateLimited
+			}
+
 			err := s.AuthPlain(username, password)
 			if err != nil {
 				s.Log.Error("authentication failed", err, "username", username, "src_ip", remoteAddr)
@@ -95,6 +118,11 @@ func (s *SASLAuth) CreateSASL(mech string, remoteAddr net.Addr, successCb func(i
 		})
 	case sasl.Login:
 		return sasl.NewLoginServer(func(username, password string) error {
+			if !s.RateLimit.Allow(remoteAddr, username) {
+				s.Log.Msg("authentication attempt rate-limited", "username", username, "src_ip", remoteAddr)
+				return ErrRateLimited
+			}
+
 			err := s.AuthPlain(username, password)
 			if err != nil {
 				s.Log.Error("authentication failed", err, "username", username, "src_ip", remoteAddr)
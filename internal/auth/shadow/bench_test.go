@@ -0,0 +1,46 @@
+//+build !windows
+
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package shadow
+
+import (
+	"strconv"
+	"strings"
+	"testing"
+
+	"github.com/GehirnInc/crypt/sha512_crypt"
+	"github.com/foxcpp/maddy/internal/testutils"
+)
+
+func BenchmarkAuthPlain(b *testing.B) {
+	hash, err := sha512_crypt.New().Generate([]byte("password"), []byte("$6$saltsalt"))
+	if err != nil {
+		b.Fatal(err)
+	}
+
+	var sb strings.Builder
+	for i := 0; i < 50000; i++ {
+		sb.WriteString("user" + strconv.Itoa(i) + ":" + hash + ":18000::::::\n")
+	}
+	withShadowFile(b, sb.String())
+
+	a := &Auth{Log: testutils.Logger(b, "shadow")}
+	testutils.BenchAuth(b, a, "user25000", "password", true)
+}
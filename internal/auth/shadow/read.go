@@ -19,47 +19,75 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 package shadow
 
 import (
-	"bufio"
 	"errors"
 	"fmt"
+	"io/ioutil"
 	"os"
 	"strconv"
 	"strings"
+	"sync"
 )
 
 var ErrNoSuchUser = errors.New("shadow: user entry is not present in database")
 var ErrWrongPassword = errors.New("shadow: wrong password")
 
+// Path is the location of the shadow passwords database.
+var Path = "/etc/shadow"
+
 // Read reads system shadow passwords database and returns all entires in it.
 func Read() ([]Entry, error) {
-	f, err := os.Open("/etc/shadow")
+	data, err := ioutil.ReadFile(Path)
 	if err != nil {
 		return nil, err
 	}
-	scnr := bufio.NewScanner(f)
 
 	var res []Entry
-	for scnr.Scan() {
-		ent, err := parseEntry(scnr.Text())
-		if err != nil {
-			return res, err
+	err = parseFile(string(data), func(ent Entry) {
+		res = append(res, ent)
+	})
+	return res, err
+}
+
+// parseFile calls cb for each entry in the shadow file contents.
+//
+// Strings in Entry are substrings of data so no per-entry allocations are
+// made.
+func parseFile(data string, cb func(Entry)) error {
+	for len(data) != 0 {
+		var line string
+		if i := strings.IndexByte(data, '\n'); i >= 0 {
+			line, data = data[:i], data[i+1:]
+		} else {
+			line, data = data, ""
+		}
+		if line == "" {
+			continue
 		}
 
-		res = append(res, *ent)
-	}
-	if err := scnr.Err(); err != nil {
-		return res, err
+		ent, err := parseEntry(line)
+		if err != nil {
+			return err
+		}
+		cb(ent)
 	}
-	return res, nil
+	return nil
 }
 
-func parseEntry(line string) (*Entry, error) {
-	parts := strings.Split(line, ":")
-	if len(parts) != 9 {
-		return nil, errors.New("read: malformed entry")
+func parseEntry(line string) (Entry, error) {
+	var parts [9]string
+	for i := 0; i < len(parts)-1; i++ {
+		sep := strings.IndexByte(line, ':')
+		if sep < 0 {
+			return Entry{}, errors.New("read: malformed entry")
+		}
+		parts[i], line = line[:sep], line[sep+1:]
+	}
+	if strings.IndexByte(line, ':') >= 0 {
+		return Entry{}, errors.New("read: malformed entry")
 	}
+	parts[8] = line
 
-	res := &Entry{
+	res := Entry{
 		Name: parts[0],
 		Pass: parts[1],
 	}
@@ -74,7 +102,7 @@ func parseEntry(line string) (*Entry, error) {
 			var err error
 			*value, err = strconv.Atoi(parts[2+i])
 			if err != nil {
-				return nil, fmt.Errorf("read: invalid value for field %d", 2+i)
+				return Entry{}, fmt.Errorf("read: invalid value for field %d", 2+i)
 			}
 		}
 	}
@@ -82,17 +110,71 @@ func parseEntry(line string) (*Entry, error) {
 	return res, nil
 }
 
-func Lookup(name string) (*Entry, error) {
-	entries, err := Read()
+// index is the in-memory copy of the shadow database that is re-read only
+// if the file is replaced or modified.
+type index struct {
+	lck     sync.RWMutex
+	info    os.FileInfo
+	entries map[string]Entry
+}
+
+var db index
+
+func (idx *index) upToDate(info os.FileInfo) bool {
+	return idx.info != nil && os.SameFile(idx.info, info) &&
+		idx.info.ModTime().Equal(info.ModTime()) && idx.info.Size() == info.Size()
+}
+
+func (idx *index) reload(info os.FileInfo) error {
+	data, err := ioutil.ReadFile(Path)
+	if err != nil {
+		return err
+	}
+	str := string(data)
+
+	entries := make(map[string]Entry, strings.Count(str, "\n")+1)
+	if err := parseFile(str, func(ent Entry) {
+		entries[ent.Name] = ent
+	}); err != nil {
+		return err
+	}
+
+	idx.entries = entries
+	idx.info = info
+	return nil
+}
+
+func (idx *index) lookup(name string) (*Entry, error) {
+	info, err := os.Stat(Path)
 	if err != nil {
 		return nil, err
 	}
 
-	for _, entry := range entries {
-		if entry.Name == name {
-			return &entry, nil
+	idx.lck.RLock()
+	if !idx.upToDate(info) {
+		idx.lck.RUnlock()
+		idx.lck.Lock()
+		if !idx.upToDate(info) {
+			if err := idx.reload(info); err != nil {
+				idx.lck.Unlock()
+				return nil, err
+			}
 		}
+		idx.lck.Unlock()
+		idx.lck.RLock()
 	}
+	ent, ok := idx.entries[name]
+	idx.lck.RUnlock()
 
-	return nil, ErrNoSuchUser
+	if !ok {
+		return nil, ErrNoSuchUser
+	}
+	return &ent, nil
+}
+
+// Lookup returns the shadow database entry for the user.
+//
+// Database is kept in memory and is read again only if the file is changed.
+func Lookup(name string) (*Entry, error) {
+	return db.lookup(name)
 }
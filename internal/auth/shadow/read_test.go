@@ -0,0 +1,139 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package shadow
+
+import (
+	"io/ioutil"
+	"os"
+	"path/filepath"
+	"strconv"
+	"strings"
+	"testing"
+	"time"
+)
+
+func withShadowFile(t testing.TB, contents string) {
+	dir, err := ioutil.TempDir("", "maddy-shadow-")
+	if err != nil {
+		t.Fatal(err)
+	}
+	path := filepath.Join(dir, "shadow")
+	if err := ioutil.WriteFile(path, []byte(contents), 0600); err != nil {
+		t.Fatal(err)
+	}
+
+	oldPath := Path
+	Path = path
+	db = index{}
+	t.Cleanup(func() {
+		Path = oldPath
+		db = index{}
+		os.RemoveAll(dir)
+	})
+}
+
+func TestLookup(t *testing.T) {
+	withShadowFile(t, "root:!:18000:0:99999:7:::\n"+
+		"user:$6$salt$hash:18000::::::\n")
+
+	ent, err := Lookup("user")
+	if err != nil {
+		t.Fatal(err)
+	}
+	if ent.Pass != "$6$salt$hash" || ent.LastChange != 18000 || ent.MinPassAge != -1 {
+		t.Fatalf("Wrong entry: %+v", ent)
+	}
+	if _, err := Lookup("nobody"); err != ErrNoSuchUser {
+		t.Fatal("Expected ErrNoSuchUser, got", err)
+	}
+
+	// Replace the file and make sure the change is noticed even if mtime is
+	// the same.
+	info, err := os.Stat(Path)
+	if err != nil {
+		t.Fatal(err)
+	}
+	tmp := Path + ".new"
+	if err := ioutil.WriteFile(tmp, []byte("nobody:x:18000::::::\n"), 0600); err != nil {
+		t.Fatal(err)
+	}
+	if err := os.Chtimes(tmp, time.Now(), info.ModTime()); err != nil {
+		t.Fatal(err)
+	}
+	if err := os.Rename(tmp, Path); err != nil {
+		t.Fatal(err)
+	}
+
+	if _, err := Lookup("user"); err != ErrNoSuchUser {
+		t.Fatal("Expected ErrNoSuchUser, got", err)
+	}
+	if _, err := Lookup("nobody"); err != nil {
+		t.Fatal(err)
+	}
+}
+
+func TestRead_Malformed(t *testing.T) {
+	for _, line := range []string{
+		"user:pass",
+		"user:pass:1:2:3:4:5:6:7:8",
+		"user:pass:a::::::",
+	} {
+		withShadowFile(t, line+"\n")
+		if _, err := Read(); err == nil {
+			t.Error("No error for", line)
+		}
+		if _, err := Lookup("user"); err == nil || err == ErrNoSuchUser {
+			t.Error("No parse error for", line)
+		}
+	}
+}
+
+func benchShadowFile(b *testing.B) {
+	var sb strings.Builder
+	for i := 0; i < 50000; i++ {
+		sb.WriteString("user")
+		sb.WriteString(strconv.Itoa(i))
+		sb.WriteString(":$6$saltsaltsalt$aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa:18000:0:99999:7:::\n")
+	}
+	withShadowFile(b, sb.String())
+}
+
+func BenchmarkLookup(b *testing.B) {
+	benchShadowFile(b)
+
+	b.ReportAllocs()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		if _, err := Lookup("user" + strconv.Itoa(i%50000)); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
+
+func BenchmarkRead(b *testing.B) {
+	benchShadowFile(b)
+
+	b.ReportAllocs()
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		if _, err := Read(); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
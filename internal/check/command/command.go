@@ -367,14 +367,9 @@ func (s *state) CheckBody(ctx context.Context, hdr textproto.Header, body buffer
 		return module.CheckResult{}
 	}
 
-	defer trace.StartRegion(ctx, "command/CheckBody"+s.c.cmd).End()
-
-	cmdName, cmdArgs := s.expandCommand("")
-
-	var buf bytes.Buffer
-	_ = textproto.WriteHeader(&buf, hdr)
 	bR, err := body.Open()
 	if err != nil {
+		cmdName, cmdArgs := s.expandCommand("")
 		return module.CheckResult{
 			Reason: &exterrors.SMTPError{
 				Code:      450,
@@ -388,6 +383,22 @@ func (s *state) CheckBody(ctx context.Context, hdr textproto.Header, body buffer
 			Reject: true,
 		}
 	}
+	defer bR.Close()
+
+	return s.CheckBodyStream(ctx, hdr, bR, body.Len())
+}
+
+func (s *state) CheckBodyStream(ctx context.Context, hdr textproto.Header, bR io.Reader, _ int) module.CheckResult {
+	if s.c.stage != StageBody {
+		return module.CheckResult{}
+	}
+
+	defer trace.StartRegion(ctx, "command/CheckBody"+s.c.cmd).End()
+
+	cmdName, cmdArgs := s.expandCommand("")
+
+	var buf bytes.Buffer
+	_ = textproto.WriteHeader(&buf, hdr)
 
 	return s.run(cmdName, cmdArgs, io.MultiReader(bytes.NewReader(buf.Bytes()), bR))
 }
@@ -116,32 +116,32 @@ func (d *dkimCheckState) CheckRcpt(ctx context.Context, rcptTo string) module.Ch
 	return module.CheckResult{}
 }
 
-func (d *dkimCheckState) CheckBody(ctx context.Context, header textproto.Header, body buffer.Buffer) module.CheckResult {
-	defer trace.StartRegion(ctx, "check.dkim/CheckBody").End()
+func (d *dkimCheckState) noSignatures() module.CheckResult {
+	if d.c.noSigAction.Reject || d.c.noSigAction.Quarantine {
+		d.log.Printf("no signatures present")
+	} else {
+		d.log.Debugf("no signatures present")
+	}
+	return d.c.noSigAction.Apply(module.CheckResult{
+		Reason: &exterrors.SMTPError{
+			Code:         550,
+			EnhancedCode: exterrors.EnhancedCode{5, 7, 20},
+			Message:      "No DKIM signatures",
+			CheckName:    "check.dkim",
+		},
+		AuthResult: []authres.Result{
+			&authres.DKIMResult{
+				Value: authres.ResultNone,
+			},
+		},
+	})
+}
 
+func (d *dkimCheckState) CheckBody(ctx context.Context, header textproto.Header, body buffer.Buffer) module.CheckResult {
 	if !header.Has("DKIM-Signature") {
-		if d.c.noSigAction.Reject || d.c.noSigAction.Quarantine {
-			d.log.Printf("no signatures present")
-		} else {
-			d.log.Debugf("no signatures present")
-		}
-		return d.c.noSigAction.Apply(module.CheckResult{
-			Reason: &exterrors.SMTPError{
-				Code:         550,
-				EnhancedCode: exterrors.EnhancedCode{5, 7, 20},
-				Message:      "No DKIM signatures",
-				CheckName:    "check.dkim",
-			},
-			AuthResult: []authres.Result{
-				&authres.DKIMResult{
-					Value: authres.ResultNone,
-				},
-			},
-		})
+		return d.noSignatures()
 	}
 
-	b := bytes.Buffer{}
-	_ = textproto.WriteHeader(&b, header)
 	bodyRdr, err := body.Open()
 	if err != nil {
 		return module.CheckResult{
@@ -155,6 +155,20 @@ func (d *dkimCheckState) CheckBody(ctx context.Context, header textproto.Header,
 			),
 		}
 	}
+	defer bodyRdr.Close()
+
+	return d.CheckBodyStream(ctx, header, bodyRdr, body.Len())
+}
+
+func (d *dkimCheckState) CheckBodyStream(ctx context.Context, header textproto.Header, bodyRdr io.Reader, _ int) module.CheckResult {
+	defer trace.StartRegion(ctx, "check.dkim/CheckBody").End()
+
+	if !header.Has("DKIM-Signature") {
+		return d.noSignatures()
+	}
+
+	b := bytes.Buffer{}
+	_ = textproto.WriteHeader(&b, header)
 
 	verifications, err := dkim.VerifyWithOptions(io.MultiReader(&b, bodyRdr), &dkim.VerifyOptions{
 		LookupTXT: func(domain string) ([]string, error) {
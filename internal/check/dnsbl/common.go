@@ -67,7 +67,7 @@ func checkDomain(ctx context.Context, resolver dns.Resolver, cfg List, domain st
 	}
 
 	// Attempt to extract explanation string.
-	txts, err := resolver.LookupTXT(context.Background(), query)
+	txts, err := resolver.LookupTXT(ctx, query)
 	if err != nil || len(txts) == 0 {
 		// Not significant, include addresses as reason. Usually they are
 		// mapped to some predefined 'reasons' by BL.
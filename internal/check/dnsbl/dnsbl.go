@@ -291,6 +291,9 @@ func (bl *DNSBL) checkList(ctx context.Context, list List, ip net.IP, ehlo, mail
 }
 
 func (bl *DNSBL) checkLists(ctx context.Context, ip net.IP, ehlo, mailFrom string) module.CheckResult {
+	ctx, cancel := context.WithCancel(ctx)
+	defer cancel()
+
 	var (
 		eg = errgroup.Group{}
 
@@ -299,24 +302,49 @@ func (bl *DNSBL) checkLists(ctx context.Context, ip net.IP, ehlo, mailFrom strin
 		score    int
 		listedOn []string
 		reasons  []string
+
+		// Sum of negative score adjustments of lists that are not checked
+		// yet. If the score is above the reject threshold even with all of
+		// them applied, the result is known and remaining lookups are
+		// cancelled.
+		pendingNegative int
+		decided         bool
 	)
 
+	for _, list := range bl.bls {
+		if list.ScoreAdj < 0 {
+			pendingNegative += list.ScoreAdj
+		}
+	}
+
 	for _, list := range bl.bls {
 		list := list
 		eg.Go(func() error {
 			err := bl.checkList(ctx, list, ip, ehlo, mailFrom)
+
+			lck.Lock()
+			defer lck.Unlock()
+			if decided {
+				// Lookups were cancelled, errors are expected.
+				return nil
+			}
+			if list.ScoreAdj < 0 {
+				pendingNegative -= list.ScoreAdj
+			}
 			if err != nil {
 				listErr, listed := err.(ListedErr)
 				if !listed {
 					return err
 				}
 
-				lck.Lock()
-				defer lck.Unlock()
 				listedOn = append(listedOn, listErr.List)
 				reasons = append(reasons, listErr.Reason)
 				score += list.ScoreAdj
 			}
+			if score+pendingNegative >= bl.rejectThres {
+				decided = true
+				cancel()
+			}
 			return nil
 		})
 	}
@@ -23,6 +23,8 @@ import (
 	"crypto/tls"
 	"errors"
 	"fmt"
+	"io"
+	"io/ioutil"
 	"net"
 	"time"
 
@@ -386,6 +388,16 @@ func (s *state) CheckRcpt(ctx context.Context, rcptTo string) module.CheckResult
 }
 
 func (s *state) CheckBody(ctx context.Context, header textproto.Header, body buffer.Buffer) module.CheckResult {
+	return s.checkBody(header, body.Open)
+}
+
+func (s *state) CheckBodyStream(ctx context.Context, header textproto.Header, body io.Reader, _ int) module.CheckResult {
+	return s.checkBody(header, func() (io.ReadCloser, error) {
+		return ioutil.NopCloser(body), nil
+	})
+}
+
+func (s *state) checkBody(header textproto.Header, openBody func() (io.ReadCloser, error)) module.CheckResult {
 	if s.skipChecks {
 		return module.CheckResult{}
 	}
@@ -402,7 +414,7 @@ func (s *state) CheckBody(ctx context.Context, header textproto.Header, body buf
 
 	if !s.session.ProtocolOption(milter.OptNoBody) {
 		// body.Open can be expensive for on-disk buffering.
-		r, err := body.Open()
+		r, err := openBody()
 		if err != nil {
 			// Not ioError(err) because fail_open directive is applied only for external I/O.
 			return module.CheckResult{
@@ -421,6 +433,7 @@ func (s *state) CheckBody(ctx context.Context, header textproto.Header, body buf
 		}
 
 		modifyAct, act, err = s.session.BodyReadFrom(r)
+		r.Close()
 		if err != nil {
 			return s.ioError(err)
 		}
@@ -440,8 +453,9 @@ func (s *state) Close() error {
 }
 
 var (
-	_ module.Check      = &Check{}
-	_ module.CheckState = &state{}
+	_ module.Check               = &Check{}
+	_ module.CheckState          = &state{}
+	_ module.StreamingCheckState = &state{}
 )
 
 func init() {
@@ -210,7 +210,12 @@ func (s *state) CheckBody(ctx context.Context, hdr textproto.Header, body buffer
 			Reason: exterrors.WithFields(err, map[string]interface{}{"check": modName}),
 		}
 	}
+	defer bodyR.Close()
 
+	return s.CheckBodyStream(ctx, hdr, bodyR, body.Len())
+}
+
+func (s *state) CheckBodyStream(ctx context.Context, hdr textproto.Header, bodyR io.Reader, bodyLen int) module.CheckResult {
 	var buf bytes.Buffer
 	if err := textproto.WriteHeader(&buf, hdr); err != nil {
 		return module.CheckResult{
@@ -241,7 +246,7 @@ func (s *state) CheckBody(ctx context.Context, hdr textproto.Header, body buffer
 	}
 
 	addConnHeaders(r, s.msgMeta, s.mailFrom, s.rcpt)
-	r.Header.Add("Content-Length", strconv.Itoa(body.Len()))
+	r.Header.Add("Content-Length", strconv.Itoa(bodyLen))
 
 	resp, err := s.c.client.Do(r)
 	if err != nil {
@@ -92,7 +92,7 @@ func (endp *Endpoint) Init(cfg *config.Map) error {
 			return fmt.Errorf("%s: %v", modName, err)
 		}
 
-		l, err := net.Listen(parsed.Network(), parsed.Address())
+		l, err := parsed.Listen()
 		if err != nil {
 			return fmt.Errorf("%s: %v", modName, err)
 		}
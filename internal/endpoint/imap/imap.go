@@ -88,6 +88,7 @@ func (endp *Endpoint) Init(cfg *config.Map) error {
 	cfg.Callback("auth", func(m *config.Map, node config.Node) error {
 		return endp.saslAuth.AddProvider(m, node)
 	})
+	cfg.Custom("auth_ratelimit", false, false, nil, auth.RateLimitDirective, &endp.saslAuth.RateLimit)
 	cfg.Custom("storage", false, true, nil, modconfig.StorageDirective, &endp.Store)
 	cfg.Custom("tls", true, true, nil, tls2.TLSDirective, &endp.tlsConfig)
 	cfg.Bool("insecure_auth", false, false, &insecureAuth)
@@ -162,7 +163,7 @@ func (endp *Endpoint) setupListeners(addresses []config.Endpoint) error {
 	for _, addr := range addresses {
 		var l net.Listener
 		var err error
-		l, err = net.Listen(addr.Network(), addr.Address())
+		l, err = addr.Listen()
 		if err != nil {
 			return fmt.Errorf("imap: %v", err)
 		}
@@ -218,6 +219,7 @@ func (endp *Endpoint) Close() error {
 		return err
 	}
 	endp.listenersWg.Wait()
+	endp.saslAuth.RateLimit.Close()
 	return nil
 }
 
@@ -233,6 +235,11 @@ func (endp *Endpoint) openAccount(c imapserver.Conn, identity string) error {
 }
 
 func (endp *Endpoint) Login(connInfo *imap.ConnInfo, username, password string) (imapbackend.User, error) {
+	if !endp.saslAuth.RateLimit.Allow(connInfo.RemoteAddr, username) {
+		endp.Log.Msg("authentication attempt rate-limited", "username", username, "src_ip", connInfo.RemoteAddr)
+		return nil, auth.ErrRateLimited
+	}
+
 	err := endp.saslAuth.AuthPlain(username, password)
 	if err != nil {
 		endp.Log.Error("authentication failed", err, "username", username, "src_ip", connInfo.RemoteAddr)
@@ -22,6 +22,7 @@ import (
 	"fmt"
 	"net"
 	"net/http"
+	"strconv"
 	"sync"
 
 	"github.com/foxcpp/maddy/framework/config"
@@ -67,6 +68,14 @@ func (e *Endpoint) Init(cfg *config.Map) error {
 		if endp.IsTLS() {
 			return fmt.Errorf("%s: TLS is not supported yet", modName)
 		}
+		if config.WorkerID > 0 {
+			// Each worker process has its own metrics, so they cannot share
+			// the endpoint. Worker N listens on port + N (or path + ".workerN").
+			endp, err = workerEndpoint(endp)
+			if err != nil {
+				return fmt.Errorf("%s: %v", modName, err)
+			}
+		}
 		l, err := net.Listen(endp.Network(), endp.Address())
 		if err != nil {
 			return fmt.Errorf("%s: %v", modName, err)
@@ -85,6 +94,20 @@ func (e *Endpoint) Init(cfg *config.Map) error {
 	return nil
 }
 
+func workerEndpoint(endp config.Endpoint) (config.Endpoint, error) {
+	endp.Original = ""
+	if endp.Network() == "unix" {
+		endp.Path += ".worker" + strconv.Itoa(config.WorkerID)
+		return endp, nil
+	}
+	port, err := strconv.Atoi(endp.Port)
+	if err != nil {
+		return config.Endpoint{}, fmt.Errorf("malformed port: %v", err)
+	}
+	endp.Port = strconv.Itoa(port + config.WorkerID)
+	return endp, nil
+}
+
 func (e *Endpoint) Name() string {
 	return modName
 }
@@ -0,0 +1,133 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package smtp
+
+import (
+	"bytes"
+	"io"
+	"io/ioutil"
+	"os"
+	"strconv"
+	"testing"
+
+	"github.com/foxcpp/maddy/framework/buffer"
+)
+
+func TestAutoBufferMode(t *testing.T) {
+	dir, err := ioutil.TempDir("", "maddy-buffer-")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer func() {
+		if err := os.RemoveAll(dir); err != nil {
+			t.Log(err)
+		}
+	}()
+
+	mode := autoBufferMode(64*1024, dir)
+	for _, size := range []int{0, 100, 64*1024 - 1, 64 * 1024, 200 * 1024} {
+		for _, hint := range []int{0, size, 1024} {
+			blob := bytes.Repeat([]byte{'A'}, size)
+			buf, err := mode(bytes.NewReader(blob), hint)
+			if err != nil {
+				t.Fatal(err)
+			}
+			r, err := buf.Open()
+			if err != nil {
+				t.Fatal(err)
+			}
+			got, err := ioutil.ReadAll(r)
+			if err != nil {
+				t.Fatal(err)
+			}
+			r.Close()
+			if !bytes.Equal(got, blob) || buf.Len() != size {
+				t.Errorf("size %d, hint %d: wrong buffer contents, %d bytes", size, hint, len(got))
+			}
+			if err := buf.Remove(); err != nil {
+				t.Fatal(err)
+			}
+		}
+	}
+}
+
+func TestBufferInMemory_LargeSizeHint(t *testing.T) {
+	// Client may announce a huge SIZE and then send only a few bytes. This
+	// should not make us allocate the announced amount upfront.
+	buf, err := bufferInMemory(bytes.NewReader([]byte("hello")), 32*1024*1024)
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer buf.Remove()
+
+	mem := buf.(buffer.MemoryBuffer)
+	if string(mem.Slice) != "hello" {
+		t.Fatalf("Wrong buffer contents: %q", mem.Slice)
+	}
+	if cap(mem.Slice) > 4*1024*1024 {
+		t.Fatal("Size hint is trusted too much, allocated", cap(mem.Slice), "bytes")
+	}
+}
+
+// BenchmarkBufferBody measures allocations made to buffer the message body
+// received via DATA. Bodies are smaller than the autobuffer limit and so
+// are kept in RAM.
+func BenchmarkBufferBody(b *testing.B) {
+	dir, err := ioutil.TempDir("", "maddy-buffer-")
+	if err != nil {
+		b.Fatal(err)
+	}
+	defer os.RemoveAll(dir)
+	mode := autoBufferMode(1*1024*1024, dir)
+
+	for _, size := range []int{4 * 1024, 64 * 1024, 900 * 1024} {
+		blob := bytes.Repeat([]byte("0123456789abcdef"), size/16)
+
+		b.Run("ReadAll/"+strconv.Itoa(size), func(b *testing.B) {
+			b.ReportAllocs()
+			b.SetBytes(int64(size))
+			for i := 0; i < b.N; i++ {
+				if _, err := ioutil.ReadAll(bytes.NewReader(blob)); err != nil {
+					b.Fatal(err)
+				}
+			}
+		})
+
+		for _, hint := range []int{0, size} {
+			name := "Auto/" + strconv.Itoa(size)
+			if hint != 0 {
+				name += "/SIZE"
+			}
+			b.Run(name, func(b *testing.B) {
+				b.ReportAllocs()
+				b.SetBytes(int64(size))
+				for i := 0; i < b.N; i++ {
+					buf, err := mode(bytes.NewReader(blob), hint)
+					if err != nil {
+						b.Fatal(err)
+					}
+					r, _ := buf.Open()
+					io.Copy(ioutil.Discard, r)
+					r.Close()
+					buf.Remove()
+				}
+			})
+		}
+	}
+}
@@ -387,7 +387,14 @@ func (s *Session) prepareBody(ctx context.Context, r io.Reader) (textproto.Heade
 	// the header size check is done. The message size will be checked by go-smtp
 	limitr.Enabled = false
 
-	buf, err := s.endp.buffer(bufr)
+	// SIZE is the size of the whole message, so it is a bit too big for the
+	// body, that is fine. Do not trust it beyond the message size limit.
+	sizeHint := s.opts.Size
+	if sizeHint > s.endp.serv.MaxMessageBytes {
+		sizeHint = s.endp.serv.MaxMessageBytes
+	}
+
+	buf, err := s.endp.buffer(bufr, sizeHint)
 	if err != nil {
 		return textproto.Header{}, nil, fmt.Errorf("I/O error while writing buffer: %w", err)
 	}
@@ -59,7 +59,9 @@ type Endpoint struct {
 	resolver  dns.Resolver
 	limits    *limits.Group
 
-	buffer func(r io.Reader) (buffer.Buffer, error)
+	// buffer stores the message body. sizeHint is the body size expected
+	// from the SIZE argument, 0 if unknown.
+	buffer func(r io.Reader, sizeHint int) (buffer.Buffer, error)
 
 	authAlwaysRequired  bool
 	submission          bool
@@ -89,7 +91,7 @@ func New(modName string, addrs []string) (module.Module, error) {
 		submission: modName == "submission",
 		lmtp:       modName == "lmtp",
 		resolver:   dns.DefaultResolver(),
-		buffer:     buffer.BufferInMemory,
+		buffer:     bufferInMemory,
 		Log:        log.Logger{Name: modName},
 		saslAuth: auth.SASLAuth{
 			Log: log.Logger{Name: modName + "/sasl"},
@@ -146,34 +148,33 @@ func (endp *Endpoint) Init(cfg *config.Map) error {
 	return nil
 }
 
-func autoBufferMode(maxSize int, dir string) func(io.Reader) (buffer.Buffer, error) {
-	return func(r io.Reader) (buffer.Buffer, error) {
+func bufferInMemory(r io.Reader, sizeHint int) (buffer.Buffer, error) {
+	buf, _, err := buffer.BufferInMemoryLimit(r, sizeHint, -1)
+	if err != nil {
+		return nil, err
+	}
+	return buf, nil
+}
+
+func autoBufferMode(maxSize int, dir string) func(io.Reader, int) (buffer.Buffer, error) {
+	return func(r io.Reader, sizeHint int) (buffer.Buffer, error) {
 		// First try to read up to N bytes.
-		initial := make([]byte, maxSize)
-		actualSize, err := io.ReadFull(r, initial)
+		initial, full, err := buffer.BufferInMemoryLimit(r, sizeHint, maxSize)
 		if err != nil {
-			if err == io.ErrUnexpectedEOF {
-				log.Debugln("autobuffer: keeping the message in RAM (read", actualSize, "bytes, got EOF)")
-				return buffer.MemoryBuffer{Slice: initial[:actualSize]}, nil
-			}
-			if err == io.EOF {
-				// Special case: message with empty body.
-				return buffer.MemoryBuffer{}, nil
-			}
 			// Some I/O error happened, bail out.
 			return nil, err
 		}
-		if actualSize < maxSize {
-			// Ok, the message is smaller than N. Make a MemoryBuffer and
-			// handle it in RAM.
-			log.Debugln("autobuffer: keeping the message in RAM (read", actualSize, "bytes, got short read)")
-			return buffer.MemoryBuffer{Slice: initial[:actualSize]}, nil
+		if !full {
+			// Ok, the message is smaller than N. Handle it in RAM.
+			log.Debugln("autobuffer: keeping the message in RAM (read", initial.Len(), "bytes, got EOF)")
+			return initial, nil
 		}
 
 		log.Debugln("autobuffer: spilling the message to the FS")
 		// The message is big. Dump what we got to the disk and continue writing it there.
+		defer initial.Remove()
 		return buffer.BufferInFile(
-			io.MultiReader(bytes.NewReader(initial[:actualSize]), r),
+			io.MultiReader(bytes.NewReader(initial.Slice), r),
 			dir)
 	}
 }
@@ -187,7 +188,7 @@ func bufferModeDirective(m *config.Map, node config.Node) (interface{}, error) {
 		if len(node.Args) > 1 {
 			return nil, config.NodeErr(node, "no additional arguments for 'ram' mode")
 		}
-		return buffer.BufferInMemory, nil
+		return bufferInMemory, nil
 	case "fs":
 		path := filepath.Join(config.StateDirectory, "buffer")
 		if err := os.MkdirAll(path, 0700); err != nil {
@@ -198,7 +199,7 @@ func bufferModeDirective(m *config.Map, node config.Node) (interface{}, error) {
 			path = node.Args[1]
 			fallthrough
 		case 1:
-			return func(r io.Reader) (buffer.Buffer, error) {
+			return func(r io.Reader, _ int) (buffer.Buffer, error) {
 				return buffer.BufferInFile(r, path)
 			}, nil
 		default:
@@ -242,6 +243,7 @@ func (endp *Endpoint) setConfig(cfg *config.Map) error {
 	cfg.Callback("auth", func(m *config.Map, node config.Node) error {
 		return endp.saslAuth.AddProvider(m, node)
 	})
+	cfg.Custom("auth_ratelimit", false, false, nil, auth.RateLimitDirective, &endp.saslAuth.RateLimit)
 	cfg.String("hostname", true, true, "", &hostname)
 	cfg.Duration("write_timeout", false, false, 1*time.Minute, &endp.serv.WriteTimeout)
 	cfg.Duration("read_timeout", false, false, 10*time.Minute, &endp.serv.ReadTimeout)
@@ -334,7 +336,7 @@ func (endp *Endpoint) setupListeners(addresses []config.Endpoint) error {
 	for _, addr := range addresses {
 		var l net.Listener
 		var err error
-		l, err = net.Listen(addr.Network(), addr.Address())
+		l, err = addr.Listen()
 		if err != nil {
 			return fmt.Errorf("%s: %w", endp.name, err)
 		}
@@ -367,6 +369,17 @@ func (endp *Endpoint) Login(state *smtp.ConnectionState, username, password stri
 		return nil, smtp.ErrAuthUnsupported
 	}
 
+	// Checked before anything else so brute-force attempts are rejected
+	// as cheaply as possible.
+	if !endp.saslAuth.RateLimit.Allow(state.RemoteAddr, username) {
+		endp.Log.Msg("authentication attempt rate-limited", "username", username, "src_ip", state.RemoteAddr)
+		return nil, &smtp.SMTPError{
+			Code:         454,
+			EnhancedCode: smtp.EnhancedCode{4, 7, 0},
+			Message:      "Too many authentication attempts, try again later",
+		}
+	}
+
 	// Executed before authentication and session initialization.
 	if err := endp.pipeline.RunEarlyChecks(context.TODO(), state); err != nil {
 		return nil, endp.wrapErr("", true, "AUTH", err)
@@ -446,6 +459,7 @@ func (endp *Endpoint) newSession(anonymous bool, username, password string, stat
 func (endp *Endpoint) Close() error {
 	endp.serv.Close()
 	endp.listenersWg.Wait()
+	endp.saslAuth.RateLimit.Close()
 	return nil
 }
 
@@ -20,18 +20,51 @@ package limiters
 
 import (
 	"context"
+	"errors"
 	"sync"
 	"time"
 )
 
+// ErrNoBuckets is returned by BucketSet.TakeContext if the set is full and no
+// buckets can be reaped.
+var ErrNoBuckets = errors.New("limiters: too many buckets in use")
+
+const (
+	// bucketShards is the amount of independently locked parts BucketSet
+	// consists of. Should be a power of two.
+	bucketShards = 32
+
+	// reapBatch is the amount of buckets checked for staleness on each
+	// insertion of a new bucket.
+	reapBatch = 4
+)
+
+type bucket struct {
+	r       L
+	lastUse time.Time
+}
+
+type bucketShard struct {
+	mLck sync.Mutex
+	m    map[string]*bucket
+
+	// No bucket in m becomes stale before this time. It is updated by
+	// reapAll so full shards are not scanned again and again while all
+	// buckets are in use.
+	staleAfter time.Time
+}
+
 // BucketSet combines a group of Ls into a single key-indexed structure.
 // Basically, each unique key gets its own counter. The main use case for
 // BucketSet is to apply per-resource rate limiting.
 //
-// Amount of buckets is limited to a certain value. When the size of internal
-// map is around or equal to that value, next Take call will attempt to remove
-// any stale buckets from the group. If it is not possible to do so (all
-// buckets are in active use), Take will return false. Alternatively, in some
+// Keys are distributed between a fixed amount of shards, each with its own
+// lock, so operations on unrelated keys rarely contend.
+//
+// Amount of buckets is limited to a certain value. Stale buckets are removed
+// incrementally: each insertion of a new bucket checks a few existing ones.
+// If the shard is still full, all its buckets are checked. If none of them
+// can be removed (all buckets are in active use), Take will return false. Alternatively, in some
 // rare cases, some other (undefined) waiting Take can return false.
 //
 // A BucksetSet without a New function assigned is no-op: Take and TakeContext
@@ -50,11 +83,7 @@ type BucketSet struct {
 
 	MaxBuckets int
 
-	mLck sync.Mutex
-	m    map[string]*struct {
-		r       L
-		lastUse time.Time
-	}
+	shards [bucketShards]bucketShard
 }
 
 func NewBucketSet(new_ func() L, reapInterval time.Duration, maxBuckets int) *BucketSet {
@@ -62,61 +91,114 @@ func NewBucketSet(new_ func() L, reapInterval time.Duration, maxBuckets int) *Bu
 		New:          new_,
 		ReapInterval: reapInterval,
 		MaxBuckets:   maxBuckets,
-		m: map[string]*struct {
-			r       L
-			lastUse time.Time
-		}{},
 	}
 }
 
 func (r *BucketSet) Close() {
-	r.mLck.Lock()
-	defer r.mLck.Unlock()
+	for i := range r.shards {
+		shard := &r.shards[i]
+		shard.mLck.Lock()
+		for _, v := range shard.m {
+			v.r.Close()
+		}
+		shard.mLck.Unlock()
+	}
+}
+
+func (r *BucketSet) shard(key string) *bucketShard {
+	// FNV-1a, inlined to avoid allocations.
+	h := uint32(2166136261)
+	for i := 0; i < len(key); i++ {
+		h ^= uint32(key[i])
+		h *= 16777619
+	}
+	return &r.shards[h&(bucketShards-1)]
+}
+
+// shardLimit returns the max. amount of buckets in a single shard.
+func (r *BucketSet) shardLimit() int {
+	limit := r.MaxBuckets / bucketShards
+	if limit < 1 {
+		limit = 1
+	}
+	return limit
+}
+
+// reap checks at most n buckets and drops stale ones.
+//
+// shard.mLck should be held by the caller.
+func (r *BucketSet) reap(shard *bucketShard, now time.Time, n int) {
+	// Map iteration starts at a random position so repeated calls
+	// eventually visit all buckets.
+	for k, v := range shard.m {
+		if n == 0 {
+			return
+		}
+		n--
+		if now.Sub(v.lastUse) > r.ReapInterval {
+			// Drop the bucket, if there happen to be any waiting Take for it.
+			// It will return 'false', but this is fine for us since this
+			// whole 'reaping' process will run only when we are under a
+			// high load and dropping random requests in this case is a
+			// more or less reasonable thing to do.
+			v.r.Close()
+			delete(shard.m, k)
+		}
+	}
+}
 
-	for _, v := range r.m {
-		v.r.Close()
+// reapAll drops all stale buckets in the shard.
+//
+// shard.mLck should be held by the caller.
+func (r *BucketSet) reapAll(shard *bucketShard, now time.Time) {
+	var oldest time.Time
+	for k, v := range shard.m {
+		if now.Sub(v.lastUse) > r.ReapInterval {
+			v.r.Close()
+			delete(shard.m, k)
+			continue
+		}
+		if oldest.IsZero() || v.lastUse.Before(oldest) {
+			oldest = v.lastUse
+		}
 	}
+	shard.staleAfter = oldest.Add(r.ReapInterval)
 }
 
 func (r *BucketSet) take(key string) L {
-	r.mLck.Lock()
-	defer r.mLck.Unlock()
-
-	if len(r.m) > r.MaxBuckets {
-		now := time.Now()
-		// Attempt to get rid of stale buckets.
-		for k, v := range r.m {
-			if v.lastUse.Sub(now) > r.ReapInterval {
-				// Drop the bucket, if there happen to be any waiting Take for it.
-				// It will return 'false', but this is fine for us since this
-				// whole 'reaping' process will run only when we are under a
-				// high load and dropping random requests in this case is a
-				// more or less reasonable thing to do.
-				v.r.Close()
-				delete(r.m, k)
-			}
+	shard := r.shard(key)
+	shard.mLck.Lock()
+	defer shard.mLck.Unlock()
+
+	now := time.Now()
+	b, ok := shard.m[key]
+	if ok {
+		b.lastUse = now
+		return b.r
+	}
+
+	if shard.m == nil {
+		shard.m = make(map[string]*bucket)
+	}
+
+	r.reap(shard, now, reapBatch)
+	if len(shard.m) >= r.shardLimit() {
+		if now.After(shard.staleAfter) {
+			r.reapAll(shard, now)
 		}
 
 		// Still full? E.g. all buckets are in use.
-		if len(r.m) > r.MaxBuckets {
+		if len(shard.m) >= r.shardLimit() {
 			return nil
 		}
 	}
 
-	bucket, ok := r.m[key]
-	if !ok {
-		r.m[key] = &struct {
-			r       L
-			lastUse time.Time
-		}{
-			r:       r.New(),
-			lastUse: time.Now(),
-		}
-		bucket = r.m[key]
+	b = &bucket{
+		r:       r.New(),
+		lastUse: now,
 	}
-	r.m[key].lastUse = time.Now()
-
-	return bucket.r
+	shard.m[key] = b
+	return b.r
 }
 
 func (r *BucketSet) Take(key string) bool {
@@ -125,18 +207,51 @@ func (r *BucketSet) Take(key string) bool {
 	}
 
 	bucket := r.take(key)
+	if bucket == nil {
+		return false
+	}
 	return bucket.Take()
 }
 
+// TryTake is a non-blocking version of Take. It also returns false if
+// there is no space for a new bucket.
+func (r *BucketSet) TryTake(key string) bool {
+	if r.New == nil {
+		return true
+	}
+
+	bucket := r.take(key)
+	if bucket == nil {
+		return false
+	}
+	return bucket.TryTake()
+}
+
+// TryTakeTracked is a version of TryTake that distinguishes a failed attempt
+// from missing space for a new bucket. If tracked is false, no limit was
+// applied and ok is false too.
+func (r *BucketSet) TryTakeTracked(key string) (ok, tracked bool) {
+	if r.New == nil {
+		return true, true
+	}
+
+	bucket := r.take(key)
+	if bucket == nil {
+		return false, false
+	}
+	return bucket.TryTake(), true
+}
+
 func (r *BucketSet) Release(key string) {
 	if r.New == nil {
 		return
 	}
 
-	r.mLck.Lock()
-	defer r.mLck.Unlock()
+	shard := r.shard(key)
+	shard.mLck.Lock()
+	defer shard.mLck.Unlock()
 
-	bucket, ok := r.m[key]
+	bucket, ok := shard.m[key]
 	if !ok {
 		return
 	}
@@ -149,5 +264,8 @@ func (r *BucketSet) TakeContext(ctx context.Context, key string) error {
 	}
 
 	bucket := r.take(key)
+	if bucket == nil {
+		return ErrNoBuckets
+	}
 	return bucket.TakeContext(ctx)
 }
@@ -0,0 +1,156 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package limiters
+
+import (
+	"strconv"
+	"sync/atomic"
+	"testing"
+	"time"
+)
+
+func TestBucketSet_Full(t *testing.T) {
+	bs := NewBucketSet(func() L { return NewSemaphore(1) }, time.Hour, bucketShards)
+	defer bs.Close()
+
+	// One bucket per shard is allowed, so some of these keys should be
+	// rejected.
+	rejected := 0
+	for i := 0; i < 4*bucketShards; i++ {
+		if !bs.TryTake(strconv.Itoa(i)) {
+			rejected++
+		}
+	}
+	if rejected == 0 {
+		t.Fatal("MaxBuckets is not enforced")
+	}
+}
+
+func TestBucketSet_Reap(t *testing.T) {
+	bs := NewBucketSet(func() L { return NewSemaphore(1) }, time.Hour, bucketShards)
+	defer bs.Close()
+
+	for i := 0; i < 4*bucketShards; i++ {
+		bs.TryTake(strconv.Itoa(i))
+	}
+
+	// Make all buckets stale.
+	ageBuckets(bs, 2*time.Hour)
+
+	// Shards are full, but a new key should replace a stale bucket in its
+	// shard.
+	seen := map[*bucketShard]bool{}
+	for i := 4 * bucketShards; len(seen) < bucketShards; i++ {
+		key := strconv.Itoa(i)
+		shard := bs.shard(key)
+		if seen[shard] {
+			continue
+		}
+		seen[shard] = true
+		if !bs.TryTake(key) {
+			t.Fatal("Stale bucket not reaped for", key)
+		}
+	}
+}
+
+// ageBuckets simulates the passage of time d for all buckets in the set.
+func ageBuckets(bs *BucketSet, d time.Duration) {
+	for i := range bs.shards {
+		for _, b := range bs.shards[i].m {
+			b.lastUse = b.lastUse.Add(-d)
+		}
+		bs.shards[i].staleAfter = bs.shards[i].staleAfter.Add(-d)
+	}
+}
+
+func TestBucketSet_ReapFullShard(t *testing.T) {
+	const perShard = 64
+	bs := NewBucketSet(func() L { return NewSemaphore(1) }, time.Hour, perShard*bucketShards)
+	defer bs.Close()
+
+	// Keys that all go to the same shard.
+	target := bs.shard("0")
+	var keys []string
+	for i := 0; len(keys) < perShard+2; i++ {
+		key := strconv.Itoa(i)
+		if bs.shard(key) == target {
+			keys = append(keys, key)
+		}
+	}
+
+	for _, key := range keys[:perShard] {
+		if !bs.TryTake(key) {
+			t.Fatal("Shard is full too early")
+		}
+	}
+	if bs.TryTake(keys[perShard]) {
+		t.Fatal("Shard limit is not enforced")
+	}
+
+	// Only one bucket becomes stale, the others are still in use.
+	ageBuckets(bs, 2*time.Hour)
+	for _, key := range keys[1:perShard] {
+		bs.Release(key)
+		bs.TryTake(key)
+	}
+
+	if !bs.TryTake(keys[perShard+1]) {
+		t.Fatal("Stale bucket in a full shard is not reaped")
+	}
+	if _, ok := target.m[keys[0]]; ok {
+		t.Fatal("Wrong bucket is reaped")
+	}
+}
+
+func TestBucketSet_Noop(t *testing.T) {
+	var bs BucketSet
+	if !bs.Take("a") || !bs.TryTake("a") {
+		t.Fatal("no-op BucketSet rejected Take")
+	}
+	bs.Release("a")
+}
+
+func benchmarkBucketSet(b *testing.B, keys int) {
+	names := make([]string, keys)
+	for i := range names {
+		names[i] = "192.0.2." + strconv.Itoa(i)
+	}
+
+	bs := NewBucketSet(func() L { return NewSemaphore(1000) }, time.Minute, 20010)
+	defer bs.Close()
+
+	var ctr uint64
+	b.ReportAllocs()
+	b.ResetTimer()
+	b.RunParallel(func(pb *testing.PB) {
+		for pb.Next() {
+			key := names[atomic.AddUint64(&ctr, 1)%uint64(keys)]
+			if bs.TryTake(key) {
+				bs.Release(key)
+			}
+		}
+	})
+}
+
+func BenchmarkBucketSet(b *testing.B) {
+	b.Run("10k keys", func(b *testing.B) { benchmarkBucketSet(b, 10000) })
+	// Approximates per-IP limits with a large amount of distinct clients,
+	// the set is constantly full.
+	b.Run("200k keys", func(b *testing.B) { benchmarkBucketSet(b, 200000) })
+}
@@ -41,6 +41,20 @@ func (s Semaphore) Take() bool {
 	return true
 }
 
+// TryTake attempts to acquire the semaphore without blocking and reports
+// whether it succeeded.
+func (s Semaphore) TryTake() bool {
+	if cap(s.c) <= 0 {
+		return true
+	}
+	select {
+	case s.c <- struct{}{}:
+		return true
+	default:
+		return false
+	}
+}
+
 func (s Semaphore) TakeContext(ctx context.Context) error {
 	if cap(s.c) <= 0 {
 		return nil
@@ -28,6 +28,11 @@ import "context"
 type L interface {
 	Take() bool
 	TakeContext(context.Context) error
+
+	// TryTake is a non-blocking version of Take. It returns false
+	// immediately if the resource is not available.
+	TryTake() bool
+
 	Release()
 
 	// Close frees any resources used internally by Limiter for book-keeping.
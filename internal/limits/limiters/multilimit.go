@@ -42,6 +42,18 @@ func (ml *MultiLimit) Take() bool {
 	return true
 }
 
+func (ml *MultiLimit) TryTake() bool {
+	for i := 0; i < len(ml.Wrapped); i++ {
+		if !ml.Wrapped[i].TryTake() {
+			for _, l := range ml.Wrapped[:i] {
+				l.Release()
+			}
+			return false
+		}
+	}
+	return true
+}
+
 func (ml *MultiLimit) TakeContext(ctx context.Context) error {
 	for i := 0; i < len(ml.Wrapped); i++ {
 		if err := ml.Wrapped[i].TakeContext(ctx); err != nil {
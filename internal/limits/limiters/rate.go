@@ -21,6 +21,7 @@ package limiters
 import (
 	"context"
 	"errors"
+	"sync"
 	"time"
 )
 
@@ -95,6 +96,19 @@ func (r Rate) Take() bool {
 	return ok
 }
 
+func (r Rate) TryTake() bool {
+	if cap(r.bucket) == 0 {
+		return true
+	}
+
+	select {
+	case _, ok := <-r.bucket:
+		return ok
+	default:
+		return false
+	}
+}
+
 func (r Rate) TakeContext(ctx context.Context) error {
 	if cap(r.bucket) == 0 {
 		return nil
@@ -117,3 +131,111 @@ func (r Rate) Release() {
 func (r Rate) Close() {
 	close(r.stop)
 }
+
+// LazyRate is a token bucket rate-limiter with the same semantics as Rate,
+// but the bucket is refilled lazily on use based on the time of the last
+// refill instead of a background goroutine.
+//
+// It is meant for large sets of buckets (e.g. per-key limits in BucketSet)
+// where a goroutine per bucket is too expensive.
+type LazyRate struct {
+	burstSize int
+	interval  time.Duration
+
+	mu     sync.Mutex
+	tokens int
+	filled time.Time
+	stop   chan struct{}
+	closed bool
+
+	// Used in tests.
+	now func() time.Time
+}
+
+func NewLazyRate(burstSize int, interval time.Duration) *LazyRate {
+	return &LazyRate{
+		burstSize: burstSize,
+		interval:  interval,
+		tokens:    burstSize,
+		filled:    time.Now(),
+		stop:      make(chan struct{}),
+		now:       time.Now,
+	}
+}
+
+// tryTake takes a token if there is one. Otherwise it returns the time to
+// wait until the next refill.
+//
+// mu should be held by the caller.
+func (r *LazyRate) tryTake() (bool, time.Duration) {
+	now := r.now()
+	if elapsed := now.Sub(r.filled); elapsed >= r.interval {
+		r.tokens = r.burstSize
+		r.filled = r.filled.Add(elapsed / r.interval * r.interval)
+	}
+	if r.tokens > 0 {
+		r.tokens--
+		return true, 0
+	}
+	return false, r.filled.Add(r.interval).Sub(now)
+}
+
+func (r *LazyRate) Take() bool {
+	return r.TakeContext(context.Background()) == nil
+}
+
+func (r *LazyRate) TryTake() bool {
+	if r.burstSize == 0 {
+		return true
+	}
+
+	r.mu.Lock()
+	defer r.mu.Unlock()
+	if r.closed {
+		return false
+	}
+	ok, _ := r.tryTake()
+	return ok
+}
+
+func (r *LazyRate) TakeContext(ctx context.Context) error {
+	if r.burstSize == 0 {
+		return nil
+	}
+
+	for {
+		r.mu.Lock()
+		if r.closed {
+			r.mu.Unlock()
+			return ErrClosed
+		}
+		ok, wait := r.tryTake()
+		r.mu.Unlock()
+		if ok {
+			return nil
+		}
+
+		t := time.NewTimer(wait)
+		select {
+		case <-t.C:
+		case <-r.stop:
+			t.Stop()
+			return ErrClosed
+		case <-ctx.Done():
+			t.Stop()
+			return ctx.Err()
+		}
+	}
+}
+
+func (r *LazyRate) Release() {
+}
+
+func (r *LazyRate) Close() {
+	r.mu.Lock()
+	defer r.mu.Unlock()
+	if !r.closed {
+		r.closed = true
+		close(r.stop)
+	}
+}
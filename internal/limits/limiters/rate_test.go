@@ -0,0 +1,75 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package limiters
+
+import (
+	"context"
+	"testing"
+	"time"
+)
+
+func TestLazyRate(t *testing.T) {
+	now := time.Unix(1000, 0)
+	r := NewLazyRate(2, time.Minute)
+	r.filled = now
+	r.now = func() time.Time { return now }
+	defer r.Close()
+
+	if !r.TryTake() || !r.TryTake() {
+		t.Fatal("Burst is not allowed")
+	}
+	if r.TryTake() {
+		t.Fatal("Limit is not enforced")
+	}
+
+	now = now.Add(59 * time.Second)
+	if r.TryTake() {
+		t.Fatal("Bucket is refilled too early")
+	}
+
+	// Unused periods do not accumulate tokens.
+	now = now.Add(5 * time.Minute)
+	for i := 0; i < 2; i++ {
+		if !r.TryTake() {
+			t.Fatal("Bucket is not refilled")
+		}
+	}
+	if r.TryTake() {
+		t.Fatal("Bucket is refilled above the burst size")
+	}
+}
+
+func TestLazyRate_Close(t *testing.T) {
+	r := NewLazyRate(1, time.Hour)
+	if !r.Take() {
+		t.Fatal("Take failed")
+	}
+
+	done := make(chan error, 1)
+	go func() {
+		done <- r.TakeContext(context.Background())
+	}()
+	r.Close()
+	if err := <-done; err != ErrClosed {
+		t.Fatal("Unexpected error:", err)
+	}
+	if r.TryTake() {
+		t.Fatal("TryTake succeeded after Close")
+	}
+}
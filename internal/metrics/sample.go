@@ -0,0 +1,72 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Package metrics contains helpers for latency histograms exported via the
+// openmetrics endpoint.
+package metrics
+
+import (
+	"sync/atomic"
+	"time"
+
+	"github.com/prometheus/client_golang/prometheus"
+)
+
+// LatencyBuckets are histogram buckets for operations on the message
+// handling path. They cover the range from in-memory table lookups (100µs)
+// to slow network checks (~26s).
+var LatencyBuckets = prometheus.ExponentialBuckets(0.0001, 4, 10)
+
+// SampleEvery is the ratio of measured operations for Sampler.
+const SampleEvery = 10
+
+// Sampler selects every SampleEvery-th operation for latency measurement.
+//
+// It is used for per-recipient operations, for which the cost of reading
+// the clock and updating the histogram is noticeable on busy servers. The
+// histogram count should be multiplied by SampleEvery to get the real
+// amount of operations.
+//
+// Each instrumented component should use its own Sampler, otherwise
+// interleaved calls from different components may cause only one of them
+// to be sampled.
+type Sampler struct {
+	cnt uint32
+}
+
+// Sample reports whether the operation should be measured.
+func (s *Sampler) Sample() bool {
+	return atomic.AddUint32(&s.cnt, 1)%SampleEvery == 0
+}
+
+// Start returns the current time if the operation should be measured and
+// zero time otherwise.
+func (s *Sampler) Start() time.Time {
+	if !s.Sample() {
+		return time.Time{}
+	}
+	return time.Now()
+}
+
+// Observe records time elapsed since start unless it is zero.
+func Observe(o prometheus.Observer, start time.Time) {
+	if start.IsZero() {
+		return
+	}
+	o.Observe(time.Since(start).Seconds())
+}
@@ -0,0 +1,52 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package metrics
+
+import (
+	"sync"
+	"testing"
+)
+
+func TestSampler(t *testing.T) {
+	var (
+		s       Sampler
+		wg      sync.WaitGroup
+		lck     sync.Mutex
+		sampled int
+	)
+	for i := 0; i < 10; i++ {
+		wg.Add(1)
+		go func() {
+			defer wg.Done()
+			for j := 0; j < 1000; j++ {
+				if s.Start().IsZero() {
+					continue
+				}
+				lck.Lock()
+				sampled++
+				lck.Unlock()
+			}
+		}()
+	}
+	wg.Wait()
+
+	if sampled != 10*1000/SampleEvery {
+		t.Fatal("Wrong amount of sampled operations:", sampled)
+	}
+}
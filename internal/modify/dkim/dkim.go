@@ -97,8 +97,8 @@ type Modifier struct {
 	instName string
 
 	domains        []string
-	selector       string
-	signers        map[string]crypto.Signer
+	selectors      []string
+	signers        map[string][]selectorKey
 	oversignHeader []string
 	signHeader     []string
 	headerCanon    dkim.Canonicalization
@@ -112,10 +112,16 @@ type Modifier struct {
 	log log.Logger
 }
 
+// selectorKey is a private key published under the selector.
+type selectorKey struct {
+	selector string
+	signer   crypto.Signer
+}
+
 func New(_, instName string, _, inlineArgs []string) (module.Module, error) {
 	m := &Modifier{
 		instName: instName,
-		signers:  map[string]crypto.Signer{},
+		signers:  map[string][]selectorKey{},
 		log:      log.Logger{Name: "modify.dkim"},
 	}
 
@@ -127,7 +133,7 @@ func New(_, instName string, _, inlineArgs []string) (module.Module, error) {
 	}
 
 	m.domains = inlineArgs[0 : len(inlineArgs)-1]
-	m.selector = inlineArgs[len(inlineArgs)-1]
+	m.selectors = []string{inlineArgs[len(inlineArgs)-1]}
 
 	return m, nil
 }
@@ -144,13 +150,13 @@ func (m *Modifier) Init(cfg *config.Map) error {
 	var (
 		hashName        string
 		keyPathTemplate string
-		newKeyAlgo      string
+		newKeyAlgos     []string
 		senderMatch     []string
 	)
 
 	cfg.Bool("debug", true, false, &m.log.Debug)
 	cfg.StringList("domains", false, false, m.domains, &m.domains)
-	cfg.String("selector", false, false, m.selector, &m.selector)
+	cfg.StringList("selector", false, false, m.selectors, &m.selectors)
 	cfg.String("key_path", false, false, "dkim_keys/{domain}_{selector}.key", &keyPathTemplate)
 	cfg.StringList("oversign_fields", false, false, oversignDefault, &m.oversignHeader)
 	cfg.StringList("sign_fields", false, false, signDefault, &m.signHeader)
@@ -163,8 +169,8 @@ func (m *Modifier) Init(cfg *config.Map) error {
 	cfg.Duration("sig_expiry", false, false, 5*Day, &m.sigExpiry)
 	cfg.Enum("hash", false, false,
 		[]string{"sha256"}, "sha256", &hashName)
-	cfg.Enum("newkey_algo", false, false,
-		[]string{"rsa4096", "rsa2048", "ed25519"}, "rsa2048", &newKeyAlgo)
+	cfg.EnumList("newkey_algo", false, false,
+		[]string{"rsa4096", "rsa2048", "ed25519"}, []string{"rsa2048"}, &newKeyAlgos)
 	cfg.EnumList("require_sender_match", false, false,
 		[]string{"envelope", "auth_domain", "auth_user", "off"}, []string{"envelope", "auth"}, &senderMatch)
 	cfg.Bool("allow_multiple_from", false, false, &m.multipleFromOk)
@@ -177,9 +183,12 @@ func (m *Modifier) Init(cfg *config.Map) error {
 	if len(m.domains) == 0 {
 		return errors.New("sign_domain: at least one domain is needed")
 	}
-	if m.selector == "" {
+	if len(m.selectors) == 0 {
 		return errors.New("sign_domain: selector is not specified")
 	}
+	if len(newKeyAlgos) > len(m.selectors) {
+		return errors.New("sign_domain: newkey_algo: more algorithms than selectors")
+	}
 	if m.signSubdomains && len(m.domains) > 1 {
 		return errors.New("sign_domain: only one domain is supported when sign_subdomains is enabled")
 	}
@@ -202,29 +211,40 @@ func (m *Modifier) Init(cfg *config.Map) error {
 			m.log.Printf("warning: unable to convert domain %s to A-labels form, non-EAI messages will not be signed: %v", domain, err)
 		}
 
-		keyValues := strings.NewReplacer("{domain}", domain, "{selector}", m.selector)
-		keyPath := keyValues.Replace(keyPathTemplate)
-
-		signer, newKey, err := m.loadOrGenerateKey(keyPath, newKeyAlgo)
+		normDomain, err := dns.ForLookup(domain)
 		if err != nil {
-			return err
+			return fmt.Errorf("sign_skim: unable to normalize domain %s: %w", domain, err)
 		}
 
-		if newKey {
-			dnsPath := keyPath + ".dns"
-			if filepath.Ext(keyPath) == ".key" {
-				dnsPath = keyPath[:len(keyPath)-4] + ".dns"
+		keys := make([]selectorKey, 0, len(m.selectors))
+		for i, selector := range m.selectors {
+			// The last algorithm is used for all remaining selectors.
+			newKeyAlgo := newKeyAlgos[len(newKeyAlgos)-1]
+			if i < len(newKeyAlgos) {
+				newKeyAlgo = newKeyAlgos[i]
 			}
-			m.log.Printf("generated a new %s keypair, private key is in %s, TXT record with public key is in %s,\n"+
-				"put its contents into TXT record for %s._domainkey.%s to make signing and verification work",
-				newKeyAlgo, keyPath, dnsPath, m.selector, domain)
-		}
 
-		normDomain, err := dns.ForLookup(domain)
-		if err != nil {
-			return fmt.Errorf("sign_skim: unable to normalize domain %s: %w", domain, err)
+			keyValues := strings.NewReplacer("{domain}", domain, "{selector}", selector)
+			keyPath := keyValues.Replace(keyPathTemplate)
+
+			signer, newKey, err := m.loadOrGenerateKey(keyPath, newKeyAlgo)
+			if err != nil {
+				return err
+			}
+
+			if newKey {
+				dnsPath := keyPath + ".dns"
+				if filepath.Ext(keyPath) == ".key" {
+					dnsPath = keyPath[:len(keyPath)-4] + ".dns"
+				}
+				m.log.Printf("generated a new %s keypair, private key is in %s, TXT record with public key is in %s,\n"+
+					"put its contents into TXT record for %s._domainkey.%s to make signing and verification work",
+					newKeyAlgo, keyPath, dnsPath, selector, domain)
+			}
+
+			keys = append(keys, selectorKey{selector: selector, signer: signer})
 		}
-		m.signers[normDomain] = signer
+		m.signers[normDomain] = keys
 	}
 
 	return nil
@@ -302,7 +322,6 @@ func (s *state) RewriteBody(ctx context.Context, h *textproto.Header, body buffe
 	if domain == "" {
 		domain = s.m.domains[0]
 	}
-	selector := s.m.selector
 
 	if s.m.signSubdomains {
 		topDomain := s.m.domains[0]
@@ -315,8 +334,8 @@ func (s *state) RewriteBody(ctx context.Context, h *textproto.Header, body buffe
 		s.log.Error("unable to normalize domain from envelope sender", err, "domain", domain)
 		return nil
 	}
-	keySigner := s.m.signers[normDomain]
-	if keySigner == nil {
+	keys := s.m.signers[normDomain]
+	if len(keys) == 0 {
 		s.log.Msg("no key for domain", "domain", normDomain)
 		return nil
 	}
@@ -329,51 +348,82 @@ func (s *state) RewriteBody(ctx context.Context, h *textproto.Header, body buffe
 		if err != nil {
 			return nil
 		}
+	}
+
+	// With multiple selectors (e.g. RSA and Ed25519 keys), the body is read
+	// once and written to all signers. Each of them hashes it in its own
+	// goroutine, so signatures are computed in parallel.
+	headerKeys := s.m.fieldsToSign(h)
+	signers := make([]*dkim.Signer, 0, len(keys))
+	writers := make([]io.Writer, 0, len(keys))
+	closed := false
+	closeSigners := func() error {
+		closed = true
+		var firstErr error
+		for _, signer := range signers {
+			if err := signer.Close(); err != nil && firstErr == nil {
+				firstErr = err
+			}
+		}
+		return firstErr
+	}
+	defer func() {
+		if !closed {
+			closeSigners()
+		}
+	}()
+	for _, key := range keys {
+		selector := key.selector
+		if !s.meta.SMTPOpts.UTF8 {
+			var err error
+			selector, err = idna.ToASCII(selector)
+			if err != nil {
+				return nil
+			}
+		}
 
-		selector, err = idna.ToASCII(selector)
+		opts := dkim.SignOptions{
+			Domain:                 domain,
+			Selector:               selector,
+			Identifier:             "@" + domain,
+			Signer:                 key.signer,
+			Hash:                   s.m.hash,
+			HeaderCanonicalization: s.m.headerCanon,
+			BodyCanonicalization:   s.m.bodyCanon,
+			HeaderKeys:             headerKeys,
+		}
+		if s.m.sigExpiry != 0 {
+			opts.Expiration = time.Now().Add(s.m.sigExpiry)
+		}
+		signer, err := dkim.NewSigner(&opts)
 		if err != nil {
-			return nil
+			return exterrors.WithFields(err, map[string]interface{}{"modifier": "modify.dkim"})
 		}
+		signers = append(signers, signer)
+		writers = append(writers, signer)
 	}
 
-	opts := dkim.SignOptions{
-		Domain:                 domain,
-		Selector:               selector,
-		Identifier:             "@" + domain,
-		Signer:                 keySigner,
-		Hash:                   s.m.hash,
-		HeaderCanonicalization: s.m.headerCanon,
-		BodyCanonicalization:   s.m.bodyCanon,
-		HeaderKeys:             s.m.fieldsToSign(h),
-	}
-	if s.m.sigExpiry != 0 {
-		opts.Expiration = time.Now().Add(s.m.sigExpiry)
-	}
-	signer, err := dkim.NewSigner(&opts)
-	if err != nil {
-		return exterrors.WithFields(err, map[string]interface{}{"modifier": "modify.dkim"})
-	}
-	if err := textproto.WriteHeader(signer, *h); err != nil {
-		signer.Close()
+	w := io.MultiWriter(writers...)
+	if err := textproto.WriteHeader(w, *h); err != nil {
 		return exterrors.WithFields(err, map[string]interface{}{"modifier": "modify.dkim"})
 	}
 	r, err := body.Open()
 	if err != nil {
-		signer.Close()
 		return exterrors.WithFields(err, map[string]interface{}{"modifier": "modify.dkim"})
 	}
-	if _, err := io.Copy(signer, r); err != nil {
-		signer.Close()
+	defer r.Close()
+	if _, err := io.Copy(w, r); err != nil {
 		return exterrors.WithFields(err, map[string]interface{}{"modifier": "modify.dkim"})
 	}
 
-	if err := signer.Close(); err != nil {
+	if err := closeSigners(); err != nil {
 		return exterrors.WithFields(err, map[string]interface{}{"modifier": "modify.dkim"})
 	}
+	for _, signer := range signers {
+		h.AddRaw([]byte(signer.Signature()))
+	}
 
-	h.AddRaw([]byte(signer.Signature()))
-
-	s.m.log.DebugMsg("signed", "domain", domain)
+	s.m.log.DebugMsg("signed", "domain", domain, "signatures", len(signers))
 
 	return nil
 }
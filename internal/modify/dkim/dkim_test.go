@@ -250,3 +250,65 @@ func TestFieldsToSign(t *testing.T) {
 		t.Errorf("incorrect set of fields to sign\nwant: %v\ngot:  %v", expected, fields)
 	}
 }
+
+func TestMultipleSelectors(t *testing.T) {
+	dir, err := ioutil.TempDir("", "maddy-tests-dkim-")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer os.RemoveAll(dir)
+
+	mod, err := New("", "test", nil, nil)
+	if err != nil {
+		t.Fatal(err)
+	}
+	m := mod.(*Modifier)
+	m.log = testutils.Logger(t, m.Name())
+	err = m.Init(config.NewMap(nil, config.Node{
+		Children: []config.Node{
+			{Name: "domains", Args: []string{"maddy.test"}},
+			{Name: "selector", Args: []string{"rsa", "ed"}},
+			{Name: "key_path", Args: []string{filepath.Join(dir, "{domain}_{selector}.key")}},
+			{Name: "require_sender_match", Args: []string{"off"}},
+			{Name: "newkey_algo", Args: []string{"rsa2048", "ed25519"}},
+		},
+	}))
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	hdr, body := signTestMsg(t, m, "test@maddy.test")
+
+	zones := map[string]mockdns.Zone{}
+	for _, selector := range []string{"rsa", "ed"} {
+		dnsRecord, err := ioutil.ReadFile(filepath.Join(dir, "maddy.test_"+selector+".dns"))
+		if err != nil {
+			t.Fatal(err)
+		}
+		zones[selector+"._domainkey.maddy.test."] = mockdns.Zone{TXT: []string{string(dnsRecord)}}
+	}
+	resolver := &mockdns.Resolver{Zones: zones}
+
+	var fullBody bytes.Buffer
+	if err := textproto.WriteHeader(&fullBody, hdr); err != nil {
+		t.Fatal(err)
+	}
+	fullBody.Write(body)
+
+	verifs, err := dkim.VerifyWithOptions(&fullBody, &dkim.VerifyOptions{
+		LookupTXT: func(domain string) ([]string, error) {
+			return resolver.LookupTXT(context.Background(), domain)
+		},
+	})
+	if err != nil {
+		t.Fatal(err)
+	}
+	if len(verifs) != 2 {
+		t.Fatal("Wrong amount of signatures:", len(verifs))
+	}
+	for _, v := range verifs {
+		if v.Err != nil {
+			t.Errorf("Verification error for %s: %v", v.Domain, v.Err)
+		}
+	}
+}
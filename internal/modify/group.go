@@ -20,6 +20,8 @@ package modify
 
 import (
 	"context"
+	"fmt"
+	"time"
 
 	"github.com/emersion/go-message/textproto"
 	"github.com/foxcpp/maddy/framework/buffer"
@@ -40,6 +42,7 @@ type (
 
 	groupState struct {
 		states []module.ModifierState
+		names  []string
 	}
 )
 
@@ -64,6 +67,14 @@ func (g *Group) InstanceName() string {
 	return g.instName
 }
 
+// modifierName returns the name used to identify the modifier in metrics.
+func modifierName(m module.Modifier) string {
+	if mod, ok := m.(module.Module); ok {
+		return mod.Name() + ":" + mod.InstanceName()
+	}
+	return fmt.Sprintf("%T", m)
+}
+
 func (g Group) ModStateForMsg(ctx context.Context, msgMeta *module.MsgMetadata) (module.ModifierState, error) {
 	gs := groupState{}
 	for _, modifier := range g.Modifiers {
@@ -76,14 +87,17 @@ func (g Group) ModStateForMsg(ctx context.Context, msgMeta *module.MsgMetadata)
 			return nil, err
 		}
 		gs.states = append(gs.states, state)
+		gs.names = append(gs.names, modifierName(modifier))
 	}
 	return gs, nil
 }
 
 func (gs groupState) RewriteSender(ctx context.Context, mailFrom string) (string, error) {
 	var err error
-	for _, state := range gs.states {
+	for i, state := range gs.states {
+		start := time.Now()
 		mailFrom, err = state.RewriteSender(ctx, mailFrom)
+		gs.observe(i, "sender", start)
 		if err != nil {
 			return "", err
 		}
@@ -93,8 +107,16 @@ func (gs groupState) RewriteSender(ctx context.Context, mailFrom string) (string
 
 func (gs groupState) RewriteRcpt(ctx context.Context, rcptTo string) (string, error) {
 	var err error
-	for _, state := range gs.states {
+	// Sampling decision is made once per recipient so all modifiers are
+	// measured for the same recipients.
+	sampled := rcptSampler.Sample()
+	for i, state := range gs.states {
+		var start time.Time
+		if sampled {
+			start = time.Now()
+		}
 		rcptTo, err = state.RewriteRcpt(ctx, rcptTo)
+		gs.observe(i, "rcpt", start)
 		if err != nil {
 			return "", err
 		}
@@ -103,14 +125,26 @@ func (gs groupState) RewriteRcpt(ctx context.Context, rcptTo string) (string, er
 }
 
 func (gs groupState) RewriteBody(ctx context.Context, h *textproto.Header, body buffer.Buffer) error {
-	for _, state := range gs.states {
-		if err := state.RewriteBody(ctx, h, body); err != nil {
+	for i, state := range gs.states {
+		start := time.Now()
+		err := state.RewriteBody(ctx, h, body)
+		gs.observe(i, "body", start)
+		if err != nil {
 			return err
 		}
 	}
 	return nil
 }
 
+// observe records the time spent in the i-th modifier since start unless
+// start is zero.
+func (gs groupState) observe(i int, stage string, start time.Time) {
+	if start.IsZero() {
+		return
+	}
+	modifierDuration.WithLabelValues(gs.names[i], stage).Observe(time.Since(start).Seconds())
+}
+
 func (gs groupState) Close() error {
 	// We still try close all state objects to minimize
 	// resource leaks when Close fails for one object..
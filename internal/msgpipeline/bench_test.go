@@ -42,13 +42,18 @@ func BenchmarkMsgPipelineSimple(b *testing.B) {
 }
 
 func BenchmarkMsgPipelineGlobalChecks(b *testing.B) {
-	testWithCount := func(checksCount int) {
-		b.Run(strconv.Itoa(checksCount), func(b *testing.B) {
+	testWithCount := func(checksCount, rcptsCount int) {
+		b.Run(strconv.Itoa(checksCount)+"x"+strconv.Itoa(rcptsCount), func(b *testing.B) {
 			checks := make([]module.Check, 0, checksCount)
 			for i := 0; i < checksCount; i++ {
 				checks = append(checks, &testutils.Check{InstName: "check_" + strconv.Itoa(i)})
 			}
 
+			rcpts := make([]string, 0, rcptsCount)
+			for i := 0; i < rcptsCount; i++ {
+				rcpts = append(rcpts, "rcpt-"+strconv.Itoa(i)+"@example.org")
+			}
+
 			target := testutils.Target{InstName: "test_target", DiscardMessages: true}
 			d := MsgPipeline{msgpipelineCfg: msgpipelineCfg{
 				globalChecks: checks,
@@ -61,13 +66,16 @@ func BenchmarkMsgPipelineGlobalChecks(b *testing.B) {
 				},
 			}}
 
-			testutils.BenchDelivery(b, &d, "sender@example.org", []string{"rcpt-X@example.org"})
+			testutils.BenchDelivery(b, &d, "sender@example.org", rcpts)
 		})
 	}
 
-	testWithCount(5)
-	testWithCount(10)
-	testWithCount(15)
+	testWithCount(5, 1)
+	testWithCount(10, 1)
+	testWithCount(15, 1)
+	testWithCount(5, 10)
+	testWithCount(15, 10)
+	testWithCount(15, 100)
 }
 
 func BenchmarkMsgPipelineTargets(b *testing.B) {
@@ -0,0 +1,158 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package msgpipeline
+
+import (
+	"context"
+	"io"
+	"sync"
+	"time"
+
+	"github.com/emersion/go-message/textproto"
+	"github.com/foxcpp/maddy/framework/buffer"
+	"github.com/foxcpp/maddy/framework/module"
+)
+
+const bodyStreamChunk = 64 * 1024
+
+// bodyTee reads the message body once and copies it to multiple readers.
+//
+// Each chunk is written to all readers in turn using io.Pipe, so there is a
+// single chunk in flight and the slowest reader sets the pace. Readers that
+// are closed before io.EOF are skipped.
+type bodyTee struct {
+	readers []*io.PipeReader
+	writers []*io.PipeWriter
+}
+
+func newBodyTee(consumers int) *bodyTee {
+	t := &bodyTee{
+		readers: make([]*io.PipeReader, consumers),
+		writers: make([]*io.PipeWriter, consumers),
+	}
+	for i := range t.readers {
+		t.readers[i], t.writers[i] = io.Pipe()
+	}
+	return t
+}
+
+func (t *bodyTee) closeAll(err error) {
+	for _, w := range t.writers {
+		if w != nil {
+			w.CloseWithError(err)
+		}
+	}
+}
+
+func (t *bodyTee) copyFrom(body buffer.Buffer) {
+	r, err := body.Open()
+	if err != nil {
+		t.closeAll(err)
+		return
+	}
+	defer r.Close()
+
+	buf := make([]byte, bodyStreamChunk)
+	alive := len(t.writers)
+	for alive != 0 {
+		n, err := r.Read(buf)
+		if n != 0 {
+			for i, w := range t.writers {
+				if w == nil {
+					continue
+				}
+				if _, err := w.Write(buf[:n]); err != nil {
+					// The reader is closed, nobody is interested in the
+					// rest of the body.
+					t.writers[i] = nil
+					alive--
+				}
+			}
+		}
+		if err == io.EOF {
+			t.closeAll(nil)
+			return
+		}
+		if err != nil {
+			t.closeAll(err)
+			return
+		}
+	}
+}
+
+// runBodyChecks runs CheckBody for all states.
+//
+// If the body is not in memory and there are multiple checks implementing
+// module.StreamingCheckState, the body is read once and streamed to them.
+// Other checks get the buffer as usual and run concurrently with the
+// stream.
+func (cr *checkRunner) runBodyChecks(ctx context.Context, states []*checkState, header textproto.Header, body buffer.Buffer) error {
+	var streaming, rest []int
+	if _, inMemory := body.(buffer.MemoryBuffer); !inMemory {
+		for i, s := range states {
+			if _, ok := s.CheckState.(module.StreamingCheckState); ok {
+				streaming = append(streaming, i)
+			} else {
+				rest = append(rest, i)
+			}
+		}
+	}
+	// Reading the buffer directly is cheaper than a single pipe.
+	if len(streaming) < 2 {
+		return cr.runAndMergeResults(states, func(s *checkState) module.CheckResult {
+			start := time.Now()
+			res := s.CheckBody(ctx, header, body)
+			s.observe("body", start)
+			return res
+		})
+	}
+
+	results := make([]module.CheckResult, len(states))
+	tee := newBodyTee(len(streaming))
+	bodyLen := body.Len()
+
+	// Stream consumers depend on each other's progress and must not wait
+	// for a free checkPool worker, hence dedicated goroutines.
+	var wg sync.WaitGroup
+	wg.Add(len(streaming) + 1)
+	for j, i := range streaming {
+		i, r := i, tee.readers[j]
+		go func() {
+			defer wg.Done()
+			start := time.Now()
+			results[i] = states[i].CheckState.(module.StreamingCheckState).CheckBodyStream(ctx, header, r, bodyLen)
+			states[i].observe("body", start)
+			r.Close()
+		}()
+	}
+	go func() {
+		defer wg.Done()
+		tee.copyFrom(body)
+	}()
+
+	checkPool.run(len(rest), func(j int) {
+		i := rest[j]
+		start := time.Now()
+		results[i] = states[i].CheckBody(ctx, header, body)
+		states[i].observe("body", start)
+	})
+	wg.Wait()
+
+	return cr.mergeResults(results)
+}
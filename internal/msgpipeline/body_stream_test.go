@@ -0,0 +1,126 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package msgpipeline
+
+import (
+	"bytes"
+	"context"
+	"io"
+	"io/ioutil"
+	"testing"
+
+	"github.com/emersion/go-message/textproto"
+	"github.com/foxcpp/maddy/framework/buffer"
+	"github.com/foxcpp/maddy/framework/module"
+	"github.com/foxcpp/maddy/internal/testutils"
+)
+
+// countingBuffer is not a buffer.MemoryBuffer, so the body is streamed.
+type countingBuffer struct {
+	blob  []byte
+	opens int
+}
+
+func (b *countingBuffer) Open() (io.ReadCloser, error) {
+	b.opens++
+	return ioutil.NopCloser(bytes.NewReader(b.blob)), nil
+}
+
+func (b *countingBuffer) Len() int { return len(b.blob) }
+
+func (b *countingBuffer) Remove() error { return nil }
+
+type streamState struct {
+	// Amount of bytes to read, -1 to read everything.
+	limit int
+
+	streamed []byte
+	bodyLen  int
+}
+
+func (s *streamState) CheckConnection(ctx context.Context) module.CheckResult {
+	return module.CheckResult{}
+}
+
+func (s *streamState) CheckSender(ctx context.Context, mailFrom string) module.CheckResult {
+	return module.CheckResult{}
+}
+
+func (s *streamState) CheckRcpt(ctx context.Context, rcptTo string) module.CheckResult {
+	return module.CheckResult{}
+}
+
+func (s *streamState) CheckBody(ctx context.Context, header textproto.Header, body buffer.Buffer) module.CheckResult {
+	panic("CheckBody called for streaming check")
+}
+
+func (s *streamState) CheckBodyStream(ctx context.Context, header textproto.Header, body io.Reader, bodyLen int) module.CheckResult {
+	s.bodyLen = bodyLen
+	var err error
+	if s.limit < 0 {
+		s.streamed, err = ioutil.ReadAll(body)
+	} else {
+		s.streamed, err = ioutil.ReadAll(io.LimitReader(body, int64(s.limit)))
+	}
+	if err != nil {
+		return module.CheckResult{Reject: true, Reason: err}
+	}
+	return module.CheckResult{}
+}
+
+func (s *streamState) Close() error {
+	return nil
+}
+
+func TestCheckRunner_BodyStream(t *testing.T) {
+	body := &countingBuffer{blob: bytes.Repeat([]byte("0123456789abcdef"), 3*bodyStreamChunk/16+5)}
+
+	full1, full2 := &streamState{limit: -1}, &streamState{limit: -1}
+	partial := &streamState{limit: 10}
+	regular := testutils.Check{}
+	regularState, _ := regular.CheckStateForMsg(context.Background(), &module.MsgMetadata{})
+
+	cr := newCheckRunner(&module.MsgMetadata{}, testutils.Logger(t, "msgpipeline"), nil)
+	defer cr.close()
+	states := []*checkState{
+		{CheckState: full1},
+		{CheckState: partial},
+		{CheckState: regularState},
+		{CheckState: full2},
+	}
+
+	if err := cr.runBodyChecks(context.Background(), states, textproto.Header{}, body); err != nil {
+		t.Fatal(err)
+	}
+
+	for _, s := range []*streamState{full1, full2} {
+		if !bytes.Equal(s.streamed, body.blob) || s.bodyLen != len(body.blob) {
+			t.Errorf("Wrong body streamed: %d bytes, len %d", len(s.streamed), s.bodyLen)
+		}
+	}
+	if !bytes.Equal(partial.streamed, body.blob[:10]) {
+		t.Errorf("Wrong body prefix streamed: %q", partial.streamed)
+	}
+	if regular.BodyCalls != 1 {
+		t.Errorf("CheckBody is not called for non-streaming check")
+	}
+	if body.opens != 1 {
+		t.Errorf("Body is read %d times, want 1", body.opens)
+	}
+}
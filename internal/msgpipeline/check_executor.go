@@ -0,0 +1,81 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package msgpipeline
+
+import (
+	"runtime"
+	"sync"
+)
+
+// checkExecutor is a fixed set of goroutines shared by all check runners.
+//
+// Checks are mostly waiting for DNS and other network I/O, so the pool is
+// considerably larger than the amount of CPUs. When all workers are busy
+// the task is executed by the caller, this bounds the amount of goroutines
+// and cannot deadlock.
+type checkExecutor struct {
+	workers int
+	tasks   chan func()
+	start   sync.Once
+}
+
+var checkPool = &checkExecutor{workers: 16 * runtime.NumCPU()}
+
+func (e *checkExecutor) worker() {
+	for task := range e.tasks {
+		task()
+	}
+}
+
+// run calls task(0), ..., task(n-1) concurrently and waits for all of them
+// to complete.
+func (e *checkExecutor) run(n int, task func(i int)) {
+	switch n {
+	case 0:
+		return
+	case 1:
+		task(0)
+		return
+	}
+
+	e.start.Do(func() {
+		e.tasks = make(chan func())
+		for i := 0; i < e.workers; i++ {
+			go e.worker()
+		}
+	})
+
+	var wg sync.WaitGroup
+	wg.Add(n - 1)
+	for i := 0; i < n-1; i++ {
+		i := i
+		t := func() {
+			task(i)
+			wg.Done()
+		}
+		select {
+		case e.tasks <- t:
+		default:
+			t()
+		}
+	}
+	// The caller would wait anyway, let it do something useful.
+	task(n - 1)
+	wg.Wait()
+}
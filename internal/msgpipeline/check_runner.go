@@ -20,7 +20,7 @@ package msgpipeline
 
 import (
 	"context"
-	"sync"
+	"time"
 
 	"github.com/emersion/go-message/textproto"
 	"github.com/emersion/go-msgauth/authres"
@@ -39,9 +39,7 @@ type checkRunner struct {
 	mailFrom         string
 	mailFromReceived bool
 
-	checkedRcpts         []string
-	checkedRcptsPerCheck map[module.CheckState]map[string]struct{}
-	checkedRcptsLock     sync.Mutex
+	checkedRcpts []string
 
 	resolver      dns.Resolver
 	doDMARC       bool
@@ -50,26 +48,97 @@ type checkRunner struct {
 
 	log log.Logger
 
-	states map[module.Check]module.CheckState
+	states map[module.Check]*checkState
 
 	mergedRes module.CheckResult
 }
 
+// checkState is the check state object along with the recipients that are
+// already passed to it.
+//
+// runAndMergeResults runs each state at most once at a time and calls are
+// not concurrent, so checkedRcpts needs no locking.
+type checkState struct {
+	module.CheckState
+	name         string
+	checkedRcpts map[string]struct{}
+}
+
+// observe records the time spent in the check since start unless start is
+// zero.
+func (s *checkState) observe(stage string, start time.Time) {
+	if start.IsZero() {
+		return
+	}
+	checkDuration.WithLabelValues(s.name, stage).Observe(time.Since(start).Seconds())
+}
+
 func newCheckRunner(msgMeta *module.MsgMetadata, log log.Logger, r dns.Resolver) *checkRunner {
 	return &checkRunner{
-		msgMeta:              msgMeta,
-		checkedRcptsPerCheck: map[module.CheckState]map[string]struct{}{},
-		log:                  log,
-		resolver:             r,
-		dmarcVerify:          dmarc.NewVerifier(r),
-		states:               make(map[module.Check]module.CheckState),
+		msgMeta:     msgMeta,
+		log:         log,
+		resolver:    r,
+		dmarcVerify: dmarc.NewVerifier(r),
+		states:      make(map[module.Check]*checkState),
+	}
+}
+
+// checkRcptOnce calls CheckRcpt for each recipient not yet seen by the
+// state. Results are merged, the first rejection stops the loop.
+//
+// Calls are timed if sampled is set.
+func (cr *checkRunner) checkRcptOnce(ctx context.Context, s *checkState, rcpts []string, sampled bool) module.CheckResult {
+	var res module.CheckResult
+	for _, rcpt := range rcpts {
+		// Avoid calling CheckRcpt for the same recipient for the same check
+		// multiple times, even if requested.
+		if _, ok := s.checkedRcpts[rcpt]; ok {
+			continue
+		}
+		s.checkedRcpts[rcpt] = struct{}{}
+
+		var start time.Time
+		if sampled {
+			start = time.Now()
+		}
+		rcptRes := s.CheckRcpt(ctx, rcpt)
+		s.observe("rcpt", start)
+		if len(rcpts) == 1 {
+			return rcptRes
+		}
+
+		res.AuthResult = append(res.AuthResult, rcptRes.AuthResult...)
+		for field := rcptRes.Header.Fields(); field.Next(); {
+			formatted, err := field.Raw()
+			if err != nil {
+				cr.log.Error("malformed header field added by check", err)
+			}
+			res.Header.AddRaw(formatted)
+		}
+		switch {
+		case rcptRes.Reject:
+			// Rejection takes priority over quarantine of earlier
+			// recipients.
+			res.Quarantine = false
+			res.Reject = true
+			res.Reason = rcptRes.Reason
+			return res
+		case rcptRes.Quarantine:
+			if !res.Quarantine {
+				res.Quarantine = true
+				res.Reason = rcptRes.Reason
+			}
+		case rcptRes.Reason != nil:
+			cr.log.Error("no check action", rcptRes.Reason)
+		}
 	}
+	return res
 }
 
-func (cr *checkRunner) checkStates(ctx context.Context, checks []module.Check) ([]module.CheckState, error) {
-	states := make([]module.CheckState, 0, len(checks))
-	newStates := make([]module.CheckState, 0, len(checks))
-	newStatesMap := make(map[module.Check]module.CheckState, len(checks))
+func (cr *checkRunner) checkStates(ctx context.Context, checks []module.Check) ([]*checkState, error) {
+	states := make([]*checkState, 0, len(checks))
+	newStates := make([]*checkState, 0, len(checks))
+	newStatesMap := make(map[module.Check]*checkState, len(checks))
 	closeStates := func() {
 		for _, state := range states {
 			state.Close()
@@ -84,11 +153,16 @@ func (cr *checkRunner) checkStates(ctx context.Context, checks []module.Check) (
 		}
 
 		cr.log.Debugf("initializing state for %v (%p)", objectName(check), check)
-		state, err := check.CheckStateForMsg(ctx, cr.msgMeta)
+		checkSt, err := check.CheckStateForMsg(ctx, cr.msgMeta)
 		if err != nil {
 			closeStates()
 			return nil, err
 		}
+		state = &checkState{
+			CheckState:   checkSt,
+			name:         objectName(check),
+			checkedRcpts: make(map[string]struct{}, len(cr.checkedRcpts)),
+		}
 		states = append(states, state)
 		newStates = append(newStates, state)
 		newStatesMap[check] = state
@@ -104,16 +178,20 @@ func (cr *checkRunner) checkStates(ctx context.Context, checks []module.Check) (
 	// Done outside of check loop above to make sure we can run these for multiple
 	// checks in parallel.
 	if cr.mailFromReceived {
-		err := cr.runAndMergeResults(newStates, func(s module.CheckState) module.CheckResult {
+		err := cr.runAndMergeResults(newStates, func(s *checkState) module.CheckResult {
+			start := time.Now()
 			res := s.CheckConnection(ctx)
+			s.observe("connection", start)
 			return res
 		})
 		if err != nil {
 			closeStates()
 			return nil, err
 		}
-		err = cr.runAndMergeResults(newStates, func(s module.CheckState) module.CheckResult {
+		err = cr.runAndMergeResults(newStates, func(s *checkState) module.CheckResult {
+			start := time.Now()
 			res := s.CheckSender(ctx, cr.mailFrom)
+			s.observe("sender", start)
 			return res
 		})
 		if err != nil {
@@ -123,29 +201,13 @@ func (cr *checkRunner) checkStates(ctx context.Context, checks []module.Check) (
 	}
 
 	if len(cr.checkedRcpts) != 0 {
-		for _, rcpt := range cr.checkedRcpts {
-			rcpt := rcpt
-			err := cr.runAndMergeResults(states, func(s module.CheckState) module.CheckResult {
-				// Avoid calling CheckRcpt for the same recipient for the same check
-				// multiple times, even if requested.
-				cr.checkedRcptsLock.Lock()
-				if _, ok := cr.checkedRcptsPerCheck[s][rcpt]; ok {
-					cr.checkedRcptsLock.Unlock()
-					return module.CheckResult{}
-				}
-				if cr.checkedRcptsPerCheck[s] == nil {
-					cr.checkedRcptsPerCheck[s] = make(map[string]struct{})
-				}
-				cr.checkedRcptsPerCheck[s][rcpt] = struct{}{}
-				cr.checkedRcptsLock.Unlock()
-
-				res := s.CheckRcpt(ctx, rcpt)
-				return res
-			})
-			if err != nil {
-				closeStates()
-				return nil, err
-			}
+		sampled := rcptSampler.Sample()
+		err := cr.runAndMergeResults(newStates, func(s *checkState) module.CheckResult {
+			return cr.checkRcptOnce(ctx, s, cr.checkedRcpts, sampled)
+		})
+		if err != nil {
+			closeStates()
+			return nil, err
 		}
 	}
 
@@ -158,73 +220,54 @@ func (cr *checkRunner) checkStates(ctx context.Context, checks []module.Check) (
 	return states, nil
 }
 
-func (cr *checkRunner) runAndMergeResults(states []module.CheckState, runner func(module.CheckState) module.CheckResult) error {
-	data := struct {
-		authResLock sync.Mutex
-		headerLock  sync.Mutex
-
-		quarantineErr    error
-		quarantineCheck  string
-		setQuarantineErr sync.Once
-
-		rejectErr    error
-		rejectCheck  string
-		setRejectErr sync.Once
-
-		wg sync.WaitGroup
-	}{}
-
-	for _, state := range states {
-		state := state
-		data.wg.Add(1)
-		go func() {
-			subCheckRes := runner(state)
-
-			// We check the length because we don't want to take locks
-			// when it is not necessary.
-			if len(subCheckRes.AuthResult) != 0 {
-				data.authResLock.Lock()
-				cr.mergedRes.AuthResult = append(cr.mergedRes.AuthResult, subCheckRes.AuthResult...)
-				data.authResLock.Unlock()
-			}
-			if subCheckRes.Header.Len() != 0 {
-				data.headerLock.Lock()
-				for field := subCheckRes.Header.Fields(); field.Next(); {
-					formatted, err := field.Raw()
-					if err != nil {
-						cr.log.Error("malformed header field added by check", err)
-					}
-					cr.mergedRes.Header.AddRaw(formatted)
-				}
-				data.headerLock.Unlock()
-			}
+// runAndMergeResults runs the runner for all states using checkPool and
+// merges results into cr.mergedRes.
+//
+// Results are stored per state and merged after all checks complete, so
+// no locking is needed and the order of added header fields and
+// authentication results does not depend on timing.
+func (cr *checkRunner) runAndMergeResults(states []*checkState, runner func(*checkState) module.CheckResult) error {
+	results := make([]module.CheckResult, len(states))
+	checkPool.run(len(states), func(i int) {
+		results[i] = runner(states[i])
+	})
+	return cr.mergeResults(results)
+}
 
-			if subCheckRes.Quarantine {
-				data.setQuarantineErr.Do(func() {
-					data.quarantineErr = subCheckRes.Reason
-				})
-			} else if subCheckRes.Reject {
-				data.setRejectErr.Do(func() {
-					data.rejectErr = subCheckRes.Reason
-				})
-			} else if subCheckRes.Reason != nil {
-				// 'action ignore' case. There is Reason, but action.Apply set
-				// both Reject and Quarantine to false. Log the reason for
-				// purposes of deployment testing.
-				cr.log.Error("no check action", subCheckRes.Reason)
+func (cr *checkRunner) mergeResults(results []module.CheckResult) error {
+	var quarantineErr, rejectErr error
+	for _, subCheckRes := range results {
+		cr.mergedRes.AuthResult = append(cr.mergedRes.AuthResult, subCheckRes.AuthResult...)
+		for field := subCheckRes.Header.Fields(); field.Next(); {
+			formatted, err := field.Raw()
+			if err != nil {
+				cr.log.Error("malformed header field added by check", err)
 			}
+			cr.mergedRes.Header.AddRaw(formatted)
+		}
 
-			data.wg.Done()
-		}()
+		if subCheckRes.Reject {
+			if rejectErr == nil {
+				rejectErr = subCheckRes.Reason
+			}
+		} else if subCheckRes.Quarantine {
+			if quarantineErr == nil {
+				quarantineErr = subCheckRes.Reason
+			}
+		} else if subCheckRes.Reason != nil {
+			// 'action ignore' case. There is Reason, but action.Apply set
+			// both Reject and Quarantine to false. Log the reason for
+			// purposes of deployment testing.
+			cr.log.Error("no check action", subCheckRes.Reason)
+		}
 	}
 
-	data.wg.Wait()
-	if data.rejectErr != nil {
-		return data.rejectErr
+	if rejectErr != nil {
+		return rejectErr
 	}
 
-	if data.quarantineErr != nil {
-		cr.log.Error("quarantined", data.quarantineErr)
+	if quarantineErr != nil {
+		cr.log.Error("quarantined", quarantineErr)
 		cr.mergedRes.Quarantine = true
 	}
 
@@ -246,20 +289,12 @@ func (cr *checkRunner) checkRcpt(ctx context.Context, checks []module.Check, rcp
 		return err
 	}
 
-	err = cr.runAndMergeResults(states, func(s module.CheckState) module.CheckResult {
-		cr.checkedRcptsLock.Lock()
-		if _, ok := cr.checkedRcptsPerCheck[s][rcptTo]; ok {
-			cr.checkedRcptsLock.Unlock()
-			return module.CheckResult{}
-		}
-		if cr.checkedRcptsPerCheck[s] == nil {
-			cr.checkedRcptsPerCheck[s] = make(map[string]struct{})
-		}
-		cr.checkedRcptsPerCheck[s][rcptTo] = struct{}{}
-		cr.checkedRcptsLock.Unlock()
-
-		res := s.CheckRcpt(ctx, rcptTo)
-		return res
+	// Sampling decision is made once per recipient so all checks are
+	// measured for the same recipients.
+	rcpts := []string{rcptTo}
+	sampled := rcptSampler.Sample()
+	err = cr.runAndMergeResults(states, func(s *checkState) module.CheckResult {
+		return cr.checkRcptOnce(ctx, s, rcpts, sampled)
 	})
 
 	cr.checkedRcpts = append(cr.checkedRcpts, rcptTo)
@@ -277,10 +312,7 @@ func (cr *checkRunner) checkBody(ctx context.Context, checks []module.Check, hea
 		cr.didDMARCFetch = true
 	}
 
-	return cr.runAndMergeResults(states, func(s module.CheckState) module.CheckResult {
-		res := s.CheckBody(ctx, header, body)
-		return res
-	})
+	return cr.runBodyChecks(ctx, states, header, body)
 }
 
 func (cr *checkRunner) applyResults(hostname string, header *textproto.Header) error {
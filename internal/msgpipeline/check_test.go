@@ -19,6 +19,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 package msgpipeline
 
 import (
+	"context"
 	"errors"
 	"testing"
 
@@ -446,3 +447,33 @@ func TestMsgPipeline_RcptCheck_Errors(t *testing.T) {
 			check_.UnclosedStates, sourceCheck.UnclosedStates, globalCheck.UnclosedStates)
 	}
 }
+
+type perRcptState struct {
+	module.CheckState
+	res map[string]module.CheckResult
+}
+
+func (s perRcptState) CheckRcpt(_ context.Context, rcptTo string) module.CheckResult {
+	return s.res[rcptTo]
+}
+
+func TestCheckRunner_RcptRejectAfterQuarantine(t *testing.T) {
+	rejectErr := errors.New("reject")
+	cr := &checkRunner{log: testutils.Logger(t, "msgpipeline")}
+	s := &checkState{
+		CheckState: perRcptState{res: map[string]module.CheckResult{
+			"rcpt1@example.com": {Quarantine: true, Reason: errors.New("quarantine")},
+			"rcpt2@example.com": {Reject: true, Reason: rejectErr},
+		}},
+		name:         "test_check",
+		checkedRcpts: map[string]struct{}{},
+	}
+
+	res := cr.checkRcptOnce(context.Background(), s, []string{"rcpt1@example.com", "rcpt2@example.com"}, false)
+	if err := cr.mergeResults([]module.CheckResult{res}); err != rejectErr {
+		t.Fatalf("expected rejection, got %v", err)
+	}
+	if cr.mergedRes.Quarantine {
+		t.Fatal("message is quarantined instead of being rejected")
+	}
+}
@@ -18,7 +18,10 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 package msgpipeline
 
-import "github.com/prometheus/client_golang/prometheus"
+import (
+	"github.com/foxcpp/maddy/internal/metrics"
+	"github.com/prometheus/client_golang/prometheus"
+)
 
 var (
 	checkReject = prometheus.NewCounterVec(
@@ -39,9 +42,23 @@ var (
 		},
 		[]string{"check"},
 	)
+	checkDuration = prometheus.NewHistogramVec(
+		prometheus.HistogramOpts{
+			Namespace: "maddy",
+			Subsystem: "check",
+			Name:      "duration_seconds",
+			Help:      "Time spent in a check per message handling stage (only a sample of per-recipient calls is measured)",
+			Buckets:   metrics.LatencyBuckets,
+		},
+		[]string{"check", "stage"},
+	)
 )
 
+// rcptSampler selects recipients for which CheckRcpt calls are timed.
+var rcptSampler metrics.Sampler
+
 func init() {
 	prometheus.MustRegister(checkReject)
 	prometheus.MustRegister(checkQuarantined)
+	prometheus.MustRegister(checkDuration)
 }
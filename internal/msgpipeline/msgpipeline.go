@@ -20,6 +20,7 @@ package msgpipeline
 
 import (
 	"context"
+	"time"
 
 	"github.com/emersion/go-message/textproto"
 	"github.com/emersion/go-smtp"
@@ -105,6 +106,10 @@ func (d *MsgPipeline) RunEarlyChecks(ctx context.Context, state *smtp.Connection
 		}
 
 		eg.Go(func() error {
+			start := time.Now()
+			defer func() {
+				checkDuration.WithLabelValues(objectName(earlyCheck), "early").Observe(time.Since(start).Seconds())
+			}()
 			return earlyCheck.CheckConnection(checkCtx, state)
 		})
 	}
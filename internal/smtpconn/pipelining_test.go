@@ -0,0 +1,235 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package smtpconn
+
+import (
+	"bufio"
+	"bytes"
+	"context"
+	"io"
+	"net"
+	"strconv"
+	"strings"
+	"testing"
+	"testing/iotest"
+	"time"
+
+	"github.com/emersion/go-message/textproto"
+	"github.com/emersion/go-smtp"
+	"github.com/foxcpp/maddy/framework/config"
+	"github.com/foxcpp/maddy/framework/exterrors"
+	"github.com/foxcpp/maddy/internal/testutils"
+)
+
+// scriptedServer accepts a single connection and answers RCPT commands only
+// after all of them are received, so the test deadlocks (and times out) if
+// the client does not pipeline them.
+func scriptedServer(t *testing.T, l net.Listener, rcpts int, rejectRcpt int, data chan<- []byte) {
+	conn, err := l.Accept()
+	if err != nil {
+		t.Error(err)
+		close(data)
+		return
+	}
+	defer conn.Close()
+	conn.SetDeadline(time.Now().Add(5 * time.Second))
+
+	r := bufio.NewReader(conn)
+	readLine := func() string {
+		line, err := r.ReadString('\n')
+		if err != nil {
+			t.Error("Server read:", err)
+		}
+		return strings.TrimRight(line, "\r\n")
+	}
+	write := func(s string) {
+		if _, err := io.WriteString(conn, s); err != nil {
+			t.Error("Server write:", err)
+		}
+	}
+
+	write("220 mx.example.org ESMTP\r\n")
+	readLine() // EHLO
+	write("250-mx.example.org\r\n250-PIPELINING\r\n250-CHUNKING\r\n250 8BITMIME\r\n")
+	readLine() // MAIL
+	write("250 OK\r\n")
+
+	for i := 0; i < rcpts; i++ {
+		if line := readLine(); !strings.HasPrefix(line, "RCPT TO:") {
+			t.Errorf("Unexpected command: %s", line)
+		}
+	}
+	for i := 0; i < rcpts; i++ {
+		if i == rejectRcpt {
+			write("550 5.1.1 No such user\r\n")
+			continue
+		}
+		write("250 OK\r\n")
+	}
+
+	var msg bytes.Buffer
+	for {
+		fields := strings.Fields(readLine())
+		if len(fields) < 2 || fields[0] != "BDAT" {
+			t.Errorf("Unexpected command: %v", fields)
+			break
+		}
+		size, err := strconv.Atoi(fields[1])
+		if err != nil {
+			t.Error(err)
+			break
+		}
+		if _, err := io.CopyN(&msg, r, int64(size)); err != nil {
+			t.Error(err)
+			break
+		}
+		write("250 OK\r\n")
+		if len(fields) == 3 && fields[2] == "LAST" {
+			break
+		}
+	}
+	data <- msg.Bytes()
+
+	readLine() // QUIT
+	write("221 Bye\r\n")
+}
+
+func TestPipeliningChunking(t *testing.T) {
+	l, err := net.Listen("tcp", "127.0.0.1:"+testPort)
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer l.Close()
+
+	data := make(chan []byte, 1)
+	go scriptedServer(t, l, 3, 1, data)
+
+	c := New()
+	c.Log = testutils.Logger(t, "smtpconn")
+	c.UsePipelining = true
+	c.UseChunking = true
+	if _, err := c.Connect(context.Background(), config.Endpoint{
+		Scheme: "tcp",
+		Host:   "127.0.0.1",
+		Port:   testPort,
+	}, false, nil); err != nil {
+		t.Fatal(err)
+	}
+	defer c.Close()
+
+	if !c.CanPipeline() {
+		t.Fatal("PIPELINING is not detected")
+	}
+	if err := c.Mail(context.Background(), "test@example.org", smtp.MailOptions{}); err != nil {
+		t.Fatal(err)
+	}
+	errs := c.RcptMany(context.Background(), []string{"rcpt1@example.org", "rcpt2@example.org", "rcpt3@example.org"})
+	if errs[0] != nil || errs[2] != nil {
+		t.Fatal("Unexpected errors:", errs)
+	}
+	smtpErr, ok := errs[1].(*exterrors.SMTPError)
+	if !ok || smtpErr.Code != 550 || smtpErr.EnhancedCode != (exterrors.EnhancedCode{5, 1, 1}) {
+		t.Fatalf("Wrong error for rejected recipient: %#v", errs[1])
+	}
+	if rcpts := c.Rcpts(); len(rcpts) != 2 {
+		t.Fatal("Wrong accepted recipients:", rcpts)
+	}
+
+	// Large enough to be split into multiple chunks.
+	body := bytes.Repeat([]byte("0123456789abcde\r\n"), 3*bdatChunkSize/16)
+	hdr := textproto.Header{}
+	hdr.Add("Subject", "test")
+	if err := c.Data(context.Background(), hdr, bytes.NewReader(body)); err != nil {
+		t.Fatal(err)
+	}
+
+	got := <-data
+	if !bytes.HasPrefix(got, []byte("Subject: test\r\n\r\n")) || !bytes.HasSuffix(got, body) ||
+		len(got) != len("Subject: test\r\n\r\n")+len(body) {
+		t.Errorf("Wrong message received, %d bytes", len(got))
+	}
+}
+
+func TestPipelining_LineBreakInAddress(t *testing.T) {
+	l, err := net.Listen("tcp", "127.0.0.1:"+testPort)
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer l.Close()
+
+	data := make(chan []byte, 1)
+	go scriptedServer(t, l, 1, -1, data)
+
+	c := New()
+	c.Log = testutils.Logger(t, "smtpconn")
+	c.UsePipelining = true
+	c.UseChunking = true
+	if _, err := c.Connect(context.Background(), config.Endpoint{
+		Scheme: "tcp",
+		Host:   "127.0.0.1",
+		Port:   testPort,
+	}, false, nil); err != nil {
+		t.Fatal(err)
+	}
+	defer c.Close()
+
+	if err := c.Mail(context.Background(), "test@example.org", smtp.MailOptions{}); err != nil {
+		t.Fatal(err)
+	}
+	errs := c.RcptMany(context.Background(), []string{"rcpt1@example.org", "rcpt2@example.org>\r\nRSET\r\nRCPT TO:<rcpt3@example.org"})
+	if errs[0] != nil {
+		t.Fatal("Unexpected error:", errs[0])
+	}
+	smtpErr, ok := errs[1].(*exterrors.SMTPError)
+	if !ok || smtpErr.Code != 553 {
+		t.Fatalf("Address with line breaks is not rejected: %#v", errs[1])
+	}
+	if rcpts := c.Rcpts(); len(rcpts) != 1 {
+		t.Fatal("Wrong accepted recipients:", rcpts)
+	}
+
+	hdr := textproto.Header{}
+	hdr.Add("Subject", "test")
+	if err := c.Data(context.Background(), hdr, strings.NewReader("test\r\n")); err != nil {
+		t.Fatal(err)
+	}
+	<-data
+}
+
+func TestCRLFReader(t *testing.T) {
+	for _, c := range []struct {
+		in, out string
+	}{
+		{"", ""},
+		{"a\r\nb\r\n", "a\r\nb\r\n"},
+		{"a\nb\n", "a\r\nb\r\n"},
+		{"a\r\nb\nc", "a\r\nb\r\nc\r\n"},
+		{"a\rb\r", "a\rb\r\n"},
+		{"\n\n", "\r\n\r\n"},
+	} {
+		// 1-byte reads check that state is kept between calls.
+		out, err := io.ReadAll(iotest.OneByteReader(newCRLFReader(strings.NewReader(c.in))))
+		if err != nil {
+			t.Fatal(err)
+		}
+		if string(out) != c.out {
+			t.Errorf("%q: got %q, want %q", c.in, out, c.out)
+		}
+	}
+}
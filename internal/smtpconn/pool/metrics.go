@@ -0,0 +1,57 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package pool
+
+import "github.com/prometheus/client_golang/prometheus"
+
+var poolHits = prometheus.NewCounterVec(
+	prometheus.CounterOpts{
+		Namespace: "maddy",
+		Subsystem: "smtpconn_pool",
+		Name:      "hits",
+		Help:      "Connections taken from the pool",
+	},
+	[]string{"module"},
+)
+
+var poolMisses = prometheus.NewCounterVec(
+	prometheus.CounterOpts{
+		Namespace: "maddy",
+		Subsystem: "smtpconn_pool",
+		Name:      "misses",
+		Help:      "Get calls that found no idle connection in the pool",
+	},
+	[]string{"module"},
+)
+
+var poolEvictions = prometheus.NewCounterVec(
+	prometheus.CounterOpts{
+		Namespace: "maddy",
+		Subsystem: "smtpconn_pool",
+		Name:      "evictions",
+		Help:      "Connections closed by the pool because they expired, failed the health check or did not fit",
+	},
+	[]string{"module"},
+)
+
+func init() {
+	prometheus.MustRegister(poolHits)
+	prometheus.MustRegister(poolMisses)
+	prometheus.MustRegister(poolEvictions)
+}
@@ -20,11 +20,17 @@ package pool
 
 import (
 	"context"
+	"hash/fnv"
 	"sync"
 	"time"
+
+	"github.com/prometheus/client_golang/prometheus"
 )
 
 type Conn interface {
+	// Usable checks whether the idle connection is still alive (e.g. by
+	// sending NOOP). It is called only by the background reaper, never
+	// on Get.
 	Usable() bool
 	Close() error
 }
@@ -35,18 +41,56 @@ type Config struct {
 	MaxConnsPerKey      int
 	MaxConnLifetimeSec  int64
 	StaleKeyLifetimeSec int64
+
+	// Idle connections are checked using Conn.Usable if they were not
+	// used or checked for that long. Zero disables checks.
+	ProbeIntervalSec int64
+
+	// Value of the 'module' label for pool metrics.
+	Name string
+}
+
+const (
+	shardCount = 32
+
+	// How often idle connections are reaped and probed.
+	reapInterval = 10 * time.Second
+)
+
+type idleConn struct {
+	c Conn
+	// Unix timestamps, to keep the structure small.
+	since     int64
+	lastProbe int64
 }
 
 type slot struct {
-	c chan Conn
-	// To keep slot size smaller it is just a unix timestamp.
+	// Stack, the most recently returned connection is at the end.
+	conns   []idleConn
 	lastUse int64
 }
 
+type shard struct {
+	lck  sync.Mutex
+	keys map[string]*slot
+}
+
+// P is a pool of idle connections grouped by key (destination domain).
+//
+// Keys are spread between independently locked shards and no I/O is done
+// while holding any locks: Get and Return only move values between slots.
+// Expired connections are closed and idle ones are probed by a background
+// goroutine.
 type P struct {
-	cfg      Config
-	keys     map[string]slot
-	keysLock sync.Mutex
+	cfg        Config
+	shardLimit int
+	shards     [shardCount]shard
+
+	hits, misses, evictions prometheus.Counter
+
+	stop      chan struct{}
+	stopped   chan struct{}
+	closeOnce sync.Once
 }
 
 func New(cfg Config) *P {
@@ -56,103 +100,230 @@ func New(cfg Config) *P {
 		}
 	}
 
-	return &P{
-		cfg:  cfg,
-		keys: make(map[string]slot, cfg.MaxKeys),
+	p := &P{
+		cfg:        cfg,
+		shardLimit: cfg.MaxKeys / shardCount,
+		hits:       poolHits.WithLabelValues(cfg.Name),
+		misses:     poolMisses.WithLabelValues(cfg.Name),
+		evictions:  poolEvictions.WithLabelValues(cfg.Name),
+		stop:       make(chan struct{}),
+		stopped:    make(chan struct{}),
+	}
+	if p.shardLimit == 0 {
+		p.shardLimit = 1
+	}
+	for i := range p.shards {
+		p.shards[i].keys = make(map[string]*slot)
 	}
-}
 
-func (p *P) Get(ctx context.Context, key string) (Conn, error) {
-	// TODO: See if it is possible to get rid of this lock.
-	p.keysLock.Lock()
-	defer p.keysLock.Unlock()
+	go p.reapLoop()
 
-	bucket, ok := p.keys[key]
-	if !ok {
-		return p.cfg.New(ctx, key)
-	}
+	return p
+}
 
-	if time.Now().Unix()-bucket.lastUse > p.cfg.MaxConnLifetimeSec {
-		// Drop bucket.
-		close(bucket.c)
-		for conn := range bucket.c {
-			conn.Close()
-		}
-		delete(p.keys, key)
+func (p *P) shard(key string) *shard {
+	h := fnv.New32a()
+	h.Write([]byte(key))
+	return &p.shards[h.Sum32()%shardCount]
+}
 
-		return p.cfg.New(ctx, key)
+func (p *P) expired(ic idleConn, now int64) bool {
+	return now-ic.since > p.cfg.MaxConnLifetimeSec
+}
+
+func (p *P) closeAll(conns []idleConn) {
+	for _, ic := range conns {
+		ic.c.Close()
 	}
+	p.evictions.Add(float64(len(conns)))
+}
 
-	for {
-		var conn Conn
-		select {
-		case conn, ok = <-bucket.c:
-			if !ok {
-				return p.cfg.New(ctx, key)
+func (p *P) Get(ctx context.Context, key string) (Conn, error) {
+	var (
+		conn    Conn
+		expired []idleConn
+		now     = time.Now().Unix()
+	)
+
+	sh := p.shard(key)
+	sh.lck.Lock()
+	if s := sh.keys[key]; s != nil {
+		for len(s.conns) != 0 {
+			ic := s.conns[len(s.conns)-1]
+			s.conns[len(s.conns)-1] = idleConn{}
+			s.conns = s.conns[:len(s.conns)-1]
+			if p.expired(ic, now) {
+				expired = append(expired, ic)
+				continue
 			}
-		default:
-			return p.cfg.New(ctx, key)
+			conn = ic.c
+			s.lastUse = now
+			break
 		}
+	}
+	sh.lck.Unlock()
 
-		if !conn.Usable() {
-			continue
-		}
+	p.closeAll(expired)
 
+	if conn != nil {
+		p.hits.Inc()
 		return conn, nil
 	}
+	p.misses.Inc()
+	return p.cfg.New(ctx, key)
 }
 
 func (p *P) Return(key string, c Conn) {
-	p.keysLock.Lock()
-	defer p.keysLock.Unlock()
+	now := time.Now().Unix()
 
-	if p.keys == nil {
+	sh := p.shard(key)
+	sh.lck.Lock()
+	if sh.keys == nil {
+		sh.lck.Unlock()
+		c.Close()
+		return
+	}
+	s := sh.keys[key]
+	if s == nil {
+		// Stale keys are removed by the reaper. If we are out of space
+		// now, just do not cache the connection.
+		if len(sh.keys) >= p.shardLimit {
+			sh.lck.Unlock()
+			p.closeAll([]idleConn{{c: c}})
+			return
+		}
+		s = &slot{}
+		sh.keys[key] = s
+	}
+	s.lastUse = now
+	if len(s.conns) >= p.cfg.MaxConnsPerKey {
+		sh.lck.Unlock()
+		// Let it go, let it go...
+		p.closeAll([]idleConn{{c: c}})
 		return
 	}
+	s.conns = append(s.conns, idleConn{c: c, since: now, lastProbe: now})
+	sh.lck.Unlock()
+}
+
+func (p *P) reapLoop() {
+	defer close(p.stopped)
+
+	t := time.NewTicker(reapInterval)
+	defer t.Stop()
+	for {
+		select {
+		case <-t.C:
+			p.reap(time.Now().Unix())
+		case <-p.stop:
+			return
+		}
+	}
+}
+
+// reap closes expired connections, probes idle ones and removes stale keys.
+// Shards are processed concurrently since probes involve network round
+// trips.
+func (p *P) reap(now int64) {
+	var wg sync.WaitGroup
+	for i := range p.shards {
+		wg.Add(1)
+		go func(sh *shard) {
+			defer wg.Done()
+			p.reapShard(sh, now)
+		}(&p.shards[i])
+	}
+	wg.Wait()
+}
+
+func (p *P) reapShard(sh *shard, now int64) {
+	type probe struct {
+		key string
+		ic  idleConn
+	}
+	var (
+		expired []idleConn
+		probes  []probe
+	)
 
-	bucket, ok := p.keys[key]
-	if !ok {
-		// Garbage-collect stale buckets.
-		if len(p.keys) == p.cfg.MaxKeys {
-			for k, v := range p.keys {
-				if v.lastUse+p.cfg.StaleKeyLifetimeSec > time.Now().Unix() {
-					continue
-				}
-
-				close(v.c)
-				for conn := range v.c {
-					conn.Close()
-				}
-				delete(p.keys, k)
+	sh.lck.Lock()
+	for key, s := range sh.keys {
+		kept := s.conns[:0]
+		for _, ic := range s.conns {
+			switch {
+			case p.expired(ic, now):
+				expired = append(expired, ic)
+			case p.cfg.ProbeIntervalSec > 0 && now-ic.lastProbe >= p.cfg.ProbeIntervalSec:
+				probes = append(probes, probe{key: key, ic: ic})
+			default:
+				kept = append(kept, ic)
 			}
 		}
+		for i := len(kept); i < len(s.conns); i++ {
+			s.conns[i] = idleConn{}
+		}
+		s.conns = kept
 
-		bucket = slot{
-			c:       make(chan Conn, p.cfg.MaxConnsPerKey),
-			lastUse: time.Now().Unix(),
+		if len(s.conns) == 0 && s.lastUse+p.cfg.StaleKeyLifetimeSec <= now {
+			delete(sh.keys, key)
 		}
-		p.keys[key] = bucket
 	}
+	sh.lck.Unlock()
 
-	select {
-	case bucket.c <- c:
-		bucket.lastUse = time.Now().Unix()
-	default:
-		// Let it go, let it go...
-		c.Close()
+	p.closeAll(expired)
+
+	for _, pr := range probes {
+		if !pr.ic.c.Usable() {
+			p.closeAll([]idleConn{pr.ic})
+			continue
+		}
+		pr.ic.lastProbe = now
+		p.putBack(sh, pr.key, pr.ic)
+	}
+}
+
+// putBack returns the probed connection into the slot without changing
+// its idle time.
+func (p *P) putBack(sh *shard, key string, ic idleConn) {
+	sh.lck.Lock()
+	if sh.keys == nil {
+		sh.lck.Unlock()
+		ic.c.Close()
+		return
+	}
+	s := sh.keys[key]
+	if s == nil && len(sh.keys) < p.shardLimit {
+		s = &slot{lastUse: ic.since}
+		sh.keys[key] = s
 	}
+	if s == nil || len(s.conns) >= p.cfg.MaxConnsPerKey {
+		sh.lck.Unlock()
+		p.closeAll([]idleConn{ic})
+		return
+	}
+	// Connections returned while the probe was running are newer, keep
+	// them on top of the stack.
+	s.conns = append(s.conns, idleConn{})
+	copy(s.conns[1:], s.conns)
+	s.conns[0] = ic
+	sh.lck.Unlock()
 }
 
 func (p *P) Close() {
-	p.keysLock.Lock()
-	defer p.keysLock.Unlock()
+	p.closeOnce.Do(func() { close(p.stop) })
+	<-p.stopped
 
-	for k, v := range p.keys {
-		close(v.c)
-		for conn := range v.c {
-			conn.Close()
+	for i := range p.shards {
+		sh := &p.shards[i]
+		sh.lck.Lock()
+		keys := sh.keys
+		sh.keys = nil
+		sh.lck.Unlock()
+
+		for _, s := range keys {
+			for _, ic := range s.conns {
+				ic.c.Close()
+			}
 		}
-		delete(p.keys, k)
 	}
-	p.keys = nil
 }
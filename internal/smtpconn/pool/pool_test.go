@@ -0,0 +1,154 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package pool
+
+import (
+	"context"
+	"strconv"
+	"sync"
+	"sync/atomic"
+	"testing"
+	"time"
+)
+
+type testConn struct {
+	usable int32
+	probes int32
+	closed int32
+}
+
+func (c *testConn) Usable() bool {
+	atomic.AddInt32(&c.probes, 1)
+	return atomic.LoadInt32(&c.usable) == 1
+}
+
+func (c *testConn) Close() error {
+	atomic.AddInt32(&c.closed, 1)
+	return nil
+}
+
+func newTestPool() *P {
+	return New(Config{
+		MaxKeys:             64,
+		MaxConnsPerKey:      2,
+		MaxConnLifetimeSec:  150,
+		StaleKeyLifetimeSec: 300,
+		ProbeIntervalSec:    30,
+	})
+}
+
+func TestPool(t *testing.T) {
+	p := newTestPool()
+	defer p.Close()
+
+	if c, _ := p.Get(context.Background(), "example.org"); c != nil {
+		t.Fatal("Got a connection from the empty pool")
+	}
+
+	c1, c2, c3 := &testConn{usable: 1}, &testConn{usable: 1}, &testConn{usable: 1}
+	p.Return("example.org", c1)
+	p.Return("example.org", c2)
+	p.Return("example.org", c3)
+	if atomic.LoadInt32(&c3.closed) != 1 {
+		t.Error("Connection exceeding MaxConnsPerKey is not closed")
+	}
+
+	// Most recently returned connection should be taken first.
+	if c, _ := p.Get(context.Background(), "example.org"); c != c2 {
+		t.Error("Wrong connection returned")
+	}
+	if c, _ := p.Get(context.Background(), "example.org"); c != c1 {
+		t.Error("Wrong connection returned")
+	}
+	if c, _ := p.Get(context.Background(), "example.com"); c != nil {
+		t.Error("Connection returned for a different key")
+	}
+	if c1.probes != 0 || c2.probes != 0 {
+		t.Error("Connections are checked on Get")
+	}
+}
+
+func TestPool_Reap(t *testing.T) {
+	p := newTestPool()
+	defer p.Close()
+
+	alive, broken, old := &testConn{usable: 1}, &testConn{}, &testConn{usable: 1}
+	p.Return("alive.example.org", alive)
+	p.Return("broken.example.org", broken)
+	p.Return("old.example.org", old)
+
+	now := time.Now().Unix()
+	p.reap(now + 40)
+	if alive.probes != 1 || broken.probes != 1 {
+		t.Fatal("Idle connections are not probed:", alive.probes, broken.probes)
+	}
+	if broken.closed != 1 {
+		t.Error("Broken connection is not closed")
+	}
+	if alive.closed != 0 {
+		t.Error("Alive connection is closed")
+	}
+
+	// Probed recently, should not be probed again.
+	p.reap(now + 50)
+	if alive.probes != 1 {
+		t.Error("Connection is probed too often")
+	}
+
+	p.reap(now + 200)
+	if old.closed != 1 || alive.closed != 1 {
+		t.Error("Expired connections are not closed")
+	}
+	p.reap(now + 1000)
+	for i := range p.shards {
+		if len(p.shards[i].keys) != 0 {
+			t.Fatal("Stale keys are not removed")
+		}
+	}
+}
+
+func BenchmarkPool(b *testing.B) {
+	p := New(Config{
+		MaxKeys:             20000,
+		MaxConnsPerKey:      10,
+		MaxConnLifetimeSec:  150,
+		StaleKeyLifetimeSec: 300,
+	})
+	defer p.Close()
+
+	var ctr uint32
+	var ctrLck sync.Mutex
+	b.ReportAllocs()
+	b.ResetTimer()
+	b.RunParallel(func(pb *testing.PB) {
+		ctrLck.Lock()
+		ctr++
+		key := "example" + strconv.Itoa(int(ctr)%64) + ".org"
+		ctrLck.Unlock()
+
+		c := &testConn{usable: 1}
+		for pb.Next() {
+			p.Return(key, c)
+			got, _ := p.Get(context.Background(), key)
+			if got != nil {
+				c = got.(*testConn)
+			}
+		}
+	})
+}
@@ -25,15 +25,22 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 // - Wrapping of returned errors using the exterrors package.
 // - SMTPUTF8/IDNA support.
 // - TLS support mode (don't use, attempt, require).
+// - Optional PIPELINING and CHUNKING use.
 package smtpconn
 
 import (
+	"bufio"
+	"bytes"
 	"context"
 	"crypto/tls"
 	"errors"
+	"fmt"
 	"io"
 	"net"
+	nettextproto "net/textproto"
 	"runtime/trace"
+	"strconv"
+	"strings"
 
 	"github.com/emersion/go-message/textproto"
 	"github.com/emersion/go-smtp"
@@ -66,11 +73,28 @@ type C struct {
 	// "ADDRESS said: ..."
 	AddrInSMTPMsg bool
 
+	// Send RCPT commands in RcptMany without waiting for replies if the
+	// server supports PIPELINING (RFC 2920).
+	UsePipelining bool
+
+	// Send the message body using BDAT if the server supports CHUNKING
+	// (RFC 3030).
+	UseChunking bool
+
 	serverName string
 	cl         *smtp.Client
+	lmtp       bool
 	rcpts      []string
 }
 
+// bdatChunkSize is the maximum size of the message data sent in a single
+// BDAT command.
+const bdatChunkSize = 128 * 1024
+
+// bdatWindow is the maximum amount of BDAT commands sent without reading
+// replies if PIPELINING is used.
+const bdatWindow = 8
+
 // New creates the new instance of the C object, populating the required fields
 // with resonable default values.
 func New() *C {
@@ -166,6 +190,7 @@ func (c *C) ConnectLMTP(ctx context.Context, endp config.Endpoint, starttls bool
 
 	c.serverName = endp.Host
 	c.cl = cl
+	c.lmtp = true
 	return didTLS, nil
 }
 
@@ -285,6 +310,7 @@ func (c *C) Mail(ctx context.Context, from string, opts smtp.MailOptions) error
 	if err := c.cl.Mail(from, &outOpts); err != nil {
 		return c.wrapClientErr(err, c.serverName)
 	}
+	c.rcpts = nil
 
 	c.Log.DebugMsg("connected", "remote_server", c.serverName)
 	return nil
@@ -310,12 +336,39 @@ func (c *C) Client() *smtp.Client {
 func (c *C) Rcpt(ctx context.Context, to string) error {
 	defer trace.StartRegion(ctx, "smtpconn/RCPT TO").End()
 
+	to, err := c.rcptAddr(to)
+	if err != nil {
+		return err
+	}
+
+	if err := c.cl.Rcpt(to); err != nil {
+		return c.wrapClientErr(err, c.serverName)
+	}
+
+	c.rcpts = append(c.rcpts, to)
+
+	return nil
+}
+
+func (c *C) rcptAddr(to string) (string, error) {
+	// go-smtp checks that for commands it sends, but RcptMany writes them
+	// directly.
+	if strings.ContainsAny(to, "\r\n") {
+		return "", &exterrors.SMTPError{
+			Code:         553,
+			EnhancedCode: exterrors.EnhancedCode{5, 1, 3},
+			Message:      "Recipient address contains a line break",
+			Misc: map[string]interface{}{
+				"remote_server": c.serverName,
+			},
+		}
+	}
 	// If necessary, the extension flag is enabled in Start.
 	if ok, _ := c.cl.Extension("SMTPUTF8"); !address.IsASCII(to) && !ok {
 		var err error
 		to, err = address.ToASCII(to)
 		if err != nil {
-			return &exterrors.SMTPError{
+			return "", &exterrors.SMTPError{
 				Code:         553,
 				EnhancedCode: exterrors.EnhancedCode{5, 6, 7},
 				Message:      "SMTPUTF8 is unsupported, cannot convert recipient address",
@@ -326,14 +379,99 @@ func (c *C) Rcpt(ctx context.Context, to string) error {
 			}
 		}
 	}
+	return to, nil
+}
 
-	if err := c.cl.Rcpt(to); err != nil {
-		return c.wrapClientErr(err, c.serverName)
+// CanPipeline reports whether RcptMany will send commands without waiting
+// for replies.
+func (c *C) CanPipeline() bool {
+	if !c.UsePipelining || c.lmtp || c.cl == nil {
+		return false
 	}
+	ok, _ := c.cl.Extension("PIPELINING")
+	return ok
+}
 
-	c.rcpts = append(c.rcpts, to)
+// RcptMany sends RCPT TO commands for all addresses.
+//
+// If CanPipeline is true, all commands are sent at once and replies are
+// read afterwards, otherwise it is equivalent to calling Rcpt for each
+// address. Returned slice contains the error for each address, nil if the
+// address is accepted.
+func (c *C) RcptMany(ctx context.Context, to []string) []error {
+	errs := make([]error, len(to))
+	if !c.CanPipeline() {
+		for i, rcpt := range to {
+			errs[i] = c.Rcpt(ctx, rcpt)
+		}
+		return errs
+	}
 
-	return nil
+	defer trace.StartRegion(ctx, "smtpconn/RCPT TO (pipelined)").End()
+
+	addrs := make([]string, len(to))
+	for i, rcpt := range to {
+		addrs[i], errs[i] = c.rcptAddr(rcpt)
+		if errs[i] != nil {
+			continue
+		}
+		fmt.Fprintf(c.cl.Text.W, "RCPT TO:<%s>\r\n", addrs[i])
+	}
+	if err := c.cl.Text.W.Flush(); err != nil {
+		err = c.wrapClientErr(err, c.serverName)
+		for i := range errs {
+			if errs[i] == nil {
+				errs[i] = err
+			}
+		}
+		return errs
+	}
+
+	for i := range to {
+		if errs[i] != nil {
+			continue
+		}
+		if _, _, err := c.cl.Text.ReadResponse(25); err != nil {
+			errs[i] = c.wrapClientErr(toSMTPErr(err), c.serverName)
+			continue
+		}
+		c.rcpts = append(c.rcpts, addrs[i])
+	}
+	return errs
+}
+
+// toSMTPErr converts the reply error returned by net/textproto into the
+// go-smtp error so wrapClientErr can handle it.
+func toSMTPErr(err error) error {
+	protoErr, ok := err.(*nettextproto.Error)
+	if !ok {
+		return err
+	}
+
+	smtpErr := &smtp.SMTPError{
+		Code:         protoErr.Code,
+		EnhancedCode: smtp.EnhancedCode{protoErr.Code / 100, 0, 0},
+		Message:      protoErr.Msg,
+	}
+	parts := strings.SplitN(protoErr.Msg, " ", 2)
+	if len(parts) != 2 {
+		return smtpErr
+	}
+	codeParts := strings.Split(parts[0], ".")
+	if len(codeParts) != 3 {
+		return smtpErr
+	}
+	var enchCode smtp.EnhancedCode
+	for i, part := range codeParts {
+		num, err := strconv.Atoi(part)
+		if err != nil {
+			return smtpErr
+		}
+		enchCode[i] = num
+	}
+	smtpErr.EnhancedCode = enchCode
+	smtpErr.Message = parts[1]
+	return smtpErr
 }
 
 // Data sends the DATA command to the remote server and then sends the message header
@@ -342,6 +480,10 @@ func (c *C) Rcpt(ctx context.Context, to string) error {
 // If the Data command fails, the connection may be in a unclean state (e.g. in
 // the middle of message data stream). It is not safe to continue using it.
 func (c *C) Data(ctx context.Context, hdr textproto.Header, body io.Reader) error {
+	if ok, _ := c.cl.Extension("CHUNKING"); ok && c.UseChunking && !c.lmtp {
+		return c.bdat(ctx, hdr, body)
+	}
+
 	defer trace.StartRegion(ctx, "smtpconn/DATA").End()
 
 	wc, err := c.cl.Data()
@@ -364,6 +506,140 @@ func (c *C) Data(ctx context.Context, hdr textproto.Header, body io.Reader) erro
 	return nil
 }
 
+// bdat sends the message using BDAT commands.
+//
+// If the server supports PIPELINING, up to bdatWindow chunks are sent
+// without waiting for replies.
+func (c *C) bdat(ctx context.Context, hdr textproto.Header, body io.Reader) error {
+	defer trace.StartRegion(ctx, "smtpconn/BDAT").End()
+
+	var hdrBuf bytes.Buffer
+	if err := textproto.WriteHeader(&hdrBuf, hdr); err != nil {
+		return err
+	}
+	// Chunk sizes are counted after normalization so the message goes out
+	// with the same bytes as it would using DATA.
+	r := newCRLFReader(io.MultiReader(&hdrBuf, body))
+
+	window := 1
+	if c.CanPipeline() {
+		window = bdatWindow
+	}
+
+	var (
+		chunk    = make([]byte, bdatChunkSize)
+		pending  int
+		firstErr error
+	)
+	readReply := func() {
+		pending--
+		if _, _, err := c.cl.Text.ReadResponse(250); err != nil && firstErr == nil {
+			firstErr = err
+		}
+	}
+	readAll := func() error {
+		for pending > 0 {
+			readReply()
+		}
+		return c.wrapClientErr(toSMTPErr(firstErr), c.serverName)
+	}
+
+	for {
+		n, err := io.ReadFull(r, chunk)
+		last := err == io.EOF || err == io.ErrUnexpectedEOF
+		if err != nil && !last {
+			// The transaction is not finished, but previously sent chunks
+			// still have to be answered to keep the connection in sync.
+			readAll()
+			return c.wrapClientErr(err, c.serverName)
+		}
+
+		if last {
+			fmt.Fprintf(c.cl.Text.W, "BDAT %d LAST\r\n", n)
+		} else {
+			fmt.Fprintf(c.cl.Text.W, "BDAT %d\r\n", n)
+		}
+		c.cl.Text.W.Write(chunk[:n])
+		if err := c.cl.Text.W.Flush(); err != nil {
+			return c.wrapClientErr(err, c.serverName)
+		}
+		pending++
+
+		if last {
+			return readAll()
+		}
+		for pending >= window {
+			readReply()
+		}
+		if firstErr != nil {
+			// Server will reject the remaining chunks anyway.
+			return readAll()
+		}
+	}
+}
+
+// crlfReader converts bare LF line endings to CRLF and terminates the last
+// line with CRLF, the same way the DotWriter used for DATA does.
+type crlfReader struct {
+	r    *bufio.Reader
+	last byte
+	lf   bool // LF should be emitted after the inserted CR.
+	eof  bool
+}
+
+func newCRLFReader(r io.Reader) *crlfReader {
+	return &crlfReader{r: bufio.NewReader(r), last: '\n'}
+}
+
+func (cr *crlfReader) Read(p []byte) (int, error) {
+	n := 0
+	for n < len(p) {
+		if cr.lf {
+			p[n] = '\n'
+			cr.last = '\n'
+			cr.lf = false
+			n++
+			continue
+		}
+
+		if cr.eof {
+			switch cr.last {
+			case '\n':
+				return n, io.EOF
+			case '\r':
+				p[n] = '\n'
+				cr.last = '\n'
+			default:
+				p[n] = '\r'
+				cr.last = '\r'
+				cr.lf = true
+			}
+			n++
+			continue
+		}
+
+		b, err := cr.r.ReadByte()
+		if err == io.EOF {
+			cr.eof = true
+			continue
+		}
+		if err != nil {
+			return n, err
+		}
+
+		if b == '\n' && cr.last != '\r' {
+			p[n] = '\r'
+			cr.last = '\r'
+			cr.lf = true
+		} else {
+			p[n] = b
+			cr.last = b
+		}
+		n++
+	}
+	return n, nil
+}
+
 func (c *C) LMTPData(ctx context.Context, hdr textproto.Header, body io.Reader, statusCb func(string, *smtp.SMTPError)) error {
 	defer trace.StartRegion(ctx, "smtpconn/LMTPDATA").End()
 
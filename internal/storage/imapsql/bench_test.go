@@ -89,3 +89,24 @@ func BenchmarkStorage_DeliveryZstd(b *testing.B) {
 
 	testutils.BenchDelivery(b, be, "sender@example.org", []string{randomKey})
 }
+
+func BenchmarkStorage_DeliveryFanOut(b *testing.B) {
+	for _, count := range []int{10, 100, 1000, 5000} {
+		count := count
+		b.Run(strconv.Itoa(count), func(b *testing.B) {
+			prefix := "rcpt-" + strconv.FormatInt(time.Now().UnixNano(), 10) + "-"
+
+			be := createTestDB(b, "")
+			rcpts := make([]string, 0, count)
+			for i := 0; i < count; i++ {
+				rcpt := prefix + strconv.Itoa(i) + "@example.org"
+				if err := be.CreateIMAPAcct(rcpt); err != nil {
+					b.Fatal(err)
+				}
+				rcpts = append(rcpts, rcpt)
+			}
+
+			testutils.BenchDelivery(b, be, "sender@example.org", rcpts)
+		})
+	}
+}
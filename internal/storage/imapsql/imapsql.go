@@ -355,19 +355,28 @@ func (store *Storage) EnableUpdatePipe(mode updatepipe.BackendMode) error {
 
 	upds := store.Back.Updates()
 
-	switch store.driver {
-	case "sqlite3":
-		dbId := sha1.Sum([]byte(strings.Join(store.dsn, " ")))
-		store.updPipe = &updatepipe.UnixSockPipe{
-			SockPath: filepath.Join(
-				config.RuntimeDirectory,
-				fmt.Sprintf("sql-%s.sock", hex.EncodeToString(dbId[:]))),
-			Log: log.Logger{Name: "sql/updpipe", Debug: store.Log.Debug},
-		}
-	default:
+	// Unix socket can be used only by processes on the same machine. This is
+	// the case for SQLite3 databases and for worker processes sharing any
+	// database.
+	if store.driver != "sqlite3" && config.WorkerID < 0 {
 		return errors.New("imapsql: driver does not have an update pipe implementation")
 	}
 
+	dbId := sha1.Sum([]byte(strings.Join(store.dsn, " ")))
+	sockPath := filepath.Join(
+		config.RuntimeDirectory,
+		fmt.Sprintf("sql-%s.sock", hex.EncodeToString(dbId[:])))
+	pipe := &updatepipe.UnixSockPipe{
+		SockPath: sockPath,
+		Log:      log.Logger{Name: "sql/updpipe", Debug: store.Log.Debug},
+	}
+	// Each worker process listens on its own socket and updates are pushed
+	// to all of them.
+	if config.WorkerID >= 0 {
+		pipe.ListenPath = fmt.Sprintf("%s.worker%d", sockPath, config.WorkerID)
+	}
+	store.updPipe = pipe
+
 	wrapped := make(chan backend.Update, cap(upds)*2)
 
 	if mode == updatepipe.ModeReplicate {
@@ -0,0 +1,240 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package table
+
+import (
+	"container/list"
+	"errors"
+	"fmt"
+	"sync"
+	"time"
+
+	"github.com/foxcpp/maddy/framework/config"
+	modconfig "github.com/foxcpp/maddy/framework/config/module"
+	"github.com/foxcpp/maddy/framework/log"
+	"github.com/foxcpp/maddy/framework/module"
+)
+
+const CacheModName = "table.cache"
+
+type cacheEntry struct {
+	key     string
+	value   string
+	found   bool
+	expires time.Time
+}
+
+type cacheCall struct {
+	done  chan struct{}
+	value string
+	found bool
+	err   error
+
+	// Set if the key is modified while the lookup is running, the result
+	// should not be cached then.
+	stale bool
+}
+
+// Cache is a table that remembers results of another table lookups.
+//
+// Up to maxEntries most recently used results are kept. Concurrent lookups
+// for the same key are coalesced into a single lookup of the wrapped
+// table. Lookup errors are not cached.
+type Cache struct {
+	modName    string
+	instName   string
+	inlineArgs []string
+
+	wrapped    module.Table
+	ttl        time.Duration
+	negTTL     time.Duration
+	maxEntries int
+	timer      *lookupTimer
+
+	// Used in tests.
+	now func() time.Time
+
+	lck      sync.Mutex
+	entries  map[string]*list.Element
+	lru      *list.List
+	inflight map[string]*cacheCall
+
+	log log.Logger
+}
+
+func NewCache(modName, instName string, _, inlineArgs []string) (module.Module, error) {
+	return &Cache{
+		modName:    modName,
+		instName:   instName,
+		inlineArgs: inlineArgs,
+		now:        time.Now,
+		entries:    map[string]*list.Element{},
+		lru:        list.New(),
+		inflight:   map[string]*cacheCall{},
+		timer:      newLookupTimer(modName, instName),
+		log:        log.Logger{Name: modName},
+	}, nil
+}
+
+func (c *Cache) Name() string {
+	return c.modName
+}
+
+func (c *Cache) InstanceName() string {
+	return c.instName
+}
+
+func (c *Cache) Init(cfg *config.Map) error {
+	if len(c.inlineArgs) != 0 {
+		if err := modconfig.ModuleFromNode("table", c.inlineArgs, cfg.Block, cfg.Globals, &c.wrapped); err != nil {
+			return err
+		}
+	} else {
+		cfg.Custom("table", false, true, nil, modconfig.TableDirective, &c.wrapped)
+	}
+	cfg.Bool("debug", true, false, &c.log.Debug)
+	cfg.Duration("ttl", false, false, 1*time.Minute, &c.ttl)
+	cfg.Duration("negative_ttl", false, false, 5*time.Second, &c.negTTL)
+	cfg.Int("max_entries", false, false, 10000, &c.maxEntries)
+	if _, err := cfg.Process(); err != nil {
+		return err
+	}
+	if c.maxEntries <= 0 {
+		return errors.New("table.cache: max_entries should be positive")
+	}
+
+	return nil
+}
+
+func (c *Cache) Lookup(key string) (string, bool, error) {
+	defer c.timer.observe(c.timer.start())
+
+	c.lck.Lock()
+	if el, ok := c.entries[key]; ok {
+		ent := el.Value.(*cacheEntry)
+		if c.now().Before(ent.expires) {
+			c.lru.MoveToFront(el)
+			c.lck.Unlock()
+			return ent.value, ent.found, nil
+		}
+		c.lru.Remove(el)
+		delete(c.entries, key)
+	}
+	if call, ok := c.inflight[key]; ok {
+		c.lck.Unlock()
+		<-call.done
+		return call.value, call.found, call.err
+	}
+	call := &cacheCall{done: make(chan struct{})}
+	c.inflight[key] = call
+	c.lck.Unlock()
+
+	defer func() {
+		c.lck.Lock()
+		delete(c.inflight, key)
+		if call.err == nil && !call.stale {
+			c.store(key, call.value, call.found)
+		}
+		c.lck.Unlock()
+		close(call.done)
+	}()
+
+	// Waiters should not get a zero value if the wrapped table panics.
+	call.err = errors.New("table.cache: lookup panicked")
+	call.value, call.found, call.err = c.wrapped.Lookup(key)
+	return call.value, call.found, call.err
+}
+
+// store adds the lookup result to the cache, evicting the least recently
+// used entry if needed.
+//
+// lck should be held by the caller.
+func (c *Cache) store(key, value string, found bool) {
+	ttl := c.ttl
+	if !found {
+		ttl = c.negTTL
+	}
+	if ttl <= 0 {
+		return
+	}
+
+	for c.lru.Len() >= c.maxEntries {
+		oldest := c.lru.Back()
+		c.lru.Remove(oldest)
+		delete(c.entries, oldest.Value.(*cacheEntry).key)
+	}
+	c.entries[key] = c.lru.PushFront(&cacheEntry{
+		key:     key,
+		value:   value,
+		found:   found,
+		expires: c.now().Add(ttl),
+	})
+}
+
+// Invalidate removes the cached result for the key.
+func (c *Cache) Invalidate(key string) {
+	c.lck.Lock()
+	defer c.lck.Unlock()
+
+	if el, ok := c.entries[key]; ok {
+		c.lru.Remove(el)
+		delete(c.entries, key)
+	}
+	if call, ok := c.inflight[key]; ok {
+		call.stale = true
+	}
+}
+
+func (c *Cache) mutable() (module.MutableTable, error) {
+	tbl, ok := c.wrapped.(module.MutableTable)
+	if !ok {
+		return nil, fmt.Errorf("%s: underlying table is not mutable", c.modName)
+	}
+	return tbl, nil
+}
+
+func (c *Cache) Keys() ([]string, error) {
+	tbl, err := c.mutable()
+	if err != nil {
+		return nil, err
+	}
+	return tbl.Keys()
+}
+
+func (c *Cache) SetKey(k, v string) error {
+	tbl, err := c.mutable()
+	if err != nil {
+		return err
+	}
+	defer c.Invalidate(k)
+	return tbl.SetKey(k, v)
+}
+
+func (c *Cache) RemoveKey(k string) error {
+	tbl, err := c.mutable()
+	if err != nil {
+		return err
+	}
+	defer c.Invalidate(k)
+	return tbl.RemoveKey(k)
+}
+
+func init() {
+	module.Register(CacheModName, NewCache)
+}
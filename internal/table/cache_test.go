@@ -0,0 +1,218 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package table
+
+import (
+	"errors"
+	"sync"
+	"sync/atomic"
+	"testing"
+	"time"
+)
+
+type mockTable struct {
+	db    map[string]string
+	err   error
+	calls int32
+
+	// If not nil, Lookup blocks until it is closed.
+	block chan struct{}
+}
+
+func (m *mockTable) Lookup(key string) (string, bool, error) {
+	atomic.AddInt32(&m.calls, 1)
+	if m.block != nil {
+		<-m.block
+	}
+	if m.err != nil {
+		return "", false, m.err
+	}
+	v, ok := m.db[key]
+	return v, ok, nil
+}
+
+func (m *mockTable) Keys() ([]string, error) {
+	keys := make([]string, 0, len(m.db))
+	for k := range m.db {
+		keys = append(keys, k)
+	}
+	return keys, nil
+}
+
+func (m *mockTable) SetKey(k, v string) error {
+	m.db[k] = v
+	return nil
+}
+
+func (m *mockTable) RemoveKey(k string) error {
+	delete(m.db, k)
+	return nil
+}
+
+func testCache(t *testing.T, m *mockTable) (*Cache, *time.Time) {
+	mod, err := NewCache(CacheModName, "", nil, nil)
+	if err != nil {
+		t.Fatal(err)
+	}
+	c := mod.(*Cache)
+	now := time.Unix(1000, 0)
+	c.wrapped = m
+	c.ttl = time.Minute
+	c.negTTL = 5 * time.Second
+	c.maxEntries = 2
+	c.now = func() time.Time { return now }
+	return c, &now
+}
+
+func checkLookup(t *testing.T, c *Cache, key, wantVal string, wantOk bool) {
+	t.Helper()
+	val, ok, err := c.Lookup(key)
+	if err != nil {
+		t.Fatal("Unexpected error:", err)
+	}
+	if val != wantVal || ok != wantOk {
+		t.Fatalf("Lookup(%q) = %q, %v; want %q, %v", key, val, ok, wantVal, wantOk)
+	}
+}
+
+func TestCache_Positive(t *testing.T) {
+	m := &mockTable{db: map[string]string{"a": "1"}}
+	c, now := testCache(t, m)
+
+	for i := 0; i < 3; i++ {
+		checkLookup(t, c, "a", "1", true)
+	}
+	if m.calls != 1 {
+		t.Fatal("Wrapped table called", m.calls, "times")
+	}
+
+	*now = now.Add(2 * time.Minute)
+	checkLookup(t, c, "a", "1", true)
+	if m.calls != 2 {
+		t.Fatal("Expired entry used")
+	}
+}
+
+func TestCache_Negative(t *testing.T) {
+	m := &mockTable{db: map[string]string{}}
+	c, now := testCache(t, m)
+
+	for i := 0; i < 3; i++ {
+		checkLookup(t, c, "a", "", false)
+	}
+	if m.calls != 1 {
+		t.Fatal("Wrapped table called", m.calls, "times")
+	}
+
+	*now = now.Add(10 * time.Second)
+	checkLookup(t, c, "a", "", false)
+	if m.calls != 2 {
+		t.Fatal("Expired entry used")
+	}
+}
+
+func TestCache_ErrNotCached(t *testing.T) {
+	m := &mockTable{err: errors.New("backend is down")}
+	c, _ := testCache(t, m)
+
+	for i := 0; i < 2; i++ {
+		if _, _, err := c.Lookup("a"); err == nil {
+			t.Fatal("Error is not returned")
+		}
+	}
+	if m.calls != 2 {
+		t.Fatal("Error is cached")
+	}
+}
+
+func TestCache_Invalidate(t *testing.T) {
+	m := &mockTable{db: map[string]string{"a": "1", "b": "2"}}
+	c, _ := testCache(t, m)
+
+	checkLookup(t, c, "a", "1", true)
+	if err := c.SetKey("a", "3"); err != nil {
+		t.Fatal(err)
+	}
+	checkLookup(t, c, "a", "3", true)
+
+	checkLookup(t, c, "b", "2", true)
+	if err := c.RemoveKey("b"); err != nil {
+		t.Fatal(err)
+	}
+	checkLookup(t, c, "b", "", false)
+
+	if m.calls != 4 {
+		t.Fatal("Wrapped table called", m.calls, "times")
+	}
+}
+
+func TestCache_LRU(t *testing.T) {
+	m := &mockTable{db: map[string]string{"a": "1", "b": "2", "c": "3"}}
+	c, _ := testCache(t, m)
+
+	checkLookup(t, c, "a", "1", true)
+	checkLookup(t, c, "b", "2", true)
+	// "a" is now more recently used than "b".
+	checkLookup(t, c, "a", "1", true)
+	checkLookup(t, c, "c", "3", true)
+	if m.calls != 3 {
+		t.Fatal("Wrapped table called", m.calls, "times")
+	}
+
+	checkLookup(t, c, "a", "1", true)
+	if m.calls != 3 {
+		t.Fatal("Recently used entry evicted")
+	}
+	checkLookup(t, c, "b", "2", true)
+	if m.calls != 4 {
+		t.Fatal("Entry is not evicted")
+	}
+	if len(c.entries) != 2 || c.lru.Len() != 2 {
+		t.Fatal("Cache size is over the limit:", len(c.entries))
+	}
+}
+
+func TestCache_Coalescing(t *testing.T) {
+	m := &mockTable{db: map[string]string{"a": "1"}, block: make(chan struct{})}
+	c, _ := testCache(t, m)
+
+	var wg sync.WaitGroup
+	for i := 0; i < 10; i++ {
+		wg.Add(1)
+		go func() {
+			defer wg.Done()
+			val, ok, err := c.Lookup("a")
+			if err != nil || val != "1" || !ok {
+				t.Errorf("Lookup = %q, %v, %v", val, ok, err)
+			}
+		}()
+	}
+
+	// Wait for the lookup to start, the rest should wait for it.
+	for atomic.LoadInt32(&m.calls) == 0 {
+		time.Sleep(time.Millisecond)
+	}
+	time.Sleep(10 * time.Millisecond)
+	close(m.block)
+	wg.Wait()
+
+	if calls := atomic.LoadInt32(&m.calls); calls != 1 {
+		t.Fatal("Wrapped table called", calls, "times")
+	}
+}
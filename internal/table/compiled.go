@@ -0,0 +1,235 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package table
+
+import (
+	"bufio"
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"io"
+	"os"
+	"sort"
+)
+
+// Compiled table file is a sorted list of key-value pairs that can be
+// searched in place, without loading it into a Go map:
+//
+//	magic "MTBL", u32 version,
+//	u64 entry count N,
+//	N x u64 offset of the entry from the file start, sorted by key,
+//	for each entry: u32 key length, u32 value length, key, value.
+//
+// All integers are big-endian. Keys are unique and ordered by byte values.
+const (
+	compiledMagic   = "MTBL"
+	compiledVersion = 1
+
+	compiledHeaderLen = 16
+)
+
+var errCompiledCorrupted = errors.New("table: compiled table is corrupted")
+
+// WriteCompiled writes entries in the compiled table format.
+func WriteCompiled(w io.Writer, entries map[string]string) error {
+	keys := make([]string, 0, len(entries))
+	for k := range entries {
+		keys = append(keys, k)
+	}
+	sort.Strings(keys)
+
+	bw := bufio.NewWriter(w)
+
+	var buf [compiledHeaderLen]byte
+	copy(buf[:4], compiledMagic)
+	binary.BigEndian.PutUint32(buf[4:8], compiledVersion)
+	binary.BigEndian.PutUint64(buf[8:16], uint64(len(keys)))
+	if _, err := bw.Write(buf[:16]); err != nil {
+		return err
+	}
+
+	offset := uint64(compiledHeaderLen + 8*len(keys))
+	for _, k := range keys {
+		binary.BigEndian.PutUint64(buf[:8], offset)
+		if _, err := bw.Write(buf[:8]); err != nil {
+			return err
+		}
+		offset += uint64(8 + len(k) + len(entries[k]))
+	}
+
+	for _, k := range keys {
+		v := entries[k]
+		binary.BigEndian.PutUint32(buf[:4], uint32(len(k)))
+		binary.BigEndian.PutUint32(buf[4:8], uint32(len(v)))
+		if _, err := bw.Write(buf[:8]); err != nil {
+			return err
+		}
+		if _, err := bw.WriteString(k); err != nil {
+			return err
+		}
+		if _, err := bw.WriteString(v); err != nil {
+			return err
+		}
+	}
+
+	return bw.Flush()
+}
+
+// CompileFile converts the table.file text file at src into the compiled
+// format and atomically replaces dst with it. The amount of written entries
+// is returned.
+func CompileFile(src, dst string) (int, error) {
+	entries := map[string]string{}
+	if err := readFile(src, entries); err != nil {
+		return 0, err
+	}
+
+	f, err := os.Create(dst + ".new")
+	if err != nil {
+		return 0, err
+	}
+	defer f.Close()
+
+	if err := WriteCompiled(f, entries); err != nil {
+		os.Remove(f.Name())
+		return 0, err
+	}
+	if err := f.Sync(); err != nil {
+		os.Remove(f.Name())
+		return 0, err
+	}
+	if err := f.Close(); err != nil {
+		os.Remove(f.Name())
+		return 0, err
+	}
+
+	// table.file reloads the table on mtime change, rename makes sure it
+	// never sees a partially written file.
+	return len(entries), os.Rename(dst+".new", dst)
+}
+
+// isCompiled reports whether the file at path is in the compiled table
+// format.
+func isCompiled(path string) (bool, error) {
+	f, err := os.Open(path)
+	if err != nil {
+		return false, err
+	}
+	defer f.Close()
+
+	var magic [len(compiledMagic)]byte
+	if _, err := io.ReadFull(f, magic[:]); err != nil {
+		if err == io.EOF || err == io.ErrUnexpectedEOF {
+			return false, nil
+		}
+		return false, err
+	}
+	return string(magic[:]) == compiledMagic, nil
+}
+
+// compiledTable is a read-only view of the compiled table file.
+//
+// The file is memory-mapped where supported, so lookups do not need the
+// table to be in the Go heap and opening it is cheap regardless of size.
+type compiledTable struct {
+	data  []byte
+	count int
+
+	unmap func() error
+}
+
+func openCompiled(path string) (*compiledTable, error) {
+	data, unmap, err := mapFile(path)
+	if err != nil {
+		return nil, err
+	}
+
+	ct := &compiledTable{data: data, unmap: unmap}
+	if len(data) < compiledHeaderLen || string(data[:4]) != compiledMagic {
+		ct.Close()
+		return nil, fmt.Errorf("%s: %w", path, errCompiledCorrupted)
+	}
+	if v := binary.BigEndian.Uint32(data[4:8]); v != compiledVersion {
+		ct.Close()
+		return nil, fmt.Errorf("%s: unsupported compiled table version: %d", path, v)
+	}
+	count := binary.BigEndian.Uint64(data[8:16])
+	if count > uint64(len(data)-compiledHeaderLen)/8 {
+		ct.Close()
+		return nil, fmt.Errorf("%s: %w", path, errCompiledCorrupted)
+	}
+	ct.count = int(count)
+
+	return ct, nil
+}
+
+func (ct *compiledTable) entry(i int) (key, value []byte, err error) {
+	offPos := compiledHeaderLen + 8*i
+	off := binary.BigEndian.Uint64(ct.data[offPos : offPos+8])
+	if off > uint64(len(ct.data)) || uint64(len(ct.data))-off < 8 {
+		return nil, nil, errCompiledCorrupted
+	}
+	keyLen := uint64(binary.BigEndian.Uint32(ct.data[off : off+4]))
+	valLen := uint64(binary.BigEndian.Uint32(ct.data[off+4 : off+8]))
+	start := off + 8
+	if uint64(len(ct.data))-start < keyLen+valLen {
+		return nil, nil, errCompiledCorrupted
+	}
+	return ct.data[start : start+keyLen], ct.data[start+keyLen : start+keyLen+valLen], nil
+}
+
+// Lookup finds the value for key. Returned string is a copy and stays
+// valid after Close.
+func (ct *compiledTable) Lookup(key string) (string, bool, error) {
+	var searchErr error
+	i := sort.Search(ct.count, func(i int) bool {
+		k, _, err := ct.entry(i)
+		if err != nil {
+			searchErr = err
+			return true
+		}
+		return string(k) >= key
+	})
+	if searchErr != nil {
+		return "", false, searchErr
+	}
+	if i == ct.count {
+		return "", false, nil
+	}
+
+	k, v, err := ct.entry(i)
+	if err != nil {
+		return "", false, err
+	}
+	if string(k) != key {
+		return "", false, nil
+	}
+	return string(v), true, nil
+}
+
+func (ct *compiledTable) Len() int {
+	return ct.count
+}
+
+func (ct *compiledTable) Close() error {
+	if ct.unmap == nil {
+		return nil
+	}
+	return ct.unmap()
+}
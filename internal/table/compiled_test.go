@@ -0,0 +1,160 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package table
+
+import (
+	"bytes"
+	"errors"
+	"io/ioutil"
+	"os"
+	"path/filepath"
+	"strconv"
+	"testing"
+)
+
+func TestCompiledTable(t *testing.T) {
+	dir, err := ioutil.TempDir("", "maddy-tests-")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer os.RemoveAll(dir)
+
+	test := func(entries map[string]string) {
+		t.Helper()
+
+		path := filepath.Join(dir, "table.mtbl")
+		var buf bytes.Buffer
+		if err := WriteCompiled(&buf, entries); err != nil {
+			t.Fatal(err)
+		}
+		if err := ioutil.WriteFile(path, buf.Bytes(), 0600); err != nil {
+			t.Fatal(err)
+		}
+
+		ct, err := openCompiled(path)
+		if err != nil {
+			t.Fatal(err)
+		}
+		defer ct.Close()
+
+		if ct.Len() != len(entries) {
+			t.Errorf("Wrong entries count: %d", ct.Len())
+		}
+		for k, v := range entries {
+			actual, ok, err := ct.Lookup(k)
+			if err != nil {
+				t.Fatal(err)
+			}
+			if !ok || actual != v {
+				t.Errorf("Wrong value for %q: %q, %v", k, actual, ok)
+			}
+		}
+		for _, k := range []string{"", "0", "zzzz", "a@example.org.", "\xff"} {
+			if _, ok := entries[k]; ok {
+				continue
+			}
+			if _, ok, err := ct.Lookup(k); ok || err != nil {
+				t.Errorf("Unexpected result for missing key %q: %v, %v", k, ok, err)
+			}
+		}
+	}
+
+	test(map[string]string{})
+	test(map[string]string{"a@example.org": "b@example.org"})
+	test(map[string]string{"a": "", "b": "c", "": "empty"})
+
+	big := make(map[string]string, 1000)
+	for i := 0; i < 1000; i++ {
+		big["user"+strconv.Itoa(i)+"@example.org"] = "target" + strconv.Itoa(i)
+	}
+	test(big)
+}
+
+func TestCompiledTable_Corrupted(t *testing.T) {
+	dir, err := ioutil.TempDir("", "maddy-tests-")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer os.RemoveAll(dir)
+
+	var buf bytes.Buffer
+	if err := WriteCompiled(&buf, map[string]string{"a": "b", "c": "d"}); err != nil {
+		t.Fatal(err)
+	}
+	blob := buf.Bytes()
+	path := filepath.Join(dir, "table.mtbl")
+
+	// Truncated records are detected on lookup.
+	if err := ioutil.WriteFile(path, blob[:len(blob)-2], 0600); err != nil {
+		t.Fatal(err)
+	}
+	ct, err := openCompiled(path)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if _, _, err := ct.Lookup("c"); !errors.Is(err, errCompiledCorrupted) {
+		t.Error("Truncated table is not detected:", err)
+	}
+	ct.Close()
+
+	// Truncated offsets list is detected on open.
+	if err := ioutil.WriteFile(path, blob[:compiledHeaderLen+4], 0600); err != nil {
+		t.Fatal(err)
+	}
+	if _, err := openCompiled(path); !errors.Is(err, errCompiledCorrupted) {
+		t.Error("Truncated table is not detected:", err)
+	}
+}
+
+func TestCompileFile(t *testing.T) {
+	dir, err := ioutil.TempDir("", "maddy-tests-")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer os.RemoveAll(dir)
+
+	src, dst := filepath.Join(dir, "aliases"), filepath.Join(dir, "aliases.mtbl")
+	if err := ioutil.WriteFile(src, []byte("# comment\na: b\nc: d, e\n"), 0600); err != nil {
+		t.Fatal(err)
+	}
+	count, err := CompileFile(src, dst)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if count != 2 {
+		t.Error("Wrong entries count:", count)
+	}
+
+	compiled, err := isCompiled(dst)
+	if err != nil || !compiled {
+		t.Fatal("Compiled table is not detected:", err)
+	}
+	if compiled, _ := isCompiled(src); compiled {
+		t.Fatal("Text file is detected as compiled")
+	}
+
+	ct, err := openCompiled(dst)
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer ct.Close()
+	if v, ok, _ := ct.Lookup("c"); !ok || v != "d, e" {
+		t.Errorf("Wrong value: %q", v)
+	}
+}
@@ -39,9 +39,14 @@ type File struct {
 	instName string
 	file     string
 
-	m      map[string]string
-	mLck   sync.RWMutex
-	mStamp time.Time
+	// Exactly one of m and compiled is used, depending on the file format.
+	// Both are never modified, reload replaces them.
+	m        map[string]string
+	compiled *compiledTable
+	mLck     sync.RWMutex
+	mStamp   time.Time
+	mSize    int64
+	timer    *lookupTimer
 
 	stopReloader chan struct{}
 	forceReload  chan struct{}
@@ -56,6 +61,7 @@ func NewFile(_, instName string, _, inlineArgs []string) (module.Module, error)
 		stopReloader: make(chan struct{}),
 		forceReload:  make(chan struct{}),
 		log:          log.Logger{Name: FileModName},
+		timer:        newLookupTimer(FileModName, instName),
 	}
 
 	switch len(inlineArgs) {
@@ -91,7 +97,7 @@ func (f *File) Init(cfg *config.Map) error {
 		f.file = file
 	}
 
-	if err := readFile(f.file, f.m); err != nil {
+	if err := f.reload(); err != nil {
 		if !os.IsNotExist(err) {
 			return err
 		}
@@ -108,6 +114,62 @@ func (f *File) Init(cfg *config.Map) error {
 
 var reloadInterval = 15 * time.Second
 
+// reload reads the file and replaces the current contents.
+//
+// Compiled tables (see WriteCompiled) are memory-mapped, so the reload
+// costs the same regardless of the table size. Text files are parsed into
+// a new map.
+func (f *File) reload() error {
+	info, err := os.Stat(f.file)
+	if err != nil {
+		return err
+	}
+
+	compiled, err := isCompiled(f.file)
+	if err != nil {
+		return err
+	}
+
+	var (
+		newm = map[string]string{}
+		newc *compiledTable
+	)
+	if compiled {
+		newc, err = openCompiled(f.file)
+		if err != nil {
+			return err
+		}
+	} else {
+		f.mLck.RLock()
+		newm = make(map[string]string, len(f.m)+5)
+		f.mLck.RUnlock()
+		if err := readFile(f.file, newm); err != nil {
+			return err
+		}
+	}
+
+	f.swap(newm, newc, info.ModTime(), info.Size())
+	return nil
+}
+
+func (f *File) swap(m map[string]string, c *compiledTable, stamp time.Time, size int64) {
+	f.mLck.Lock()
+	oldc := f.compiled
+	f.m = m
+	f.compiled = c
+	f.mStamp = stamp
+	f.mSize = size
+	f.mLck.Unlock()
+
+	// Lookups hold the read lock while accessing the mapping, so nobody
+	// uses it now.
+	if oldc != nil {
+		if err := oldc.Close(); err != nil {
+			f.log.Error("failed to unmap the compiled table", err)
+		}
+	}
+}
+
 func (f *File) reloader() {
 	defer func() {
 		if err := recover(); err != nil {
@@ -117,24 +179,26 @@ func (f *File) reloader() {
 	}()
 
 	t := time.NewTicker(reloadInterval)
+	defer t.Stop()
 
 	for {
 		select {
 		case <-t.C:
-			var latestStamp time.Time
 			info, err := os.Stat(f.file)
 			if err != nil {
 				if os.IsNotExist(err) {
-					f.mLck.Lock()
-					f.m = map[string]string{}
-					f.mStamp = time.Now()
-					f.mLck.Unlock()
+					f.swap(map[string]string{}, nil, time.Time{}, 0)
 					continue
 				}
 				f.log.Printf("%v", err)
+				continue
 			}
-			if info.ModTime().After(latestStamp) {
-				latestStamp = info.ModTime()
+
+			f.mLck.RLock()
+			changed := !info.ModTime().Equal(f.mStamp) || info.Size() != f.mSize
+			f.mLck.RUnlock()
+			if !changed {
+				continue
 			}
 		case <-f.forceReload:
 		case <-f.stopReloader:
@@ -144,8 +208,7 @@ func (f *File) reloader() {
 
 		f.log.Debugf("reloading")
 
-		newm := make(map[string]string, len(f.m)+5)
-		if err := readFile(f.file, newm); err != nil {
+		if err := f.reload(); err != nil {
 			if os.IsNotExist(err) {
 				f.log.Printf("ignoring non-existent file: %s", f.file)
 				continue
@@ -154,17 +217,14 @@ func (f *File) reloader() {
 			f.log.Println(err)
 			continue
 		}
-
-		f.mLck.Lock()
-		f.m = newm
-		f.mStamp = time.Now()
-		f.mLck.Unlock()
 	}
 }
 
 func (f *File) Close() error {
 	f.stopReloader <- struct{}{}
 	<-f.stopReloader
+
+	f.swap(map[string]string{}, nil, time.Time{}, 0)
 	return nil
 }
 
@@ -213,9 +273,15 @@ func readFile(path string, out map[string]string) error {
 }
 
 func (f *File) Lookup(val string) (string, bool, error) {
+	defer f.timer.observe(f.timer.start())
+
 	// The existing map is never modified, instead it is replaced with a new
 	// one if reload is performed.
 	f.mLck.RLock()
+	if f.compiled != nil {
+		defer f.mLck.RUnlock()
+		return f.compiled.Lookup(val)
+	}
 	usedFile := f.m
 	f.mLck.RUnlock()
 
@@ -21,6 +21,7 @@ package table
 import (
 	"io/ioutil"
 	"os"
+	"path/filepath"
 	"reflect"
 	"testing"
 	"time"
@@ -220,6 +221,59 @@ func TestFileReload_Removed(t *testing.T) {
 	}
 }
 
+func TestFile_Compiled(t *testing.T) {
+	t.Parallel()
+
+	dir, err := ioutil.TempDir("", "maddy-tests-")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer os.RemoveAll(dir)
+	src, path := filepath.Join(dir, "aliases"), filepath.Join(dir, "aliases.mtbl")
+
+	compile := func(text string) {
+		t.Helper()
+		if err := ioutil.WriteFile(src, []byte(text), 0600); err != nil {
+			t.Fatal(err)
+		}
+		if _, err := CompileFile(src, path); err != nil {
+			t.Fatal(err)
+		}
+	}
+	compile("cat: dog")
+
+	mod, err := NewFile("", "", nil, []string{path})
+	if err != nil {
+		t.Fatal(err)
+	}
+	m := mod.(*File)
+	m.log = testutils.Logger(t, FileModName)
+	defer m.Close()
+
+	if err := mod.Init(&config.Map{Block: config.Node{}}); err != nil {
+		t.Fatal(err)
+	}
+	if val, ok, err := m.Lookup("cat"); err != nil || !ok || val != "dog" {
+		t.Fatal("Wrong lookup result:", val, ok, err)
+	}
+
+	time.Sleep(250 * time.Millisecond)
+	compile("dog: cat\nmouse: cheese")
+
+	for i := 0; i < 10; i++ {
+		time.Sleep(reloadInterval + 50*time.Millisecond)
+		if _, ok, _ := m.Lookup("mouse"); ok {
+			break
+		}
+	}
+	if val, ok, err := m.Lookup("mouse"); err != nil || !ok || val != "cheese" {
+		t.Fatal("New table was not loaded:", val, ok, err)
+	}
+	if _, ok, _ := m.Lookup("cat"); ok {
+		t.Fatal("Old table is still used")
+	}
+}
+
 func init() {
 	reloadInterval = 250 * time.Millisecond
 }
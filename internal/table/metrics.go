@@ -0,0 +1,65 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package table
+
+import (
+	"time"
+
+	"github.com/foxcpp/maddy/internal/metrics"
+	"github.com/prometheus/client_golang/prometheus"
+)
+
+var lookupDuration = prometheus.NewHistogramVec(
+	prometheus.HistogramOpts{
+		Namespace: "maddy",
+		Subsystem: "table",
+		Name:      "lookup_duration_seconds",
+		Help:      "Time spent in table lookups (only a sample of lookups is measured)",
+		Buckets:   metrics.LatencyBuckets,
+	},
+	[]string{"table"},
+)
+
+// lookupTimer measures a sample of lookups made using a table instance.
+type lookupTimer struct {
+	sampler  metrics.Sampler
+	duration prometheus.Observer
+}
+
+func newLookupTimer(modName, instName string) *lookupTimer {
+	return &lookupTimer{
+		duration: lookupDuration.WithLabelValues(modName + ":" + instName),
+	}
+}
+
+// start should be called before the lookup and its result passed to
+// observe after it, e.g.
+//
+//	defer t.observe(t.start())
+func (t *lookupTimer) start() time.Time {
+	return t.sampler.Start()
+}
+
+func (t *lookupTimer) observe(start time.Time) {
+	metrics.Observe(t.duration, start)
+}
+
+func init() {
+	prometheus.MustRegister(lookupDuration)
+}
@@ -66,6 +66,17 @@ func (r *Regexp) Init(cfg *config.Map) error {
 		r.replacement = r.inlineArgs[1]
 	}
 
+	var err error
+	r.re, err = regexp.Compile(regexpExpr(regex, fullMatch, caseInsensitive))
+	if err != nil {
+		return fmt.Errorf("%s: %v", r.modName, err)
+	}
+	return nil
+}
+
+// regexpExpr applies full_match and case_insensitive options to the
+// regular expression.
+func regexpExpr(regex string, fullMatch, caseInsensitive bool) string {
 	if fullMatch {
 		if !strings.HasPrefix(regex, "^") {
 			regex = "^" + regex
@@ -79,12 +90,7 @@ func (r *Regexp) Init(cfg *config.Map) error {
 		regex = "(?i)" + regex
 	}
 
-	var err error
-	r.re, err = regexp.Compile(regex)
-	if err != nil {
-		return fmt.Errorf("%s: %v", r.modName, err)
-	}
-	return nil
+	return regex
 }
 
 func (r *Regexp) Name() string {
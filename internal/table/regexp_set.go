@@ -0,0 +1,320 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package table
+
+import (
+	"regexp"
+	"regexp/syntax"
+	"unicode/utf8"
+
+	"github.com/foxcpp/maddy/framework/config"
+	"github.com/foxcpp/maddy/framework/module"
+)
+
+type regexpSetEntry struct {
+	re          *regexp.Regexp
+	replacement string
+}
+
+// RegexpSet is a table.regexp for multiple regular expressions, the first
+// matching one is used.
+//
+// Go regexp package has no DFA, so a single alternation of all expressions
+// is slower than trying them one by one. Instead, literal strings that must
+// be present in any match of each expression are put into an Aho-Corasick
+// automaton. The key is scanned once to find expressions that may match and
+// only these are tried.
+type RegexpSet struct {
+	modName  string
+	instName string
+
+	entries []regexpSetEntry
+	// Entries without any required literals, these are always tried.
+	unfiltered []int
+	literals   literalMatcher
+
+	expandPlaceholders bool
+}
+
+func NewRegexpSet(modName, instName string, _, _ []string) (module.Module, error) {
+	return &RegexpSet{
+		modName:  modName,
+		instName: instName,
+	}, nil
+}
+
+func (r *RegexpSet) Init(cfg *config.Map) error {
+	var (
+		fullMatch       bool
+		caseInsensitive bool
+		exprs           []config.Node
+	)
+	cfg.Bool("full_match", false, true, &fullMatch)
+	cfg.Bool("case_insensitive", false, true, &caseInsensitive)
+	cfg.Bool("expand_placeholders", false, true, &r.expandPlaceholders)
+	cfg.Callback("entry", func(m *config.Map, node config.Node) error {
+		if len(node.Args) != 1 && len(node.Args) != 2 {
+			return config.NodeErr(node, "expected one or two arguments")
+		}
+		exprs = append(exprs, node)
+		return nil
+	})
+	if _, err := cfg.Process(); err != nil {
+		return err
+	}
+
+	r.literals.init()
+	for _, node := range exprs {
+		expr := regexpExpr(node.Args[0], fullMatch, caseInsensitive)
+		re, err := regexp.Compile(expr)
+		if err != nil {
+			return config.NodeErr(node, "%v", err)
+		}
+		parsed, err := syntax.Parse(expr, syntax.Perl)
+		if err != nil {
+			return config.NodeErr(node, "%v", err)
+		}
+
+		e := regexpSetEntry{re: re}
+		if len(node.Args) == 2 {
+			e.replacement = node.Args[1]
+		}
+		r.entries = append(r.entries, e)
+
+		lits := requiredLiterals(parsed)
+		if lits == nil {
+			r.unfiltered = append(r.unfiltered, len(r.entries)-1)
+			continue
+		}
+		for _, lit := range lits {
+			r.literals.add(lit, len(r.entries)-1)
+		}
+	}
+	r.literals.build()
+
+	return nil
+}
+
+func (r *RegexpSet) Name() string {
+	return r.modName
+}
+
+func (r *RegexpSet) InstanceName() string {
+	return r.instName
+}
+
+func (r *RegexpSet) Lookup(key string) (string, bool, error) {
+	for i := 0; i < len(key); i++ {
+		if key[i] >= utf8.RuneSelf {
+			// Case folding of non-ASCII characters can make them match ASCII
+			// literals, e.g. U+212A KELVIN SIGN matches (?i)k.
+			return r.lookupAll(key)
+		}
+	}
+
+	candidates := make([]bool, len(r.entries))
+	for _, i := range r.unfiltered {
+		candidates[i] = true
+	}
+	r.literals.match(key, func(i int) {
+		candidates[i] = true
+	})
+
+	for i, ok := range candidates {
+		if !ok {
+			continue
+		}
+		if val, ok := r.tryEntry(i, key); ok {
+			return val, true, nil
+		}
+	}
+	return "", false, nil
+}
+
+func (r *RegexpSet) lookupAll(key string) (string, bool, error) {
+	for i := range r.entries {
+		if val, ok := r.tryEntry(i, key); ok {
+			return val, true, nil
+		}
+	}
+	return "", false, nil
+}
+
+func (r *RegexpSet) tryEntry(i int, key string) (string, bool) {
+	e := r.entries[i]
+	matches := e.re.FindStringSubmatchIndex(key)
+	if matches == nil {
+		return "", false
+	}
+
+	if !r.expandPlaceholders {
+		return e.replacement, true
+	}
+
+	return string(e.re.ExpandString([]byte{}, e.replacement, key, matches)), true
+}
+
+// requiredLiterals returns the list of strings such that any string matching
+// re contains at least one of them. Returned strings are in lower case.
+//
+// nil is returned if there is no such list or it can not be determined.
+// Only ASCII literals are considered.
+func requiredLiterals(re *syntax.Regexp) []string {
+	switch re.Op {
+	case syntax.OpLiteral:
+		lit := make([]byte, 0, len(re.Rune))
+		for _, ch := range re.Rune {
+			if ch >= utf8.RuneSelf {
+				return nil
+			}
+			lit = append(lit, asciiLower(byte(ch)))
+		}
+		return []string{string(lit)}
+	case syntax.OpCapture, syntax.OpPlus:
+		return requiredLiterals(re.Sub[0])
+	case syntax.OpRepeat:
+		if re.Min == 0 {
+			return nil
+		}
+		return requiredLiterals(re.Sub[0])
+	case syntax.OpConcat:
+		var best []string
+		for _, sub := range re.Sub {
+			lits := requiredLiterals(sub)
+			if lits != nil && (best == nil || shortestLen(lits) > shortestLen(best)) {
+				best = lits
+			}
+		}
+		return best
+	case syntax.OpAlternate:
+		var all []string
+		for _, sub := range re.Sub {
+			lits := requiredLiterals(sub)
+			if lits == nil {
+				return nil
+			}
+			all = append(all, lits...)
+		}
+		return all
+	}
+	return nil
+}
+
+func shortestLen(lits []string) int {
+	min := len(lits[0])
+	for _, lit := range lits[1:] {
+		if len(lit) < min {
+			min = len(lit)
+		}
+	}
+	return min
+}
+
+func asciiLower(ch byte) byte {
+	if 'A' <= ch && ch <= 'Z' {
+		return ch + ('a' - 'A')
+	}
+	return ch
+}
+
+type literalNode struct {
+	next map[byte]int
+	fail int
+	// Indexes of entries with literals ending at this node, including ones
+	// reachable via fail links.
+	out []int
+}
+
+// literalMatcher is an Aho-Corasick automaton that finds all literals
+// contained in a string in one pass, ignoring ASCII letter case.
+type literalMatcher struct {
+	nodes []literalNode
+}
+
+func (m *literalMatcher) init() {
+	m.nodes = []literalNode{{next: map[byte]int{}}}
+}
+
+func (m *literalMatcher) add(lit string, entry int) {
+	state := 0
+	for i := 0; i < len(lit); i++ {
+		next, ok := m.nodes[state].next[lit[i]]
+		if !ok {
+			next = len(m.nodes)
+			m.nodes = append(m.nodes, literalNode{next: map[byte]int{}})
+			m.nodes[state].next[lit[i]] = next
+		}
+		state = next
+	}
+	m.nodes[state].out = append(m.nodes[state].out, entry)
+}
+
+// build computes fail links, it should be called after all literals are
+// added.
+func (m *literalMatcher) build() {
+	queue := make([]int, 0, len(m.nodes))
+	for _, child := range m.nodes[0].next {
+		queue = append(queue, child)
+	}
+	for len(queue) != 0 {
+		state := queue[0]
+		queue = queue[1:]
+
+		for ch, child := range m.nodes[state].next {
+			fail := m.nodes[state].fail
+			for {
+				if next, ok := m.nodes[fail].next[ch]; ok {
+					m.nodes[child].fail = next
+					break
+				}
+				if fail == 0 {
+					break
+				}
+				fail = m.nodes[fail].fail
+			}
+			failOut := m.nodes[m.nodes[child].fail].out
+			m.nodes[child].out = append(m.nodes[child].out, failOut...)
+			queue = append(queue, child)
+		}
+	}
+}
+
+func (m *literalMatcher) match(s string, found func(entry int)) {
+	state := 0
+	for i := 0; i < len(s); i++ {
+		ch := asciiLower(s[i])
+		for {
+			if next, ok := m.nodes[state].next[ch]; ok {
+				state = next
+				break
+			}
+			if state == 0 {
+				break
+			}
+			state = m.nodes[state].fail
+		}
+		for _, entry := range m.nodes[state].out {
+			found(entry)
+		}
+	}
+}
+
+func init() {
+	module.Register("table.regexp_set", NewRegexpSet)
+}
@@ -0,0 +1,144 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package table
+
+import (
+	"fmt"
+	"testing"
+
+	"github.com/foxcpp/maddy/framework/config"
+)
+
+func initRegexpSet(t testing.TB, opts []config.Node, entries [][]string) *RegexpSet {
+	children := append([]config.Node{}, opts...)
+	for _, e := range entries {
+		children = append(children, config.Node{Name: "entry", Args: e})
+	}
+
+	mod, err := NewRegexpSet("table.regexp_set", "", nil, nil)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if err := mod.Init(config.NewMap(nil, config.Node{Children: children})); err != nil {
+		t.Fatal(err)
+	}
+	return mod.(*RegexpSet)
+}
+
+func TestRegexpSet(t *testing.T) {
+	r := initRegexpSet(t, nil, [][]string{
+		{`postmaster@.*`, "admin@example.org"},
+		{`(.+)\+bounce@example\.org`, "$1@example.org"},
+		{`[a-z]+@example\.(org|com)`, "match-$1"},
+		{`.*@example\.org`, "catch-all"},
+		{`hostmaster|webmaster`},
+	})
+
+	test := func(key, wantVal string, wantOk bool) {
+		t.Helper()
+		for name, lookup := range map[string]func(string) (string, bool, error){
+			"Lookup":    r.Lookup,
+			"lookupAll": r.lookupAll,
+		} {
+			val, ok, err := lookup(key)
+			if err != nil {
+				t.Fatal(err)
+			}
+			if val != wantVal || ok != wantOk {
+				t.Errorf("%s(%q) = %q, %v; want %q, %v", name, key, val, ok, wantVal, wantOk)
+			}
+		}
+	}
+
+	test("postmaster@example.org", "admin@example.org", true)
+	test("PostMaster@example.com", "admin@example.org", true)
+	test("foo+bounce@example.org", "foo@example.org", true)
+	test("foo@example.com", "match-com", true)
+	test("FOO@EXAMPLE.ORG", "match-ORG", true)
+	test("foo+bar@example.org", "catch-all", true)
+	test("foo+bar@example.com", "", false)
+	test("webmaster", "", true)
+	test("webmaster@example.net", "", false)
+	// Matched via case folding, make sure prefiltering does not skip it.
+	test("po\u017ftmaster@example.org", "admin@example.org", true)
+	test("\u212a@example.com", "match-com", true)
+}
+
+func TestRequiredLiterals(t *testing.T) {
+	r := initRegexpSet(t, nil, [][]string{
+		{`(?i)ab+c[0-9]*DEFG`},
+		{`x|yz`},
+		{`(abc){2,3}`},
+		{`a*b?`},
+		{`ü+`},
+	})
+	if len(r.unfiltered) != 2 || r.unfiltered[0] != 3 || r.unfiltered[1] != 4 {
+		t.Fatal("Wrong unfiltered entries:", r.unfiltered)
+	}
+
+	found := map[int]bool{}
+	r.literals.match("xdefg", func(i int) { found[i] = true })
+	if !found[0] || !found[1] || found[2] || len(found) != 2 {
+		t.Fatal("Wrong literal matches:", found)
+	}
+}
+
+func benchPatterns(n int) [][]string {
+	entries := make([][]string, 0, n)
+	for i := 0; i < n; i++ {
+		entries = append(entries, []string{fmt.Sprintf(`([a-z]+)\+bounce%d@example%d\.org`, i, i%7), "$1"})
+	}
+	return entries
+}
+
+func BenchmarkRegexpSet(b *testing.B) {
+	r := initRegexpSet(b, nil, benchPatterns(500))
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		if _, ok, _ := r.Lookup("postmaster+bounce499@example2.org"); !ok {
+			b.Fatal("no match")
+		}
+	}
+}
+
+func BenchmarkRegexpChain(b *testing.B) {
+	var chain []*Regexp
+	for _, e := range benchPatterns(500) {
+		mod, err := NewRegexp("table.regexp", "", nil, e)
+		if err != nil {
+			b.Fatal(err)
+		}
+		if err := mod.Init(config.NewMap(nil, config.Node{})); err != nil {
+			b.Fatal(err)
+		}
+		chain = append(chain, mod.(*Regexp))
+	}
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		ok := false
+		for _, r := range chain {
+			if _, ok, _ = r.Lookup("postmaster+bounce499@example2.org"); ok {
+				break
+			}
+		}
+		if !ok {
+			b.Fatal("no match")
+		}
+	}
+}
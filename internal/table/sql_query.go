@@ -33,6 +33,7 @@ type SQL struct {
 	instName string
 
 	namedArgs bool
+	timer     *lookupTimer
 
 	db     *sql.DB
 	lookup *sql.Stmt
@@ -46,6 +47,7 @@ func NewSQL(modName, instName string, _, _ []string) (module.Module, error) {
 	return &SQL{
 		modName:  modName,
 		instName: instName,
+		timer:    newLookupTimer(modName, instName),
 	}, nil
 }
 
@@ -138,6 +140,8 @@ func (s *SQL) Close() error {
 }
 
 func (s *SQL) Lookup(val string) (string, bool, error) {
+	defer s.timer.observe(s.timer.start())
+
 	var (
 		repl string
 		row  *sql.Row
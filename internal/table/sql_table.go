@@ -41,6 +41,7 @@ func NewSQLTable(modName, instName string, _, _ []string) (module.Module, error)
 		wrapped: &SQL{
 			modName:  modName,
 			instName: instName,
+			timer:    newLookupTimer(modName, instName),
 		},
 	}, nil
 }
@@ -0,0 +1,242 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package queue
+
+import (
+	"bufio"
+	"encoding/binary"
+	"errors"
+	"hash/crc32"
+	"io"
+	"io/ioutil"
+	"os"
+	"path/filepath"
+	"time"
+)
+
+// indexEntry is the part of message meta-data needed to schedule the next
+// delivery attempt.
+type indexEntry struct {
+	ID          string
+	Domain      string
+	LastAttempt time.Time
+
+	// Smallest amount of tries across all recipients.
+	TriesCount int
+}
+
+func newIndexEntry(meta *QueueMetadata) indexEntry {
+	smallestTriesCount := 999999
+	for _, count := range meta.TriesCount {
+		if smallestTriesCount > count {
+			smallestTriesCount = count
+		}
+	}
+	return indexEntry{
+		ID:          meta.MsgMeta.ID,
+		Domain:      destDomain(meta.To),
+		LastAttempt: meta.LastAttempt,
+		TriesCount:  smallestTriesCount,
+	}
+}
+
+// The index file is a snapshot of indexEntry for all messages in the queue
+// directory. It is rewritten periodically and is used to schedule messages
+// on startup without decoding each .meta file.
+//
+// Format:
+//
+//	magic "MQIX", u8 version, u32 entry count,
+//	for each entry: u16 ID length, ID, u16 Domain length, Domain,
+//	  i64 LastAttempt (Unix ns), u32 TriesCount,
+//	u32 CRC-32C of everything above.
+//
+// The index is advisory: entries may be stale, the real meta-data is still
+// read from the .meta file when the message is due.
+const (
+	indexFileName = "queue.index"
+	indexMagic    = "MQIX"
+	indexVersion  = 2
+
+	indexFlushInterval = 10 * time.Second
+)
+
+var (
+	indexCRCTable = crc32.MakeTable(crc32.Castagnoli)
+
+	errIndexCorrupted = errors.New("queue: index file is corrupted")
+)
+
+func writeIndex(path string, entries map[string]indexEntry) error {
+	f, err := os.Create(path + ".new")
+	if err != nil {
+		return err
+	}
+	defer f.Close()
+
+	crc := crc32.New(indexCRCTable)
+	w := bufio.NewWriter(io.MultiWriter(f, crc))
+
+	var buf [14]byte
+	copy(buf[:4], indexMagic)
+	buf[4] = indexVersion
+	binary.BigEndian.PutUint32(buf[5:9], uint32(len(entries)))
+	if _, err := w.Write(buf[:9]); err != nil {
+		return err
+	}
+	for _, ent := range entries {
+		for _, str := range [...]string{ent.ID, ent.Domain} {
+			binary.BigEndian.PutUint16(buf[:2], uint16(len(str)))
+			if _, err := w.Write(buf[:2]); err != nil {
+				return err
+			}
+			if _, err := w.WriteString(str); err != nil {
+				return err
+			}
+		}
+		binary.BigEndian.PutUint64(buf[:8], uint64(ent.LastAttempt.UnixNano()))
+		binary.BigEndian.PutUint32(buf[8:12], uint32(ent.TriesCount))
+		if _, err := w.Write(buf[:12]); err != nil {
+			return err
+		}
+	}
+	if err := w.Flush(); err != nil {
+		return err
+	}
+
+	binary.BigEndian.PutUint32(buf[:4], crc.Sum32())
+	if _, err := f.Write(buf[:4]); err != nil {
+		return err
+	}
+	if err := f.Close(); err != nil {
+		return err
+	}
+
+	// No fsync: torn or missing index is detected by readIndex and the full
+	// directory scan is done instead.
+	return os.Rename(path+".new", path)
+}
+
+func readIndex(path string) (map[string]indexEntry, error) {
+	blob, err := ioutil.ReadFile(path)
+	if err != nil {
+		return nil, err
+	}
+	if len(blob) < 13 || string(blob[:4]) != indexMagic || blob[4] != indexVersion {
+		return nil, errIndexCorrupted
+	}
+	data, sum := blob[:len(blob)-4], blob[len(blob)-4:]
+	if crc32.Checksum(data, indexCRCTable) != binary.BigEndian.Uint32(sum) {
+		return nil, errIndexCorrupted
+	}
+
+	count := binary.BigEndian.Uint32(data[5:9])
+	data = data[9:]
+	entries := make(map[string]indexEntry, count)
+	readString := func() (string, bool) {
+		if len(data) < 2 {
+			return "", false
+		}
+		strLen := int(binary.BigEndian.Uint16(data[:2]))
+		if len(data) < 2+strLen {
+			return "", false
+		}
+		str := string(data[2 : 2+strLen])
+		data = data[2+strLen:]
+		return str, true
+	}
+	for i := uint32(0); i < count; i++ {
+		var (
+			ent       indexEntry
+			idOk, dOk bool
+		)
+		ent.ID, idOk = readString()
+		ent.Domain, dOk = readString()
+		if !idOk || !dOk || len(data) < 12 {
+			return nil, errIndexCorrupted
+		}
+		ent.LastAttempt = time.Unix(0, int64(binary.BigEndian.Uint64(data[:8])))
+		ent.TriesCount = int(binary.BigEndian.Uint32(data[8:12]))
+		data = data[12:]
+
+		entries[ent.ID] = ent
+	}
+	if len(data) != 0 {
+		return nil, errIndexCorrupted
+	}
+
+	return entries, nil
+}
+
+func (s *fileStore) indexPath() string {
+	return filepath.Join(s.location, indexFileName)
+}
+
+func (s *fileStore) setIndex(ent indexEntry) {
+	s.idxLck.Lock()
+	defer s.idxLck.Unlock()
+	s.idx[ent.ID] = ent
+	s.idxDirty = true
+}
+
+func (s *fileStore) dropIndex(id string) {
+	s.idxLck.Lock()
+	defer s.idxLck.Unlock()
+	delete(s.idx, id)
+	s.idxDirty = true
+}
+
+func (s *fileStore) flushIndex() error {
+	s.idxLck.Lock()
+	if !s.idxDirty {
+		s.idxLck.Unlock()
+		return nil
+	}
+	snapshot := make(map[string]indexEntry, len(s.idx))
+	for id, ent := range s.idx {
+		snapshot[id] = ent
+	}
+	s.idxDirty = false
+	s.idxLck.Unlock()
+
+	if err := writeIndex(s.indexPath(), snapshot); err != nil {
+		s.idxLck.Lock()
+		s.idxDirty = true
+		s.idxLck.Unlock()
+		return err
+	}
+	return nil
+}
+
+func (s *fileStore) indexLoop() {
+	defer close(s.stopped)
+
+	t := time.NewTicker(indexFlushInterval)
+	defer t.Stop()
+	for {
+		select {
+		case <-t.C:
+			if err := s.flushIndex(); err != nil {
+				s.log.Error("failed to write queue index", err)
+			}
+		case <-s.stop:
+			return
+		}
+	}
+}
@@ -0,0 +1,137 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package queue
+
+import (
+	"io/ioutil"
+	"os"
+	"path/filepath"
+	"strconv"
+	"testing"
+	"time"
+
+	"github.com/emersion/go-message/textproto"
+	"github.com/foxcpp/maddy/framework/buffer"
+	"github.com/foxcpp/maddy/framework/log"
+	"github.com/foxcpp/maddy/framework/module"
+)
+
+func TestIndexRoundtrip(t *testing.T) {
+	dir, err := ioutil.TempDir("", "maddy-tests-queue")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer os.RemoveAll(dir)
+
+	path := filepath.Join(dir, indexFileName)
+	entries := map[string]indexEntry{
+		"msg1": {ID: "msg1", LastAttempt: time.Unix(1600000000, 123), TriesCount: 1},
+		"msg2": {ID: "msg2", LastAttempt: time.Unix(1600000001, 0), TriesCount: 999999},
+	}
+	if err := writeIndex(path, entries); err != nil {
+		t.Fatal(err)
+	}
+
+	read, err := readIndex(path)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if len(read) != len(entries) {
+		t.Fatal("Wrong amount of entries:", len(read))
+	}
+	for id, ent := range entries {
+		got := read[id]
+		if got.ID != ent.ID || !got.LastAttempt.Equal(ent.LastAttempt) || got.TriesCount != ent.TriesCount {
+			t.Errorf("Wrong entry for %s: %+v", id, got)
+		}
+	}
+
+	// Any damage should be detected.
+	blob, err := ioutil.ReadFile(path)
+	if err != nil {
+		t.Fatal(err)
+	}
+	blob[12] ^= 0xFF
+	if err := ioutil.WriteFile(path, blob, 0600); err != nil {
+		t.Fatal(err)
+	}
+	if _, err := readIndex(path); err != errIndexCorrupted {
+		t.Error("Corrupted index is not detected:", err)
+	}
+}
+
+func TestFileStore_Index(t *testing.T) {
+	dir, err := ioutil.TempDir("", "maddy-tests-queue")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer os.RemoveAll(dir)
+
+	s := newFileStore(dir, log.Logger{Out: log.NopOutput{}})
+	for i := 0; i < 3; i++ {
+		id := "msg" + strconv.Itoa(i)
+		if _, err := s.Store(&QueueMetadata{
+			MsgMeta:    &module.MsgMetadata{ID: id},
+			TriesCount: map[string]int{"rcpt@example.org": i},
+		}, textproto.Header{}, buffer.MemoryBuffer{Slice: []byte("body")}); err != nil {
+			t.Fatal(err)
+		}
+	}
+	s.Remove(&module.MsgMetadata{ID: "msg0"})
+	if err := s.Close(); err != nil {
+		t.Fatal(err)
+	}
+
+	saved, err := readIndex(filepath.Join(dir, indexFileName))
+	if err != nil {
+		t.Fatal(err)
+	}
+	if len(saved) != 2 || saved["msg1"].TriesCount != 1 || saved["msg2"].TriesCount != 2 {
+		t.Fatalf("Wrong index contents: %+v", saved)
+	}
+
+	load := func() map[string]indexEntry {
+		t.Helper()
+		s := newFileStore(dir, log.Logger{Out: log.NopOutput{}})
+		defer s.Close()
+		loaded := map[string]indexEntry{}
+		if err := s.Load(func(ent indexEntry) {
+			loaded[ent.ID] = ent
+		}); err != nil {
+			t.Fatal(err)
+		}
+		return loaded
+	}
+
+	// Messages removed after the index was written should be ignored.
+	if err := os.Remove(filepath.Join(dir, "msg1.meta")); err != nil {
+		t.Fatal(err)
+	}
+	if loaded := load(); len(loaded) != 1 || loaded["msg2"].TriesCount != 2 {
+		t.Errorf("Wrong loaded entries: %+v", loaded)
+	}
+
+	// Broken index should not prevent scheduling.
+	if err := ioutil.WriteFile(filepath.Join(dir, indexFileName), []byte("garbage"), 0600); err != nil {
+		t.Fatal(err)
+	}
+	if loaded := load(); len(loaded) != 1 || loaded["msg2"].TriesCount != 2 {
+		t.Errorf("Wrong loaded entries with broken index: %+v", loaded)
+	}
+}
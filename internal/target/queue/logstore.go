@@ -0,0 +1,1056 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package queue
+
+import (
+	"bufio"
+	"bytes"
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"hash/crc32"
+	"io"
+	"io/ioutil"
+	"math"
+	"os"
+	"path/filepath"
+	"runtime"
+	"sort"
+	"strconv"
+	"strings"
+	"sync"
+	"time"
+
+	"github.com/emersion/go-message/textproto"
+	"github.com/foxcpp/maddy/framework/buffer"
+	"github.com/foxcpp/maddy/framework/log"
+	"github.com/foxcpp/maddy/framework/module"
+)
+
+/*
+logStore keeps messages in a set of append-only segment files named
+SEQUENCE.seg. The last segment is the active one, all new records are
+appended to it.
+
+Record format (all integers are big-endian):
+
+	<payload length, u32> <CRC-32C of type and payload, u32> <type, u8> <payload>
+
+Payload of each record type:
+
+	message: <ID length, u16> <ID> <meta length, u32> <meta> <header length, u32> <header> <body>
+	meta:    <ID length, u16> <ID> <meta length, u32> <meta>
+	remove:  <ID length, u16> <ID>
+
+Concurrent writers share fsync calls (group commit): after appending a
+record, the writer waits for a single fsync that covers all records appended
+before it started.
+
+Space for a record is reserved under the store lock and its header is
+written with the final length but an empty checksum, the payload is then
+copied without holding the lock. Thus replay can skip a record that was
+never completed (e.g. the message body failed to be read) even if records
+reserved after it were persisted.
+
+Segments are compacted oldest-first: live messages are copied from the
+oldest segment to the active one and then the oldest segment is deleted.
+Since the deleted segment is always the oldest one, 'remove' records in it
+can refer only to messages in the same segment and are not needed anymore.
+
+The oldest segment is compacted once it contains less live data than there
+is unused data in all sealed segments. Thus a single long-living message
+at the head cannot prevent newer unused segments from being reclaimed: it is
+copied as soon as this frees at least as much space as gets written.
+*/
+
+const (
+	logRecMessage byte = 1
+	logRecMeta    byte = 2
+	logRecRemove  byte = 3
+
+	logRecHeaderLen = 9
+
+	logCompactInterval = 1 * time.Minute
+)
+
+var logCRCTable = crc32.MakeTable(crc32.Castagnoli)
+
+var logWriterPool = sync.Pool{
+	New: func() interface{} {
+		return bufio.NewWriterSize(nil, 64*1024)
+	},
+}
+
+type logSegment struct {
+	seq  uint64
+	path string
+	f    *os.File
+
+	// Offset of the next record.
+	size int64
+	// Total length of records that are still needed.
+	live int64
+	// Amount of records reserved, but not yet completed.
+	writers int
+}
+
+type logLoc struct {
+	seg *logSegment
+	// Offset and length of the whole record.
+	off, len int64
+}
+
+type logEntry struct {
+	msg logLoc
+	// Location of the latest meta-data record. Equal to msg if meta-data was
+	// never updated.
+	meta logLoc
+
+	// Absolute offsets of record parts within segment files.
+	metaOff, metaLen int64 // in meta.seg
+	hdrOff, hdrLen   int64 // in msg.seg
+	bodyOff, bodyLen int64 // in msg.seg
+}
+
+func (e *logEntry) separateMeta() bool {
+	return e.meta != e.msg
+}
+
+type logStore struct {
+	dir         string
+	segmentSize int64
+	log         log.Logger
+
+	// wrapMoved, if set, wraps body readers used by compaction. Used in
+	// tests.
+	wrapMoved func(io.Reader) io.Reader
+
+	// mu protects all fields below, segments slice and segment offsets.
+	mu       sync.RWMutex
+	segments []*logSegment
+	index    map[string]*logEntry
+	writeGen uint64
+
+	// syncLck serializes fsync calls. It should always be acquired before
+	// mu.
+	syncLck   sync.Mutex
+	syncedGen uint64
+
+	closeOnce sync.Once
+	stop      chan struct{}
+	stopped   chan struct{}
+}
+
+func segmentName(seq uint64) string {
+	return fmt.Sprintf("%016x.seg", seq)
+}
+
+func openLogStore(dir string, segmentSize int64, log log.Logger) (*logStore, error) {
+	if segmentSize <= 0 {
+		return nil, errors.New("queue: segment_size should be positive")
+	}
+
+	l := &logStore{
+		dir:         dir,
+		segmentSize: segmentSize,
+		log:         log,
+		index:       map[string]*logEntry{},
+		stop:        make(chan struct{}),
+		stopped:     make(chan struct{}),
+	}
+
+	dirInfo, err := ioutil.ReadDir(dir)
+	if err != nil {
+		return nil, err
+	}
+	hasMetaFiles := false
+	for _, entry := range dirInfo {
+		name := entry.Name()
+		if strings.HasSuffix(name, ".meta") {
+			hasMetaFiles = true
+		}
+		if entry.IsDir() || !strings.HasSuffix(name, ".seg") {
+			continue
+		}
+		seq, err := strconv.ParseUint(strings.TrimSuffix(name, ".seg"), 16, 64)
+		if err != nil {
+			l.log.Printf("ignoring unexpected file in queue directory: %s", name)
+			continue
+		}
+		f, err := os.OpenFile(filepath.Join(dir, name), os.O_RDWR, 0)
+		if err != nil {
+			l.closeFiles()
+			return nil, err
+		}
+		l.segments = append(l.segments, &logSegment{
+			seq:  seq,
+			path: filepath.Join(dir, name),
+			f:    f,
+		})
+	}
+	if hasMetaFiles {
+		l.log.Printf("queue directory contains messages stored using 'files' format, they will be ignored")
+	}
+	sort.Slice(l.segments, func(i, j int) bool {
+		return l.segments[i].seq < l.segments[j].seq
+	})
+
+	for i, seg := range l.segments {
+		if err := l.replay(seg, i == len(l.segments)-1); err != nil {
+			l.closeFiles()
+			return nil, err
+		}
+	}
+	for _, ent := range l.index {
+		ent.msg.seg.live += ent.msg.len
+		if ent.separateMeta() {
+			ent.meta.seg.live += ent.meta.len
+		}
+	}
+
+	if len(l.segments) == 0 {
+		if _, err := l.rotate(); err != nil {
+			return nil, err
+		}
+	}
+
+	go l.compactLoop()
+
+	return l, nil
+}
+
+func (l *logStore) closeFiles() {
+	for _, seg := range l.segments {
+		seg.f.Close()
+	}
+}
+
+func (l *logStore) active() *logSegment {
+	return l.segments[len(l.segments)-1]
+}
+
+// readLogField reads a length-prefixed field. lenSize is either 2 or 4.
+func readLogField(r io.Reader, lenSize int) ([]byte, error) {
+	var l [4]byte
+	if _, err := io.ReadFull(r, l[:lenSize]); err != nil {
+		return nil, err
+	}
+	var n uint32
+	if lenSize == 2 {
+		n = uint32(binary.BigEndian.Uint16(l[:2]))
+	} else {
+		n = binary.BigEndian.Uint32(l[:4])
+	}
+	buf := make([]byte, n)
+	if _, err := io.ReadFull(r, buf); err != nil {
+		return nil, err
+	}
+	return buf, nil
+}
+
+// replay reads all records from the segment and applies them to the index.
+//
+// Incomplete records with a valid header are skipped. If the segment ends
+// with an incomplete record (e.g. due to a crash in the middle of write) and
+// it is the last one, it is truncated.
+func (l *logStore) replay(seg *logSegment, last bool) error {
+	if _, err := seg.f.Seek(0, io.SeekStart); err != nil {
+		return err
+	}
+	info, err := seg.f.Stat()
+	if err != nil {
+		return err
+	}
+	br := bufio.NewReaderSize(seg.f, 64*1024)
+
+	var off int64
+	for {
+		ent, id, typ, recLen, err := readLogRecord(br, seg, off)
+		if err == io.EOF {
+			break
+		}
+		if err != nil && recLen != 0 && off+recLen <= info.Size() {
+			// Record that was reserved, but not completed.
+			l.log.Printf("segment %s: skipping incomplete record at offset %d: %v", seg.path, off, err)
+			off += recLen
+			if _, err := seg.f.Seek(off, io.SeekStart); err != nil {
+				return err
+			}
+			br.Reset(seg.f)
+			continue
+		}
+		if err != nil {
+			l.log.Printf("segment %s: corrupted record at offset %d, ignoring the rest of segment: %v", seg.path, off, err)
+			if last {
+				if err := seg.f.Truncate(off); err != nil {
+					return err
+				}
+			}
+			break
+		}
+
+		switch typ {
+		case logRecMessage:
+			l.index[id] = ent
+		case logRecMeta:
+			if old := l.index[id]; old != nil {
+				old.meta = ent.meta
+				old.metaOff, old.metaLen = ent.metaOff, ent.metaLen
+			}
+		case logRecRemove:
+			delete(l.index, id)
+		}
+
+		off += recLen
+	}
+	seg.size = off
+	return nil
+}
+
+// readLogRecord reads and verifies the next record from r, which is
+// positioned at the offset off of the segment seg.
+//
+// For message and meta records, the returned logEntry contains the locations
+// of record parts. If the header is valid, but the payload is not, the record
+// length is returned along with the error.
+func readLogRecord(r io.Reader, seg *logSegment, off int64) (*logEntry, string, byte, int64, error) {
+	var hdr [logRecHeaderLen]byte
+	if n, err := io.ReadFull(r, hdr[:]); err != nil {
+		if n == 0 && err == io.EOF {
+			return nil, "", 0, 0, io.EOF
+		}
+		return nil, "", 0, 0, io.ErrUnexpectedEOF
+	}
+	payloadLen := int64(binary.BigEndian.Uint32(hdr[0:4]))
+	expectedCRC := binary.BigEndian.Uint32(hdr[4:8])
+	typ := hdr[8]
+	recLen := logRecHeaderLen + payloadLen
+	switch typ {
+	case logRecMessage, logRecMeta, logRecRemove:
+	default:
+		return nil, "", 0, 0, fmt.Errorf("unknown record type: %d", typ)
+	}
+
+	crc := crc32.New(logCRCTable)
+	crc.Write([]byte{typ})
+	lr := &io.LimitedReader{R: r, N: payloadLen}
+	payload := io.TeeReader(lr, crc)
+
+	idBlob, err := readLogField(payload, 2)
+	if err != nil {
+		return nil, "", 0, recLen, err
+	}
+	id := string(idBlob)
+	pos := off + logRecHeaderLen + 2 + int64(len(idBlob))
+
+	loc := logLoc{seg: seg, off: off, len: recLen}
+	ent := &logEntry{msg: loc, meta: loc}
+
+	switch typ {
+	case logRecMessage, logRecMeta:
+		metaBlob, err := readLogField(payload, 4)
+		if err != nil {
+			return nil, "", 0, recLen, err
+		}
+		ent.metaOff, ent.metaLen = pos+4, int64(len(metaBlob))
+		pos += 4 + int64(len(metaBlob))
+
+		if typ == logRecMessage {
+			var hdrLen [4]byte
+			if _, err := io.ReadFull(payload, hdrLen[:]); err != nil {
+				return nil, "", 0, recLen, err
+			}
+			ent.hdrOff, ent.hdrLen = pos+4, int64(binary.BigEndian.Uint32(hdrLen[:]))
+			ent.bodyOff = ent.hdrOff + ent.hdrLen
+			ent.bodyLen = off + recLen - ent.bodyOff
+			if ent.bodyLen < 0 {
+				return nil, "", 0, recLen, errors.New("header length is out of bounds")
+			}
+		}
+	}
+
+	// Consume the rest of payload to verify the checksum.
+	if _, err := io.Copy(ioutil.Discard, payload); err != nil {
+		return nil, "", 0, recLen, err
+	}
+	if lr.N != 0 {
+		return nil, "", 0, recLen, io.ErrUnexpectedEOF
+	}
+	if crc.Sum32() != expectedCRC {
+		return nil, "", 0, recLen, errors.New("checksum mismatch")
+	}
+	return ent, id, typ, recLen, nil
+}
+
+// rotate creates a new active segment.
+//
+// mu should be held by the caller (if the store is already initialized).
+func (l *logStore) rotate() (*logSegment, error) {
+	var seq uint64 = 1
+	if len(l.segments) != 0 {
+		prev := l.active()
+		// Records in the previous segment should be persisted before
+		// any record in the new one.
+		if err := prev.f.Sync(); err != nil {
+			return nil, err
+		}
+		seq = prev.seq + 1
+	}
+
+	path := filepath.Join(l.dir, segmentName(seq))
+	f, err := os.OpenFile(path, os.O_RDWR|os.O_CREATE|os.O_EXCL, 0600)
+	if err != nil {
+		return nil, err
+	}
+	if err := syncDir(l.dir); err != nil {
+		f.Close()
+		return nil, err
+	}
+
+	seg := &logSegment{seq: seq, path: path, f: f}
+	l.segments = append(l.segments, seg)
+	return seg, nil
+}
+
+func syncDir(path string) error {
+	if runtime.GOOS == "windows" {
+		return nil
+	}
+	dir, err := os.Open(path)
+	if err != nil {
+		return err
+	}
+	defer dir.Close()
+	return dir.Sync()
+}
+
+// offsetWriter writes to the file at increasing offsets and updates the
+// record checksum.
+type offsetWriter struct {
+	f   *os.File
+	off int64
+	crc uint32
+}
+
+func (w *offsetWriter) Write(b []byte) (int, error) {
+	n, err := w.f.WriteAt(b, w.off)
+	w.crc = crc32.Update(w.crc, logCRCTable, b[:n])
+	w.off += int64(n)
+	return n, err
+}
+
+func writeLogField(w io.Writer, b []byte, lenSize int) error {
+	var l [4]byte
+	if lenSize == 2 {
+		binary.BigEndian.PutUint16(l[:2], uint16(len(b)))
+	} else {
+		binary.BigEndian.PutUint32(l[:4], uint32(len(b)))
+	}
+	if _, err := w.Write(l[:lenSize]); err != nil {
+		return err
+	}
+	_, err := w.Write(b)
+	return err
+}
+
+// reserve allocates space for a record in the active segment and writes its
+// header with an empty checksum. The record should be then completed using
+// fill and finish.
+//
+// mu should be held by the caller.
+func (l *logStore) reserve(typ byte, payloadLen int64) (logLoc, error) {
+	if payloadLen > math.MaxUint32 {
+		return logLoc{}, errors.New("queue: message is too big")
+	}
+
+	seg := l.active()
+	if seg.size >= l.segmentSize {
+		var err error
+		seg, err = l.rotate()
+		if err != nil {
+			return logLoc{}, err
+		}
+	}
+
+	var hdr [logRecHeaderLen]byte
+	binary.BigEndian.PutUint32(hdr[0:4], uint32(payloadLen))
+	hdr[8] = typ
+	if _, err := seg.f.WriteAt(hdr[:], seg.size); err != nil {
+		return logLoc{}, err
+	}
+
+	loc := logLoc{seg: seg, off: seg.size, len: logRecHeaderLen + payloadLen}
+	seg.size += loc.len
+	seg.writers++
+	return loc, nil
+}
+
+// fill writes the payload of the reserved record and its checksum. Payload
+// is written by the passed function. Payload offset is passed to it to
+// simplify offsets calculation.
+//
+// It does not need mu to be held. If it fails, the record is left incomplete
+// and is skipped on replay.
+func (l *logStore) fill(loc logLoc, typ byte, write func(w io.Writer, payloadOff int64) error) error {
+	payloadOff := loc.off + logRecHeaderLen
+	ow := &offsetWriter{
+		f:   loc.seg.f,
+		off: payloadOff,
+		crc: crc32.Update(0, logCRCTable, []byte{typ}),
+	}
+	bw := logWriterPool.Get().(*bufio.Writer)
+	bw.Reset(ow)
+	err := write(bw, payloadOff)
+	if err == nil {
+		err = bw.Flush()
+	}
+	bw.Reset(nil)
+	logWriterPool.Put(bw)
+	if err != nil {
+		return err
+	}
+	if ow.off != loc.off+loc.len {
+		return errors.New("queue: record length does not match the reserved one")
+	}
+
+	var crc [4]byte
+	binary.BigEndian.PutUint32(crc[:], ow.crc)
+	_, err = loc.seg.f.WriteAt(crc[:], loc.off+4)
+	return err
+}
+
+// finish marks the record reserved at loc as no longer being written. If
+// err is nil, the record is included in the next sync.
+//
+// mu should be held by the caller.
+func (l *logStore) finish(loc logLoc, err error) {
+	loc.seg.writers--
+	if err == nil {
+		l.writeGen++
+	}
+}
+
+// appendRecord writes a new record to the active segment while holding mu.
+// It is used for small records.
+//
+// mu should be held by the caller.
+func (l *logStore) appendRecord(typ byte, payloadLen int64, write func(w io.Writer, payloadOff int64) error) (logLoc, error) {
+	loc, err := l.reserve(typ, payloadLen)
+	if err != nil {
+		return logLoc{}, err
+	}
+	err = l.fill(loc, typ, write)
+	l.finish(loc, err)
+	if err != nil {
+		return logLoc{}, err
+	}
+	return loc, nil
+}
+
+// sync waits until all records up to the write generation gen are
+// persisted.
+//
+// Writers that call sync while another fsync is in progress wait for it
+// and then are served by a single fsync.
+func (l *logStore) sync(gen uint64) error {
+	l.syncLck.Lock()
+	defer l.syncLck.Unlock()
+
+	if l.syncedGen >= gen {
+		return nil
+	}
+
+	// Records from previous segments are persisted during rotation.
+	l.mu.RLock()
+	target := l.writeGen
+	f := l.active().f
+	l.mu.RUnlock()
+
+	if err := f.Sync(); err != nil {
+		return err
+	}
+	l.syncedGen = target
+	return nil
+}
+
+// syncRecord waits until the record written at the write generation gen is
+// persisted.
+func (l *logStore) syncRecord(loc logLoc, gen uint64) error {
+	l.mu.RLock()
+	sealed := loc.seg != l.active()
+	l.mu.RUnlock()
+	if sealed {
+		// The segment was rotated while the record was written, fsync done
+		// during rotation may not include it.
+		return loc.seg.f.Sync()
+	}
+	return l.sync(gen)
+}
+
+// writeMessage appends a message record and updates the index.
+//
+// mu should be held by the caller. It is released while the body is copied
+// and is held again when writeMessage returns. If replaced is not nil, the
+// index is updated only if the message is still stored as replaced.
+func (l *logStore) writeMessage(id string, metaBlob, hdrBlob []byte, body io.Reader, bodyLen int64, replaced *logEntry) (*logEntry, logLoc, error) {
+	payloadLen := 2 + int64(len(id)) + 4 + int64(len(metaBlob)) + 4 + int64(len(hdrBlob)) + bodyLen
+	loc, err := l.reserve(logRecMessage, payloadLen)
+	if err != nil {
+		return nil, logLoc{}, err
+	}
+
+	ent := &logEntry{msg: loc, meta: loc}
+	l.mu.Unlock()
+	err = l.fill(loc, logRecMessage, func(w io.Writer, off int64) error {
+		if err := writeLogField(w, []byte(id), 2); err != nil {
+			return err
+		}
+		off += 2 + int64(len(id))
+		if err := writeLogField(w, metaBlob, 4); err != nil {
+			return err
+		}
+		ent.metaOff, ent.metaLen = off+4, int64(len(metaBlob))
+		off += 4 + int64(len(metaBlob))
+		if err := writeLogField(w, hdrBlob, 4); err != nil {
+			return err
+		}
+		ent.hdrOff, ent.hdrLen = off+4, int64(len(hdrBlob))
+		ent.bodyOff = ent.hdrOff + ent.hdrLen
+
+		// Read one more byte to detect body that is longer than expected.
+		n, err := io.Copy(w, io.LimitReader(body, bodyLen+1))
+		ent.bodyLen = n
+		if err == nil && n != bodyLen {
+			err = errors.New("queue: body length does not match the reported one")
+		}
+		return err
+	})
+	l.mu.Lock()
+	l.finish(loc, err)
+	if err != nil {
+		return nil, logLoc{}, err
+	}
+
+	old := l.index[id]
+	if replaced != nil && old != replaced {
+		// Removed or replaced while being copied, the new record is not
+		// needed.
+		return ent, loc, nil
+	}
+	if old != nil {
+		l.release(old)
+	}
+	loc.seg.live += loc.len
+	l.index[id] = ent
+	return ent, loc, nil
+}
+
+// release decreases live counters of segments containing the entry records.
+//
+// mu should be held by the caller.
+func (l *logStore) release(ent *logEntry) {
+	ent.msg.seg.live -= ent.msg.len
+	if ent.separateMeta() {
+		ent.meta.seg.live -= ent.meta.len
+	}
+}
+
+func (l *logStore) Store(meta *QueueMetadata, header textproto.Header, body buffer.Buffer) (buffer.Buffer, error) {
+	id := meta.MsgMeta.ID
+	if len(id) > math.MaxUint16 {
+		return nil, errors.New("queue: message ID is too long")
+	}
+
+	var metaBlob, hdrBlob bytes.Buffer
+	if err := encodeMeta(&metaBlob, meta); err != nil {
+		return nil, err
+	}
+	if err := textproto.WriteHeader(&hdrBlob, header); err != nil {
+		return nil, err
+	}
+
+	bodyReader, err := body.Open()
+	if err != nil {
+		return nil, err
+	}
+	defer bodyReader.Close()
+
+	l.mu.Lock()
+	ent, loc, err := l.writeMessage(id, metaBlob.Bytes(), hdrBlob.Bytes(), bodyReader, int64(body.Len()), nil)
+	gen := l.writeGen
+	l.mu.Unlock()
+	if err != nil {
+		return nil, err
+	}
+
+	if err := l.syncRecord(loc, gen); err != nil {
+		l.Remove(meta.MsgMeta)
+		return nil, err
+	}
+
+	return logBody{l: l, id: id, len: int(ent.bodyLen)}, nil
+}
+
+func (l *logStore) UpdateMeta(meta *QueueMetadata) error {
+	id := meta.MsgMeta.ID
+
+	var metaBlob bytes.Buffer
+	if err := encodeMeta(&metaBlob, meta); err != nil {
+		return err
+	}
+
+	l.mu.Lock()
+	ent := l.index[id]
+	if ent == nil {
+		l.mu.Unlock()
+		return fmt.Errorf("queue: message %s is not stored", id)
+	}
+	var metaOff int64
+	loc, err := l.appendRecord(logRecMeta, 2+int64(len(id))+4+int64(metaBlob.Len()), func(w io.Writer, off int64) error {
+		if err := writeLogField(w, []byte(id), 2); err != nil {
+			return err
+		}
+		metaOff = off + 2 + int64(len(id)) + 4
+		return writeLogField(w, metaBlob.Bytes(), 4)
+	})
+	if err != nil {
+		l.mu.Unlock()
+		return err
+	}
+	if ent.separateMeta() {
+		ent.meta.seg.live -= ent.meta.len
+	}
+	// Entries are not modified in place so writeMessage can detect updates
+	// done while the message was copied.
+	updated := *ent
+	updated.meta = loc
+	updated.metaOff, updated.metaLen = metaOff, int64(metaBlob.Len())
+	l.index[id] = &updated
+	loc.seg.live += loc.len
+	gen := l.writeGen
+	l.mu.Unlock()
+
+	return l.sync(gen)
+}
+
+// drop removes the message from the index and writes the corresponding
+// record. It is not waited to be persisted, worst case the message will be
+// delivered twice.
+func (l *logStore) drop(id string) error {
+	l.mu.Lock()
+	defer l.mu.Unlock()
+
+	ent := l.index[id]
+	if ent == nil {
+		return nil
+	}
+	_, err := l.appendRecord(logRecRemove, 2+int64(len(id)), func(w io.Writer, _ int64) error {
+		return writeLogField(w, []byte(id), 2)
+	})
+	if err != nil {
+		return err
+	}
+	l.release(ent)
+	delete(l.index, id)
+	return nil
+}
+
+func (l *logStore) Remove(msgMeta *module.MsgMetadata) {
+	if err := l.drop(msgMeta.ID); err != nil {
+		l.log.Error("failed to remove message from disk", err, "msg_id", msgMeta.ID)
+		return
+	}
+	l.log.DebugMsg("removed message from disk", "msg_id", msgMeta.ID)
+}
+
+// MarkBroken removes the message from the queue. Its data is kept in the
+// segment until it is compacted.
+func (l *logStore) MarkBroken(id string) {
+	if err := l.drop(id); err != nil {
+		// Note: Global logger is used in case there is something wrong with Queue.Log.
+		log.Printf("can't mark the queue message as broken: %v", err)
+		return
+	}
+	log.Printf("queue message %s is marked as broken and will not be delivered", id)
+}
+
+// readAt reads the part of segment file.
+//
+// mu should be held by the caller.
+func readAt(seg *logSegment, off, n int64) ([]byte, error) {
+	buf := make([]byte, n)
+	if _, err := seg.f.ReadAt(buf, off); err != nil {
+		return nil, err
+	}
+	return buf, nil
+}
+
+func (l *logStore) Open(id string) (*QueueMetadata, textproto.Header, buffer.Buffer, error) {
+	l.mu.RLock()
+	ent := l.index[id]
+	if ent == nil {
+		l.mu.RUnlock()
+		return nil, textproto.Header{}, nil, nil
+	}
+	metaBlob, err := readAt(ent.meta.seg, ent.metaOff, ent.metaLen)
+	if err != nil {
+		l.mu.RUnlock()
+		return nil, textproto.Header{}, nil, err
+	}
+	hdrBlob, err := readAt(ent.msg.seg, ent.hdrOff, ent.hdrLen)
+	bodyLen := ent.bodyLen
+	l.mu.RUnlock()
+	if err != nil {
+		return nil, textproto.Header{}, nil, err
+	}
+
+	meta, err := decodeMeta(bytes.NewReader(metaBlob))
+	if err != nil {
+		return nil, textproto.Header{}, nil, err
+	}
+	header, err := textproto.ReadHeader(bufio.NewReader(bytes.NewReader(hdrBlob)))
+	if err != nil {
+		return nil, textproto.Header{}, nil, nil
+	}
+
+	return meta, header, logBody{l: l, id: id, len: int(bodyLen)}, nil
+}
+
+func (l *logStore) Load(cb func(ent indexEntry)) error {
+	type stored struct {
+		id   string
+		meta []byte
+	}
+
+	l.mu.RLock()
+	all := make([]stored, 0, len(l.index))
+	for id, ent := range l.index {
+		metaBlob, err := readAt(ent.meta.seg, ent.metaOff, ent.metaLen)
+		if err != nil {
+			l.mu.RUnlock()
+			return err
+		}
+		all = append(all, stored{id: id, meta: metaBlob})
+	}
+	l.mu.RUnlock()
+
+	for _, s := range all {
+		meta, err := decodeMeta(bytes.NewReader(s.meta))
+		if err != nil {
+			l.log.Printf("failed to read meta-data, skipping: %v (msg ID = %s)", err, s.id)
+			continue
+		}
+		cb(newIndexEntry(meta))
+	}
+	return nil
+}
+
+func (l *logStore) compactLoop() {
+	defer close(l.stopped)
+
+	t := time.NewTicker(logCompactInterval)
+	defer t.Stop()
+	for {
+		select {
+		case <-t.C:
+			if err := l.compact(); err != nil {
+				l.log.Error("segment compaction failed", err)
+			}
+		case <-l.stop:
+			return
+		}
+	}
+}
+
+// unused returns the total length of records in sealed segments that are
+// not needed anymore.
+//
+// mu should be held by the caller.
+func (l *logStore) unused() int64 {
+	var total int64
+	for _, seg := range l.segments[:len(l.segments)-1] {
+		total += seg.size - seg.live
+	}
+	return total
+}
+
+// compact removes old segments that are mostly unused.
+func (l *logStore) compact() error {
+	for {
+		l.mu.RLock()
+		if len(l.segments) < 2 {
+			l.mu.RUnlock()
+			return nil
+		}
+		oldest := l.segments[0]
+		if oldest.live > l.unused() || oldest.writers != 0 {
+			l.mu.RUnlock()
+			return nil
+		}
+		var ids []string
+		for id, ent := range l.index {
+			if ent.msg.seg == oldest {
+				ids = append(ids, id)
+			}
+		}
+		l.mu.RUnlock()
+
+		// Lock is released between messages so intake is not blocked
+		// for the whole compaction.
+		sealed := map[*logSegment]struct{}{}
+		for _, id := range ids {
+			loc, err := l.move(id, oldest)
+			if err != nil {
+				return err
+			}
+			if loc.seg != nil {
+				sealed[loc.seg] = struct{}{}
+			}
+		}
+
+		l.mu.RLock()
+		gen := l.writeGen
+		delete(sealed, l.active())
+		l.mu.RUnlock()
+		// Segments rotated while messages were copied.
+		for seg := range sealed {
+			if err := seg.f.Sync(); err != nil {
+				return err
+			}
+		}
+		if err := l.sync(gen); err != nil {
+			return err
+		}
+
+		// Acquire syncLck so the segment file is not closed while being synced.
+		l.syncLck.Lock()
+		l.mu.Lock()
+		if oldest.live != 0 {
+			l.mu.Unlock()
+			l.syncLck.Unlock()
+			return fmt.Errorf("queue: segment %s is still in use after compaction", oldest.path)
+		}
+		l.segments = l.segments[1:]
+		l.mu.Unlock()
+		l.syncLck.Unlock()
+
+		oldest.f.Close()
+		if err := os.Remove(oldest.path); err != nil {
+			return err
+		}
+		l.log.Debugf("removed segment %s", oldest.path)
+	}
+}
+
+// move rewrites the message stored in the segment from to the active segment.
+// It returns the location of the new record.
+func (l *logStore) move(id string, from *logSegment) (logLoc, error) {
+	l.mu.Lock()
+	defer l.mu.Unlock()
+
+	for {
+		ent := l.index[id]
+		if ent == nil || ent.msg.seg != from {
+			return logLoc{}, nil
+		}
+
+		metaBlob, err := readAt(ent.meta.seg, ent.metaOff, ent.metaLen)
+		if err != nil {
+			return logLoc{}, err
+		}
+		hdrBlob, err := readAt(ent.msg.seg, ent.hdrOff, ent.hdrLen)
+		if err != nil {
+			return logLoc{}, err
+		}
+		// from is not removed until move returns, so it is safe to read it
+		// without mu.
+		var body io.Reader = io.NewSectionReader(ent.msg.seg.f, ent.bodyOff, ent.bodyLen)
+		if l.wrapMoved != nil {
+			body = l.wrapMoved(body)
+		}
+
+		newEnt, loc, err := l.writeMessage(id, metaBlob, hdrBlob, body, ent.bodyLen, ent)
+		if err != nil || l.index[id] == newEnt {
+			return loc, err
+		}
+		// Meta-data was updated while the message was copied, the copy
+		// contains the old one. Try again unless the message is gone.
+	}
+}
+
+func (l *logStore) Close() error {
+	var err error
+	l.closeOnce.Do(func() {
+		close(l.stop)
+		<-l.stopped
+
+		l.syncLck.Lock()
+		defer l.syncLck.Unlock()
+		l.mu.Lock()
+		defer l.mu.Unlock()
+
+		err = l.active().f.Sync()
+		l.closeFiles()
+	})
+	return err
+}
+
+// logBody is the Buffer referring to the message body stored in a segment.
+//
+// Segment location is resolved on each Open since the message may be moved
+// by compaction.
+type logBody struct {
+	l   *logStore
+	id  string
+	len int
+}
+
+type sectionReadCloser struct {
+	*io.SectionReader
+	io.Closer
+}
+
+func (b logBody) Open() (io.ReadCloser, error) {
+	b.l.mu.RLock()
+	defer b.l.mu.RUnlock()
+
+	ent := b.l.index[b.id]
+	if ent == nil {
+		return nil, fmt.Errorf("queue: message %s is not stored", b.id)
+	}
+	// Separate file descriptor is used so the reader stays valid even if
+	// the segment is removed while it is in use.
+	f, err := os.Open(ent.msg.seg.path)
+	if err != nil {
+		return nil, err
+	}
+	return sectionReadCloser{
+		SectionReader: io.NewSectionReader(f, ent.bodyOff, ent.bodyLen),
+		Closer:        f,
+	}, nil
+}
+
+func (b logBody) Len() int {
+	return b.len
+}
+
+// Remove is no-op, message lifetime is controlled by the queue.
+func (b logBody) Remove() error {
+	return nil
+}
@@ -0,0 +1,579 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package queue
+
+import (
+	"errors"
+	"io"
+	"io/ioutil"
+	"os"
+	"path/filepath"
+	"strconv"
+	"sync"
+	"testing"
+
+	"github.com/emersion/go-message/textproto"
+	"github.com/foxcpp/maddy/framework/buffer"
+	"github.com/foxcpp/maddy/framework/log"
+	"github.com/foxcpp/maddy/framework/module"
+)
+
+func newTestLogStore(t *testing.T, dir string, segmentSize int64) *logStore {
+	t.Helper()
+	l, err := openLogStore(dir, segmentSize, log.Logger{Out: log.NopOutput{}})
+	if err != nil {
+		t.Fatal(err)
+	}
+	return l
+}
+
+func storeTestMsg(t *testing.T, l *logStore, id, body string) {
+	t.Helper()
+	hdr := textproto.Header{}
+	hdr.Add("Subject", id)
+	meta := &QueueMetadata{
+		MsgMeta: &module.MsgMetadata{ID: id},
+		From:    "sender@example.org",
+		To:      []string{"rcpt@example.org"},
+	}
+	stored, err := l.Store(meta, hdr, buffer.MemoryBuffer{Slice: []byte(body)})
+	if err != nil {
+		t.Fatal(err)
+	}
+	if stored.Len() != len(body) {
+		t.Fatal("Wrong stored body length:", stored.Len())
+	}
+}
+
+func checkTestMsg(t *testing.T, l *logStore, id, body string, to []string) {
+	t.Helper()
+	meta, hdr, storedBody, err := l.Open(id)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if meta == nil {
+		t.Fatal("Message is not stored:", id)
+	}
+	if meta.MsgMeta.ID != id {
+		t.Error("Wrong ID:", meta.MsgMeta.ID)
+	}
+	if len(meta.To) != len(to) || (len(to) != 0 && meta.To[0] != to[0]) {
+		t.Error("Wrong recipients:", meta.To)
+	}
+	if subj := hdr.Get("Subject"); subj != id {
+		t.Error("Wrong header:", subj)
+	}
+	r, err := storedBody.Open()
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer r.Close()
+	blob, err := ioutil.ReadAll(r)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if string(blob) != body {
+		t.Errorf("Wrong body: %q", blob)
+	}
+}
+
+func loadedIDs(t *testing.T, l *logStore) map[string]bool {
+	t.Helper()
+	ids := map[string]bool{}
+	if err := l.Load(func(ent indexEntry) {
+		ids[ent.ID] = true
+	}); err != nil {
+		t.Fatal(err)
+	}
+	return ids
+}
+
+func TestLogStore(t *testing.T) {
+	dir, err := ioutil.TempDir("", "maddy-tests-queue")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer os.RemoveAll(dir)
+
+	l := newTestLogStore(t, dir, 1024*1024)
+	storeTestMsg(t, l, "msg1", "body1\r\n")
+	storeTestMsg(t, l, "msg2", "body2\r\n")
+	storeTestMsg(t, l, "msg3", "body3\r\n")
+
+	meta, _, _, err := l.Open("msg2")
+	if err != nil {
+		t.Fatal(err)
+	}
+	meta.To = []string{"rcpt2@example.org"}
+	if err := l.UpdateMeta(meta); err != nil {
+		t.Fatal(err)
+	}
+	l.Remove(&module.MsgMetadata{ID: "msg3"})
+
+	checkTestMsg(t, l, "msg1", "body1\r\n", []string{"rcpt@example.org"})
+	checkTestMsg(t, l, "msg2", "body2\r\n", []string{"rcpt2@example.org"})
+	if meta, _, _, _ := l.Open("msg3"); meta != nil {
+		t.Error("Removed message is returned by Open")
+	}
+	if err := l.Close(); err != nil {
+		t.Fatal(err)
+	}
+
+	// Everything should be replayed.
+	l = newTestLogStore(t, dir, 1024*1024)
+	defer l.Close()
+	checkTestMsg(t, l, "msg1", "body1\r\n", []string{"rcpt@example.org"})
+	checkTestMsg(t, l, "msg2", "body2\r\n", []string{"rcpt2@example.org"})
+	if ids := loadedIDs(t, l); len(ids) != 2 || !ids["msg1"] || !ids["msg2"] {
+		t.Error("Wrong loaded IDs:", ids)
+	}
+}
+
+func TestLogStore_TornWrite(t *testing.T) {
+	dir, err := ioutil.TempDir("", "maddy-tests-queue")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer os.RemoveAll(dir)
+
+	l := newTestLogStore(t, dir, 1024*1024)
+	storeTestMsg(t, l, "msg1", "body1\r\n")
+	storeTestMsg(t, l, "msg2", "body2\r\n")
+	segPath := l.active().path
+	size := l.active().size
+	l.Close()
+
+	// Cut the last record in half.
+	if err := os.Truncate(segPath, size-5); err != nil {
+		t.Fatal(err)
+	}
+
+	l = newTestLogStore(t, dir, 1024*1024)
+	checkTestMsg(t, l, "msg1", "body1\r\n", []string{"rcpt@example.org"})
+	if meta, _, _, _ := l.Open("msg2"); meta != nil {
+		t.Error("Incomplete message is returned by Open")
+	}
+
+	// New records should be appended after the last complete one.
+	storeTestMsg(t, l, "msg3", "body3\r\n")
+	l.Close()
+
+	l = newTestLogStore(t, dir, 1024*1024)
+	defer l.Close()
+	checkTestMsg(t, l, "msg1", "body1\r\n", []string{"rcpt@example.org"})
+	checkTestMsg(t, l, "msg3", "body3\r\n", []string{"rcpt@example.org"})
+}
+
+func TestLogStore_Compact(t *testing.T) {
+	dir, err := ioutil.TempDir("", "maddy-tests-queue")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer os.RemoveAll(dir)
+
+	l := newTestLogStore(t, dir, 1024*1024)
+	for i := 0; i < 5; i++ {
+		storeTestMsg(t, l, "msg"+strconv.Itoa(i), "body"+strconv.Itoa(i))
+	}
+	l.mu.Lock()
+	if _, err := l.rotate(); err != nil {
+		t.Fatal(err)
+	}
+	l.mu.Unlock()
+	// Most of the first segment is not used anymore.
+	for i := 1; i < 5; i++ {
+		l.Remove(&module.MsgMetadata{ID: "msg" + strconv.Itoa(i)})
+	}
+
+	// Keep a reader for the message that will be moved.
+	_, _, body, err := l.Open("msg0")
+	if err != nil {
+		t.Fatal(err)
+	}
+	r, err := body.Open()
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer r.Close()
+
+	if err := l.compact(); err != nil {
+		t.Fatal(err)
+	}
+	if len(l.segments) != 1 {
+		t.Error("Unused segments are not removed:", len(l.segments))
+	}
+	segs, err := filepath.Glob(filepath.Join(dir, "*.seg"))
+	if err != nil {
+		t.Fatal(err)
+	}
+	if len(segs) != 1 {
+		t.Error("Segment files are not removed:", segs)
+	}
+
+	blob, err := ioutil.ReadAll(r)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if string(blob) != "body0" {
+		t.Errorf("Wrong body read using an old reader: %q", blob)
+	}
+	checkTestMsg(t, l, "msg0", "body0", []string{"rcpt@example.org"})
+	l.Close()
+
+	l = newTestLogStore(t, dir, 1024*1024)
+	defer l.Close()
+	checkTestMsg(t, l, "msg0", "body0", []string{"rcpt@example.org"})
+	if ids := loadedIDs(t, l); len(ids) != 1 {
+		t.Error("Wrong loaded IDs:", ids)
+	}
+}
+
+func TestLogStore_CompactLiveHead(t *testing.T) {
+	dir, err := ioutil.TempDir("", "maddy-tests-queue")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer os.RemoveAll(dir)
+
+	rotate := func(l *logStore) {
+		l.mu.Lock()
+		defer l.mu.Unlock()
+		if _, err := l.rotate(); err != nil {
+			t.Fatal(err)
+		}
+	}
+
+	l := newTestLogStore(t, dir, 1024*1024)
+	// The first segment contains only a message that is still in the queue.
+	storeTestMsg(t, l, "pinned", "pinned body")
+	rotate(l)
+	for seg := 0; seg < 2; seg++ {
+		for i := 0; i < 5; i++ {
+			storeTestMsg(t, l, "msg"+strconv.Itoa(seg)+strconv.Itoa(i), "body")
+		}
+		rotate(l)
+	}
+
+	// Nothing to reclaim yet.
+	if err := l.compact(); err != nil {
+		t.Fatal(err)
+	}
+	if len(l.segments) != 4 {
+		t.Fatal("Live segments are compacted:", len(l.segments))
+	}
+
+	for seg := 0; seg < 2; seg++ {
+		for i := 0; i < 5; i++ {
+			l.Remove(&module.MsgMetadata{ID: "msg" + strconv.Itoa(seg) + strconv.Itoa(i)})
+		}
+	}
+	if err := l.compact(); err != nil {
+		t.Fatal(err)
+	}
+	if len(l.segments) != 1 {
+		t.Error("Unused segments behind the live one are not removed:", len(l.segments))
+	}
+	checkTestMsg(t, l, "pinned", "pinned body", []string{"rcpt@example.org"})
+	l.Close()
+
+	l = newTestLogStore(t, dir, 1024*1024)
+	defer l.Close()
+	checkTestMsg(t, l, "pinned", "pinned body", []string{"rcpt@example.org"})
+	if ids := loadedIDs(t, l); len(ids) != 1 || !ids["pinned"] {
+		t.Error("Wrong loaded IDs:", ids)
+	}
+}
+
+// blockingBuffer returns the first half of the body, then blocks until
+// unblock is closed and fails if fail is set.
+type blockingBuffer struct {
+	body    []byte
+	started chan struct{}
+	unblock chan struct{}
+	fail    bool
+}
+
+func (b *blockingBuffer) Read(p []byte) (int, error) {
+	if len(b.body) > 1 {
+		n := copy(p, b.body[:len(b.body)/2])
+		b.body = b.body[n:]
+		return n, nil
+	}
+	close(b.started)
+	<-b.unblock
+	if b.fail {
+		return 0, errors.New("read failed")
+	}
+	n := copy(p, b.body)
+	b.body = b.body[n:]
+	if len(b.body) == 0 {
+		return n, io.EOF
+	}
+	return n, nil
+}
+
+func (b *blockingBuffer) Open() (io.ReadCloser, error) {
+	return ioutil.NopCloser(b), nil
+}
+
+func (b *blockingBuffer) Len() int {
+	return len(b.body)
+}
+
+func (b *blockingBuffer) Remove() error {
+	return nil
+}
+
+func storeBlocking(l *logStore, id string, b *blockingBuffer) chan error {
+	done := make(chan error, 1)
+	go func() {
+		_, err := l.Store(&QueueMetadata{
+			MsgMeta: &module.MsgMetadata{ID: id},
+			To:      []string{"rcpt@example.org"},
+		}, textproto.Header{}, b)
+		done <- err
+	}()
+	return done
+}
+
+func TestLogStore_SlowBody(t *testing.T) {
+	dir, err := ioutil.TempDir("", "maddy-tests-queue")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer os.RemoveAll(dir)
+
+	l := newTestLogStore(t, dir, 1024*1024)
+	defer l.Close()
+
+	slow := &blockingBuffer{
+		body:    []byte("slow body\r\n"),
+		started: make(chan struct{}),
+		unblock: make(chan struct{}),
+	}
+	done := storeBlocking(l, "slow", slow)
+	<-slow.started
+
+	// Store is not blocked while the body of another message is copied.
+	storeTestMsg(t, l, "msg1", "body1\r\n")
+	checkTestMsg(t, l, "msg1", "body1\r\n", []string{"rcpt@example.org"})
+
+	close(slow.unblock)
+	if err := <-done; err != nil {
+		t.Fatal(err)
+	}
+}
+
+func TestLogStore_IncompleteRecord(t *testing.T) {
+	dir, err := ioutil.TempDir("", "maddy-tests-queue")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer os.RemoveAll(dir)
+
+	l := newTestLogStore(t, dir, 1024*1024)
+	storeTestMsg(t, l, "msg1", "body1\r\n")
+
+	failing := &blockingBuffer{
+		body:    []byte("failing body\r\n"),
+		started: make(chan struct{}),
+		unblock: make(chan struct{}),
+		fail:    true,
+	}
+	done := storeBlocking(l, "msg2", failing)
+	<-failing.started
+	// Reserved after msg2.
+	storeTestMsg(t, l, "msg3", "body3\r\n")
+	close(failing.unblock)
+	if err := <-done; err == nil {
+		t.Fatal("Expected an error")
+	}
+	l.Close()
+
+	l = newTestLogStore(t, dir, 1024*1024)
+	defer l.Close()
+	checkTestMsg(t, l, "msg1", "body1\r\n", []string{"rcpt@example.org"})
+	checkTestMsg(t, l, "msg3", "body3\r\n", []string{"rcpt@example.org"})
+	if meta, _, _, _ := l.Open("msg2"); meta != nil {
+		t.Error("Incomplete message is returned by Open")
+	}
+}
+
+func TestLogStore_UpdateMetaDuringMove(t *testing.T) {
+	dir, err := ioutil.TempDir("", "maddy-tests-queue")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer os.RemoveAll(dir)
+
+	l := newTestLogStore(t, dir, 1024*1024)
+	for i := 0; i < 5; i++ {
+		storeTestMsg(t, l, "msg"+strconv.Itoa(i), "body"+strconv.Itoa(i)+"\r\n")
+	}
+	l.mu.Lock()
+	if _, err := l.rotate(); err != nil {
+		t.Fatal(err)
+	}
+	l.mu.Unlock()
+	for i := 1; i < 5; i++ {
+		l.Remove(&module.MsgMetadata{ID: "msg" + strconv.Itoa(i)})
+	}
+
+	// Block the first copy of the body until meta-data is updated.
+	slow := &blockingBuffer{
+		started: make(chan struct{}),
+		unblock: make(chan struct{}),
+	}
+	moves := 0
+	l.wrapMoved = func(r io.Reader) io.Reader {
+		moves++
+		if moves != 1 {
+			return r
+		}
+		body, err := ioutil.ReadAll(r)
+		if err != nil {
+			t.Error(err)
+		}
+		slow.body = body
+		return slow
+	}
+	done := make(chan error, 1)
+	go func() {
+		done <- l.compact()
+	}()
+	<-slow.started
+
+	if err := l.UpdateMeta(&QueueMetadata{
+		MsgMeta:    &module.MsgMetadata{ID: "msg0"},
+		From:       "sender@example.org",
+		To:         []string{"rcpt2@example.org"},
+		TriesCount: map[string]int{"rcpt@example.org": 1},
+	}); err != nil {
+		t.Fatal(err)
+	}
+	close(slow.unblock)
+	if err := <-done; err != nil {
+		t.Fatal(err)
+	}
+	if len(l.segments) != 1 {
+		t.Error("Segment is not compacted:", len(l.segments))
+	}
+	checkTestMsg(t, l, "msg0", "body0\r\n", []string{"rcpt2@example.org"})
+	l.Close()
+
+	l = newTestLogStore(t, dir, 1024*1024)
+	defer l.Close()
+	checkTestMsg(t, l, "msg0", "body0\r\n", []string{"rcpt2@example.org"})
+	meta, _, _, err := l.Open("msg0")
+	if err != nil {
+		t.Fatal(err)
+	}
+	if meta.TriesCount["rcpt@example.org"] != 1 {
+		t.Error("Wrong TriesCount:", meta.TriesCount)
+	}
+}
+
+func TestLogStore_Concurrent(t *testing.T) {
+	dir, err := ioutil.TempDir("", "maddy-tests-queue")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer os.RemoveAll(dir)
+
+	l := newTestLogStore(t, dir, 4096)
+
+	var wg sync.WaitGroup
+	for i := 0; i < 50; i++ {
+		wg.Add(1)
+		go func(i int) {
+			defer wg.Done()
+			id := "msg" + strconv.Itoa(i)
+			storeTestMsg(t, l, id, "body"+strconv.Itoa(i))
+			if i%2 == 0 {
+				l.Remove(&module.MsgMetadata{ID: id})
+			}
+		}(i)
+	}
+	wg.Wait()
+	if err := l.compact(); err != nil {
+		t.Fatal(err)
+	}
+	l.Close()
+
+	l = newTestLogStore(t, dir, 4096)
+	defer l.Close()
+	ids := loadedIDs(t, l)
+	if len(ids) != 25 {
+		t.Error("Wrong amount of loaded messages:", len(ids))
+	}
+	for i := 1; i < 50; i += 2 {
+		checkTestMsg(t, l, "msg"+strconv.Itoa(i), "body"+strconv.Itoa(i), []string{"rcpt@example.org"})
+	}
+}
+
+func BenchmarkStore(b *testing.B) {
+	body := buffer.MemoryBuffer{Slice: make([]byte, 16*1024)}
+	hdr := textproto.Header{}
+	hdr.Add("Subject", "benchmark")
+
+	bench := func(b *testing.B, s msgStore) {
+		var ctr uint64
+		var ctrLck sync.Mutex
+		b.ReportAllocs()
+		b.ResetTimer()
+		b.RunParallel(func(pb *testing.PB) {
+			for pb.Next() {
+				ctrLck.Lock()
+				ctr++
+				id := strconv.FormatUint(ctr, 10)
+				ctrLck.Unlock()
+
+				if _, err := s.Store(&QueueMetadata{
+					MsgMeta: &module.MsgMetadata{ID: id},
+					To:      []string{"rcpt@example.org"},
+				}, hdr, body); err != nil {
+					b.Fatal(err)
+				}
+			}
+		})
+	}
+
+	for _, format := range []string{"files", "log"} {
+		format := format
+		b.Run(format, func(b *testing.B) {
+			dir, err := ioutil.TempDir("", "maddy-tests-queue")
+			if err != nil {
+				b.Fatal(err)
+			}
+			defer os.RemoveAll(dir)
+
+			var s msgStore = newFileStore(dir, log.Logger{Out: log.NopOutput{}})
+			if format == "log" {
+				s, err = openLogStore(dir, 64*1024*1024, log.Logger{Out: log.NopOutput{}})
+				if err != nil {
+					b.Fatal(err)
+				}
+			}
+			defer s.Close()
+
+			b.SetParallelism(16)
+			bench(b, s)
+		})
+	}
+}
@@ -18,7 +18,10 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 package queue
 
-import "github.com/prometheus/client_golang/prometheus"
+import (
+	"github.com/foxcpp/maddy/internal/metrics"
+	"github.com/prometheus/client_golang/prometheus"
+)
 
 var queuedMsgs = prometheus.NewGaugeVec(
 	prometheus.GaugeOpts{
@@ -30,6 +33,29 @@ var queuedMsgs = prometheus.NewGaugeVec(
 	[]string{"module", "location"},
 )
 
+var startupDuration = prometheus.NewGaugeVec(
+	prometheus.GaugeOpts{
+		Namespace: "maddy",
+		Subsystem: "queue",
+		Name:      "startup_duration_seconds",
+		Help:      "Time spent loading the saved queue state on startup",
+	},
+	[]string{"module", "location"},
+)
+
+var storeDuration = prometheus.NewHistogramVec(
+	prometheus.HistogramOpts{
+		Namespace: "maddy",
+		Subsystem: "queue",
+		Name:      "store_duration_seconds",
+		Help:      "Time spent writing messages (operation=store) and updated meta-data (operation=update_meta) to disk",
+		Buckets:   metrics.LatencyBuckets,
+	},
+	[]string{"module", "location", "operation"},
+)
+
 func init() {
 	prometheus.MustRegister(queuedMsgs)
+	prometheus.MustRegister(startupDuration)
+	prometheus.MustRegister(storeDuration)
 }
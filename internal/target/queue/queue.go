@@ -59,15 +59,12 @@ import (
 	"bufio"
 	"bytes"
 	"context"
-	"encoding/json"
 	"errors"
 	"fmt"
 	"io"
-	"io/ioutil"
 	"math"
 	"os"
 	"path/filepath"
-	"runtime"
 	"runtime/debug"
 	"runtime/trace"
 	"strconv"
@@ -126,6 +123,15 @@ type Queue struct {
 	autogenMsgDomain string
 	wheel            *TimeWheel
 
+	// Storage engine to use, either "files" or "log".
+	storeFormat string
+	segmentSize int
+	store       msgStore
+
+	// Directories with messages left by worker processes that do not exist
+	// anymore, see adoptOrphaned.
+	orphanDirs []string
+
 	dsnPipeline module.DeliveryTarget
 
 	// Retry delay is calculated using the following formula:
@@ -150,10 +156,11 @@ type Queue struct {
 	Log    log.Logger
 	Target module.DeliveryTarget
 
-	deliveryWg sync.WaitGroup
-	// Buffered channel used to restrict count of deliveries attempted
-	// in parallel.
-	deliverySemaphore chan struct{}
+	// Per-domain scheduling parameters, see domainScheduler.
+	maxDomainParallelism int
+	domainBatch          int
+	domainWeights        map[string]float64
+	sched                *domainScheduler
 }
 
 type QueueMetadata struct {
@@ -182,6 +189,9 @@ type QueueMetadata struct {
 type queueSlot struct {
 	ID string
 
+	// Destination domain used to schedule the delivery, see destDomain.
+	Domain string
+
 	// If nil - Hdr and Body are invalid, all values should be read from
 	// disk.
 	Meta *QueueMetadata
@@ -195,6 +205,7 @@ func NewQueue(_, instName string, _, inlineArgs []string) (module.Module, error)
 		initialRetryTime: 15 * time.Minute,
 		retryTimeScale:   1.25,
 		postInitDelay:    10 * time.Second,
+		domainWeights:    map[string]float64{},
 		Log:              log.Logger{Name: "queue"},
 	}
 	switch len(inlineArgs) {
@@ -213,7 +224,26 @@ func (q *Queue) Init(cfg *config.Map) error {
 	cfg.Bool("debug", true, false, &q.Log.Debug)
 	cfg.Int("max_tries", false, false, 20, &q.maxTries)
 	cfg.Int("max_parallelism", false, false, 16, &maxParallelism)
+	// 0 means the same as max_parallelism.
+	cfg.Int("max_domain_parallelism", false, false, 0, &q.maxDomainParallelism)
+	cfg.Int("domain_batch", false, false, 10, &q.domainBatch)
+	cfg.Callback("domain_weight", func(m *config.Map, node config.Node) error {
+		if len(node.Args) != 2 {
+			return config.NodeErr(node, "expected two arguments")
+		}
+		weight, err := strconv.ParseFloat(node.Args[1], 64)
+		if err != nil {
+			return config.NodeErr(node, "%v", err)
+		}
+		if weight <= 0 {
+			return config.NodeErr(node, "weight should be positive")
+		}
+		q.domainWeights[strings.ToLower(node.Args[0])] = weight
+		return nil
+	})
 	cfg.String("location", false, false, q.location, &q.location)
+	cfg.Enum("store_format", false, false, []string{"files", "log"}, "files", &q.storeFormat)
+	cfg.DataSize("segment_size", false, false, 64*1024*1024, &q.segmentSize)
 	cfg.Custom("target", false, true, nil, modconfig.DeliveryDirective, &q.Target)
 	cfg.String("hostname", true, true, "", &q.hostname)
 	cfg.String("autogenerated_msg_domain", true, false, "", &q.autogenMsgDomain)
@@ -232,12 +262,26 @@ func (q *Queue) Init(cfg *config.Map) error {
 		q.dsnPipeline.(*msgpipeline.MsgPipeline).Hostname = q.hostname
 		q.dsnPipeline.(*msgpipeline.MsgPipeline).Log = log.Logger{Name: "queue/pipeline", Debug: q.Log.Debug}
 	}
+	if q.maxDomainParallelism == 0 {
+		q.maxDomainParallelism = maxParallelism
+	}
+	if maxParallelism <= 0 || q.maxDomainParallelism <= 0 || q.domainBatch <= 0 {
+		return errors.New("queue: max_parallelism, max_domain_parallelism and domain_batch should be positive")
+	}
 	if q.location == "" && q.name == "" {
 		return errors.New("queue: need explicit location directive or inline argument if defined inline")
 	}
 	if q.location == "" {
 		q.location = filepath.Join(config.StateDirectory, q.name)
 	}
+	// Worker processes cannot share the queue, each gets its own
+	// subdirectory.
+	orphanDirs, err := config.OrphanedWorkerDirs(q.location)
+	if err != nil {
+		return err
+	}
+	q.orphanDirs = orphanDirs
+	q.location = config.WorkerDir(q.location)
 
 	// TODO: Check location write permissions.
 	if err := os.MkdirAll(q.location, os.ModePerm); err != nil {
@@ -247,9 +291,31 @@ func (q *Queue) Init(cfg *config.Map) error {
 	return q.start(maxParallelism)
 }
 
+func (q *Queue) openStore(dir string) (msgStore, error) {
+	switch q.storeFormat {
+	case "log":
+		return openLogStore(dir, int64(q.segmentSize), q.Log)
+	default:
+		return newFileStore(dir, q.Log), nil
+	}
+}
+
 func (q *Queue) start(maxParallelism int) error {
+	store, err := q.openStore(q.location)
+	if err != nil {
+		return err
+	}
+	q.store = store
+
+	for _, dir := range q.orphanDirs {
+		if err := q.adoptOrphaned(dir); err != nil {
+			q.store.Close()
+			return fmt.Errorf("queue: failed to take over messages from %s: %w", dir, err)
+		}
+	}
+
+	q.sched = newDomainScheduler(maxParallelism, q.maxDomainParallelism, q.domainBatch, q.domainWeights, q.deliverSlot)
 	q.wheel = NewTimeWheel(q.dispatch)
-	q.deliverySemaphore = make(chan struct{}, maxParallelism)
 
 	if err := q.readDiskQueue(); err != nil {
 		return err
@@ -260,76 +326,121 @@ func (q *Queue) start(maxParallelism int) error {
 	return nil
 }
 
-func (q *Queue) Close() error {
-	q.wheel.Close()
-	q.deliveryWg.Wait()
+// adoptOrphaned moves messages from the queue directory that is not used by
+// any process anymore (e.g. after the amount of workers was changed) to
+// q.store.
+func (q *Queue) adoptOrphaned(dir string) error {
+	// Do not create an empty store where there was none.
+	pattern := "*.meta"
+	if q.storeFormat == "log" {
+		pattern = "*.seg"
+	}
+	files, err := filepath.Glob(filepath.Join(dir, pattern))
+	if err != nil || len(files) == 0 {
+		return err
+	}
+
+	orphan, err := q.openStore(dir)
+	if err != nil {
+		return err
+	}
+	var ids []string
+	if err := orphan.Load(func(ent indexEntry) {
+		ids = append(ids, ent.ID)
+	}); err != nil {
+		orphan.Close()
+		return err
+	}
+
+	for _, id := range ids {
+		meta, header, body, err := orphan.Open(id)
+		if err != nil {
+			orphan.Close()
+			return err
+		}
+		if meta == nil {
+			continue
+		}
+		if _, err := q.store.Store(meta, header, body); err != nil {
+			orphan.Close()
+			return err
+		}
+		orphan.Remove(meta.MsgMeta)
+	}
+	if err := orphan.Close(); err != nil {
+		return err
+	}
 
+	if q.storeFormat == "log" {
+		// Segments contain only removed messages now.
+		files, err := filepath.Glob(filepath.Join(dir, pattern))
+		if err != nil {
+			return err
+		}
+		for _, f := range files {
+			if err := os.Remove(f); err != nil {
+				return err
+			}
+		}
+	}
+
+	if len(ids) != 0 {
+		q.Log.Printf("took over %d messages from %s", len(ids), dir)
+	}
 	return nil
 }
 
-// discardBroken changes the name of metadata file to have .meta_broken
-// extension.
-//
-// Further attempts to deliver (due to a timewheel) it will fail due to
-// non-existent meta-data file.
-//
-// No error handling is done since this function is called from panic handler.
-func (q *Queue) discardBroken(id string) {
-	err := os.Rename(filepath.Join(q.location, id+".meta"), filepath.Join(q.location, id+".meta_broken"))
-	if err != nil {
-		// Note: Global logger is used in case there is something wrong with Queue.Log.
-		log.Printf("can't mark the queue message as broken: %v", err)
-	}
+func (q *Queue) Close() error {
+	q.wheel.Close()
+	q.sched.Close()
+
+	return q.store.Close()
 }
 
 func (q *Queue) dispatch(value TimeSlot) {
 	slot := value.Value.(queueSlot)
 
-	q.Log.Debugln("starting delivery for", slot.ID)
+	q.Log.Debugln("scheduling delivery for", slot.ID, "domain", slot.Domain)
+	q.sched.Add(slot)
+}
 
-	q.deliveryWg.Add(1)
-	go func() {
-		q.Log.Debugln("waiting on delivery semaphore for", slot.ID)
-		q.deliverySemaphore <- struct{}{}
-		defer func() {
-			<-q.deliverySemaphore
-			q.deliveryWg.Done()
+// deliverSlot is called by domainScheduler workers.
+func (q *Queue) deliverSlot(slot queueSlot) {
+	defer func() {
+		if dontRecover {
+			return
+		}
 
-			if dontRecover {
-				return
-			}
+		if err := recover(); err != nil {
+			stack := debug.Stack()
+			log.Printf("panic during queue dispatch %s: %v\n%s", slot.ID, err, stack)
+			q.store.MarkBroken(slot.ID)
+		}
+	}()
 
-			if err := recover(); err != nil {
-				stack := debug.Stack()
-				log.Printf("panic during queue dispatch %s: %v\n%s", slot.ID, err, stack)
-				q.discardBroken(slot.ID)
-			}
-		}()
-
-		q.Log.Debugln("delivery semaphore acquired for", slot.ID)
-		var (
-			meta *QueueMetadata
-			hdr  textproto.Header
-			body buffer.Buffer
-		)
-		if slot.Meta == nil {
-			var err error
-			meta, hdr, body, err = q.openMessage(slot.ID)
-			if err != nil {
-				q.Log.Error("read message", err, slot.ID)
-				return
-			}
-			if meta == nil {
-				panic("wtf")
-			}
-		} else {
-			meta = slot.Meta
-			hdr = *slot.Hdr
-			body = slot.Body
+	q.Log.Debugln("starting delivery for", slot.ID)
+	var (
+		meta *QueueMetadata
+		hdr  textproto.Header
+		body buffer.Buffer
+	)
+	if slot.Meta == nil {
+		var err error
+		meta, hdr, body, err = q.store.Open(slot.ID)
+		if err != nil {
+			q.Log.Error("read message", err, slot.ID)
+			return
 		}
+		if meta == nil {
+			panic("wtf")
+		}
+	} else {
+		meta = slot.Meta
+		hdr = *slot.Hdr
+		body = slot.Body
+	}
 
-		q.tryDelivery(meta, hdr, body)
-	}()
+	q.tryDelivery(meta, hdr, body)
 }
 
 func toSMTPErr(err error) *smtp.SMTPError {
@@ -426,16 +537,18 @@ func (q *Queue) tryDelivery(meta *QueueMetadata, header textproto.Header, body b
 	}
 	// No recipients to try, either all failed or all succeeded.
 	if len(newRcpts) == 0 {
-		q.removeFromDisk(meta.MsgMeta)
+		q.store.Remove(meta.MsgMeta)
 		return
 	}
 
 	meta.To = newRcpts
 	meta.LastAttempt = time.Now()
 
-	if err := q.updateMetadataOnDisk(meta); err != nil {
+	updateStart := time.Now()
+	if err := q.store.UpdateMeta(meta); err != nil {
 		dl.Error("meta-data update", err)
 	}
+	storeDuration.WithLabelValues(q.name, q.location, "update_meta").Observe(time.Since(updateStart).Seconds())
 
 	nextTryTime := time.Now()
 	// Delay between retries grows exponentally, the formula is:
@@ -449,7 +562,8 @@ func (q *Queue) tryDelivery(meta *QueueMetadata, header textproto.Header, body b
 		"rcpts", meta.To)
 
 	q.wheel.Add(nextTryTime, queueSlot{
-		ID: meta.MsgMeta.ID,
+		ID:     meta.MsgMeta.ID,
+		Domain: destDomain(meta.To),
 
 		// Do not keep (meta-)data in memory to reduce usage.  At this point,
 		// it is safe on disk and next try will reread it.
@@ -485,6 +599,14 @@ func (q *Queue) deliver(meta *QueueMetadata, header textproto.Header, body buffe
 	}
 	dl.Debugf("target.Start OK")
 
+	// BodyNonAtomic reports recipient rejections, so the target is free to
+	// batch RCPT commands.
+	if _, ok := delivery.(module.PartialDelivery); ok {
+		if batcher, ok := delivery.(module.RcptBatcher); ok {
+			batcher.DeferRcpts()
+		}
+	}
+
 	var acceptedRcpts []string
 	for _, rcpt := range meta.To {
 		rcptCtx, rcptTask := trace.NewTask(msgCtx, "RCPT TO")
@@ -568,8 +690,10 @@ func (qd *queueDelivery) Body(ctx context.Context, header textproto.Header, body
 	defer trace.StartRegion(ctx, "queue/Body").End()
 
 	// Body buffer initially passed to us may not be valid after "delivery" to queue completes.
-	// storeNewMessage returns a new buffer object created from message blob stored on disk.
-	storedBody, err := qd.q.storeNewMessage(qd.meta, header, body)
+	// Store returns a new buffer object created from message blob stored on disk.
+	start := time.Now()
+	storedBody, err := qd.q.store.Store(qd.meta, header, body)
+	storeDuration.WithLabelValues(qd.q.name, qd.q.location, "store").Observe(time.Since(start).Seconds())
 	if err != nil {
 		return err
 	}
@@ -583,7 +707,7 @@ func (qd *queueDelivery) Abort(ctx context.Context) error {
 	defer trace.StartRegion(ctx, "queue/Abort").End()
 
 	if qd.body != nil {
-		qd.q.removeFromDisk(qd.meta.MsgMeta)
+		qd.q.store.Remove(qd.meta.MsgMeta)
 	}
 	return nil
 }
@@ -596,10 +720,11 @@ func (qd *queueDelivery) Commit(ctx context.Context) error {
 	}
 
 	qd.q.wheel.Add(time.Time{}, queueSlot{
-		ID:   qd.meta.MsgMeta.ID,
-		Meta: qd.meta,
-		Hdr:  &qd.header,
-		Body: qd.body,
+		ID:     qd.meta.MsgMeta.ID,
+		Domain: destDomain(qd.meta.To),
+		Meta:   qd.meta,
+		Hdr:    &qd.header,
+		Body:   qd.body,
 	})
 	qd.meta = nil
 	qd.body = nil
@@ -617,83 +742,13 @@ func (q *Queue) Start(ctx context.Context, msgMeta *module.MsgMetadata, mailFrom
 	return &queueDelivery{q: q, meta: meta}, nil
 }
 
-func (q *Queue) removeFromDisk(msgMeta *module.MsgMetadata) {
-	id := msgMeta.ID
-	dl := target.DeliveryLogger(q.Log, msgMeta)
-
-	// Order is important.
-	// If we remove header and body but can't remove meta now - readDiskQueue
-	// will detect and report it.
-	headerPath := filepath.Join(q.location, id+".header")
-	if err := os.Remove(headerPath); err != nil {
-		dl.Error("failed to remove header from disk", err)
-	}
-	bodyPath := filepath.Join(q.location, id+".body")
-	if err := os.Remove(bodyPath); err != nil {
-		dl.Error("failed to remove body from disk", err)
-	}
-	metaPath := filepath.Join(q.location, id+".meta")
-	if err := os.Remove(metaPath); err != nil {
-		dl.Error("failed to remove meta-data from disk", err)
-	}
-	dl.Debugf("removed message from disk")
-}
-
 func (q *Queue) readDiskQueue() error {
-	dirInfo, err := ioutil.ReadDir(q.location)
-	if err != nil {
-		return err
-	}
-
-	// TODO(GH #209): Rewrite this function to pass all sub-tests in TestQueueDelivery_DeserializationCleanUp/NoMeta.
-
+	loadStart := time.Now()
 	loadedCount := 0
-	for _, entry := range dirInfo {
-		// We start loading from meta-data files and then check whether ID.header and ID.body exist.
-		// This allows us to properly detect dangling body files.
-		if entry.IsDir() || !strings.HasSuffix(entry.Name(), ".meta") {
-			continue
-		}
-		id := entry.Name()[:len(entry.Name())-5]
-
-		meta, err := q.readMessageMeta(id)
-		if err != nil {
-			q.Log.Printf("failed to read meta-data, skipping: %v (msg ID = %s)", err, id)
-			continue
-		}
-
-		// Check header file existence.
-		if _, err := os.Stat(filepath.Join(q.location, id+".header")); err != nil {
-			if os.IsNotExist(err) {
-				q.Log.Printf("header file doesn't exist for msg ID = %s", id)
-				q.tryRemoveDanglingFile(id + ".meta")
-				q.tryRemoveDanglingFile(id + ".body")
-			} else {
-				q.Log.Printf("skipping nonstat'able header file: %v (msg ID = %s)", err, id)
-			}
-			continue
-		}
-
-		// Check body file existence.
-		if _, err := os.Stat(filepath.Join(q.location, id+".body")); err != nil {
-			if os.IsNotExist(err) {
-				q.Log.Printf("body file doesn't exist for msg ID = %s", id)
-				q.tryRemoveDanglingFile(id + ".meta")
-				q.tryRemoveDanglingFile(id + ".header")
-			} else {
-				q.Log.Printf("skipping nonstat'able body file: %v (msg ID = %s)", err, id)
-			}
-			continue
-		}
-
-		smallestTriesCount := 999999
-		for _, count := range meta.TriesCount {
-			if smallestTriesCount > count {
-				smallestTriesCount = count
-			}
-		}
-		nextTryTime := meta.LastAttempt
-		scaleFactor := time.Duration(math.Pow(q.retryTimeScale, float64(smallestTriesCount-1)))
+	err := q.store.Load(func(ent indexEntry) {
+		id := ent.ID
+		nextTryTime := ent.LastAttempt
+		scaleFactor := time.Duration(math.Pow(q.retryTimeScale, float64(ent.TriesCount-1)))
 		nextTryTime = nextTryTime.Add(q.initialRetryTime * scaleFactor)
 
 		if time.Until(nextTryTime) < q.postInitDelay {
@@ -702,181 +757,28 @@ func (q *Queue) readDiskQueue() error {
 
 		q.Log.Debugf("will try to deliver (msg ID = %s) in %v (%v)", id, time.Until(nextTryTime), nextTryTime)
 		q.wheel.Add(nextTryTime, queueSlot{
-			ID: id,
+			ID:     id,
+			Domain: ent.Domain,
 		})
 		loadedCount++
-	}
-
-	if loadedCount != 0 {
-		q.Log.Printf("loaded %d saved queue entries", loadedCount)
-	}
-
-	return nil
-}
-
-func (q *Queue) storeNewMessage(meta *QueueMetadata, header textproto.Header, body buffer.Buffer) (buffer.Buffer, error) {
-	id := meta.MsgMeta.ID
-
-	headerPath := filepath.Join(q.location, id+".header")
-	headerFile, err := os.Create(headerPath)
-	if err != nil {
-		return nil, err
-	}
-	defer headerFile.Close()
-
-	if err := textproto.WriteHeader(headerFile, header); err != nil {
-		q.tryRemoveDanglingFile(id + ".header")
-		return nil, err
-	}
-
-	bodyReader, err := body.Open()
-	if err != nil {
-		q.tryRemoveDanglingFile(id + ".header")
-		return nil, err
-	}
-	defer bodyReader.Close()
-
-	bodyPath := filepath.Join(q.location, id+".body")
-	bodyFile, err := os.Create(bodyPath)
+	})
 	if err != nil {
-		return nil, err
-	}
-	defer bodyFile.Close()
-
-	if _, err := io.Copy(bodyFile, bodyReader); err != nil {
-		q.tryRemoveDanglingFile(id + ".body")
-		q.tryRemoveDanglingFile(id + ".header")
-		return nil, err
-	}
-
-	if err := q.updateMetadataOnDisk(meta); err != nil {
-		q.tryRemoveDanglingFile(id + ".body")
-		q.tryRemoveDanglingFile(id + ".header")
-		return nil, err
-	}
-
-	if err := headerFile.Sync(); err != nil {
-		return nil, err
-	}
-
-	if err := bodyFile.Sync(); err != nil {
-		return nil, err
-	}
-
-	return buffer.FileBuffer{Path: bodyPath, LenHint: body.Len()}, nil
-}
-
-func (q *Queue) updateMetadataOnDisk(meta *QueueMetadata) error {
-	metaPath := filepath.Join(q.location, meta.MsgMeta.ID+".meta")
-
-	var file *os.File
-	var err error
-	if runtime.GOOS == "windows" {
-		file, err = os.Create(metaPath)
-		if err != nil {
-			return err
-		}
-	} else {
-		file, err = os.Create(metaPath + ".new")
-		if err != nil {
-			return err
-		}
-	}
-	defer file.Close()
-
-	metaCopy := *meta
-	metaCopy.MsgMeta = meta.MsgMeta.DeepCopy()
-	metaCopy.MsgMeta.Conn = nil
-
-	if err := json.NewEncoder(file).Encode(metaCopy); err != nil {
 		return err
 	}
+	startupDuration.WithLabelValues(q.name, q.location).Set(time.Since(loadStart).Seconds())
 
-	if err := file.Sync(); err != nil {
-		return err
-	}
-
-	if runtime.GOOS != "windows" {
-		if err := os.Rename(metaPath+".new", metaPath); err != nil {
-			return err
-		}
+	if loadedCount != 0 {
+		q.Log.Printf("loaded %d saved queue entries in %v", loadedCount, time.Since(loadStart))
 	}
 
 	return nil
 }
 
-func (q *Queue) readMessageMeta(id string) (*QueueMetadata, error) {
-	metaPath := filepath.Join(q.location, id+".meta")
-	file, err := os.Open(metaPath)
-	if err != nil {
-		return nil, err
-	}
-	defer file.Close()
-
-	meta := &QueueMetadata{}
-
-	meta.MsgMeta = &module.MsgMetadata{}
-
-	// There is a couple of problems we have to solve before we would be able to
-	// serialize ConnState.
-	// 1. future.Future can't be serialized.
-	// 2. net.Addr can't be deserialized because we don't know the concrete type.
-
-	if err := json.NewDecoder(file).Decode(meta); err != nil {
-		return nil, err
-	}
-
-	return meta, nil
-}
-
 type BufferedReadCloser struct {
 	*bufio.Reader
 	io.Closer
 }
 
-func (q *Queue) tryRemoveDanglingFile(name string) {
-	if err := os.Remove(filepath.Join(q.location, name)); err != nil {
-		q.Log.Error("dangling file remove failed", err)
-		return
-	}
-	q.Log.Printf("removed dangling file %s", name)
-}
-
-func (q *Queue) openMessage(id string) (*QueueMetadata, textproto.Header, buffer.Buffer, error) {
-	meta, err := q.readMessageMeta(id)
-	if err != nil {
-		return nil, textproto.Header{}, nil, err
-	}
-
-	bodyPath := filepath.Join(q.location, id+".body")
-	_, err = os.Stat(bodyPath)
-	if err != nil {
-		if os.IsNotExist(err) {
-			q.tryRemoveDanglingFile(id + ".meta")
-		}
-		return nil, textproto.Header{}, nil, nil
-	}
-	body := buffer.FileBuffer{Path: bodyPath}
-
-	headerPath := filepath.Join(q.location, id+".header")
-	headerFile, err := os.Open(headerPath)
-	if err != nil {
-		if os.IsNotExist(err) {
-			q.tryRemoveDanglingFile(id + ".meta")
-			q.tryRemoveDanglingFile(id + ".body")
-		}
-		return nil, textproto.Header{}, nil, nil
-	}
-
-	bufferedHeader := bufio.NewReader(headerFile)
-	header, err := textproto.ReadHeader(bufferedHeader)
-	if err != nil {
-		return nil, textproto.Header{}, nil, nil
-	}
-
-	return meta, header, body, nil
-}
-
 func (q *Queue) InstanceName() string {
 	return q.name
 }
@@ -63,13 +63,24 @@ func cleanQueue(t *testing.T, q *Queue) {
 }
 
 func newTestQueueDir(t *testing.T, target module.DeliveryTarget, dir string) *Queue {
+	return newTestQueueFormat(t, target, dir, "files")
+}
+
+func newTestQueueFormat(t *testing.T, target module.DeliveryTarget, dir, format string) *Queue {
+	return newTestQueueOrphans(t, target, dir, format, nil)
+}
+
+func newTestQueueOrphans(t *testing.T, target module.DeliveryTarget, dir, format string, orphanDirs []string) *Queue {
 	mod, _ := NewQueue("", "queue", nil, nil)
 	q := mod.(*Queue)
+	q.storeFormat = format
+	q.segmentSize = 64 * 1024 * 1024
 	q.initialRetryTime = 0
 	q.retryTimeScale = 1
 	q.postInitDelay = 0
 	q.maxTries = 5
 	q.location = dir
+	q.orphanDirs = orphanDirs
 	q.Target = target
 
 	if testing.Verbose() {
@@ -218,6 +229,9 @@ func checkQueueDir(t *testing.T, q *Queue, expectedIDs []string) {
 		if file.IsDir() {
 			t.Fatalf("queue should not create subdirectories in the store, but there is %s dir in it", file.Name())
 		}
+		if strings.HasPrefix(file.Name(), indexFileName) {
+			continue
+		}
 
 		nameParts := strings.Split(file.Name(), ".")
 		if len(nameParts) != 2 {
@@ -512,6 +526,99 @@ func TestQueueDelivery_SerializationRoundtrip(t *testing.T) {
 	checkQueueDir(t, q, []string{})
 }
 
+func TestQueueDelivery_LogStore(t *testing.T) {
+	t.Parallel()
+
+	dt := unreliableTarget{
+		rcptFailures: []map[string]error{
+			{
+				"tester1@example.org": exterrors.WithTemporary(errors.New("go away"), true),
+			},
+		},
+		committed: make(chan testutils.Msg, 10),
+	}
+	dir, err := ioutil.TempDir("", "maddy-tests-queue")
+	if err != nil {
+		t.Fatal("failed to create temporary directory for queue:", err)
+	}
+	q := newTestQueueFormat(t, &dt, dir, "log")
+	defer cleanQueue(t, q)
+
+	// See TestQueueDelivery_SerializationRoundtrip.
+	q.initialRetryTime = 1 * time.Second
+
+	deliveryID := testutils.DoTestDelivery(t, q, "tester@example.com", []string{"tester1@example.org", "tester2@example.org"})
+
+	msg := readMsgChanTimeout(t, dt.committed, 5*time.Second)
+	testutils.CheckMsgID(t, msg, "tester@example.com", []string{"tester2@example.org"}, "")
+
+	q.Close()
+
+	q = newTestQueueFormat(t, &dt, dir, "log")
+	if meta, _, _, err := q.store.Open(deliveryID); err != nil || meta == nil {
+		t.Fatal("Message is not loaded from the log:", err)
+	}
+
+	msg = readMsgChanTimeout(t, dt.committed, 5*time.Second)
+	testutils.CheckMsgID(t, msg, "tester@example.com", []string{"tester1@example.org"}, "")
+
+	q.Close()
+	if len(q.store.(*logStore).index) != 0 {
+		t.Error("Delivered message is not removed from the log")
+	}
+}
+
+func TestQueueDelivery_AdoptOrphaned(t *testing.T) {
+	t.Parallel()
+
+	for _, format := range []string{"files", "log"} {
+		format := format
+		t.Run(format, func(t *testing.T) {
+			dt := unreliableTarget{
+				rcptFailures: []map[string]error{
+					{
+						"tester1@example.org": exterrors.WithTemporary(errors.New("go away"), true),
+					},
+				},
+				committed: make(chan testutils.Msg, 10),
+			}
+			base, err := ioutil.TempDir("", "maddy-tests-queue")
+			if err != nil {
+				t.Fatal("failed to create temporary directory for queue:", err)
+			}
+			defer os.RemoveAll(base)
+
+			// Message left by a single-process setup.
+			q := newTestQueueFormat(t, &dt, base, format)
+			q.initialRetryTime = 1 * time.Second
+			testutils.DoTestDelivery(t, q, "tester@example.com", []string{"tester1@example.org", "tester2@example.org"})
+			msg := readMsgChanTimeout(t, dt.committed, 5*time.Second)
+			testutils.CheckMsgID(t, msg, "tester@example.com", []string{"tester2@example.org"}, "")
+			q.Close()
+
+			// First worker should take it over.
+			workerDir := filepath.Join(base, "worker0")
+			if err := os.Mkdir(workerDir, 0700); err != nil {
+				t.Fatal(err)
+			}
+			q = newTestQueueOrphans(t, &dt, workerDir, format, []string{base})
+			msg = readMsgChanTimeout(t, dt.committed, 5*time.Second)
+			testutils.CheckMsgID(t, msg, "tester@example.com", []string{"tester1@example.org"}, "")
+			q.Close()
+
+			left, err := filepath.Glob(filepath.Join(base, "*.*"))
+			if err != nil {
+				t.Fatal(err)
+			}
+			for _, name := range left {
+				if ext := filepath.Ext(name); ext == ".meta" || ext == ".seg" {
+					t.Error("Message is left in the orphaned directory:", name)
+				}
+			}
+		})
+	}
+}
+
 func TestQueueDelivery_DeserlizationCleanUp(t *testing.T) {
 	t.Parallel()
 
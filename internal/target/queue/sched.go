@@ -0,0 +1,253 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package queue
+
+import (
+	"container/heap"
+	"strings"
+	"sync"
+
+	"github.com/foxcpp/maddy/framework/address"
+)
+
+// destDomain returns the scheduling key for the message with the
+// specified recipients.
+//
+// Only the first recipient is considered, messages with recipients in
+// multiple domains are accounted to that domain.
+func destDomain(rcpts []string) string {
+	if len(rcpts) == 0 {
+		return ""
+	}
+	_, domain, err := address.Split(rcpts[0])
+	if err != nil {
+		return ""
+	}
+	return strings.ToLower(domain)
+}
+
+// flow is the set of due messages for a single destination domain.
+type flow struct {
+	domain  string
+	weight  float64
+	pending []queueSlot
+
+	// Amount of workers delivering messages from this flow.
+	active int
+
+	// Virtual time at which the last batch taken from the flow is
+	// considered to be completed.
+	finish float64
+
+	// Position in domainScheduler.ready, -1 if the flow is not there.
+	index int
+}
+
+type flowHeap []*flow
+
+func (h flowHeap) Len() int { return len(h) }
+
+func (h flowHeap) Less(i, j int) bool { return h[i].finish < h[j].finish }
+
+func (h flowHeap) Swap(i, j int) {
+	h[i], h[j] = h[j], h[i]
+	h[i].index = i
+	h[j].index = j
+}
+
+func (h *flowHeap) Push(x interface{}) {
+	f := x.(*flow)
+	f.index = len(*h)
+	*h = append(*h, f)
+}
+
+func (h *flowHeap) Pop() interface{} {
+	old := *h
+	f := old[len(old)-1]
+	old[len(old)-1] = nil
+	f.index = -1
+	*h = old[:len(old)-1]
+	return f
+}
+
+// domainScheduler distributes due messages between a fixed amount of
+// delivery workers.
+//
+// Messages are grouped into flows by destination domain and flows are
+// served using weighted fair queuing: each message taken from a flow
+// advances its virtual time by 1/weight and the flow with the smallest
+// virtual time is served next. Thus a large backlog for one domain does not
+// delay deliveries to other domains.
+//
+// Up to batchSize messages of one flow are handed to a single worker and are
+// delivered back-to-back so the target can reuse the connection. No more
+// than maxPerDomain workers are serving a single flow at the same time.
+type domainScheduler struct {
+	deliver      func(slot queueSlot)
+	maxPerDomain int
+	batchSize    int
+	weights      map[string]float64
+
+	mu     sync.Mutex
+	cond   *sync.Cond
+	flows  map[string]*flow
+	ready  flowHeap
+	vtime  float64
+	closed bool
+
+	workers sync.WaitGroup
+}
+
+func newDomainScheduler(workers, maxPerDomain, batchSize int, weights map[string]float64, deliver func(queueSlot)) *domainScheduler {
+	s := &domainScheduler{
+		deliver:      deliver,
+		maxPerDomain: maxPerDomain,
+		batchSize:    batchSize,
+		weights:      weights,
+		flows:        map[string]*flow{},
+	}
+	s.cond = sync.NewCond(&s.mu)
+
+	s.workers.Add(workers)
+	for i := 0; i < workers; i++ {
+		go s.worker()
+	}
+	return s
+}
+
+// Add schedules the message for delivery as soon as a worker is available.
+func (s *domainScheduler) Add(slot queueSlot) {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+
+	f := s.flows[slot.Domain]
+	if f == nil {
+		weight := s.weights[slot.Domain]
+		if weight <= 0 {
+			weight = 1
+		}
+		f = &flow{domain: slot.Domain, weight: weight, index: -1}
+		s.flows[slot.Domain] = f
+	}
+	if len(f.pending) == 0 && f.active == 0 && f.finish < s.vtime {
+		// Idle flows do not accumulate credit.
+		f.finish = s.vtime
+	}
+	f.pending = append(f.pending, slot)
+
+	s.update(f)
+	s.cond.Signal()
+}
+
+// update puts f into the ready heap if it can be served and removes it
+// otherwise.
+func (s *domainScheduler) update(f *flow) {
+	eligible := len(f.pending) != 0 && f.active < s.maxPerDomain
+	switch {
+	case eligible && f.index < 0:
+		heap.Push(&s.ready, f)
+	case eligible:
+		heap.Fix(&s.ready, f.index)
+	case f.index >= 0:
+		heap.Remove(&s.ready, f.index)
+	}
+}
+
+func (s *domainScheduler) next() (*flow, []queueSlot, bool) {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+
+	for len(s.ready) == 0 && !s.closed {
+		s.cond.Wait()
+	}
+	if s.closed {
+		return nil, nil, false
+	}
+
+	f := s.ready[0]
+	n := len(f.pending)
+	if n > s.batchSize {
+		n = s.batchSize
+	}
+	batch := make([]queueSlot, n)
+	copy(batch, f.pending)
+	for i := 0; i < n; i++ {
+		f.pending[i] = queueSlot{}
+	}
+	f.pending = f.pending[n:]
+	if len(f.pending) == 0 {
+		f.pending = nil
+	}
+
+	f.active++
+	s.vtime = f.finish
+	f.finish += float64(n) / f.weight
+	s.update(f)
+
+	return f, batch, true
+}
+
+func (s *domainScheduler) done(f *flow) {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+
+	f.active--
+	if len(f.pending) == 0 && f.active == 0 {
+		delete(s.flows, f.domain)
+		return
+	}
+	s.update(f)
+	s.cond.Signal()
+}
+
+func (s *domainScheduler) isClosed() bool {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	return s.closed
+}
+
+func (s *domainScheduler) worker() {
+	defer s.workers.Done()
+	for {
+		f, batch, ok := s.next()
+		if !ok {
+			return
+		}
+		for _, slot := range batch {
+			// Messages left in the batch are still on disk and will be
+			// loaded on the next start.
+			if s.isClosed() {
+				break
+			}
+			s.deliver(slot)
+		}
+		s.done(f)
+	}
+}
+
+// Close stops all workers and waits for running deliveries to complete.
+// Pending messages are discarded.
+func (s *domainScheduler) Close() {
+	s.mu.Lock()
+	s.closed = true
+	s.cond.Broadcast()
+	s.mu.Unlock()
+
+	s.workers.Wait()
+}
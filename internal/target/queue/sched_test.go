@@ -0,0 +1,152 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package queue
+
+import (
+	"strconv"
+	"sync"
+	"testing"
+	"time"
+)
+
+func TestDestDomain(t *testing.T) {
+	for _, c := range []struct {
+		rcpts  []string
+		domain string
+	}{
+		{nil, ""},
+		{[]string{"test@Example.ORG"}, "example.org"},
+		{[]string{"test@example.org", "test@example.com"}, "example.org"},
+		{[]string{"postmaster"}, ""},
+	} {
+		if domain := destDomain(c.rcpts); domain != c.domain {
+			t.Errorf("destDomain(%v) = %s, want %s", c.rcpts, domain, c.domain)
+		}
+	}
+}
+
+// schedRecorder blocks deliveries until release is closed so the whole
+// backlog is queued before the first worker takes anything.
+type schedRecorder struct {
+	release chan struct{}
+
+	lck     sync.Mutex
+	order   []queueSlot
+	active  map[string]int
+	maxSeen map[string]int
+	wg      sync.WaitGroup
+}
+
+func newSchedRecorder() *schedRecorder {
+	return &schedRecorder{
+		release: make(chan struct{}),
+		active:  map[string]int{},
+		maxSeen: map[string]int{},
+	}
+}
+
+func (r *schedRecorder) deliver(slot queueSlot) {
+	<-r.release
+
+	r.lck.Lock()
+	r.order = append(r.order, slot)
+	r.active[slot.Domain]++
+	if r.active[slot.Domain] > r.maxSeen[slot.Domain] {
+		r.maxSeen[slot.Domain] = r.active[slot.Domain]
+	}
+	r.lck.Unlock()
+
+	time.Sleep(time.Millisecond)
+
+	r.lck.Lock()
+	r.active[slot.Domain]--
+	r.lck.Unlock()
+	r.wg.Done()
+}
+
+func TestDomainScheduler_Fairness(t *testing.T) {
+	r := newSchedRecorder()
+	// Worker is started after everything is queued.
+	s := newDomainScheduler(0, 1, 5, map[string]float64{"weighted.example": 2}, r.deliver)
+	defer s.Close()
+
+	r.wg.Add(100 + 10 + 10)
+	for i := 0; i < 100; i++ {
+		s.Add(queueSlot{ID: "big" + strconv.Itoa(i), Domain: "big.example"})
+	}
+	for i := 0; i < 10; i++ {
+		s.Add(queueSlot{ID: "small" + strconv.Itoa(i), Domain: "small.example"})
+		s.Add(queueSlot{ID: "weighted" + strconv.Itoa(i), Domain: "weighted.example"})
+	}
+	close(r.release)
+	s.workers.Add(1)
+	go s.worker()
+	r.wg.Wait()
+
+	// Both small flows should be completely served long before the big one
+	// even though it was queued first.
+	lastSmall, lastWeighted := 0, 0
+	for i, slot := range r.order {
+		switch slot.Domain {
+		case "small.example":
+			lastSmall = i
+		case "weighted.example":
+			lastWeighted = i
+		}
+	}
+	if lastSmall > 40 {
+		t.Error("Small flow is starved, last message at", lastSmall)
+	}
+	if lastWeighted > lastSmall {
+		t.Error("Flow with bigger weight is served slower:", lastWeighted, lastSmall)
+	}
+
+	// Messages for the same domain are delivered back-to-back.
+	for i := 0; i < 5; i++ {
+		if r.order[i].Domain != r.order[0].Domain {
+			t.Fatal("Batch is not delivered back-to-back:", r.order[:5])
+		}
+	}
+}
+
+func TestDomainScheduler_Parallelism(t *testing.T) {
+	r := newSchedRecorder()
+	s := newDomainScheduler(8, 2, 1, nil, r.deliver)
+	defer s.Close()
+
+	r.wg.Add(40)
+	for i := 0; i < 20; i++ {
+		s.Add(queueSlot{ID: "a" + strconv.Itoa(i), Domain: "a.example"})
+		s.Add(queueSlot{ID: "b" + strconv.Itoa(i), Domain: "b.example"})
+	}
+	close(r.release)
+	r.wg.Wait()
+
+	for domain, max := range r.maxSeen {
+		if max > 2 {
+			t.Errorf("Per-domain limit is exceeded for %s: %d", domain, max)
+		}
+	}
+
+	s.mu.Lock()
+	defer s.mu.Unlock()
+	if len(s.flows) != 0 || len(s.ready) != 0 {
+		t.Error("Completed flows are not removed:", len(s.flows), len(s.ready))
+	}
+}
@@ -0,0 +1,426 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package queue
+
+import (
+	"bufio"
+	"encoding/json"
+	"io"
+	"os"
+	"path/filepath"
+	"runtime"
+	"strings"
+	"sync"
+
+	"github.com/emersion/go-message/textproto"
+	"github.com/foxcpp/maddy/framework/buffer"
+	"github.com/foxcpp/maddy/framework/log"
+	"github.com/foxcpp/maddy/framework/module"
+	"github.com/foxcpp/maddy/internal/target"
+)
+
+// msgStore is the persistent storage for queued messages.
+//
+// Implementations should be safe for concurrent use.
+type msgStore interface {
+	// Store saves a new message. The returned Buffer refers to the stored
+	// copy of the body and is valid until the message is removed.
+	Store(meta *QueueMetadata, header textproto.Header, body buffer.Buffer) (buffer.Buffer, error)
+
+	// UpdateMeta replaces saved meta-data of the message.
+	UpdateMeta(meta *QueueMetadata) error
+
+	// Open reads the stored message. If it is not stored completely, nil
+	// meta-data is returned with nil error.
+	Open(id string) (*QueueMetadata, textproto.Header, buffer.Buffer, error)
+
+	// Remove discards the message. Errors are logged.
+	Remove(msgMeta *module.MsgMetadata)
+
+	// MarkBroken excludes the message from further processing.
+	//
+	// No error handling is done since this function is called from panic
+	// handler.
+	MarkBroken(id string)
+
+	// Load calls cb for each stored message. Implementations may use
+	// cached scheduling information instead of reading the full meta-data.
+	Load(cb func(ent indexEntry)) error
+
+	Close() error
+}
+
+// fileStore keeps each message in three files in the queue directory:
+// ID.header, ID.body and ID.meta.
+//
+// Scheduling information for all messages is additionally kept in memory and
+// periodically saved to the index file so Load does not have to decode each
+// .meta file.
+type fileStore struct {
+	location string
+	log      log.Logger
+
+	idxLck   sync.Mutex
+	idx      map[string]indexEntry
+	idxDirty bool
+
+	stop    chan struct{}
+	stopped chan struct{}
+}
+
+func newFileStore(location string, log log.Logger) *fileStore {
+	s := &fileStore{
+		location: location,
+		log:      log,
+		idx:      map[string]indexEntry{},
+		stop:     make(chan struct{}),
+		stopped:  make(chan struct{}),
+	}
+	go s.indexLoop()
+	return s
+}
+
+// MarkBroken changes the name of metadata file to have .meta_broken
+// extension.
+//
+// Further attempts to deliver (due to a timewheel) it will fail due to
+// non-existent meta-data file.
+func (s *fileStore) MarkBroken(id string) {
+	s.dropIndex(id)
+	err := os.Rename(filepath.Join(s.location, id+".meta"), filepath.Join(s.location, id+".meta_broken"))
+	if err != nil {
+		// Note: Global logger is used in case there is something wrong with Queue.Log.
+		log.Printf("can't mark the queue message as broken: %v", err)
+	}
+}
+
+func (s *fileStore) Remove(msgMeta *module.MsgMetadata) {
+	id := msgMeta.ID
+	dl := target.DeliveryLogger(s.log, msgMeta)
+	s.dropIndex(id)
+
+	// Order is important.
+	// If we remove header and body but can't remove meta now - Load
+	// will detect and report it.
+	headerPath := filepath.Join(s.location, id+".header")
+	if err := os.Remove(headerPath); err != nil {
+		dl.Error("failed to remove header from disk", err)
+	}
+	bodyPath := filepath.Join(s.location, id+".body")
+	if err := os.Remove(bodyPath); err != nil {
+		dl.Error("failed to remove body from disk", err)
+	}
+	metaPath := filepath.Join(s.location, id+".meta")
+	if err := os.Remove(metaPath); err != nil {
+		dl.Error("failed to remove meta-data from disk", err)
+	}
+	dl.Debugf("removed message from disk")
+}
+
+func (s *fileStore) Load(cb func(ent indexEntry)) error {
+	// Names are enough here, ioutil.ReadDir would stat each file.
+	dir, err := os.Open(s.location)
+	if err != nil {
+		return err
+	}
+	dirNames, err := dir.Readdirnames(-1)
+	dir.Close()
+	if err != nil {
+		return err
+	}
+
+	// The directory listing is still needed to find messages saved after
+	// the last index flush and to skip index entries for removed messages,
+	// but that is much cheaper than decoding all meta-data files.
+	saved, err := readIndex(s.indexPath())
+	if err != nil && !os.IsNotExist(err) {
+		s.log.Error("failed to read queue index, scanning all meta-data files", err)
+	}
+
+	// TODO(GH #209): Rewrite this function to pass all sub-tests in TestQueueDelivery_DeserializationCleanUp/NoMeta.
+
+	names := make(map[string]struct{}, len(dirNames))
+	for _, name := range dirNames {
+		names[name] = struct{}{}
+	}
+	complete := func(id string) bool {
+		_, hdrOk := names[id+".header"]
+		_, bodyOk := names[id+".body"]
+		return hdrOk && bodyOk
+	}
+
+	indexed := 0
+	for _, name := range dirNames {
+		// We start loading from meta-data files and then check whether ID.header and ID.body exist.
+		// This allows us to properly detect dangling body files.
+		if !strings.HasSuffix(name, ".meta") {
+			continue
+		}
+		id := name[:len(name)-5]
+
+		if ent, ok := saved[id]; ok && complete(id) {
+			s.setIndex(ent)
+			cb(ent)
+			indexed++
+			continue
+		}
+
+		meta, err := s.readMeta(id)
+		if err != nil {
+			s.log.Printf("failed to read meta-data, skipping: %v (msg ID = %s)", err, id)
+			continue
+		}
+
+		// Check header file existence.
+		if _, err := os.Stat(filepath.Join(s.location, id+".header")); err != nil {
+			if os.IsNotExist(err) {
+				s.log.Printf("header file doesn't exist for msg ID = %s", id)
+				s.tryRemoveDanglingFile(id + ".meta")
+				s.tryRemoveDanglingFile(id + ".body")
+			} else {
+				s.log.Printf("skipping nonstat'able header file: %v (msg ID = %s)", err, id)
+			}
+			continue
+		}
+
+		// Check body file existence.
+		if _, err := os.Stat(filepath.Join(s.location, id+".body")); err != nil {
+			if os.IsNotExist(err) {
+				s.log.Printf("body file doesn't exist for msg ID = %s", id)
+				s.tryRemoveDanglingFile(id + ".meta")
+				s.tryRemoveDanglingFile(id + ".header")
+			} else {
+				s.log.Printf("skipping nonstat'able body file: %v (msg ID = %s)", err, id)
+			}
+			continue
+		}
+
+		ent := newIndexEntry(meta)
+		s.setIndex(ent)
+		cb(ent)
+	}
+	s.log.DebugMsg("queue index loaded", "indexed", indexed, "index_entries", len(saved))
+
+	// Entries for removed messages should not survive until the next flush.
+	s.idxLck.Lock()
+	s.idxDirty = true
+	s.idxLck.Unlock()
+	return s.flushIndex()
+}
+
+func (s *fileStore) Store(meta *QueueMetadata, header textproto.Header, body buffer.Buffer) (buffer.Buffer, error) {
+	id := meta.MsgMeta.ID
+
+	headerPath := filepath.Join(s.location, id+".header")
+	headerFile, err := os.Create(headerPath)
+	if err != nil {
+		return nil, err
+	}
+	defer headerFile.Close()
+
+	if err := textproto.WriteHeader(headerFile, header); err != nil {
+		s.tryRemoveDanglingFile(id + ".header")
+		return nil, err
+	}
+
+	bodyPath := filepath.Join(s.location, id+".body")
+	if err := s.writeBody(bodyPath, body); err != nil {
+		s.tryRemoveDanglingFile(id + ".body")
+		s.tryRemoveDanglingFile(id + ".header")
+		return nil, err
+	}
+
+	if err := s.UpdateMeta(meta); err != nil {
+		s.tryRemoveDanglingFile(id + ".body")
+		s.tryRemoveDanglingFile(id + ".header")
+		return nil, err
+	}
+
+	if err := headerFile.Sync(); err != nil {
+		return nil, err
+	}
+
+	return buffer.FileBuffer{Path: bodyPath, LenHint: body.Len()}, nil
+}
+
+// writeBody stores the body at path and syncs it to disk.
+//
+// FileBuffer bodies are hard-linked if the buffer directory is on the same
+// file system, Buffer contents are immutable so the file can be shared.
+// Otherwise the body is copied.
+func (s *fileStore) writeBody(path string, body buffer.Buffer) error {
+	if fb, ok := body.(buffer.FileBuffer); ok {
+		err := os.Link(fb.Path, path)
+		if err == nil {
+			return syncFile(path)
+		}
+		s.log.Debugf("cannot link %s, copying the body: %v", fb.Path, err)
+	}
+
+	bodyReader, err := body.Open()
+	if err != nil {
+		return err
+	}
+	defer bodyReader.Close()
+
+	bodyFile, err := os.Create(path)
+	if err != nil {
+		return err
+	}
+	defer bodyFile.Close()
+
+	if _, err := io.Copy(bodyFile, bodyReader); err != nil {
+		return err
+	}
+	return bodyFile.Sync()
+}
+
+func syncFile(path string) error {
+	f, err := os.Open(path)
+	if err != nil {
+		return err
+	}
+	defer f.Close()
+	return f.Sync()
+}
+
+// encodeMeta serializes the meta-data for storage. Connection state is
+// not preserved.
+func encodeMeta(w io.Writer, meta *QueueMetadata) error {
+	metaCopy := *meta
+	metaCopy.MsgMeta = meta.MsgMeta.DeepCopy()
+	metaCopy.MsgMeta.Conn = nil
+
+	return json.NewEncoder(w).Encode(metaCopy)
+}
+
+// decodeMeta is the reverse of encodeMeta.
+func decodeMeta(r io.Reader) (*QueueMetadata, error) {
+	meta := &QueueMetadata{}
+
+	meta.MsgMeta = &module.MsgMetadata{}
+
+	// There is a couple of problems we have to solve before we would be able to
+	// serialize ConnState.
+	// 1. future.Future can't be serialized.
+	// 2. net.Addr can't be deserialized because we don't know the concrete type.
+
+	if err := json.NewDecoder(r).Decode(meta); err != nil {
+		return nil, err
+	}
+
+	return meta, nil
+}
+
+func (s *fileStore) UpdateMeta(meta *QueueMetadata) error {
+	metaPath := filepath.Join(s.location, meta.MsgMeta.ID+".meta")
+
+	var file *os.File
+	var err error
+	if runtime.GOOS == "windows" {
+		file, err = os.Create(metaPath)
+		if err != nil {
+			return err
+		}
+	} else {
+		file, err = os.Create(metaPath + ".new")
+		if err != nil {
+			return err
+		}
+	}
+	defer file.Close()
+
+	if err := encodeMeta(file, meta); err != nil {
+		return err
+	}
+
+	if err := file.Sync(); err != nil {
+		return err
+	}
+
+	if runtime.GOOS != "windows" {
+		if err := os.Rename(metaPath+".new", metaPath); err != nil {
+			return err
+		}
+	}
+
+	s.setIndex(newIndexEntry(meta))
+	return nil
+}
+
+func (s *fileStore) readMeta(id string) (*QueueMetadata, error) {
+	metaPath := filepath.Join(s.location, id+".meta")
+	file, err := os.Open(metaPath)
+	if err != nil {
+		return nil, err
+	}
+	defer file.Close()
+
+	return decodeMeta(file)
+}
+
+func (s *fileStore) tryRemoveDanglingFile(name string) {
+	if err := os.Remove(filepath.Join(s.location, name)); err != nil {
+		s.log.Error("dangling file remove failed", err)
+		return
+	}
+	s.log.Printf("removed dangling file %s", name)
+}
+
+func (s *fileStore) Open(id string) (*QueueMetadata, textproto.Header, buffer.Buffer, error) {
+	meta, err := s.readMeta(id)
+	if err != nil {
+		return nil, textproto.Header{}, nil, err
+	}
+
+	bodyPath := filepath.Join(s.location, id+".body")
+	_, err = os.Stat(bodyPath)
+	if err != nil {
+		if os.IsNotExist(err) {
+			s.tryRemoveDanglingFile(id + ".meta")
+		}
+		return nil, textproto.Header{}, nil, nil
+	}
+	body := buffer.FileBuffer{Path: bodyPath}
+
+	headerPath := filepath.Join(s.location, id+".header")
+	headerFile, err := os.Open(headerPath)
+	if err != nil {
+		if os.IsNotExist(err) {
+			s.tryRemoveDanglingFile(id + ".meta")
+			s.tryRemoveDanglingFile(id + ".body")
+		}
+		return nil, textproto.Header{}, nil, nil
+	}
+	defer headerFile.Close()
+
+	bufferedHeader := bufio.NewReader(headerFile)
+	header, err := textproto.ReadHeader(bufferedHeader)
+	if err != nil {
+		return nil, textproto.Header{}, nil, nil
+	}
+
+	return meta, header, body, nil
+}
+
+func (s *fileStore) Close() error {
+	close(s.stop)
+	<-s.stopped
+	return s.flushIndex()
+}
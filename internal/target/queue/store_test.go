@@ -0,0 +1,100 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package queue
+
+import (
+	"bytes"
+	"io/ioutil"
+	"os"
+	"path/filepath"
+	"testing"
+
+	"github.com/emersion/go-message/textproto"
+	"github.com/foxcpp/maddy/framework/buffer"
+	"github.com/foxcpp/maddy/framework/log"
+	"github.com/foxcpp/maddy/framework/module"
+)
+
+func TestFileStore_LinkBody(t *testing.T) {
+	dir, err := ioutil.TempDir("", "maddy-tests-queue")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer os.RemoveAll(dir)
+	bufDir := filepath.Join(dir, "buffer")
+	queueDir := filepath.Join(dir, "queue")
+	for _, d := range []string{bufDir, queueDir} {
+		if err := os.Mkdir(d, 0700); err != nil {
+			t.Fatal(err)
+		}
+	}
+
+	s := newFileStore(queueDir, log.Logger{Out: log.NopOutput{}})
+	defer s.Close()
+
+	store := func(id string, body buffer.Buffer) string {
+		t.Helper()
+		stored, err := s.Store(&QueueMetadata{
+			MsgMeta: &module.MsgMetadata{ID: id},
+		}, textproto.Header{}, body)
+		if err != nil {
+			t.Fatal(err)
+		}
+		r, err := stored.Open()
+		if err != nil {
+			t.Fatal(err)
+		}
+		defer r.Close()
+		blob, err := ioutil.ReadAll(r)
+		if err != nil {
+			t.Fatal(err)
+		}
+		if !bytes.Equal(blob, []byte("body")) {
+			t.Fatalf("Wrong body stored: %q", blob)
+		}
+		return filepath.Join(queueDir, id+".body")
+	}
+
+	fileBody, err := buffer.BufferInFile(bytes.NewReader([]byte("body")), bufDir)
+	if err != nil {
+		t.Fatal(err)
+	}
+	linkedPath := store("linked", fileBody)
+	bufInfo, err := os.Stat(fileBody.(buffer.FileBuffer).Path)
+	if err != nil {
+		t.Fatal(err)
+	}
+	linkedInfo, err := os.Stat(linkedPath)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if !os.SameFile(bufInfo, linkedInfo) {
+		t.Error("FileBuffer body is copied instead of linking")
+	}
+
+	// The queue copy should survive the removal of the original buffer.
+	if err := fileBody.Remove(); err != nil {
+		t.Fatal(err)
+	}
+	if _, err := os.Stat(linkedPath); err != nil {
+		t.Error("Linked body is removed with the buffer:", err)
+	}
+
+	store("copied", buffer.MemoryBuffer{Slice: []byte("body")})
+}
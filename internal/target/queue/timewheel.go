@@ -19,7 +19,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 package queue
 
 import (
-	"container/list"
+	"container/heap"
 	"sync"
 	"sync/atomic"
 	"time"
@@ -30,13 +30,55 @@ type TimeSlot struct {
 	Value interface{}
 }
 
+type heapSlot struct {
+	TimeSlot
+	// Insertion order, used to keep slots with equal Time in FIFO order.
+	seq uint64
+}
+
+// slotHeap is a min-heap of slots ordered by Time.
+type slotHeap []heapSlot
+
+func (h slotHeap) Len() int { return len(h) }
+
+func (h slotHeap) Less(i, j int) bool {
+	if h[i].Time.Equal(h[j].Time) {
+		return h[i].seq < h[j].seq
+	}
+	return h[i].Time.Before(h[j].Time)
+}
+
+func (h slotHeap) Swap(i, j int) { h[i], h[j] = h[j], h[i] }
+
+func (h *slotHeap) Push(x interface{}) {
+	*h = append(*h, x.(heapSlot))
+}
+
+func (h *slotHeap) Pop() interface{} {
+	old := *h
+	n := len(old)
+	slot := old[n-1]
+	// Do not keep the value alive.
+	old[n-1] = heapSlot{}
+	*h = old[:n-1]
+	return slot
+}
+
+// TimeWheel calls dispatch for each added value once its target time is
+// reached.
+//
+// Values are kept in a binary heap so Add and removal of each due value are
+// O(log n). Add never blocks on the dispatching goroutine. All values that
+// are due at the moment of wake-up are dispatched together.
 type TimeWheel struct {
 	stopped uint32
 
-	slots     *list.List
+	slots     slotHeap
 	slotsLock sync.Mutex
+	nextSeq   uint64
 
-	updateNotify chan time.Time
+	// updateNotify is signaled when the earliest slot changes.
+	updateNotify chan struct{}
 	stopNotify   chan struct{}
 
 	dispatch func(TimeSlot)
@@ -44,9 +86,8 @@ type TimeWheel struct {
 
 func NewTimeWheel(dispatch func(TimeSlot)) *TimeWheel {
 	tw := &TimeWheel{
-		slots:        list.New(),
 		stopNotify:   make(chan struct{}),
-		updateNotify: make(chan time.Time),
+		updateNotify: make(chan struct{}, 1),
 		dispatch:     dispatch,
 	}
 	go tw.tick()
@@ -64,10 +105,22 @@ func (tw *TimeWheel) Add(target time.Time, value interface{}) {
 	}
 
 	tw.slotsLock.Lock()
-	tw.slots.PushBack(TimeSlot{Time: target, Value: value})
+	heap.Push(&tw.slots, heapSlot{
+		TimeSlot: TimeSlot{Time: target, Value: value},
+		seq:      tw.nextSeq,
+	})
+	tw.nextSeq++
+	// Wait time changes only if the new slot became the earliest one.
+	earliest := tw.slots[0].seq == tw.nextSeq-1
 	tw.slotsLock.Unlock()
 
-	tw.updateNotify <- target
+	if earliest {
+		select {
+		case tw.updateNotify <- struct{}{}:
+		default:
+			// Ticker is already going to recalculate its wait time.
+		}
+	}
 }
 
 func (tw *TimeWheel) Close() {
@@ -82,65 +135,67 @@ func (tw *TimeWheel) Close() {
 	<-tw.stopNotify
 
 	tw.stopNotify = nil
+}
 
-	close(tw.updateNotify)
+// maxDispatchBatch is the max. amount of slots removed from the heap
+// without releasing the lock.
+const maxDispatchBatch = 1024
+
+// popDue removes slots with target time before or equal to now and appends
+// them to due, at most maxDispatchBatch at once.
+//
+// It returns the time until the next slot is due or -1 if there are no
+// slots left.
+func (tw *TimeWheel) popDue(now time.Time, due []TimeSlot) ([]TimeSlot, time.Duration) {
+	tw.slotsLock.Lock()
+	defer tw.slotsLock.Unlock()
+
+	for len(tw.slots) != 0 {
+		if tw.slots[0].Time.After(now) {
+			return due, tw.slots[0].Time.Sub(now)
+		}
+		if len(due) == maxDispatchBatch {
+			return due, 0
+		}
+		due = append(due, heap.Pop(&tw.slots).(heapSlot).TimeSlot)
+	}
+	return due, -1
 }
 
 func (tw *TimeWheel) tick() {
+	timer := time.NewTimer(0)
+	if !timer.Stop() {
+		<-timer.C
+	}
+	defer timer.Stop()
+
+	var due []TimeSlot
 	for {
-		now := time.Now()
-		// Look for list element closest to now.
-		tw.slotsLock.Lock()
-		var closestSlot TimeSlot
-		var closestEl *list.Element
-		for e := tw.slots.Front(); e != nil; e = e.Next() {
-			slot := e.Value.(TimeSlot)
-			if slot.Time.Sub(now) < closestSlot.Time.Sub(now) || closestSlot.Value == nil {
-				closestSlot = slot
-				closestEl = e
-			}
+		var wait time.Duration
+		due, wait = tw.popDue(time.Now(), due[:0])
+
+		// Only this goroutine removes elements from TimeWheel, dispatch is
+		// called without holding the lock so it can Add new slots.
+		for i, slot := range due {
+			tw.dispatch(slot)
+			due[i] = TimeSlot{}
 		}
-		tw.slotsLock.Unlock()
-		// Only this goroutine removes elements from TimeWheel so we can be safe using closestSlot.
-
-		// Queue is empty. Just wait until update.
-		if closestEl == nil {
-			select {
-			case <-tw.updateNotify:
-				continue
-			case <-tw.stopNotify:
-				tw.stopNotify <- struct{}{}
-				return
-			}
+
+		var timerC <-chan time.Time
+		if wait >= 0 {
+			timer.Reset(wait)
+			timerC = timer.C
 		}
 
-		timer := time.NewTimer(closestSlot.Time.Sub(now))
-
-	selectloop:
-		for {
-			select {
-			case <-timer.C:
-				tw.slotsLock.Lock()
-				tw.slots.Remove(closestEl)
-				tw.slotsLock.Unlock()
-
-				tw.dispatch(closestSlot)
-
-				break selectloop
-			case newTarget := <-tw.updateNotify:
-				// Avoid unnecessary restarts if new target is not going to affect our
-				// current wait time.
-				if closestSlot.Time.Sub(now) <= newTarget.Sub(now) {
-					continue
-				}
-
-				timer.Stop()
-				// Recalculate new slot time.
-				break selectloop
-			case <-tw.stopNotify:
-				tw.stopNotify <- struct{}{}
-				return
+		select {
+		case <-timerC:
+		case <-tw.updateNotify:
+			if timerC != nil && !timer.Stop() {
+				<-timer.C
 			}
+		case <-tw.stopNotify:
+			tw.stopNotify <- struct{}{}
+			return
 		}
 	}
 }
@@ -125,3 +125,78 @@ func TestTimeWheelAdd_EmptyUpdWait(t *testing.T) {
 		t.Errorf("Wrong slot value: %v", slot.Value)
 	}
 }
+
+func TestTimeWheelAdd_Batch(t *testing.T) {
+	t.Parallel()
+
+	const count = 3 * maxDispatchBatch
+	called := make(chan TimeSlot, count)
+
+	w := NewTimeWheel(func(slot TimeSlot) {
+		called <- slot
+	})
+	defer w.Close()
+
+	target := time.Now().Add(100 * time.Millisecond)
+	for i := 0; i < count; i++ {
+		w.Add(target, i)
+	}
+
+	// Slots with equal target time are dispatched in insertion order.
+	for i := 0; i < count; i++ {
+		slot := <-called
+		if val, _ := slot.Value.(int); val != i {
+			t.Fatalf("Wrong slot value: %v, expected %v", slot.Value, i)
+		}
+	}
+}
+
+func BenchmarkTimeWheelAdd(b *testing.B) {
+	const prefill = 1000000
+
+	w := NewTimeWheel(func(TimeSlot) {})
+	defer w.Close()
+
+	// Simulate a deferred queue after a long outage of some remote server.
+	base := time.Now().Add(1 * time.Hour)
+	for i := 0; i < prefill; i++ {
+		w.Add(base.Add(time.Duration(i)*time.Millisecond), i)
+	}
+
+	b.ReportAllocs()
+	b.ResetTimer()
+	b.RunParallel(func(pb *testing.PB) {
+		i := 0
+		for pb.Next() {
+			w.Add(base.Add(time.Duration(i%prefill)*time.Millisecond), i)
+			i++
+		}
+	})
+}
+
+func BenchmarkTimeWheelDispatch(b *testing.B) {
+	const count = 1000000
+
+	for i := 0; i < b.N; i++ {
+		b.StopTimer()
+		done := make(chan struct{})
+		dispatched := 0
+		w := NewTimeWheel(func(TimeSlot) {
+			dispatched++
+			if dispatched == count {
+				close(done)
+			}
+		})
+		target := time.Now().Add(500 * time.Millisecond)
+		for j := 0; j < count; j++ {
+			w.Add(target, j)
+		}
+		time.Sleep(time.Until(target))
+		b.StartTimer()
+
+		<-done
+
+		b.StopTimer()
+		w.Close()
+	}
+}
@@ -22,10 +22,13 @@ import (
 	"context"
 	"crypto/tls"
 	"crypto/x509"
+	"errors"
+	"io"
 	"net"
 	"runtime/trace"
 	"sort"
 
+	"github.com/emersion/go-smtp"
 	"github.com/foxcpp/maddy/framework/config"
 	"github.com/foxcpp/maddy/framework/dns"
 	"github.com/foxcpp/maddy/framework/exterrors"
@@ -48,6 +51,12 @@ type mxConn struct {
 	// Amount of times connection was used for an SMTP transaction.
 	transactions int
 
+	// Recipients to be sent using PIPELINING before the message body.
+	pendingRcpts []string
+
+	// MAIL command was sent, but the transaction was not completed.
+	inTransaction bool
+
 	// MX/TLS security level established for this connection.
 	mxLevel  module.MXLevel
 	tlsLevel module.TLSLevel
@@ -57,7 +66,7 @@ func (c *mxConn) Usable() bool {
 	if c.C == nil || c.transactions > c.reuseLimit || c.C.Client() == nil {
 		return false
 	}
-	return c.C.Client().Reset() == nil
+	return c.C.Noop() == nil
 }
 
 func (c *mxConn) Close() error {
@@ -206,12 +215,16 @@ func (rd *remoteDelivery) connectionForDomain(ctx context.Context, domain string
 		return nil, err
 	}
 
-	var conn *mxConn
+	var (
+		conn   *mxConn
+		reused bool
+	)
 	// Ignore pool for connections with REQUIRETLS to avoid "pool poisoning"
 	// where attacker can make messages indeliverable by forcing reuse of old
 	// connection with weaker security.
 	if pooledConn != nil && !rd.msgMeta.SMTPOpts.RequireTLS {
 		conn = pooledConn.(*mxConn)
+		reused = true
 		rd.Log.Msg("reusing cached connection", "domain", domain, "transactions_counter", conn.transactions)
 	} else {
 		rd.Log.DebugMsg("opening new connection", "domain", domain, "cache_ignored", pooledConn != nil)
@@ -267,13 +280,41 @@ func (rd *remoteDelivery) connectionForDomain(ctx context.Context, domain string
 
 	if err := conn.Mail(ctx, rd.mailFrom, rd.msgMeta.SMTPOpts); err != nil {
 		conn.Close()
-		return nil, err
+		if !reused || !isStaleConnErr(err) {
+			return nil, err
+		}
+
+		// Idle connections are not checked before being returned from the
+		// pool, the remote server might have closed it meanwhile.
+		rd.Log.Error("cached connection failed, opening new connection", err, "domain", domain)
+		conn, err = rd.newConn(ctx, domain)
+		if err != nil {
+			return nil, err
+		}
+		if err := conn.Mail(ctx, rd.mailFrom, rd.msgMeta.SMTPOpts); err != nil {
+			conn.Close()
+			return nil, err
+		}
 	}
+	conn.inTransaction = true
 
 	rd.connections[domain] = conn
 	return conn.C, nil
 }
 
+// isStaleConnErr reports whether the error returned for the first command on
+// a reused connection indicates that the connection itself is broken rather
+// than the command being rejected.
+func isStaleConnErr(err error) bool {
+	var smtpErr *smtp.SMTPError
+	if errors.As(err, &smtpErr) {
+		// 421 is sent by servers closing idle connections.
+		return smtpErr.Code == 421
+	}
+	var netErr net.Error
+	return errors.As(err, &netErr) || errors.Is(err, io.EOF) || errors.Is(err, io.ErrUnexpectedEOF)
+}
+
 func (rd *remoteDelivery) newConn(ctx context.Context, domain string) (*mxConn, error) {
 	conn := mxConn{
 		reuseLimit: rd.rt.connReuseLimit,
@@ -285,6 +326,8 @@ func (rd *remoteDelivery) newConn(ctx context.Context, domain string) (*mxConn,
 	conn.Log = rd.Log
 	conn.Hostname = rd.rt.hostname
 	conn.AddrInSMTPMsg = true
+	conn.UsePipelining = rd.rt.pipelining
+	conn.UseChunking = rd.rt.chunking
 
 	for _, p := range rd.policies {
 		p.PrepareDomain(ctx, domain)
@@ -0,0 +1,423 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package remote
+
+import (
+	"container/list"
+	"context"
+	"encoding/json"
+	"errors"
+	"io/ioutil"
+	"os"
+	"sync"
+	"time"
+
+	"github.com/foxcpp/maddy/framework/dns"
+	"github.com/foxcpp/maddy/framework/log"
+)
+
+const (
+	// Bounds for TTL of cached TLSA records.
+	tlsaMinTTL = 1 * time.Minute
+	tlsaMaxTTL = 1 * time.Hour
+	// TTL used if there are no usable TLSA records for MX.
+	tlsaNegTTL = 5 * time.Minute
+
+	// Expired entries are still refreshed in background if used recently,
+	// e.g. ones loaded from the snapshot after a downtime.
+	tlsaStaleLimit = 24 * time.Hour
+
+	tlsaRefreshTimeout    = 30 * time.Second
+	tlsaRefreshConcurrent = 8
+	tlsaRefreshInterval   = 1 * time.Minute
+	tlsaSnapshotInterval  = 10 * time.Minute
+)
+
+type tlsaEntry struct {
+	mx      string
+	recs    []dns.TLSA
+	ttl     time.Duration
+	expires time.Time
+
+	// Set if the entry was used since it was stored, only such entries are
+	// refreshed in background.
+	used       bool
+	refreshing bool
+}
+
+type tlsaCall struct {
+	done chan struct{}
+	recs []dns.TLSA
+	err  error
+}
+
+// tlsaCache remembers results of TLSA discovery for MX hosts.
+//
+// Entries that were used are refreshed in the background before they
+// expire, so deliveries to the same MX do not wait for DNS lookups. Only
+// successful lookups are cached, errors should cause deliveries to be
+// retried later anyway.
+//
+// If path is not empty, the cache is saved to the file periodically and on
+// close so it survives restarts.
+type tlsaCache struct {
+	discover   func(ctx context.Context, mx string) ([]dns.TLSA, error)
+	maxEntries int
+	path       string
+	modName    string
+	log        log.Logger
+
+	// Used in tests.
+	now func() time.Time
+
+	lck      sync.Mutex
+	entries  map[string]*list.Element
+	lru      *list.List
+	inflight map[string]*tlsaCall
+
+	refreshSem chan struct{}
+	stop       chan struct{}
+	done       chan struct{}
+}
+
+func newTLSACache(modName string, maxEntries int, path string, discover func(ctx context.Context, mx string) ([]dns.TLSA, error), l log.Logger) *tlsaCache {
+	return &tlsaCache{
+		discover:   discover,
+		maxEntries: maxEntries,
+		path:       path,
+		modName:    modName,
+		log:        l,
+		now:        time.Now,
+		entries:    map[string]*list.Element{},
+		lru:        list.New(),
+		inflight:   map[string]*tlsaCall{},
+		refreshSem: make(chan struct{}, tlsaRefreshConcurrent),
+	}
+}
+
+func tlsaTTL(recs []dns.TLSA) time.Duration {
+	if len(recs) == 0 {
+		return tlsaNegTTL
+	}
+
+	ttl := tlsaMaxTTL
+	for _, rec := range recs {
+		recTTL := time.Duration(rec.Hdr.Ttl) * time.Second
+		if recTTL < ttl {
+			ttl = recTTL
+		}
+	}
+	if ttl < tlsaMinTTL {
+		ttl = tlsaMinTTL
+	}
+	return ttl
+}
+
+// Get returns TLSA records for the MX, looking them up if there is no cached
+// result.
+func (c *tlsaCache) Get(ctx context.Context, mx string) ([]dns.TLSA, error) {
+	c.lck.Lock()
+	if el, ok := c.entries[mx]; ok {
+		ent := el.Value.(*tlsaEntry)
+		now := c.now()
+		if now.Before(ent.expires) {
+			c.lru.MoveToFront(el)
+			ent.used = true
+			if ent.expires.Sub(now) < ent.ttl/4 {
+				c.refresh(ent)
+			}
+			c.lck.Unlock()
+			tlsaCacheLookups.WithLabelValues(c.modName, "hit").Inc()
+			return ent.recs, nil
+		}
+	}
+	tlsaCacheLookups.WithLabelValues(c.modName, "miss").Inc()
+
+	for {
+		call, ok := c.inflight[mx]
+		if !ok {
+			break
+		}
+		c.lck.Unlock()
+		select {
+		case <-call.done:
+		case <-ctx.Done():
+			return nil, ctx.Err()
+		}
+		// Lookup made for another delivery was cancelled, try again using
+		// our context.
+		if call.err != nil && (errors.Is(call.err, context.Canceled) || errors.Is(call.err, context.DeadlineExceeded)) {
+			c.lck.Lock()
+			continue
+		}
+		return call.recs, call.err
+	}
+	call := &tlsaCall{done: make(chan struct{})}
+	c.inflight[mx] = call
+	c.lck.Unlock()
+
+	call.recs, call.err = c.discover(ctx, mx)
+
+	c.lck.Lock()
+	delete(c.inflight, mx)
+	if call.err == nil {
+		c.store(mx, call.recs, true)
+	}
+	c.lck.Unlock()
+	close(call.done)
+
+	return call.recs, call.err
+}
+
+// store adds the lookup result to the cache.
+//
+// lck should be held by the caller.
+func (c *tlsaCache) store(mx string, recs []dns.TLSA, used bool) {
+	ttl := tlsaTTL(recs)
+	ent := &tlsaEntry{
+		mx:      mx,
+		recs:    recs,
+		ttl:     ttl,
+		expires: c.now().Add(ttl),
+		used:    used,
+	}
+	c.storeEntry(ent)
+}
+
+func (c *tlsaCache) storeEntry(ent *tlsaEntry) {
+	if el, ok := c.entries[ent.mx]; ok {
+		el.Value = ent
+		c.lru.MoveToFront(el)
+		return
+	}
+
+	for c.lru.Len() >= c.maxEntries {
+		oldest := c.lru.Back()
+		c.lru.Remove(oldest)
+		delete(c.entries, oldest.Value.(*tlsaEntry).mx)
+	}
+	c.entries[ent.mx] = c.lru.PushFront(ent)
+}
+
+// refresh starts a background lookup to replace the entry.
+//
+// lck should be held by the caller.
+func (c *tlsaCache) refresh(ent *tlsaEntry) {
+	if ent.refreshing {
+		return
+	}
+	ent.refreshing = true
+	tlsaCachePrefetches.WithLabelValues(c.modName).Inc()
+
+	go func() {
+		c.refreshSem <- struct{}{}
+		defer func() { <-c.refreshSem }()
+
+		ctx, cancel := context.WithTimeout(context.Background(), tlsaRefreshTimeout)
+		defer cancel()
+		recs, err := c.discover(ctx, ent.mx)
+
+		c.lck.Lock()
+		defer c.lck.Unlock()
+		ent.refreshing = false
+		if err != nil {
+			c.log.Error("TLSA records refresh failed", err, "mx", ent.mx)
+			return
+		}
+		// The entry might have been evicted or replaced meanwhile.
+		if el, ok := c.entries[ent.mx]; !ok || el.Value != ent {
+			return
+		}
+		c.store(ent.mx, recs, false)
+	}()
+}
+
+// refreshAll starts refresh for used entries that are about to expire and
+// removes unused expired entries.
+func (c *tlsaCache) refreshAll() {
+	c.lck.Lock()
+	defer c.lck.Unlock()
+
+	now := c.now()
+	for el := c.lru.Front(); el != nil; {
+		next := el.Next()
+		ent := el.Value.(*tlsaEntry)
+		switch {
+		case ent.used && now.Sub(ent.expires) < tlsaStaleLimit && ent.expires.Sub(now) < ent.ttl/4:
+			c.refresh(ent)
+		case !now.Before(ent.expires) && !ent.refreshing:
+			c.lru.Remove(el)
+			delete(c.entries, ent.mx)
+		}
+		el = next
+	}
+}
+
+type tlsaSnapshotRecord struct {
+	Usage        uint8
+	Selector     uint8
+	MatchingType uint8
+	Certificate  string
+	TTL          uint32
+}
+
+type tlsaSnapshotEntry struct {
+	MX      string
+	Records []tlsaSnapshotRecord
+	TTL     time.Duration
+	Expires time.Time
+	Used    bool
+}
+
+func (c *tlsaCache) load() error {
+	blob, err := ioutil.ReadFile(c.path)
+	if err != nil {
+		if os.IsNotExist(err) {
+			return nil
+		}
+		return err
+	}
+	var snapshot []tlsaSnapshotEntry
+	if err := json.Unmarshal(blob, &snapshot); err != nil {
+		return err
+	}
+
+	c.lck.Lock()
+	defer c.lck.Unlock()
+
+	now := c.now()
+	// Snapshot is ordered from the most recently used entry.
+	for i := len(snapshot) - 1; i >= 0; i-- {
+		snapEnt := snapshot[i]
+		if now.Sub(snapEnt.Expires) > tlsaStaleLimit {
+			continue
+		}
+
+		ent := &tlsaEntry{
+			mx:      snapEnt.MX,
+			ttl:     snapEnt.TTL,
+			expires: snapEnt.Expires,
+			used:    snapEnt.Used,
+		}
+		for _, rec := range snapEnt.Records {
+			tlsa := dns.TLSA{
+				Usage:        rec.Usage,
+				Selector:     rec.Selector,
+				MatchingType: rec.MatchingType,
+				Certificate:  rec.Certificate,
+			}
+			tlsa.Hdr.Ttl = rec.TTL
+			ent.recs = append(ent.recs, tlsa)
+		}
+		c.storeEntry(ent)
+	}
+	return nil
+}
+
+func (c *tlsaCache) save() error {
+	c.lck.Lock()
+	snapshot := make([]tlsaSnapshotEntry, 0, c.lru.Len())
+	for el := c.lru.Front(); el != nil; el = el.Next() {
+		ent := el.Value.(*tlsaEntry)
+		snapEnt := tlsaSnapshotEntry{
+			MX:      ent.mx,
+			Records: make([]tlsaSnapshotRecord, 0, len(ent.recs)),
+			TTL:     ent.ttl,
+			Expires: ent.expires,
+			Used:    ent.used,
+		}
+		for _, rec := range ent.recs {
+			snapEnt.Records = append(snapEnt.Records, tlsaSnapshotRecord{
+				Usage:        rec.Usage,
+				Selector:     rec.Selector,
+				MatchingType: rec.MatchingType,
+				Certificate:  rec.Certificate,
+				TTL:          rec.Hdr.Ttl,
+			})
+		}
+		snapshot = append(snapshot, snapEnt)
+	}
+	c.lck.Unlock()
+
+	blob, err := json.Marshal(snapshot)
+	if err != nil {
+		return err
+	}
+	if err := ioutil.WriteFile(c.path+".tmp", blob, 0600); err != nil {
+		return err
+	}
+	return os.Rename(c.path+".tmp", c.path)
+}
+
+// Start loads the snapshot and starts the goroutine refreshing entries
+// and saving the snapshot.
+func (c *tlsaCache) Start() error {
+	if c.path != "" {
+		if err := c.load(); err != nil {
+			return err
+		}
+	}
+
+	c.stop = make(chan struct{})
+	c.done = make(chan struct{})
+	go c.maintain()
+	return nil
+}
+
+func (c *tlsaCache) maintain() {
+	defer close(c.done)
+
+	// Refresh entries loaded from the snapshot right away since we may have
+	// been down for some time.
+	c.refreshAll()
+
+	refreshTick := time.NewTicker(tlsaRefreshInterval)
+	defer refreshTick.Stop()
+	snapshotTick := time.NewTicker(tlsaSnapshotInterval)
+	defer snapshotTick.Stop()
+	for {
+		select {
+		case <-refreshTick.C:
+			c.refreshAll()
+		case <-snapshotTick.C:
+			if c.path == "" {
+				continue
+			}
+			if err := c.save(); err != nil {
+				c.log.Error("failed to save TLSA cache", err)
+			}
+		case <-c.stop:
+			return
+		}
+	}
+}
+
+func (c *tlsaCache) Close() error {
+	if c.stop == nil {
+		return nil
+	}
+	close(c.stop)
+	<-c.done
+	c.stop = nil
+
+	if c.path == "" {
+		return nil
+	}
+	return c.save()
+}
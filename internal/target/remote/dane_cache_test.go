@@ -0,0 +1,180 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package remote
+
+import (
+	"context"
+	"errors"
+	"io/ioutil"
+	"os"
+	"path/filepath"
+	"sync"
+	"testing"
+	"time"
+
+	"github.com/foxcpp/maddy/framework/dns"
+	"github.com/foxcpp/maddy/internal/testutils"
+)
+
+type tlsaDiscoverMock struct {
+	lck   sync.Mutex
+	calls int
+	recs  []dns.TLSA
+	err   error
+}
+
+func (m *tlsaDiscoverMock) discover(_ context.Context, _ string) ([]dns.TLSA, error) {
+	m.lck.Lock()
+	defer m.lck.Unlock()
+	m.calls++
+	return m.recs, m.err
+}
+
+func (m *tlsaDiscoverMock) callCount() int {
+	m.lck.Lock()
+	defer m.lck.Unlock()
+	return m.calls
+}
+
+func testTLSARecs(ttl uint32) []dns.TLSA {
+	rec := dns.TLSA{
+		Usage:        3,
+		Selector:     1,
+		MatchingType: 1,
+		Certificate:  "c0ffee",
+	}
+	rec.Hdr.Ttl = ttl
+	return []dns.TLSA{rec}
+}
+
+func TestTLSACache(t *testing.T) {
+	now := time.Unix(1600000000, 0)
+	mock := &tlsaDiscoverMock{recs: testTLSARecs(600)}
+	c := newTLSACache("test", 10, "", mock.discover, testutils.Logger(t, "tlsa_cache"))
+	c.now = func() time.Time { return now }
+
+	for i := 0; i < 3; i++ {
+		recs, err := c.Get(context.Background(), "mx.example.org.")
+		if err != nil {
+			t.Fatal(err)
+		}
+		if len(recs) != 1 || recs[0].Certificate != "c0ffee" {
+			t.Fatal("Wrong records returned:", recs)
+		}
+	}
+	if calls := mock.callCount(); calls != 1 {
+		t.Fatal("Expected 1 lookup, got", calls)
+	}
+
+	now = now.Add(11 * time.Minute)
+	if _, err := c.Get(context.Background(), "mx.example.org."); err != nil {
+		t.Fatal(err)
+	}
+	if calls := mock.callCount(); calls != 2 {
+		t.Fatal("Expected lookup after expiry, got", calls)
+	}
+}
+
+func TestTLSACache_Error(t *testing.T) {
+	mock := &tlsaDiscoverMock{err: errors.New("oops")}
+	c := newTLSACache("test", 10, "", mock.discover, testutils.Logger(t, "tlsa_cache"))
+
+	for i := 0; i < 2; i++ {
+		if _, err := c.Get(context.Background(), "mx.example.org."); err == nil {
+			t.Fatal("Expected error")
+		}
+	}
+	if calls := mock.callCount(); calls != 2 {
+		t.Fatal("Errors should not be cached, got", calls, "lookups")
+	}
+}
+
+func TestTLSACache_Prefetch(t *testing.T) {
+	now := time.Unix(1600000000, 0)
+	mock := &tlsaDiscoverMock{recs: testTLSARecs(600)}
+	c := newTLSACache("test", 10, "", mock.discover, testutils.Logger(t, "tlsa_cache"))
+	c.now = func() time.Time { return now }
+
+	if _, err := c.Get(context.Background(), "mx.example.org."); err != nil {
+		t.Fatal(err)
+	}
+
+	// Less than 1/4 of TTL left, cached records are returned and the refresh
+	// is started in background.
+	now = now.Add(8 * time.Minute)
+	if _, err := c.Get(context.Background(), "mx.example.org."); err != nil {
+		t.Fatal(err)
+	}
+	refreshed := func() bool {
+		c.lck.Lock()
+		defer c.lck.Unlock()
+		ent := c.entries["mx.example.org."].Value.(*tlsaEntry)
+		return ent.expires.After(now.Add(5 * time.Minute))
+	}
+	for i := 0; !refreshed(); i++ {
+		if i == 100 {
+			t.Fatal("Entry was not refreshed")
+		}
+		time.Sleep(10 * time.Millisecond)
+	}
+
+	now = now.Add(5 * time.Minute)
+	if _, err := c.Get(context.Background(), "mx.example.org."); err != nil {
+		t.Fatal(err)
+	}
+	if calls := mock.callCount(); calls != 2 {
+		t.Fatal("Refreshed entry was not used, got", calls, "lookups")
+	}
+}
+
+func TestTLSACache_Snapshot(t *testing.T) {
+	dir, err := ioutil.TempDir("", "maddy-tests-")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer os.RemoveAll(dir)
+	path := filepath.Join(dir, "dane_cache.json")
+
+	mock := &tlsaDiscoverMock{recs: testTLSARecs(600)}
+	c := newTLSACache("test", 10, path, mock.discover, testutils.Logger(t, "tlsa_cache"))
+	if err := c.Start(); err != nil {
+		t.Fatal(err)
+	}
+	if _, err := c.Get(context.Background(), "mx.example.org."); err != nil {
+		t.Fatal(err)
+	}
+	if err := c.Close(); err != nil {
+		t.Fatal(err)
+	}
+
+	mock2 := &tlsaDiscoverMock{err: errors.New("should not be called")}
+	c2 := newTLSACache("test", 10, path, mock2.discover, testutils.Logger(t, "tlsa_cache"))
+	if err := c2.Start(); err != nil {
+		t.Fatal(err)
+	}
+	defer c2.Close()
+
+	recs, err := c2.Get(context.Background(), "mx.example.org.")
+	if err != nil {
+		t.Fatal(err)
+	}
+	if len(recs) != 1 || recs[0].Certificate != "c0ffee" || recs[0].Hdr.Ttl != 600 {
+		t.Fatal("Wrong records loaded:", recs)
+	}
+}
@@ -40,7 +40,29 @@ var tlsLevelCnt = prometheus.NewCounterVec(
 	[]string{"module", "level"},
 )
 
+var tlsaCacheLookups = prometheus.NewCounterVec(
+	prometheus.CounterOpts{
+		Namespace: "maddy",
+		Subsystem: "remote",
+		Name:      "dane_cache_lookups",
+		Help:      "TLSA records lookups served from the cache (hit) or resolved (miss)",
+	},
+	[]string{"module", "result"},
+)
+
+var tlsaCachePrefetches = prometheus.NewCounterVec(
+	prometheus.CounterOpts{
+		Namespace: "maddy",
+		Subsystem: "remote",
+		Name:      "dane_cache_prefetches",
+		Help:      "Background refreshes of cached TLSA records before they expire",
+	},
+	[]string{"module"},
+)
+
 func init() {
 	prometheus.MustRegister(mxLevelCnt)
 	prometheus.MustRegister(tlsLevelCnt)
+	prometheus.MustRegister(tlsaCacheLookups)
+	prometheus.MustRegister(tlsaCachePrefetches)
 }
@@ -74,6 +74,8 @@ type Target struct {
 
 	pool           *pool.P
 	connReuseLimit int
+	pipelining     bool
+	chunking       bool
 
 	Log log.Logger
 }
@@ -130,15 +132,20 @@ func (rt *Target) Init(cfg *config.Map) error {
 	cfg.Bool("requiretls_override", false, true, &rt.allowSecOverride)
 	cfg.Bool("relaxed_requiretls", false, true, &rt.relaxedREQUIRETLS)
 	cfg.Int("conn_reuse_limit", false, false, 10, &rt.connReuseLimit)
+	cfg.Bool("pipelining", false, true, &rt.pipelining)
+	cfg.Bool("chunking", false, true, &rt.chunking)
 
 	poolCfg := pool.Config{
 		MaxKeys:             20000,
 		MaxConnsPerKey:      10,     // basically, max. amount of idle connections in cache
 		MaxConnLifetimeSec:  150,    // 2.5 mins, half of recommended idle time from RFC 5321
 		StaleKeyLifetimeSec: 60 * 5, // should be bigger than MaxConnLifetimeSec
+		ProbeIntervalSec:    30,
+		Name:                rt.name,
 	}
 	cfg.Int("conn_max_idle_count", false, false, 10, &poolCfg.MaxConnsPerKey)
 	cfg.Int64("conn_max_idle_time", false, false, 150, &poolCfg.MaxConnLifetimeSec)
+	cfg.Int64("conn_probe_interval", false, false, 30, &poolCfg.ProbeIntervalSec)
 
 	if _, err := cfg.Process(); err != nil {
 		return err
@@ -188,6 +195,9 @@ type remoteDelivery struct {
 	connections map[string]*mxConn
 
 	policies []module.DeliveryMXAuthPolicy
+
+	// Set by DeferRcpts, see module.RcptBatcher.
+	deferRcpts bool
 }
 
 func (rt *Target) Start(ctx context.Context, msgMeta *module.MsgMetadata, mailFrom string) (module.Delivery, error) {
@@ -250,6 +260,15 @@ func (rt *Target) Start(ctx context.Context, msgMeta *module.MsgMetadata, mailFr
 	}, nil
 }
 
+// DeferRcpts implements module.RcptBatcher.
+//
+// If it is called, recipients for connections that support PIPELINING
+// are not sent by AddRcpt. They are sent in one batch by BodyNonAtomic
+// instead.
+func (rd *remoteDelivery) DeferRcpts() {
+	rd.deferRcpts = true
+}
+
 func (rd *remoteDelivery) AddRcpt(ctx context.Context, to string) error {
 	defer trace.StartRegion(ctx, "remote/AddRcpt").End()
 
@@ -292,6 +311,15 @@ func (rd *remoteDelivery) AddRcpt(ctx context.Context, to string) error {
 		return err
 	}
 
+	if rd.deferRcpts && conn.CanPipeline() {
+		// Sent in one batch by BodyNonAtomic, errors are reported as
+		// per-recipient delivery statuses.
+		mxConn := rd.connections[domain]
+		mxConn.pendingRcpts = append(mxConn.pendingRcpts, to)
+		rd.recipients = append(rd.recipients, to)
+		return nil
+	}
+
 	if err := conn.Rcpt(ctx, to); err != nil {
 		return moduleError(err)
 	}
@@ -391,6 +419,19 @@ func (rd *remoteDelivery) BodyNonAtomic(ctx context.Context, c module.StatusColl
 		go func() {
 			defer wg.Done()
 
+			if len(conn.pendingRcpts) != 0 {
+				errs := conn.RcptMany(ctx, conn.pendingRcpts)
+				for i, err := range errs {
+					if err != nil {
+						c.SetStatus(conn.pendingRcpts[i], moduleError(err))
+					}
+				}
+				conn.pendingRcpts = nil
+				if len(conn.Rcpts()) == 0 {
+					return
+				}
+			}
+
 			bodyR, err := b.Open()
 			if err != nil {
 				for _, rcpt := range conn.Rcpts() {
@@ -405,6 +446,7 @@ func (rd *remoteDelivery) BodyNonAtomic(ctx context.Context, c module.StatusColl
 				c.SetStatus(rcpt, err)
 			}
 			rd.connections[i].errored = err != nil
+			rd.connections[i].inTransaction = false
 		}()
 	}
 
@@ -430,7 +472,14 @@ func (rd *remoteDelivery) Close() error {
 			rd.Log.Debugf("disconnected from %s (errored=%v,transactions=%v,disconnected before=%v)",
 				conn.ServerName(), conn.errored, conn.transactions, conn.C.Client() == nil)
 			conn.Close()
+		} else if conn.inTransaction && conn.Client().Reset() != nil {
+			// Transaction was aborted (e.g. all recipients were rejected),
+			// the connection should be clean before it is reused.
+			rd.Log.Debugf("disconnected from %s (RSET failed)", conn.ServerName())
+			conn.Close()
 		} else {
+			conn.inTransaction = false
+			conn.pendingRcpts = nil
 			rd.Log.Debugf("returning connection for %s to pool", conn.ServerName())
 			rd.rt.pool.Return(conn.domain, conn)
 		}
@@ -61,6 +61,9 @@ func testTarget(t *testing.T, zones map[string]mockdns.Zone, extResolver *dns.Ex
 		Log:         testutils.Logger(t, "remote"),
 		policies:    extraPolicies,
 		limits:      &limits.Group{},
+		// Match defaults used by Init.
+		pipelining: true,
+		chunking:   true,
 		pool: pool.New(pool.Config{
 			MaxKeys:             20000,
 			MaxConnsPerKey:      10,     // basically, max. amount of idle connections in cache
@@ -104,7 +107,12 @@ func testDANEPolicy(t *testing.T, extR *dns.ExtResolver) *danePolicy {
 	}
 	p := m.(*danePolicy)
 	err = p.Init(config.NewMap(nil, config.Node{
-		Children: nil,
+		Children: []config.Node{
+			{
+				Name: "cache",
+				Args: []string{"ram"},
+			},
+		},
 	}))
 	if err != nil {
 		t.Fatal(err)
@@ -538,6 +546,63 @@ func TestRemoteDelivery_RcptErr(t *testing.T) {
 	be.CheckMsg(t, 0, "test@example.com", []string{"test2@example.invalid"})
 }
 
+func TestRemoteDelivery_RcptErr_Deferred(t *testing.T) {
+	be, srv := testutils.SMTPServer(t, "127.0.0.1:"+smtpPort)
+	defer srv.Close()
+	defer testutils.CheckSMTPConnLeak(t, srv)
+	zones := map[string]mockdns.Zone{
+		"example.invalid.": {
+			MX: []net.MX{{Host: "mx.example.invalid.", Pref: 10}},
+		},
+		"mx.example.invalid.": {
+			A: []string{"127.0.0.1"},
+		},
+	}
+
+	be.RcptErr = map[string]error{
+		"test@example.invalid": &smtp.SMTPError{
+			Code:         550,
+			EnhancedCode: smtp.EnhancedCode{5, 1, 2},
+			Message:      "Hey",
+		},
+	}
+
+	tgt := testTarget(t, zones, nil, nil)
+	defer tgt.Close()
+
+	delivery, err := tgt.Start(context.Background(), &module.MsgMetadata{ID: "test..."}, "test@example.com")
+	if err != nil {
+		t.Fatal(err)
+	}
+	delivery.(module.RcptBatcher).DeferRcpts()
+
+	// Both recipients are accepted, the rejection is reported by
+	// BodyNonAtomic.
+	for _, rcpt := range []string{"test@example.invalid", "test2@example.invalid"} {
+		if err := delivery.AddRcpt(context.Background(), rcpt); err != nil {
+			t.Fatal(err)
+		}
+	}
+
+	hdr := textproto.Header{}
+	hdr.Add("B", "2")
+	hdr.Add("A", "1")
+	body := buffer.MemoryBuffer{Slice: []byte("foobar\n")}
+	merr := multipleErrs{errs: make(map[string]error)}
+	delivery.(module.PartialDelivery).BodyNonAtomic(context.Background(), &merr, hdr, body)
+
+	testutils.CheckSMTPErr(t, merr.errs["test@example.invalid"], 550, exterrors.EnhancedCode{5, 1, 2}, "mx.example.invalid. said: Hey")
+	if err := merr.errs["test2@example.invalid"]; err != nil {
+		t.Fatal("Unexpected error for test2:", err)
+	}
+
+	if err := delivery.Commit(context.Background()); err != nil {
+		t.Fatal(err)
+	}
+
+	be.CheckMsg(t, 0, "test@example.com", []string{"test2@example.invalid"})
+}
+
 func TestRemoteDelivery_DownMX(t *testing.T) {
 	be, srv := testutils.SMTPServer(t, "127.0.0.1:"+smtpPort)
 	defer srv.Close()
@@ -1052,3 +1117,29 @@ func TestRemoteDelivery_ConnReuse(t *testing.T) {
 		t.Fatal("Only one session should be used, found", be.SourceEndpoints)
 	}
 }
+
+func TestRemoteDelivery_ConnReuse_PeerClosed(t *testing.T) {
+	_, srv := testutils.SMTPServer(t, "127.0.0.1:"+smtpPort)
+	zones := map[string]mockdns.Zone{
+		"example.invalid.": {
+			MX: []net.MX{{Host: "mx.example.invalid.", Pref: 10}},
+		},
+		"mx.example.invalid.": {
+			A: []string{"127.0.0.1"},
+		},
+	}
+
+	tgt := testTarget(t, zones, nil, nil)
+	tgt.connReuseLimit = 5
+	defer tgt.Close()
+	testutils.DoTestDelivery(t, tgt, "test@example.com", []string{"test@example.invalid"})
+
+	// Drop the idle connection kept in the pool from the server side.
+	srv.Close()
+	be, srv := testutils.SMTPServer(t, "127.0.0.1:"+smtpPort)
+	defer srv.Close()
+	defer testutils.CheckSMTPConnLeak(t, srv)
+
+	testutils.DoTestDelivery(t, tgt, "test@example.com", []string{"test@example.invalid"})
+	be.CheckMsg(t, 0, "test@example.com", []string{"test@example.invalid"})
+}
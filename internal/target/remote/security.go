@@ -23,6 +23,7 @@ import (
 	"crypto/tls"
 	"errors"
 	"os"
+	"path/filepath"
 	"time"
 
 	"github.com/foxcpp/go-mtasts"
@@ -83,6 +84,8 @@ func (c *mtastsPolicy) Init(cfg *config.Map) error {
 
 	switch storeType {
 	case "fs":
+		// Cache files are written without any locking.
+		storeDir = config.WorkerDir(storeDir)
 		if err := os.MkdirAll(storeDir, os.ModePerm); err != nil {
 			return err
 		}
@@ -338,6 +341,7 @@ func (dnssecPolicy) CheckConn(ctx context.Context, mxLevel module.MXLevel, tlsLe
 type (
 	danePolicy struct {
 		extResolver *dns.ExtResolver
+		cache       *tlsaCache
 		log         log.Logger
 		instName    string
 	}
@@ -373,10 +377,36 @@ func (c *danePolicy) Init(cfg *config.Map) error {
 		c.log.Error("DANE support is no-op: unable to init EDNS resolver", err)
 	}
 
+	var (
+		storeType  string
+		storeFile  string
+		maxEntries int
+	)
 	cfg.Bool("debug", true, log.DefaultLogger.Debug, &c.log.Debug)
+	cfg.Enum("cache", false, false, []string{"ram", "fs"}, "fs", &storeType)
+	cfg.String("fs_file", false, false, "dane_cache.json", &storeFile)
+	cfg.Int("max_entries", false, false, 10000, &maxEntries)
+	if _, err := cfg.Process(); err != nil {
+		return err
+	}
+	if maxEntries <= 0 {
+		return errors.New("mx_auth.dane: max_entries should be positive")
+	}
 
-	_, err = cfg.Process()
-	return err
+	if storeType == "fs" {
+		storeDir := config.WorkerDir(filepath.Dir(storeFile))
+		if err := os.MkdirAll(storeDir, os.ModePerm); err != nil {
+			return err
+		}
+		storeFile = filepath.Join(storeDir, filepath.Base(storeFile))
+	} else {
+		storeFile = ""
+	}
+	c.cache = newTLSACache(c.instName, maxEntries, storeFile, c.discoverTLSA, c.log)
+	if err := c.cache.Start(); err != nil {
+		c.log.Error("failed to load TLSA cache", err)
+	}
+	return nil
 }
 
 func (c *danePolicy) Start(*module.MsgMetadata) module.DeliveryMXAuthPolicy {
@@ -384,13 +414,16 @@ func (c *danePolicy) Start(*module.MsgMetadata) module.DeliveryMXAuthPolicy {
 }
 
 func (c *danePolicy) Close() error {
+	if c.cache != nil {
+		return c.cache.Close()
+	}
 	return nil
 }
 
 func (c *daneDelivery) PrepareDomain(ctx context.Context, domain string) {}
 
-func (c *daneDelivery) discoverTLSA(ctx context.Context, mx string) ([]dns.TLSA, error) {
-	adA, rname, err := c.c.extResolver.CheckCNAMEAD(ctx, mx)
+func (c *danePolicy) discoverTLSA(ctx context.Context, mx string) ([]dns.TLSA, error) {
+	adA, rname, err := c.extResolver.CheckCNAMEAD(ctx, mx)
 	if err != nil {
 		// This may indicate a bogus DNSSEC signature or other lookup issue
 		// (including non-existing domain).
@@ -409,52 +442,52 @@ func (c *daneDelivery) discoverTLSA(ctx context.Context, mx string) ([]dns.TLSA,
 		// to avoid hitting weird errors like SERVFAIL, NOTIMP
 		// e.g. see https://github.com/foxcpp/maddy/issues/287
 		if rname == mx {
-			c.c.log.Debugln("skipping DANE for", mx, "due to non-authenticated A records")
+			c.log.Debugln("skipping DANE for", mx, "due to non-authenticated A records")
 			return nil, nil
 		}
 
 		// But if it is CNAME'd then we may not want to skip it and actually
 		// consider initial name since it may be signed. To confirm the
 		// initial name is signed, do CNAME lookup.
-		cnameAD, _, err := c.c.extResolver.AuthLookupCNAME(ctx, mx)
+		cnameAD, _, err := c.extResolver.AuthLookupCNAME(ctx, mx)
 		if err != nil {
 			return nil, err
 		}
 		if !cnameAD {
-			c.c.log.Debugln("skipping DANE for", mx, "due to non-authenticated CNAME record")
+			c.log.Debugln("skipping DANE for", mx, "due to non-authenticated CNAME record")
 			return nil, nil
 		}
 	}
 
 	// If there was a CNAME - try it first.
 	if rname != mx {
-		ad, recs, err := c.c.extResolver.AuthLookupTLSA(ctx, "25", "tcp", rname)
+		ad, recs, err := c.extResolver.AuthLookupTLSA(ctx, "25", "tcp", rname)
 		if err != nil && !dns.IsNotFound(err) {
 			return nil, err
 		}
 		if ad && len(recs) != 0 {
 			// recs may be empty or contain only unusable records - this is
 			// okay per RFC 7672, no fallback to initial name is done.
-			c.c.log.Debugln("using", len(recs), "DANE records at", rname, "to authenticate", mx)
+			c.log.Debugln("using", len(recs), "DANE records at", rname, "to authenticate", mx)
 			return recs, nil
 		}
 		// Per RFC 7672 Section 2.2 we interpret a non-authenticated RRset just
 		// like an empty RRset and fallback to trying original name.
-		c.c.log.Debugln("ignoring non-authenticated TLSA records for", rname)
+		c.log.Debugln("ignoring non-authenticated TLSA records for", rname)
 	}
 
 	// If initial name is not a CNAME or final canonical name is not "secure"
 	// - we consider TLSA under the initial name.
-	ad, recs, err := c.c.extResolver.AuthLookupTLSA(ctx, "25", "tcp", mx)
+	ad, recs, err := c.extResolver.AuthLookupTLSA(ctx, "25", "tcp", mx)
 	if err != nil && !dns.IsNotFound(err) {
 		return nil, err
 	}
 	if !ad {
-		c.c.log.Debugln("ignoring non-authenticated TLSA records for", mx)
+		c.log.Debugln("ignoring non-authenticated TLSA records for", mx)
 		return nil, nil
 	}
 
-	c.c.log.Debugln("using", len(recs), "DANE records at original name to authenticate", mx)
+	c.log.Debugln("using", len(recs), "DANE records at original name to authenticate", mx)
 	return recs, nil
 }
 
@@ -467,7 +500,7 @@ func (c *daneDelivery) PrepareConn(ctx context.Context, mx string) {
 	c.tlsaFut = future.New()
 
 	go func() {
-		c.tlsaFut.Set(c.discoverTLSA(ctx, dns.FQDN(mx)))
+		c.tlsaFut.Set(c.c.cache.Get(ctx, dns.FQDN(mx)))
 	}()
 }
 
@@ -0,0 +1,91 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package testutils
+
+import (
+	"sort"
+	"sync/atomic"
+	"testing"
+	"time"
+
+	"github.com/foxcpp/maddy/framework/module"
+)
+
+// reportLatency reports p50 and p99 of the collected samples as custom
+// benchmark metrics.
+func reportLatency(b *testing.B, samples []time.Duration) {
+	if len(samples) == 0 {
+		return
+	}
+	sort.Slice(samples, func(i, j int) bool { return samples[i] < samples[j] })
+	b.ReportMetric(float64(samples[len(samples)*50/100]), "p50-ns")
+	b.ReportMetric(float64(samples[len(samples)*99/100]), "p99-ns")
+}
+
+// BenchAuth runs sequential and parallel benchmarks for the
+// PlainAuth.AuthPlain method of the module, reporting latency percentiles
+// in addition to the usual metrics.
+//
+// If expectOK is false, AuthPlain is expected to fail.
+func BenchAuth(b *testing.B, a module.PlainAuth, username, password string, expectOK bool) {
+	BenchFunc(b, func() error {
+		return a.AuthPlain(username, password)
+	}, expectOK)
+}
+
+// BenchFunc is the same as BenchAuth but for an arbitrary function.
+func BenchFunc(b *testing.B, f func() error, expectOK bool) {
+	check := func(err error) {
+		if (err == nil) != expectOK {
+			b.Errorf("expectOK=%v, err: %v", expectOK, err)
+		}
+	}
+
+	b.Run("sequential", func(b *testing.B) {
+		samples := make([]time.Duration, b.N)
+
+		b.ReportAllocs()
+		b.ResetTimer()
+		for i := 0; i < b.N; i++ {
+			start := time.Now()
+			check(f())
+			samples[i] = time.Since(start)
+		}
+		b.StopTimer()
+
+		reportLatency(b, samples)
+	})
+	b.Run("parallel", func(b *testing.B) {
+		samples := make([]time.Duration, b.N)
+		var idx int64 = -1
+
+		b.ReportAllocs()
+		b.ResetTimer()
+		b.RunParallel(func(pb *testing.PB) {
+			for pb.Next() {
+				start := time.Now()
+				check(f())
+				samples[atomic.AddInt64(&idx, 1)] = time.Since(start)
+			}
+		})
+		b.StopTimer()
+
+		reportLatency(b, samples)
+	})
+}
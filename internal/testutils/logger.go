@@ -33,7 +33,7 @@ var (
 	directLog = flag.Bool("test.directlog", false, "(maddy) Log to stderr instead of test log")
 )
 
-func Logger(t *testing.T, name string) log.Logger {
+func Logger(t testing.TB, name string) log.Logger {
 	if *directLog {
 		return log.Logger{
 			Out:   log.WriterOutput(os.Stderr, true),
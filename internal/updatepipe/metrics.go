@@ -0,0 +1,73 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package updatepipe
+
+import "github.com/prometheus/client_golang/prometheus"
+
+var (
+	updatesPushed = prometheus.NewCounter(
+		prometheus.CounterOpts{
+			Namespace: "maddy",
+			Subsystem: "updatepipe",
+			Name:      "pushed",
+			Help:      "Updates written to the update pipe",
+		},
+	)
+	updatesCoalesced = prometheus.NewCounter(
+		prometheus.CounterOpts{
+			Namespace: "maddy",
+			Subsystem: "updatepipe",
+			Name:      "coalesced",
+			Help:      "Updates not written to the update pipe because a newer one for the same mailbox replaced them",
+		},
+	)
+	updatesReceived = prometheus.NewCounter(
+		prometheus.CounterOpts{
+			Namespace: "maddy",
+			Subsystem: "updatepipe",
+			Name:      "received",
+			Help:      "Updates read from the update pipe",
+		},
+	)
+	pushBatches = prometheus.NewCounter(
+		prometheus.CounterOpts{
+			Namespace: "maddy",
+			Subsystem: "updatepipe",
+			Name:      "batches",
+			Help:      "Writes of batched updates to the update pipe",
+		},
+	)
+	pushLag = prometheus.NewHistogram(
+		prometheus.HistogramOpts{
+			Namespace: "maddy",
+			Subsystem: "updatepipe",
+			Name:      "push_lag_seconds",
+			Help:      "Time between Push call and the update being written to the update pipe",
+			Buckets:   prometheus.ExponentialBuckets(0.001, 2, 14),
+		},
+	)
+)
+
+func init() {
+	prometheus.MustRegister(updatesPushed)
+	prometheus.MustRegister(updatesCoalesced)
+	prometheus.MustRegister(updatesReceived)
+	prometheus.MustRegister(pushBatches)
+	prometheus.MustRegister(pushLag)
+}
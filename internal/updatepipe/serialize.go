@@ -19,9 +19,11 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 package updatepipe
 
 import (
+	"encoding/binary"
 	"encoding/json"
 	"errors"
 	"fmt"
+	"math"
 	"strings"
 
 	"github.com/emersion/go-imap"
@@ -32,15 +34,12 @@ func unescapeName(s string) string {
 	return strings.ReplaceAll(s, "\x10", ";")
 }
 
-func escapeName(s string) string {
-	return strings.ReplaceAll(s, ";", "\x10")
-}
-
 type message struct {
 	SeqNum uint32
 	Flags  []string
 }
 
+// parseUpdate parses the text serialization used by older versions.
 func parseUpdate(s string) (id string, upd backend.Update, err error) {
 	parts := strings.SplitN(s, ";", 5)
 	if len(parts) != 5 {
@@ -83,48 +82,162 @@ func parseUpdate(s string) (id string, upd backend.Update, err error) {
 	return parts[0], upd, nil
 }
 
-func formatUpdate(myID string, upd backend.Update) (string, error) {
-	var (
-		objType string
-		objStr  []byte
-		err     error
-	)
+const (
+	binExpungeUpdate byte = iota + 1
+	binMailboxUpdate
+	binMessageUpdate
+)
+
+func appendUvarint(b []byte, v uint64) []byte {
+	var buf [binary.MaxVarintLen64]byte
+	n := binary.PutUvarint(buf[:], v)
+	return append(b, buf[:n]...)
+}
+
+func appendString(b []byte, s string) []byte {
+	b = appendUvarint(b, uint64(len(s)))
+	return append(b, s...)
+}
+
+// appendUpdate appends the binary serialization of the update to b:
+//
+//	ID, TYPE, USER, MAILBOX, OBJECT
+//
+// TYPE is a single byte, strings are prefixed with their length as a uvarint.
+// OBJECT is the SeqNum for ExpungeUpdate, the SeqNum followed by the count of
+// flags and the flags for MessageUpdate and the JSON-serialized
+// imap.MailboxStatus for MailboxUpdate.
+func appendUpdate(b []byte, myID string, upd backend.Update) ([]byte, error) {
+	b = appendString(b, myID)
 	switch v := upd.(type) {
 	case *backend.ExpungeUpdate:
-		objType = "ExpungeUpdate"
-		objStr, err = json.Marshal(v.SeqNum)
-		if err != nil {
-			return "", err
-		}
+		b = append(b, binExpungeUpdate)
+		b = appendString(b, upd.Username())
+		b = appendString(b, upd.Mailbox())
+		b = appendUvarint(b, uint64(v.SeqNum))
 	case *backend.MessageUpdate:
-		// imap.Message is not JSON-serializable because it contains maps with
-		// complex keys.
-		// In practice, however, MessageUpdate is used only for FLAGS, so we
-		// serialize them only with a seqnum.
-
-		objType = "MessageUpdate"
-		objStr, err = json.Marshal(message{
-			SeqNum: v.Message.SeqNum,
-			Flags:  v.Message.Flags,
-		})
-		if err != nil {
-			return "", err
+		// See parseUpdate for why only the flags are serialized.
+		b = append(b, binMessageUpdate)
+		b = appendString(b, upd.Username())
+		b = appendString(b, upd.Mailbox())
+		b = appendUvarint(b, uint64(v.Message.SeqNum))
+		b = appendUvarint(b, uint64(len(v.Message.Flags)))
+		for _, flag := range v.Message.Flags {
+			b = appendString(b, flag)
 		}
 	case *backend.MailboxUpdate:
-		objType = "MailboxUpdate"
-		objStr, err = json.Marshal(v.MailboxStatus)
+		status, err := json.Marshal(v.MailboxStatus)
 		if err != nil {
-			return "", err
+			return nil, err
 		}
+		b = append(b, binMailboxUpdate)
+		b = appendString(b, upd.Username())
+		b = appendString(b, upd.Mailbox())
+		b = appendString(b, string(status))
 	default:
-		return "", fmt.Errorf("updatepipe: unknown update type: %T", upd)
+		return nil, fmt.Errorf("updatepipe: unknown update type: %T", upd)
+	}
+	return b, nil
+}
+
+var errTruncated = errors.New("updatepipe: truncated update")
+
+type binReader struct {
+	b   []byte
+	err error
+}
+
+func (r *binReader) uvarint() uint64 {
+	if r.err != nil {
+		return 0
+	}
+	v, n := binary.Uvarint(r.b)
+	if n <= 0 {
+		r.err = errTruncated
+		return 0
+	}
+	r.b = r.b[n:]
+	return v
+}
+
+func (r *binReader) byte() byte {
+	if r.err != nil {
+		return 0
+	}
+	if len(r.b) == 0 {
+		r.err = errTruncated
+		return 0
+	}
+	v := r.b[0]
+	r.b = r.b[1:]
+	return v
+}
+
+func (r *binReader) bytes() []byte {
+	l := r.uvarint()
+	if r.err != nil {
+		return nil
+	}
+	if uint64(len(r.b)) < l {
+		r.err = errTruncated
+		return nil
+	}
+	v := r.b[:l]
+	r.b = r.b[l:]
+	return v
+}
+
+func (r *binReader) seqNum() uint32 {
+	v := r.uvarint()
+	if v > math.MaxUint32 {
+		r.err = errors.New("updatepipe: sequence number is out of range")
+	}
+	return uint32(v)
+}
+
+// decodeUpdate parses the update serialized by appendUpdate.
+func decodeUpdate(b []byte) (id string, upd backend.Update, err error) {
+	r := binReader{b: b}
+	id = string(r.bytes())
+	typ := r.byte()
+	username := string(r.bytes())
+	mailbox := string(r.bytes())
+	if r.err != nil {
+		return "", nil, r.err
+	}
+	updBase := backend.NewUpdate(username, mailbox)
+
+	switch typ {
+	case binExpungeUpdate:
+		upd = &backend.ExpungeUpdate{Update: updBase, SeqNum: r.seqNum()}
+	case binMessageUpdate:
+		msg := imap.NewMessage(r.seqNum(), []imap.FetchItem{imap.FetchFlags})
+		count := r.uvarint()
+		if count > uint64(len(r.b)) {
+			return "", nil, errTruncated
+		}
+		if count != 0 {
+			msg.Flags = make([]string, 0, count)
+		}
+		for i := uint64(0); i < count && r.err == nil; i++ {
+			msg.Flags = append(msg.Flags, string(r.bytes()))
+		}
+		upd = &backend.MessageUpdate{Update: updBase, Message: msg}
+	case binMailboxUpdate:
+		mboxUpd := &backend.MailboxUpdate{Update: updBase}
+		status := r.bytes()
+		if r.err == nil {
+			if err := json.Unmarshal(status, &mboxUpd.MailboxStatus); err != nil {
+				return "", nil, err
+			}
+		}
+		upd = mboxUpd
+	default:
+		return "", nil, fmt.Errorf("updatepipe: unknown update type: %d", typ)
+	}
+	if r.err != nil {
+		return "", nil, r.err
 	}
 
-	return strings.Join([]string{
-		myID,
-		objType,
-		escapeName(upd.Username()),
-		escapeName(upd.Mailbox()),
-		string(objStr),
-	}, ";") + "\n", nil
+	return id, upd, nil
 }
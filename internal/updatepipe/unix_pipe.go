@@ -20,35 +20,89 @@ package updatepipe
 
 import (
 	"bufio"
+	"encoding/binary"
+	"errors"
 	"fmt"
 	"io"
 	"net"
 	"os"
+	"path/filepath"
+	"sync"
+	"time"
 
 	"github.com/emersion/go-imap/backend"
 	"github.com/foxcpp/maddy/framework/log"
 )
 
+const (
+	// Push blocks if that many updates are waiting be written.
+	maxPendingUpdates = 4096
+
+	maxFrameSize = 1024 * 1024
+
+	// Sockets of other listening processes are looked up at most that often.
+	peerScanInterval = 1 * time.Second
+)
+
+// Updates are collected for pushWindow before being written so redundant
+// ones can be coalesced and all are written at once. Changed in tests.
+var pushWindow = 5 * time.Millisecond
+
 // UnixSockPipe implements the UpdatePipe interface by serializating updates
 // to/from a Unix domain socket. Due to the way Unix sockets work, only one
-// Listen goroutine can be running.
+// process can Listen on a socket. If multiple processes need to receive
+// updates, each of them should set ListenPath to SockPath + "." + unique
+// suffix. Push writes updates to SockPath and to all sockets with names
+// starting with SockPath + ".", except for own ListenPath.
+//
+// The socket is stream-oriented and consists of frames with a big-endian
+// uint32 length followed by the update serialized by appendUpdate:
 //
-// The socket is stream-oriented and consists of the following messages:
-//		OBJ_ID;TYPE_NAME;USER;MAILBOX;JSON_SERIALIZED_INTERNAL_OBJECT\n
+//	OBJ_ID, TYPE, USER, MAILBOX, OBJECT
 //
-// Where TYPE_NAME is one of the folow: ExpungeUpdate, MailboxUpdate,
-// MessageUpdate.
-// And OBJ_ID is Process ID and UnixSockPipe address concated as a string.
+// OBJ_ID is Process ID and UnixSockPipe address concated as a string.
 // It is used to deduplicate updates sent to Push and recevied via Listen.
 //
+// Older versions used text lines, these are still accepted by Listen. The
+// first byte of a binary frame is always zero since frames are smaller than
+// 16 MiB, text lines start with the process ID.
+//
+// Push does not write updates immediately. They are collected for a short
+// time and written in a batch. If a mailbox gets multiple MailboxUpdates or
+// MessageUpdates for the same message in a row, only the last one is
+// written.
+//
 // The SockPath field specifies the socket path to use. The actual socket
 // is initialized on the first call to Listen or (Init)Push.
 type UnixSockPipe struct {
-	SockPath string
-	Log      log.Logger
+	SockPath   string
+	ListenPath string
+	Log        log.Logger
+
+	listener   net.Listener
+	listenPath string
+	// Used only by pushLoop once it is started.
+	peers    map[string]net.Conn
+	lastScan time.Time
 
-	listener net.Listener
-	sender   net.Conn
+	pushLck  sync.Mutex
+	pushCond *sync.Cond
+	pending  []pendingUpdate
+	// Index in pending of the last update for the mailbox.
+	lastUpd  map[mailboxKey]int
+	closing  bool
+	pushWake chan struct{}
+	pushStop chan struct{}
+	pushDone chan struct{}
+}
+
+type mailboxKey struct {
+	username, mailbox string
+}
+
+type pendingUpdate struct {
+	upd    backend.Update
+	queued time.Time
 }
 
 var _ P = &UnixSockPipe{}
@@ -58,12 +112,69 @@ func (usp *UnixSockPipe) myID() string {
 }
 
 func (usp *UnixSockPipe) readUpdates(conn net.Conn, updCh chan<- backend.Update) {
-	scnr := bufio.NewScanner(conn)
+	defer conn.Close()
+
+	br := bufio.NewReader(conn)
+	first, err := br.Peek(1)
+	if err != nil {
+		return
+	}
+	if first[0] != 0 {
+		usp.readLegacyUpdates(br, updCh)
+		return
+	}
+
+	myID := usp.myID()
+	var (
+		lenBuf [4]byte
+		frame  []byte
+	)
+	for {
+		if _, err := io.ReadFull(br, lenBuf[:]); err != nil {
+			if err != io.EOF {
+				usp.Log.Error("update read failed", err)
+			}
+			return
+		}
+		frameLen := binary.BigEndian.Uint32(lenBuf[:])
+		if frameLen > maxFrameSize {
+			usp.Log.Msg("update is too big, closing connection", "size", frameLen)
+			return
+		}
+		if cap(frame) < int(frameLen) {
+			frame = make([]byte, frameLen)
+		}
+		frame = frame[:frameLen]
+		if _, err := io.ReadFull(br, frame); err != nil {
+			usp.Log.Error("update read failed", err)
+			return
+		}
+
+		id, upd, err := decodeUpdate(frame)
+		if err != nil {
+			usp.Log.Error("malformed update received", err)
+			continue
+		}
+		updatesReceived.Inc()
+
+		// It is our own update, skip.
+		if id == myID {
+			continue
+		}
+
+		updCh <- upd
+	}
+}
+
+func (usp *UnixSockPipe) readLegacyUpdates(r io.Reader, updCh chan<- backend.Update) {
+	scnr := bufio.NewScanner(r)
 	for scnr.Scan() {
 		id, upd, err := parseUpdate(scnr.Text())
 		if err != nil {
 			usp.Log.Error("malformed update received", err, "str", scnr.Text())
+			continue
 		}
+		updatesReceived.Inc()
 
 		// It is our own update, skip.
 		if id == usp.myID() {
@@ -81,11 +192,19 @@ func (usp *UnixSockPipe) Wrap(upd <-chan backend.Update) chan backend.Update {
 }
 
 func (usp *UnixSockPipe) Listen(upd chan<- backend.Update) error {
-	l, err := net.Listen("unix", usp.SockPath)
+	path := usp.SockPath
+	if usp.ListenPath != "" {
+		path = usp.ListenPath
+		// The socket is not shared with other processes, so it is safe to
+		// remove the one left by a crashed process using the same path.
+		os.Remove(path)
+	}
+	l, err := net.Listen("unix", path)
 	if err != nil {
 		return err
 	}
 	usp.listener = l
+	usp.listenPath = path
 	go func() {
 		for {
 			conn, err := l.Accept()
@@ -99,38 +218,194 @@ func (usp *UnixSockPipe) Listen(upd chan<- backend.Update) error {
 }
 
 func (usp *UnixSockPipe) InitPush() error {
-	sock, err := net.Dial("unix", usp.SockPath)
-	if err != nil {
+	usp.pushLck.Lock()
+	defer usp.pushLck.Unlock()
+	if usp.pushCond != nil {
+		return nil
+	}
+
+	usp.peers = map[string]net.Conn{}
+	// There may be no other listening processes yet, they are looked up
+	// again later.
+	if err := usp.scanPeers(); err != nil && len(usp.peers) == 0 && usp.ListenPath == "" {
 		return err
 	}
 
-	usp.sender = sock
+	usp.pushCond = sync.NewCond(&usp.pushLck)
+	usp.lastUpd = map[mailboxKey]int{}
+	usp.pushWake = make(chan struct{}, 1)
+	usp.pushStop = make(chan struct{})
+	usp.pushDone = make(chan struct{})
+	go usp.pushLoop()
 	return nil
 }
 
 func (usp *UnixSockPipe) Push(upd backend.Update) error {
-	if usp.sender == nil {
-		if err := usp.InitPush(); err != nil {
-			return err
+	if err := usp.InitPush(); err != nil {
+		return err
+	}
+
+	usp.pushLck.Lock()
+	for len(usp.pending) >= maxPendingUpdates && !usp.closing {
+		usp.pushCond.Wait()
+	}
+	if usp.closing {
+		usp.pushLck.Unlock()
+		return errors.New("updatepipe: pipe is closed")
+	}
+
+	key := mailboxKey{upd.Username(), upd.Mailbox()}
+	if i, ok := usp.lastUpd[key]; ok && supersedes(upd, usp.pending[i].upd) {
+		usp.pending[i].upd = upd
+		updatesCoalesced.Inc()
+	} else {
+		usp.lastUpd[key] = len(usp.pending)
+		usp.pending = append(usp.pending, pendingUpdate{upd: upd, queued: time.Now()})
+	}
+	usp.pushLck.Unlock()
+
+	select {
+	case usp.pushWake <- struct{}{}:
+	default:
+	}
+	return nil
+}
+
+// supersedes reports whether upd makes prev, the previous update for the same
+// mailbox, redundant.
+func supersedes(upd, prev backend.Update) bool {
+	switch upd := upd.(type) {
+	case *backend.MailboxUpdate:
+		_, ok := prev.(*backend.MailboxUpdate)
+		return ok
+	case *backend.MessageUpdate:
+		// Flags are sent in full, so the old ones are not needed anymore.
+		prev, ok := prev.(*backend.MessageUpdate)
+		return ok && prev.Message.SeqNum == upd.Message.SeqNum
+	}
+	return false
+}
+
+func (usp *UnixSockPipe) pushLoop() {
+	defer close(usp.pushDone)
+
+	var buf []byte
+	for {
+		select {
+		case <-usp.pushWake:
+			select {
+			case <-time.After(pushWindow):
+			case <-usp.pushStop:
+			}
+		case <-usp.pushStop:
+		}
+
+		usp.pushLck.Lock()
+		batch := usp.pending
+		usp.pending = nil
+		usp.lastUpd = map[mailboxKey]int{}
+		stopping := usp.closing
+		usp.pushCond.Broadcast()
+		usp.pushLck.Unlock()
+
+		if len(batch) != 0 {
+			buf = usp.writeBatch(batch, buf[:0])
+		}
+		if stopping {
+			return
 		}
 	}
+}
 
-	updStr, err := formatUpdate(usp.myID(), upd)
-	if err != nil {
-		return err
+// scanPeers connects to listening sockets that are not connected yet.
+//
+// The last connection error is returned.
+func (usp *UnixSockPipe) scanPeers() error {
+	paths, _ := filepath.Glob(usp.SockPath + ".*")
+	paths = append(paths, usp.SockPath)
+
+	var lastErr error
+	for _, path := range paths {
+		if path == usp.ListenPath {
+			continue
+		}
+		if _, ok := usp.peers[path]; ok {
+			continue
+		}
+		conn, err := net.Dial("unix", path)
+		if err != nil {
+			lastErr = err
+			continue
+		}
+		usp.peers[path] = conn
+	}
+	usp.lastScan = time.Now()
+	return lastErr
+}
+
+func (usp *UnixSockPipe) writeBatch(batch []pendingUpdate, buf []byte) []byte {
+	if time.Since(usp.lastScan) >= peerScanInterval {
+		usp.scanPeers()
+	}
+
+	myID := usp.myID()
+	for _, p := range batch {
+		start := len(buf)
+		frame, err := appendUpdate(append(buf, 0, 0, 0, 0), myID, p.upd)
+		if err != nil {
+			usp.Log.Error("failed to serialize update", err)
+			continue
+		}
+		binary.BigEndian.PutUint32(frame[start:start+4], uint32(len(frame)-start-4))
+		buf = frame
 	}
 
-	_, err = io.WriteString(usp.sender, updStr)
-	return err
+	written := false
+	for path, conn := range usp.peers {
+		if _, err := conn.Write(buf); err != nil {
+			usp.Log.Error("update write failed", err, "socket", path, "count", len(batch))
+			conn.Close()
+			delete(usp.peers, path)
+			// The listener might have been restarted, reconnect on the
+			// next batch.
+			usp.lastScan = time.Time{}
+			continue
+		}
+		written = true
+	}
+	if !written {
+		return buf
+	}
+
+	pushBatches.Inc()
+	updatesPushed.Add(float64(len(batch)))
+	now := time.Now()
+	for _, p := range batch {
+		pushLag.Observe(now.Sub(p.queued).Seconds())
+	}
+	return buf
 }
 
+// Close writes all pending updates and closes the pipe.
 func (usp *UnixSockPipe) Close() error {
-	if usp.sender != nil {
-		usp.sender.Close()
+	usp.pushLck.Lock()
+	pushing := usp.pushCond != nil && !usp.closing
+	if pushing {
+		usp.closing = true
+		usp.pushCond.Broadcast()
+	}
+	usp.pushLck.Unlock()
+
+	if pushing {
+		close(usp.pushStop)
+		<-usp.pushDone
+		for _, conn := range usp.peers {
+			conn.Close()
+		}
 	}
 	if usp.listener != nil {
 		usp.listener.Close()
-		os.Remove(usp.SockPath)
+		os.Remove(usp.listenPath)
 	}
 	return nil
 }
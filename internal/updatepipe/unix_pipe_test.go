@@ -0,0 +1,220 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package updatepipe
+
+import (
+	"fmt"
+	"io"
+	"io/ioutil"
+	"net"
+	"os"
+	"path/filepath"
+	"testing"
+	"time"
+
+	"github.com/emersion/go-imap"
+	"github.com/emersion/go-imap/backend"
+	"github.com/foxcpp/maddy/internal/testutils"
+)
+
+func listenPipe(t *testing.T) (*UnixSockPipe, chan backend.Update, func()) {
+	dir, err := ioutil.TempDir("", "maddy-tests-")
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	l := &UnixSockPipe{
+		SockPath: filepath.Join(dir, "pipe.sock"),
+		Log:      testutils.Logger(t, "updatepipe"),
+	}
+	upds := make(chan backend.Update, 16)
+	if err := l.Listen(upds); err != nil {
+		os.RemoveAll(dir)
+		t.Fatal(err)
+	}
+	return l, upds, func() {
+		l.Close()
+		os.RemoveAll(dir)
+	}
+}
+
+func receiveUpdate(t *testing.T, upds <-chan backend.Update) backend.Update {
+	t.Helper()
+	select {
+	case upd := <-upds:
+		return upd
+	case <-time.After(5 * time.Second):
+		t.Fatal("No update received")
+		return nil
+	}
+}
+
+func messageUpdate(mbox string, seq uint32, flags ...string) *backend.MessageUpdate {
+	msg := imap.NewMessage(seq, []imap.FetchItem{imap.FetchFlags})
+	msg.Flags = flags
+	return &backend.MessageUpdate{Update: backend.NewUpdate("user", mbox), Message: msg}
+}
+
+func mailboxUpdate(mbox string, messages uint32) *backend.MailboxUpdate {
+	return &backend.MailboxUpdate{
+		Update:        backend.NewUpdate("user", mbox),
+		MailboxStatus: &imap.MailboxStatus{Name: mbox, Messages: messages},
+	}
+}
+
+// describe formats fields of the update that are preserved by the pipe.
+func describe(upd backend.Update) string {
+	var obj string
+	switch upd := upd.(type) {
+	case *backend.ExpungeUpdate:
+		obj = fmt.Sprintf("expunge %d", upd.SeqNum)
+	case *backend.MessageUpdate:
+		obj = fmt.Sprintf("message %d %v", upd.Message.SeqNum, upd.Message.Flags)
+	case *backend.MailboxUpdate:
+		obj = fmt.Sprintf("mailbox %s %d", upd.MailboxStatus.Name, upd.MailboxStatus.Messages)
+	default:
+		obj = fmt.Sprintf("%T", upd)
+	}
+	return upd.Username() + "/" + upd.Mailbox() + " " + obj
+}
+
+func TestUnixSockPipe(t *testing.T) {
+	defer func(old time.Duration) { pushWindow = old }(pushWindow)
+	// Everything is written on Close.
+	pushWindow = time.Hour
+
+	l, upds, cleanup := listenPipe(t)
+	defer cleanup()
+
+	// Own updates are not received.
+	if err := l.Push(mailboxUpdate("INBOX", 42)); err != nil {
+		t.Fatal(err)
+	}
+
+	p := &UnixSockPipe{SockPath: l.SockPath, Log: l.Log}
+	for _, upd := range []backend.Update{
+		mailboxUpdate("INBOX", 1),
+		mailboxUpdate("Sent", 1),
+		mailboxUpdate("INBOX", 2),
+		&backend.ExpungeUpdate{Update: backend.NewUpdate("user", "INBOX"), SeqNum: 3},
+		messageUpdate("INBOX", 5, "a"),
+		messageUpdate("INBOX", 5, "b", "c"),
+		messageUpdate("INBOX", 6),
+		mailboxUpdate("INBOX", 3),
+	} {
+		if err := p.Push(upd); err != nil {
+			t.Fatal(err)
+		}
+	}
+	p.Close()
+
+	want := []backend.Update{
+		mailboxUpdate("INBOX", 2),
+		mailboxUpdate("Sent", 1),
+		&backend.ExpungeUpdate{Update: backend.NewUpdate("user", "INBOX"), SeqNum: 3},
+		messageUpdate("INBOX", 5, "b", "c"),
+		messageUpdate("INBOX", 6),
+		mailboxUpdate("INBOX", 3),
+	}
+	for i, wantUpd := range want {
+		upd := receiveUpdate(t, upds)
+		if describe(upd) != describe(wantUpd) {
+			t.Fatalf("Update %d: got %s, want %s", i, describe(upd), describe(wantUpd))
+		}
+	}
+
+	if err := p.Push(mailboxUpdate("INBOX", 4)); err == nil {
+		t.Fatal("Push after Close succeeded")
+	}
+}
+
+func TestUnixSockPipe_Legacy(t *testing.T) {
+	l, upds, cleanup := listenPipe(t)
+	defer cleanup()
+
+	conn, err := net.Dial("unix", l.SockPath)
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer conn.Close()
+	if _, err := io.WriteString(conn, "1-0x1;ExpungeUpdate;user;IN\x10BOX;5\n"); err != nil {
+		t.Fatal(err)
+	}
+
+	upd := receiveUpdate(t, upds)
+	want := &backend.ExpungeUpdate{Update: backend.NewUpdate("user", "IN;BOX"), SeqNum: 5}
+	if describe(upd) != describe(want) {
+		t.Fatalf("got %s, want %s", describe(upd), describe(want))
+	}
+}
+
+func TestUnixSockPipe_MultipleListeners(t *testing.T) {
+	dir, err := ioutil.TempDir("", "maddy-tests-")
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer os.RemoveAll(dir)
+	sockPath := filepath.Join(dir, "pipe.sock")
+
+	var (
+		pipes []*UnixSockPipe
+		upds  []chan backend.Update
+	)
+	for _, suffix := range []string{".worker0", ".worker1"} {
+		l := &UnixSockPipe{
+			SockPath:   sockPath,
+			ListenPath: sockPath + suffix,
+			Log:        testutils.Logger(t, "updatepipe"),
+		}
+		ch := make(chan backend.Update, 16)
+		if err := l.Listen(ch); err != nil {
+			t.Fatal(err)
+		}
+		defer l.Close()
+		pipes = append(pipes, l)
+		upds = append(upds, ch)
+	}
+
+	// Updates from one listening process are received by the other one.
+	if err := pipes[0].Push(mailboxUpdate("INBOX", 1)); err != nil {
+		t.Fatal(err)
+	}
+	if upd := receiveUpdate(t, upds[1]); describe(upd) != describe(mailboxUpdate("INBOX", 1)) {
+		t.Fatal("Wrong update received:", describe(upd))
+	}
+
+	// Updates from a process that does not listen (e.g. maddyctl) are
+	// received by all of them.
+	p := &UnixSockPipe{SockPath: sockPath, Log: testutils.Logger(t, "updatepipe")}
+	if err := p.Push(mailboxUpdate("Sent", 2)); err != nil {
+		t.Fatal(err)
+	}
+	p.Close()
+	for i, ch := range upds {
+		if upd := receiveUpdate(t, ch); describe(upd) != describe(mailboxUpdate("Sent", 2)) {
+			t.Fatalf("Wrong update received by listener %d: %s", i, describe(upd))
+		}
+	}
+
+	select {
+	case upd := <-upds[0]:
+		t.Fatal("Own update received:", describe(upd))
+	default:
+	}
+}
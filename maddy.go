@@ -33,11 +33,13 @@ import (
 	parser "github.com/foxcpp/maddy/framework/cfgparser"
 	"github.com/foxcpp/maddy/framework/config"
 	"github.com/foxcpp/maddy/framework/config/tls"
+	"github.com/foxcpp/maddy/framework/dns"
 	"github.com/foxcpp/maddy/framework/hooks"
 	"github.com/foxcpp/maddy/framework/log"
 	"github.com/foxcpp/maddy/framework/module"
 
 	// Import packages for side-effect of module registration.
+	_ "github.com/foxcpp/maddy/internal/auth/cache"
 	_ "github.com/foxcpp/maddy/internal/auth/dovecot_sasl"
 	_ "github.com/foxcpp/maddy/internal/auth/external"
 	_ "github.com/foxcpp/maddy/internal/auth/pam"
@@ -250,6 +252,8 @@ func ReadGlobals(cfg []config.Node) (map[string]interface{}, []config.Node, erro
 	globals.StringList("auth_domains", false, false, nil, nil)
 	globals.Custom("log", false, false, defaultLogOutput, logOutput, &log.DefaultLogger.Out)
 	globals.Bool("debug", false, log.DefaultLogger.Debug, &log.DefaultLogger.Debug)
+	globals.Int("workers", false, false, 1, nil)
+	globals.Bool("dns_direct_queries", false, false, &dns.DirectQueries)
 	globals.AllowUnknown()
 	unknown, err := globals.Process()
 	return globals.Values, unknown, err
@@ -261,6 +265,20 @@ func moduleMain(cfg []config.Node) error {
 		return err
 	}
 
+	if err := initWorker(); err != nil {
+		return err
+	}
+	workers := globals["workers"].(int)
+	if workers < 1 {
+		return errors.New("workers should be positive")
+	}
+	if workers > 1 && config.WorkerID < 0 {
+		return runWorkers(workers)
+	}
+	if config.WorkerID >= 0 {
+		config.WorkerCount = workers
+	}
+
 	if err := InitDirs(); err != nil {
 		return err
 	}
@@ -279,6 +297,7 @@ func moduleMain(cfg []config.Node) error {
 		return err
 	}
 
+	workerReady()
 	systemdStatus(SDReady, "Listening for incoming connections...")
 
 	handleSignals()
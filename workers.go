@@ -0,0 +1,73 @@
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package maddy
+
+import (
+	"fmt"
+	"os"
+	"strconv"
+
+	"github.com/foxcpp/maddy/framework/config"
+	"github.com/foxcpp/maddy/framework/log"
+)
+
+// workerEnv is set by the main process for worker processes to the index
+// of the worker.
+const workerEnv = "MADDY_WORKER"
+
+// workerReadyEnv is set by the main process for the first worker to the file
+// descriptor it should write to once modules are initialized. Other workers
+// are started only after that.
+const workerReadyEnv = "MADDY_WORKER_READY_FD"
+
+var workerReadyFile *os.File
+
+// initWorker sets config.WorkerID if this is a worker process.
+func initWorker() error {
+	idStr, ok := os.LookupEnv(workerEnv)
+	if !ok {
+		return nil
+	}
+	id, err := strconv.Atoi(idStr)
+	if err != nil || id < 0 {
+		return fmt.Errorf("malformed %s value: %s", workerEnv, idStr)
+	}
+	config.WorkerID = id
+
+	if fdStr, ok := os.LookupEnv(workerReadyEnv); ok {
+		fd, err := strconv.Atoi(fdStr)
+		if err != nil || fd < 0 {
+			return fmt.Errorf("malformed %s value: %s", workerReadyEnv, fdStr)
+		}
+		workerReadyFile = os.NewFile(uintptr(fd), "worker-ready")
+	}
+	return nil
+}
+
+// workerReady notifies the main process that the worker is initialized.
+func workerReady() {
+	if workerReadyFile == nil {
+		return
+	}
+	if _, err := workerReadyFile.Write([]byte{1}); err != nil {
+		log.Printf("workers: failed to notify the main process: %v", err)
+	}
+	workerReadyFile.Close()
+	workerReadyFile = nil
+}
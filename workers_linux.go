@@ -0,0 +1,223 @@
+//+build linux
+
+/*
+Maddy Mail Server - Composable all-in-one email server.
+Copyright © 2019-2020 Max Mazurov <fox.cpp@disroot.org>, Maddy Mail Server contributors
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+package maddy
+
+import (
+	"fmt"
+	"os"
+	"os/exec"
+	"os/signal"
+	"strconv"
+	"strings"
+	"syscall"
+	"time"
+
+	"github.com/foxcpp/maddy/framework/log"
+)
+
+const (
+	// Worker exiting earlier than that after start is most likely
+	// misconfigured, restarting it will not help.
+	workerMinUptime = 10 * time.Second
+
+	workerRestartDelay = 1 * time.Second
+)
+
+type workerExit struct {
+	id     int
+	err    error
+	uptime time.Duration
+}
+
+// runWorkers starts count worker processes running the same executable with
+// the same arguments and supervises them.
+//
+// Workers that crash are restarted. Signals are forwarded to all workers,
+// termination signals cause runWorkers to return once all workers exit.
+func runWorkers(count int) error {
+	exe, err := os.Executable()
+	if err != nil {
+		return fmt.Errorf("workers: %w", err)
+	}
+
+	env := make([]string, 0, len(os.Environ())+1)
+	for _, kv := range os.Environ() {
+		// Only the main process reports status to systemd.
+		if strings.HasPrefix(kv, "NOTIFY_SOCKET=") || strings.HasPrefix(kv, workerEnv+"=") ||
+			strings.HasPrefix(kv, workerReadyEnv+"=") {
+			continue
+		}
+		env = append(env, kv)
+	}
+
+	sig := make(chan os.Signal, 5)
+	signal.Notify(sig, os.Interrupt, syscall.SIGTERM, syscall.SIGHUP, syscall.SIGINT, syscall.SIGUSR1, syscall.SIGUSR2)
+	defer signal.Stop(sig)
+
+	var (
+		procs    = make([]*os.Process, count)
+		exits    = make(chan workerExit, count)
+		restarts = make(chan int, count)
+		// Workers that are running or waiting to be restarted.
+		alive    = 0
+		stopping = false
+		exitErr  error
+		// Set once worker 0 is initialized and the rest are started.
+		allStarted = false
+		ready      chan bool
+	)
+	start := func(id int, readyW *os.File) error {
+		cmd := exec.Command(exe, os.Args[1:]...)
+		cmd.Env = append(append(make([]string, 0, len(env)+2), env...), workerEnv+"="+strconv.Itoa(id))
+		if readyW != nil {
+			cmd.ExtraFiles = []*os.File{readyW}
+			cmd.Env = append(cmd.Env, workerReadyEnv+"=3")
+		}
+		cmd.Stdout = os.Stdout
+		cmd.Stderr = os.Stderr
+		// Signals are forwarded explicitly, do not let signals sent to the
+		// process group (e.g. Ctrl-C in the terminal) reach workers twice.
+		// Workers are stopped if the main process is killed without a
+		// chance to do so, otherwise they would keep the listening sockets.
+		cmd.SysProcAttr = &syscall.SysProcAttr{
+			Setpgid:   true,
+			Pdeathsig: syscall.SIGTERM,
+		}
+		if err := cmd.Start(); err != nil {
+			return fmt.Errorf("workers: failed to start worker %d: %w", id, err)
+		}
+		log.Debugf("workers: started worker %d (pid %d)", id, cmd.Process.Pid)
+
+		procs[id] = cmd.Process
+		started := time.Now()
+		go func() {
+			err := cmd.Wait()
+			exits <- workerExit{id: id, err: err, uptime: time.Since(started)}
+		}()
+		return nil
+	}
+	signalAll := func(s os.Signal) {
+		for _, proc := range procs {
+			if proc == nil {
+				continue
+			}
+			if err := proc.Signal(s); err != nil {
+				log.Printf("workers: failed to signal pid %d: %v", proc.Pid, err)
+			}
+		}
+	}
+	stop := func(err error) {
+		if !stopping {
+			systemdStatus(SDStopping, "Waiting for running transactions to complete...")
+		}
+		if exitErr == nil {
+			exitErr = err
+		}
+		stopping = true
+		signalAll(syscall.SIGTERM)
+	}
+
+	// Worker 0 is started first and the rest only once it is initialized,
+	// so one-time initialization done by modules (e.g. DKIM key generation
+	// or database schema creation) does not run in all workers at once.
+	readyR, readyW, err := os.Pipe()
+	if err != nil {
+		return fmt.Errorf("workers: %w", err)
+	}
+	err = start(0, readyW)
+	readyW.Close()
+	if err != nil {
+		readyR.Close()
+		return err
+	}
+	alive++
+	ready = make(chan bool, 1)
+	go func() {
+		defer readyR.Close()
+		var b [1]byte
+		n, _ := readyR.Read(b[:])
+		ready <- n == 1
+	}()
+
+	for alive != 0 {
+		select {
+		case ok := <-ready:
+			ready = nil
+			if !ok || stopping {
+				// Worker 0 exited, this is handled below.
+				continue
+			}
+			for id := 1; id < count; id++ {
+				if err := start(id, nil); err != nil {
+					stop(err)
+					break
+				}
+				alive++
+			}
+			allStarted = true
+			if !stopping {
+				systemdStatus(SDReady, "Listening for incoming connections...")
+			}
+		case s := <-sig:
+			switch s {
+			case syscall.SIGUSR1:
+				log.Printf("signal received (%s), rotating logs", s.String())
+				reinitLogging()
+				signalAll(s)
+			case syscall.SIGUSR2:
+				signalAll(s)
+			default:
+				// Workers handle the second signal as a forced shutdown
+				// request too.
+				log.Printf("signal received (%v), stopping workers", s)
+				if !stopping {
+					systemdStatus(SDStopping, "Waiting for running transactions to complete...")
+				}
+				stopping = true
+				signalAll(s)
+			}
+		case e := <-exits:
+			procs[e.id] = nil
+			if stopping {
+				alive--
+				continue
+			}
+			log.Printf("workers: worker %d exited unexpectedly: %v", e.id, e.err)
+			if e.uptime < workerMinUptime || !allStarted {
+				alive--
+				stop(fmt.Errorf("workers: worker %d failed to start: %v", e.id, e.err))
+				continue
+			}
+			time.AfterFunc(workerRestartDelay, func() { restarts <- e.id })
+		case id := <-restarts:
+			if stopping {
+				alive--
+				continue
+			}
+			if err := start(id, nil); err != nil {
+				alive--
+				stop(err)
+			}
+		}
+	}
+
+	return exitErr
+}